@@ -5,6 +5,7 @@
 #include <dim-sum/errno.h>
 #include <dim-sum/idle.h>
 #include <dim-sum/init.h>
+#include <dim-sum/irq.h>
 #include <dim-sum/percpu.h>
 #include <dim-sum/psci.h>
 #include <dim-sum/sched.h>
@@ -24,5 +25,22 @@ void __init smp_set_raise_ipi_call(void (*fn)(const struct cpumask *, unsigned i
 
 void do_IPI(int ipinr, struct exception_spot *regs)
 {
-	printk("xby_debug in do_IPI, irq is %d, cpu is %d.\n", ipinr, smp_processor_id());
+	irq_preface(-1);
+
+	switch (ipinr) {
+	case IPI_RESCHEDULE:
+		/**
+		 * 在中断尾声中触发调度
+		 */
+		set_need_resched();
+		break;
+	case IPI_CALL_FUNC:
+		smp_call_interrupt();
+		break;
+	default:
+		printk("CPU%d: unknown IPI %d.\n", smp_processor_id(), ipinr);
+		break;
+	}
+
+	irq_tail(-1, regs);
 }
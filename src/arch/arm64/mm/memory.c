@@ -30,20 +30,26 @@ unsigned long phys_addr_kernel_max = GENMASK(48, 48);
 
 void __init init_per_cpu_offsets(void)
 {
-	unsigned long size, i;
+	unsigned long size, unit_size, i;
 	char *ptr;
 
 	/* 静态per-cpu变量的区间长度 */
 	size = ALIGN(per_cpu_var_end - per_cpu_var_start, SMP_CACHE_BYTES);
+	/**
+	 * 每个CPU单元在静态变量之后，为动态分配保留一段空间
+	 * 包括CPU 0在内，所有单元连续分配、间隔相同
+	 * 这样动态分配的块也可以使用per_cpu_offset寻址
+	 */
+	unit_size = ALIGN(size + PERCPU_DYNAMIC_RESERVE, PAGE_SIZE);
 
 	/* 为per-cpu分配内存 */
-	ptr = alloc_boot_mem_permanent(size * (MAX_CPUS - 1), /* -1!! */
-					SMP_CACHE_BYTES);
+	ptr = alloc_boot_mem_permanent(unit_size * MAX_CPUS, PAGE_SIZE);
 
 	/* 设置per-cpu的偏移值 */
-	per_cpu_var_offsets[0] = 0;
-	for (i = 1; i < MAX_CPUS; i++, ptr += size) {
+	for (i = 0; i < MAX_CPUS; i++, ptr += unit_size) {
 		per_cpu_var_offsets[i] = ptr - per_cpu_var_start;
 		memcpy(ptr, per_cpu_var_start, per_cpu_var_end - per_cpu_var_start);
 	}
+
+	init_percpu_first_chunk(size, unit_size);
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include <dim-sum/bitmap.h>
+#include <dim-sum/blk_dev.h>
+#include <dim-sum/blk_mq.h>
+#include <dim-sum/cmd.h>
+#include <dim-sum/err.h>
+#include <dim-sum/fs.h>
+#include <dim-sum/string.h>
+
+static void blk_show_legacy_stat(struct blk_request_queue *queue)
+{
+	struct blk_queue_stat stat;
+
+	smp_lock_irq(queue->queue_lock);
+	stat = queue->stat;
+	smp_unlock_irq(queue->queue_lock);
+
+	printk("merges back:%lu front:%lu request:%lu\n",
+		stat.back_merges, stat.front_merges, stat.request_merges);
+	printk("dispatched:%lu completed:%lu in-flight:%u\n",
+		stat.dispatched, stat.completed, stat.in_flight);
+	printk("queued:%u max queued:%u\n", stat.queued, stat.max_queued);
+}
+
+static void blk_show_mq_stat(struct blk_request_queue *queue)
+{
+	unsigned long merged = 0, queued = 0;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = __percpu_ptr(queue->queue_ctx, cpu);
+
+		merged += ctx->nr_merged;
+		queued += ctx->nr_queued;
+	}
+	printk("merges:%lu queued:%lu\n", merged, queued);
+
+	for (i = 0; i < queue->nr_hw_queues; i++) {
+		struct blk_mq_hw_ctx *hctx = queue->hw_ctxs[i];
+
+		printk("hctx %d dispatched:%lu busy:%lu in-flight:%d%s\n",
+			i, hctx->nr_dispatched, hctx->nr_busy,
+			bitmap_weight(hctx->tags->bitmap, hctx->tags->nr_tags),
+			test_bit(__BLK_MQ_STOPPED, &hctx->state) ? " stopped" : "");
+	}
+}
+
+/**
+ * 清零累计的计数，queued、in_flight等当前值保持不变
+ */
+static void blk_reset_stat(struct blk_request_queue *queue)
+{
+	unsigned long flags;
+	int cpu, i;
+
+	smp_lock_irq(queue->queue_lock);
+	queue->stat.back_merges = queue->stat.front_merges = 0;
+	queue->stat.request_merges = 0;
+	queue->stat.dispatched = queue->stat.completed = 0;
+	queue->stat.max_queued = queue->stat.queued;
+	smp_unlock_irq(queue->queue_lock);
+
+	if (blk_queue_mq(queue)) {
+		for_each_possible_cpu(cpu) {
+			struct blk_mq_ctx *ctx = __percpu_ptr(queue->queue_ctx, cpu);
+
+			smp_lock_irqsave(&ctx->lock, flags);
+			ctx->nr_merged = ctx->nr_queued = 0;
+			smp_unlock_irqrestore(&ctx->lock, flags);
+		}
+
+		for (i = 0; i < queue->nr_hw_queues; i++) {
+			struct blk_mq_hw_ctx *hctx = queue->hw_ctxs[i];
+
+			smp_lock_irqsave(&hctx->lock, flags);
+			hctx->nr_dispatched = hctx->nr_busy = 0;
+			smp_unlock_irqrestore(&hctx->lock, flags);
+		}
+	}
+
+	blk_reset_latency(queue);
+}
+
+/**
+ * 显示块设备请求队列的统计信息
+ */
+int blk_stat_cmd(int argc, char **args)
+{
+	struct blk_request_queue *queue;
+	struct block_device *bdev;
+
+	if (argc < 2 || argc > 3) {
+		printk("Usage: blkstat device [reset]\n");
+		return -1;
+	}
+
+	bdev = blkdev_load_desc(args[1]);
+	if (IS_ERR(bdev)) {
+		printk("blkstat: can not find %s\n", args[1]);
+		return -1;
+	}
+
+	if (open_block_device(bdev, FMODE_READ, 0)) {
+		loosen_block_device(bdev);
+		return -1;
+	}
+
+	queue = blkdev_get_queue(bdev);
+	if (argc == 3 && !strcmp(args[2], "reset")) {
+		blk_reset_stat(queue);
+		goto out;
+	}
+
+	if (blk_queue_mq(queue))
+		blk_show_mq_stat(queue);
+	else
+		blk_show_legacy_stat(queue);
+	blk_dump_latency(queue);
+
+out:
+	close_block_device(bdev);
+
+	return 0;
+}
+
+/**
+ * 显示或者更换块设备请求队列的IO调度器
+ */
+int blk_iosched_cmd(int argc, char **args)
+{
+	struct blk_request_queue *queue;
+	struct block_device *bdev;
+	int ret = 0;
+
+	if (argc < 2 || argc > 3) {
+		printk("Usage: iosched device [noop|deadline]\n");
+		return -1;
+	}
+
+	bdev = blkdev_load_desc(args[1]);
+	if (IS_ERR(bdev)) {
+		printk("iosched: can not find %s\n", args[1]);
+		return -1;
+	}
+
+	if (open_block_device(bdev, FMODE_READ, 0)) {
+		loosen_block_device(bdev);
+		return -1;
+	}
+
+	queue = blkdev_get_queue(bdev);
+	if (argc == 3) {
+		ret = iosched_switch(queue, args[2]);
+		if (ret == -EBUSY)
+			printk("iosched: %s is busy, try again later\n", args[1]);
+		else if (ret)
+			printk("iosched: can not switch to %s: %d\n", args[2], ret);
+	}
+
+	printk("%s: %s\n", args[1], queue->scheduler->type->name);
+
+	close_block_device(bdev);
+
+	return ret;
+}
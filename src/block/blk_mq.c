@@ -0,0 +1,659 @@
+#include <dim-sum/beehive.h>
+#include <dim-sum/bitops.h>
+#include <dim-sum/blkio.h>
+#include <dim-sum/blk_dev.h>
+#include <dim-sum/blk_mq.h>
+#include <dim-sum/cpumask.h>
+#include <dim-sum/sched.h>
+#include <dim-sum/string.h>
+
+/**
+ * 分配一个空闲标签，从hint处开始查找
+ * 没有空闲标签时返回-1
+ */
+static int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int hint)
+{
+	unsigned int tag;
+
+	if (hint >= tags->nr_tags)
+		hint = 0;
+
+again:
+	tag = find_next_zero_bit(tags->bitmap, tags->nr_tags, hint);
+	while (tag < tags->nr_tags) {
+		if (!atomic_test_and_set_bit(tag, tags->bitmap))
+			return tag;
+
+		tag = find_next_zero_bit(tags->bitmap, tags->nr_tags, tag + 1);
+	}
+
+	/**
+	 * 回绕到位图开始处再找一次
+	 */
+	if (hint) {
+		hint = 0;
+		goto again;
+	}
+
+	return -1;
+}
+
+static void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	/**
+	 * 请求描述符的修改必须在释放标签之前完成
+	 */
+	smp_mb();
+	atomic_clear_bit(tag, tags->bitmap);
+
+	smp_mb();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+/**
+ * 请求完成后归还其标签
+ */
+void blk_mq_free_request(struct blk_request *req)
+{
+	struct blk_mq_hw_ctx *hctx = req->mq_ctx->hctx;
+
+	blk_mq_put_tag(hctx->tags, req->tag);
+}
+
+/**
+ * 从本地CPU对应的硬件队列获取一个预先分配的请求
+ * 成功返回时仍然持有本地软件队列，调用者负责释放
+ * 标签用完时，先向设备派发请求，然后等待其他请求完成
+ */
+static struct blk_request *
+blk_mq_get_request(struct blk_request_queue *queue,
+	struct block_io_desc *bio, struct blk_mq_ctx **pctx)
+{
+	/**
+	 * 在内存紧张时，预读请求可以不用等待
+	 */
+	bool may_wait = !bio_rw_ahead(bio);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct blk_request *req;
+	DEFINE_WAIT(wait);
+	int tag;
+
+	while (1) {
+		ctx = hold_percpu_ptr(queue->queue_ctx);
+		hctx = ctx->hctx;
+		tag = blk_mq_get_tag(hctx->tags, ctx->last_tag);
+		if (tag >= 0) {
+			ctx->last_tag = tag + 1;
+			break;
+		}
+		loosen_percpu_ptr(ctx);
+
+		if (!may_wait)
+			return NULL;
+
+		blk_mq_run_hw_queue(hctx, false);
+
+		prepare_to_wait(&hctx->tags->wait, &wait, TASK_UNINTERRUPTIBLE);
+		/**
+		 * 加入等待队列后再检查一次，避免丢失唤醒
+		 */
+		if (find_first_zero_bit(hctx->tags->bitmap,
+		    hctx->tags->nr_tags) >= hctx->tags->nr_tags)
+			io_schedule();
+		finish_wait(&hctx->tags->wait, &wait);
+	}
+
+	req = hctx->tags->rqs[tag];
+	memset(req, 0, sizeof(*req));
+	list_init(&req->list);
+	req->ref_count = 1;
+	req->queue = queue;
+	req->tag = tag;
+	req->mq_ctx = ctx;
+	req->flags = BLKREQ_MQ;
+	RB_CLEAR_NODE(&req->rb_node);
+	if (bio_is_write(bio))
+		req->flags |= BLKQUEUE_WRITE;
+
+	*pctx = ctx;
+
+	return req;
+}
+
+/**
+ * 多队列路径的请求提交函数
+ * 先在本地软件队列中合并，不能合并时分配带标签的请求并暂存
+ * 整个过程只获取本地CPU的锁，不关中断
+ */
+static int
+blk_mq_sumit_request(struct blk_request_queue *queue, struct block_io_desc *bio)
+{
+	bool barrier = bio_is_barrier(bio);
+	bool run = bio_sync(bio) || barrier;
+	struct blk_plug *plug = barrier ? NULL : current->plug;
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct blk_request *req;
+	bool merged;
+
+	if (plug && blk_attempt_list_merge(queue, &plug->list, bio,
+	    BLK_MAX_PLUG_REQUESTS))
+		return 0;
+
+	if (!barrier) {
+		ctx = hold_percpu_ptr(queue->queue_ctx);
+		smp_lock(&ctx->lock);
+		merged = blk_attempt_list_merge(queue, &ctx->rq_list, bio,
+						BLK_MQ_MERGE_DEPTH);
+		if (merged)
+			ctx->nr_merged++;
+		smp_unlock(&ctx->lock);
+		hctx = ctx->hctx;
+		loosen_percpu_ptr(ctx);
+
+		if (merged)
+			goto out;
+	}
+
+	req = blk_mq_get_request(queue, bio, &ctx);
+	if (!req) {
+		blkio_finished(bio, bio_sectors(bio) << 9, -EWOULDBLOCK);
+		return 0;
+	}
+
+	blk_init_request_from_bio(queue, req, bio);
+	if (barrier)
+		req->flags |= (BLKREQ_BARRIER | BLKREQ_NOMERGE);
+
+	/**
+	 * 暂存在插头中，拔出插头时再放入软件队列
+	 */
+	if (plug) {
+		loosen_percpu_ptr(ctx);
+		blk_plug_add_request(plug, req);
+		return 0;
+	}
+
+	smp_lock(&ctx->lock);
+	list_insert_behind(&req->list, &ctx->rq_list);
+	ctx->nr_queued++;
+	if (++ctx->nr_pending >= BLK_MQ_BATCH)
+		run = true;
+	smp_unlock(&ctx->lock);
+	hctx = ctx->hctx;
+	loosen_percpu_ptr(ctx);
+
+out:
+	atomic_set_bit(__BLK_MQ_PENDING, &hctx->state);
+
+	/**
+	 * 同步请求和积压较多时立即派发
+	 * 否则由push_timer稍后派发，以便合并更多的BIO
+	 */
+	if (run)
+		blk_mq_run_hw_queue(hctx, false);
+	else
+		blk_attach_device(queue);
+
+	return 0;
+}
+
+/**
+ * 将插头中的请求放回各自的软件队列，然后派发
+ * 请求的标签属于分配时软件队列所映射的硬件队列
+ */
+void blk_mq_insert_requests(struct blk_request_queue *queue,
+	struct double_list *list)
+{
+	int i;
+
+	while (!list_is_empty(list)) {
+		struct blk_request *req = BLK_FIRST_REQUEST(list);
+		struct blk_mq_ctx *ctx = req->mq_ctx;
+
+		list_del_init(&req->list);
+
+		smp_lock(&ctx->lock);
+		list_insert_behind(&req->list, &ctx->rq_list);
+		ctx->nr_pending++;
+		ctx->nr_queued++;
+		smp_unlock(&ctx->lock);
+
+		atomic_set_bit(__BLK_MQ_PENDING, &ctx->hctx->state);
+	}
+
+	for (i = 0; i < queue->nr_hw_queues; i++)
+		if (test_bit(__BLK_MQ_PENDING, &queue->hw_ctxs[i]->state))
+			blk_mq_run_hw_queue(queue->hw_ctxs[i], false);
+}
+
+static inline bool blk_mq_sched_active(struct blk_request_queue *queue)
+{
+	return test_bit(__BLKQUEUE_MQ_SCHED, &queue->state);
+}
+
+/**
+ * 将软件队列中的请求交给IO调度器排序
+ * 调度器的私有数据只在请求位于调度器中时存在，因此更换调度器时
+ * 只需要等调度器变空。在锁内再检查一次，调度器可能刚被换成noop
+ * 无法进入调度器的请求放入bypass链表，直接派发
+ */
+static void blk_mq_sched_insert(struct blk_request_queue *queue,
+	struct double_list *list, struct double_list *bypass)
+{
+	struct blk_request *req;
+	unsigned long flags;
+
+	smp_lock_irqsave(queue->queue_lock, flags);
+	while (!list_is_empty(list)) {
+		req = BLK_FIRST_REQUEST(list);
+		list_del_init(&req->list);
+
+		if (!blk_mq_sched_active(queue)
+		    || iosched_init_request(queue, req, PAF_ATOMIC)) {
+			list_insert_behind(&req->list, bypass);
+			continue;
+		}
+
+		iosched_add_request(queue, req, IOSCHED_INSERT_ORDERED);
+	}
+	smp_unlock_irqrestore(queue->queue_lock, flags);
+}
+
+/**
+ * 按IO调度器的顺序取出下一个属于hctx的请求
+ * 请求的标签属于其软件队列映射的硬件队列，其他硬件队列的请求
+ * 放入各自的dispatch链表，由kblockd派发
+ */
+static struct blk_request *blk_mq_sched_next(struct blk_mq_hw_ctx *hctx)
+{
+	struct blk_request_queue *queue = hctx->queue;
+	struct blk_mq_hw_ctx *owner;
+	struct blk_request *req;
+	unsigned long flags;
+
+	smp_lock_irqsave(queue->queue_lock, flags);
+	while ((req = iosched_get_first_request(queue)) != NULL) {
+		iosched_remove_request(queue, req);
+		iosched_uninit_request(queue, req);
+
+		owner = req->mq_ctx->hctx;
+		if (owner == hctx)
+			break;
+
+		smp_lock(&owner->lock);
+		list_insert_behind(&req->list, &owner->dispatch);
+		smp_unlock(&owner->lock);
+		atomic_set_bit(__BLK_MQ_PENDING, &owner->state);
+		blk_mq_run_hw_queue(owner, true);
+	}
+	smp_unlock_irqrestore(queue->queue_lock, flags);
+
+	return req;
+}
+
+/**
+ * 驱动退回的请求放回调度器，下次仍然最先派发
+ * 调度器已经被关闭或者内存不足时返回false，由调用者放入dispatch链表
+ */
+static bool blk_mq_sched_requeue(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	unsigned long flags;
+	bool requeued = false;
+
+	smp_lock_irqsave(queue->queue_lock, flags);
+	if (blk_mq_sched_active(queue)
+	    && !iosched_init_request(queue, req, PAF_ATOMIC)) {
+		iosched_add_request(queue, req, IOSCHED_INSERT_HEAD);
+		requeued = true;
+	}
+	smp_unlock_irqrestore(queue->queue_lock, flags);
+
+	return requeued;
+}
+
+/**
+ * 收集映射到hctx的所有软件队列中的请求，依次交给驱动
+ * 队列使用IO调度器时，软件队列中的请求先进入调度器
+ * 然后在设备能够接收时，每次按调度器的顺序取出一个
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct blk_request_queue *queue = hctx->queue;
+	bool sched = blk_mq_sched_active(queue);
+	struct double_list rq_list, sw_list;
+	struct blk_request *req;
+	int queued = 0;
+	int cpu, ret;
+	bool last;
+
+	atomic_clear_bit(__BLK_MQ_PENDING, &hctx->state);
+	smp_mb();
+
+	list_init(&rq_list);
+	list_init(&sw_list);
+
+	/**
+	 * 上一轮因为硬件忙而未派发的请求优先
+	 */
+	smp_lock(&hctx->lock);
+	list_combine_behind_init(&hctx->dispatch, &rq_list);
+	smp_unlock(&hctx->lock);
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = __percpu_ptr(queue->queue_ctx, cpu);
+
+		if (ctx->hctx != hctx || !ctx->nr_pending)
+			continue;
+
+		smp_lock(&ctx->lock);
+		list_combine_behind_init(&ctx->rq_list,
+					sched ? &sw_list : &rq_list);
+		ctx->nr_pending = 0;
+		smp_unlock(&ctx->lock);
+	}
+
+	if (sched && !list_is_empty(&sw_list))
+		blk_mq_sched_insert(queue, &sw_list, &rq_list);
+
+	while (1) {
+		if (!list_is_empty(&rq_list)) {
+			req = BLK_FIRST_REQUEST(&rq_list);
+			list_del_init(&req->list);
+		} else if (!sched || !(req = blk_mq_sched_next(hctx)))
+			break;
+
+		/**
+		 * 调度器中是否还有请求无从得知，由commit_rqs通知设备
+		 */
+		last = !sched && list_is_empty(&rq_list);
+		ret = queue->mq_ops->queue_rq(hctx, req, last);
+		if (ret == BLK_MQ_RQ_BUSY) {
+			/**
+			 * 硬件队列满了，剩下的请求放回dispatch链表
+			 * 来自调度器的请求放回调度器
+			 * 驱动在请求完成后重新启动硬件队列
+			 */
+			if (!(req->flags & BLKREQ_STARTED)
+			    || !blk_mq_sched_requeue(queue, req))
+				list_insert_front(&req->list, &rq_list);
+			hctx->nr_busy++;
+
+			if (queued && queue->mq_ops->commit_rqs)
+				queue->mq_ops->commit_rqs(hctx);
+
+			smp_lock(&hctx->lock);
+			list_combine_front(&rq_list, &hctx->dispatch);
+			smp_unlock(&hctx->lock);
+
+			/**
+			 * 驱动没有暂停队列，稍后重试
+			 */
+			if (!test_bit(__BLK_MQ_STOPPED, &hctx->state))
+				blk_attach_device(queue);
+			return;
+		}
+
+		queued++;
+		hctx->nr_dispatched++;
+	}
+
+	if (sched && queued && queue->mq_ops->commit_rqs)
+		queue->mq_ops->commit_rqs(hctx);
+}
+
+/**
+ * 向驱动派发硬件队列中的请求
+ * async为真时在kblockd中派发，可以在中断上下文中调用
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (test_bit(__BLK_MQ_STOPPED, &hctx->state))
+		return;
+
+	if (async) {
+		kblockd_schedule_work(&hctx->run_work);
+		return;
+	}
+
+	/**
+	 * 其他任务正在派发，它退出前会检查PENDING标志
+	 */
+	while (!atomic_test_and_set_bit(__BLK_MQ_RUNNING, &hctx->state)) {
+		__blk_mq_run_hw_queue(hctx);
+		atomic_clear_bit(__BLK_MQ_RUNNING, &hctx->state);
+		smp_mb();
+
+		if (!test_bit(__BLK_MQ_PENDING, &hctx->state)
+		    || test_bit(__BLK_MQ_STOPPED, &hctx->state))
+			break;
+	}
+}
+
+void blk_mq_run_hw_queues(struct blk_request_queue *queue, bool async)
+{
+	int i;
+
+	for (i = 0; i < queue->nr_hw_queues; i++)
+		blk_mq_run_hw_queue(queue->hw_ctxs[i], async);
+}
+
+/**
+ * 驱动暂时不能接受更多请求
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	atomic_set_bit(__BLK_MQ_STOPPED, &hctx->state);
+}
+
+/**
+ * 驱动重新允许接受请求
+ */
+void blk_mq_start_stopped_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (!atomic_test_and_clear_bit(__BLK_MQ_STOPPED, &hctx->state))
+		return;
+
+	atomic_set_bit(__BLK_MQ_PENDING, &hctx->state);
+	blk_mq_run_hw_queue(hctx, async);
+}
+
+static void blk_mq_run_work(void *data)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+
+	blk_mq_run_hw_queue(hctx, false);
+}
+
+/**
+ * push_timer到期或者文件系统推动时，派发所有硬件队列
+ */
+static void blk_mq_push_queue(struct blk_request_queue *queue)
+{
+	blk_disable_attach(queue);
+	blk_mq_run_hw_queues(queue, false);
+}
+
+static void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	int i;
+
+	if (tags->rqs)
+		for (i = 0; i < tags->nr_tags; i++)
+			kfree(tags->rqs[i]);
+
+	kfree(tags->rqs);
+	kfree(tags->bitmap);
+	kfree(tags);
+}
+
+/**
+ * 为硬件队列预先分配queue_depth个请求
+ * 每个请求后面紧跟cmd_size字节的驱动私有数据
+ */
+static struct blk_mq_tags *
+blk_mq_alloc_tags(struct blk_request_queue *queue, unsigned int hctx_idx,
+	unsigned int queue_depth, unsigned int cmd_size, void *driver_data)
+{
+	struct blk_mq_tags *tags;
+	int i;
+
+	tags = kzalloc(sizeof(*tags), PAF_KERNEL);
+	if (!tags)
+		return NULL;
+
+	tags->nr_tags = queue_depth;
+	init_waitqueue(&tags->wait);
+
+	tags->bitmap = kzalloc(BITS_TO_LONGS(queue_depth) * sizeof(unsigned long),
+				PAF_KERNEL);
+	tags->rqs = kzalloc(queue_depth * sizeof(struct blk_request *), PAF_KERNEL);
+	if (!tags->bitmap || !tags->rqs)
+		goto fail;
+
+	for (i = 0; i < queue_depth; i++) {
+		struct blk_request *req;
+
+		req = kzalloc(sizeof(struct blk_request) + cmd_size, PAF_KERNEL);
+		if (!req)
+			goto fail;
+		tags->rqs[i] = req;
+
+		if (queue->mq_ops->init_request &&
+		    queue->mq_ops->init_request(driver_data, req, hctx_idx, i))
+			goto fail;
+	}
+
+	return tags;
+
+fail:
+	blk_mq_free_tags(tags);
+	return NULL;
+}
+
+static struct blk_mq_hw_ctx *
+blk_mq_alloc_hctx(struct blk_request_queue *queue, unsigned int hctx_idx,
+	unsigned int queue_depth, unsigned int cmd_size, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = kzalloc(sizeof(*hctx), PAF_KERNEL);
+	if (!hctx)
+		return NULL;
+
+	smp_lock_init(&hctx->lock);
+	list_init(&hctx->dispatch);
+	hctx->queue_num = hctx_idx;
+	hctx->queue = queue;
+	hctx->driver_data = driver_data;
+	INIT_WORK(&hctx->run_work, blk_mq_run_work, hctx);
+
+	hctx->tags = blk_mq_alloc_tags(queue, hctx_idx, queue_depth,
+					cmd_size, driver_data);
+	if (!hctx->tags) {
+		kfree(hctx);
+		return NULL;
+	}
+
+	return hctx;
+}
+
+/**
+ * 释放多队列相关的数据结构
+ * 在队列引用计数变为0时调用
+ */
+void blk_mq_free_queue(struct blk_request_queue *queue)
+{
+	int i;
+
+	if (queue->hw_ctxs) {
+		for (i = 0; i < queue->nr_hw_queues; i++) {
+			struct blk_mq_hw_ctx *hctx = queue->hw_ctxs[i];
+
+			if (!hctx)
+				continue;
+
+			blk_mq_free_tags(hctx->tags);
+			kfree(hctx);
+		}
+		kfree(queue->hw_ctxs);
+		queue->hw_ctxs = NULL;
+	}
+
+	if (queue->queue_ctx) {
+		free_percpu(queue->queue_ctx);
+		queue->queue_ctx = NULL;
+	}
+}
+
+/**
+ * 为支持多队列的驱动创建请求队列
+ *	ops:		驱动的多队列回调
+ *	nr_hw_queues:	驱动的硬件队列数量，CPU按编号依次映射到硬件队列
+ *	queue_depth:	每个硬件队列的请求数量，为0则使用默认值
+ *	cmd_size:	每个请求中驱动私有数据的大小
+ *	driver_data:	传递给init_request，并作为硬件队列的默认私有数据
+ * 默认使用noop，即不经过IO调度器，可以通过iosched_switch更换
+ */
+struct blk_request_queue *
+blk_mq_create_queue(struct blk_mq_ops *ops, unsigned int nr_hw_queues,
+	unsigned int queue_depth, unsigned int cmd_size, void *driver_data)
+{
+	struct blk_request_queue *queue;
+	int i, cpu;
+
+	queue = blk_create_queue(NULL, NULL);
+	if (!queue)
+		return NULL;
+
+	if (!nr_hw_queues)
+		nr_hw_queues = 1;
+	if (!queue_depth)
+		queue_depth = BLK_MQ_DEFAULT_DEPTH;
+
+	/**
+	 * 先设置标志，失败时由__release_queue释放已分配的部分
+	 */
+	atomic_set_bit(__BLKQUEUE_MQ, &queue->state);
+	queue->mq_ops = ops;
+	queue->nr_hw_queues = nr_hw_queues;
+
+	queue->hw_ctxs = kzalloc(nr_hw_queues * sizeof(struct blk_mq_hw_ctx *),
+				PAF_KERNEL);
+	if (!queue->hw_ctxs)
+		goto fail;
+
+	for (i = 0; i < nr_hw_queues; i++) {
+		queue->hw_ctxs[i] = blk_mq_alloc_hctx(queue, i, queue_depth,
+						cmd_size, driver_data);
+		if (!queue->hw_ctxs[i])
+			goto fail;
+	}
+
+	queue->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	if (!queue->queue_ctx)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = __percpu_ptr(queue->queue_ctx, cpu);
+
+		smp_lock_init(&ctx->lock);
+		list_init(&ctx->rq_list);
+		ctx->cpu = cpu;
+		queue->mq_map[cpu] = cpu % nr_hw_queues;
+		ctx->hctx = queue->hw_ctxs[queue->mq_map[cpu]];
+		ctx->last_tag = (cpu * queue_depth / num_possible_cpus()) % queue_depth;
+	}
+
+	queue->sumit_request = blk_mq_sumit_request;
+	queue->push_queue = blk_mq_push_queue;
+
+	return queue;
+
+fail:
+	blk_loosen_queue(queue);
+	return NULL;
+}
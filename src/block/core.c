@@ -1,6 +1,7 @@
 #include <dim-sum/beehive.h>
 #include <dim-sum/blkio.h>
 #include <dim-sum/blk_dev.h>
+#include <dim-sum/blk_mq.h>
 #include <dim-sum/disk.h>
 #include <dim-sum/fs.h>
 #include <dim-sum/irq.h>
@@ -8,6 +9,9 @@
 #include <dim-sum/sched.h>
 #include <dim-sum/stacktrace.h>
 #include <dim-sum/timer.h>
+#include <dim-sum/timex.h>
+
+#include <clocksource/arm_arch_timer.h>
 
 static struct beehive_allotter *request_allotter;
 static struct beehive_allotter *queue_allotter;
@@ -202,6 +206,12 @@ static void __release_queue(struct object *obj)
 
 	blk_sync_queue(queue);
 
+	if (blk_queue_mq(queue))
+		blk_mq_free_queue(queue);
+
+	if (queue->latency)
+		free_percpu(queue->latency);
+
 	beehive_free(queue_allotter, queue);
 }
 
@@ -346,6 +356,100 @@ int blk_update_request(struct blk_request *req, int uptodate, int sector_count)
 	return 1;
 }
 
+/**
+ * 将请求的完成延迟计入本CPU的直方图
+ */
+static void blk_account_latency(struct blk_request *req)
+{
+	struct blk_request_queue *queue = req->queue;
+	struct blk_latency_stat *stat;
+	bool write = blk_request_is_write(req);
+	unsigned long us;
+	int bucket;
+
+	if (!queue || !queue->latency || !req->start_cycles)
+		return;
+
+	us = (get_cycles() - req->start_cycles) * 1000000ULL
+		/ arch_timer_get_rate();
+	bucket = us ? fls_long(us) - 1 : 0;
+	if (bucket >= BLK_LATENCY_BUCKETS)
+		bucket = BLK_LATENCY_BUCKETS - 1;
+
+	stat = hold_percpu_ptr(queue->latency);
+	stat->buckets[write][bucket]++;
+	stat->nr_requests[write]++;
+	stat->total_us[write] += us;
+	if (us > stat->max_us[write])
+		stat->max_us[write] = us;
+	loosen_percpu_ptr(stat);
+}
+
+/**
+ * 汇总所有CPU上的延迟统计
+ */
+void blk_get_latency(struct blk_request_queue *queue,
+	struct blk_latency_stat *sum)
+{
+	int cpu, rw, i;
+
+	memset(sum, 0, sizeof(*sum));
+	if (!queue->latency)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_latency_stat *stat = __percpu_ptr(queue->latency, cpu);
+
+		for (rw = READ; rw <= WRITE; rw++) {
+			for (i = 0; i < BLK_LATENCY_BUCKETS; i++)
+				sum->buckets[rw][i] += stat->buckets[rw][i];
+			sum->nr_requests[rw] += stat->nr_requests[rw];
+			sum->total_us[rw] += stat->total_us[rw];
+			if (stat->max_us[rw] > sum->max_us[rw])
+				sum->max_us[rw] = stat->max_us[rw];
+		}
+	}
+}
+
+void blk_reset_latency(struct blk_request_queue *queue)
+{
+	int cpu;
+
+	if (!queue->latency)
+		return;
+
+	for_each_possible_cpu(cpu)
+		memset(__percpu_ptr(queue->latency, cpu), 0,
+			sizeof(struct blk_latency_stat));
+}
+
+/**
+ * 打印队列的延迟直方图，用于比较不同的IO调度器
+ */
+void blk_dump_latency(struct blk_request_queue *queue)
+{
+	struct blk_latency_stat sum;
+	int rw, i;
+
+	blk_get_latency(queue, &sum);
+
+	printk("io scheduler: %s\n", queue->scheduler ?
+		queue->scheduler->type->name : "none");
+	for (rw = READ; rw <= WRITE; rw++) {
+		if (!sum.nr_requests[rw])
+			continue;
+
+		printk("%s: %lu requests, avg %lu us, max %lu us\n",
+			rw == READ ? "read" : "write", sum.nr_requests[rw],
+			sum.total_us[rw] / sum.nr_requests[rw], sum.max_us[rw]);
+		for (i = 0; i < BLK_LATENCY_BUCKETS; i++) {
+			if (!sum.buckets[rw][i])
+				continue;
+			printk("    %8lu us: %lu\n", 1UL << i, sum.buckets[rw][i]);
+		}
+	}
+}
+
 /**
  * 当整个请求全部结束后调用此函数
  */
@@ -354,6 +458,17 @@ void blk_finish_request(struct blk_request *req)
 	struct disk_device *disk = req->disk;
 	struct semaphore *waiting = req->waiting;
 
+	if (req->flags & BLKREQ_DATA)
+		blk_account_latency(req);
+
+	/**
+	 * 多队列请求直接归还标签
+	 */
+	if (req->flags & BLKREQ_MQ) {
+		blk_mq_free_request(req);
+		goto wake;
+	}
+
 	if (disk && (req->flags & BLKREQ_DATA))
 		disk->request_count--;
 
@@ -362,6 +477,7 @@ void blk_finish_request(struct blk_request *req)
 	 */
 	blk_loosen_request(req->queue, req);
 
+wake:
 	/**
 	 * 唤醒等待此请求的任务
 	 */
@@ -575,6 +691,8 @@ static struct blk_request *get_request(struct blk_request_queue *queue, bool wri
 	}
 
 	list_init(&req->list);
+	hash_list_init_node(&req->hash);
+	RB_CLEAR_NODE(&req->rb_node);
 	req->ref_count = 1;
 	req->queue = queue;
 	if (write)
@@ -738,11 +856,13 @@ static int merge_bio_head(struct blk_request_queue *queue, struct blk_request *r
 	req->start_sector = req->remain_sector_start = start_sector;
 	req->sector_count = req->remain_sector_count += bio_sectors(bio);
 	req->segcount_hw += nr_hw_segs;
+	iosched_merged_bio(queue, req, IOSCHED_FRONT_MERGE);
 
 	/**
 	 * 检查是否可以与上面的bio进行进一步的合并。
+	 * 合并后req已经被释放，否则通知调度器请求的起始扇区变化了
 	 */
-	if (prev && try_merge_requests(queue, prev, req))
+	if (!prev || !try_merge_requests(queue, prev, req))
 		iosched_merge_post(queue, req);
 
 	return 1;
@@ -776,16 +896,261 @@ static int merge_bio_tail(struct blk_request_queue *queue,
 	req->bio_tail = bio;
 	req->sector_count = req->remain_sector_count += bio_sectors(bio);
 	req->segcount_hw += nr_hw_segs;
+	iosched_merged_bio(queue, req, IOSCHED_BACK_MERGE);
 
 	/**
 	 * 检查是否可以与后面的请求合并。
 	 */
-	if (next && try_merge_requests(queue, req, next))
+	if (!next || !try_merge_requests(queue, req, next))
 		iosched_merge_post(queue, req);
 
 	return 1;
 }
 
+/**
+ * 请求是否可以与bio合并
+ */
+static bool blk_request_bio_mergeable(struct blk_request *req,
+	struct block_io_desc *bio)
+{
+	if (!rq_mergeable(req))
+		return false;
+
+	if (blk_request_is_write(req) != bio_is_write(bio)
+	    || req->disk != bio->bi_bdev->disk
+	    || req->waiting || req->special)
+		return false;
+
+	return true;
+}
+
+/**
+ * 在尚未交给IO调度器的请求链表中查找可以合并的请求
+ * 只检查最后depth个请求，顺序流一般都能命中最后一个
+ * 调用者保证链表不会被并发修改
+ */
+bool blk_attempt_list_merge(struct blk_request_queue *queue,
+	struct double_list *list, struct block_io_desc *bio, int depth)
+{
+	unsigned int req_sectors = bio_sectors(bio);
+	struct double_list *pos;
+	int nr_hw_segs = -1;
+
+	list_for_each_prev(pos, list) {
+		struct blk_request *req = TO_BLK_REQUEST(pos);
+
+		if (depth-- <= 0)
+			break;
+
+		if (req->queue != queue || !blk_request_bio_mergeable(req, bio))
+			continue;
+
+		if (req->sector_count + req_sectors >
+		    queue->request_settings.max_sectors)
+			continue;
+
+		if (nr_hw_segs < 0)
+			nr_hw_segs = blkio_hw_segments(queue, bio);
+		if (req->segcount_hw + nr_hw_segs >
+		    queue->request_settings.max_hw_segment_count)
+			continue;
+
+		/**
+		 * 合并到请求的末尾
+		 */
+		if (req->start_sector + req->sector_count == bio->start_sector) {
+			req->bio_tail->bi_next = bio;
+			req->bio_tail = bio;
+			req->sector_count = req->remain_sector_count += req_sectors;
+			req->segcount_hw += nr_hw_segs;
+
+			return true;
+		}
+
+		/**
+		 * 合并到请求的前面
+		 */
+		if (bio->start_sector + req_sectors == req->start_sector) {
+			int fire_sectors = bio_fire_sectors(bio);
+
+			bio->bi_next = req->bio_head;
+			req->bio_head = bio;
+			req->buffer = bio_data(bio);
+			req->sectors_seg_drv = fire_sectors;
+			req->sectors_seg = fire_sectors;
+			req->start_sector = req->remain_sector_start = bio->start_sector;
+			req->sector_count = req->remain_sector_count += req_sectors;
+			req->segcount_hw += nr_hw_segs;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * 开始积攒当前任务提交的请求
+ * 嵌套调用时，由最外层的插头负责推送
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	list_init(&plug->list);
+	plug->count = 0;
+
+	if (!current->plug)
+		current->plug = plug;
+}
+
+/**
+ * 插头中的请求按队列和扇区排序
+ * 请求数量很少，插入排序即可
+ */
+static void blk_sort_plug_list(struct double_list *list)
+{
+	struct double_list sorted;
+
+	list_init(&sorted);
+	while (!list_is_empty(list)) {
+		struct blk_request *req = BLK_FIRST_REQUEST(list);
+		struct double_list *pos;
+
+		list_del(&req->list);
+		list_for_each_prev(pos, &sorted) {
+			struct blk_request *prev = TO_BLK_REQUEST(pos);
+
+			if (prev->queue < req->queue ||
+			    (prev->queue == req->queue &&
+			     prev->start_sector <= req->start_sector))
+				break;
+		}
+		list_insert_front(&req->list, pos);
+	}
+
+	list_combine_behind_init(&sorted, list);
+}
+
+/**
+ * 将插头中属于同一个传统队列的请求加入IO调度器
+ * 并且只调用一次engorge_queue
+ */
+static void blk_insert_plugged_requests(struct blk_request_queue *queue,
+	struct double_list *list)
+{
+	smp_lock_irq(queue->queue_lock);
+	while (!list_is_empty(list)) {
+		struct blk_request *req = BLK_FIRST_REQUEST(list);
+
+		list_del_init(&req->list);
+		iosched_add_request(queue, req, IOSCHED_INSERT_ORDERED);
+	}
+
+	if (!test_bit(__BLKQUEUE_STOPPED, &queue->state)) {
+		blk_disable_attach(queue);
+		queue->engorge_queue(queue);
+	}
+	smp_unlock_irq(queue->queue_lock);
+}
+
+/**
+ * 将插头中的请求推送给驱动
+ * 可能在schedule中调用，不能睡眠
+ */
+void blk_flush_plug_list(struct blk_plug *plug)
+{
+	struct double_list list, queue_list;
+	struct blk_request_queue *queue;
+
+	if (list_is_empty(&plug->list))
+		return;
+
+	list_init(&list);
+	list_combine_behind_init(&plug->list, &list);
+	plug->count = 0;
+
+	blk_sort_plug_list(&list);
+
+	while (!list_is_empty(&list)) {
+		queue = BLK_FIRST_REQUEST(&list)->queue;
+
+		list_init(&queue_list);
+		while (!list_is_empty(&list) &&
+		       BLK_FIRST_REQUEST(&list)->queue == queue)
+			list_move_to_behind(list.next, &queue_list);
+
+		if (blk_queue_mq(queue))
+			blk_mq_insert_requests(queue, &queue_list);
+		else
+			blk_insert_plugged_requests(queue, &queue_list);
+	}
+}
+
+/**
+ * 拔出插头，推送积攒的请求
+ */
+void blk_finish_plug(struct blk_plug *plug)
+{
+	blk_flush_plug_list(plug);
+
+	if (current->plug == plug)
+		current->plug = NULL;
+}
+
+/**
+ * 将新请求加入插头，积攒太多时立即推送
+ */
+void blk_plug_add_request(struct blk_plug *plug, struct blk_request *req)
+{
+	list_insert_behind(&req->list, &plug->list);
+
+	if (++plug->count >= BLK_MAX_PLUG_REQUESTS)
+		blk_flush_plug_list(plug);
+}
+
+/**
+ * 任务即将睡眠，不能让插头中的请求等待它被唤醒
+ */
+void blk_schedule_flush_plug(struct task_desc *tsk)
+{
+	if (tsk->plug)
+		blk_flush_plug_list(tsk->plug);
+}
+
+/**
+ * 用第一个BIO初始化请求描述符
+ */
+void blk_init_request_from_bio(struct blk_request_queue *queue,
+	struct blk_request *req, struct block_io_desc *bio)
+{
+	int fire_sectors = bio_fire_sectors(bio);
+
+	/**
+	 * 一次标准的读或写操作标志
+	 */
+	req->flags |= BLKREQ_DATA;
+
+	/**
+	 * 是一次预读。
+	 * 或者调用者不希望重试。
+	 * 那么，失败时就直接返回不用重试。
+	 */
+	if (bio_rw_ahead(bio) || bio_noretry(bio))
+		req->flags |= BLKREQ_NORETRY;
+
+	/**
+	 * 初始化请求描述符中的字段。
+	 */
+	req->remain_sector_start = req->start_sector = bio->start_sector;
+	req->remain_sector_count = req->sector_count = bio_sectors(bio);
+	req->sectors_seg_drv = req->sectors_seg = fire_sectors;
+	req->segcount_hw = blkio_hw_segments(queue, bio);
+	req->buffer = bio_data(bio);
+	req->bio_head = req->bio_tail = bio;
+	req->disk = bio->bi_bdev->disk;
+	req->start_time = jiffies;
+	req->start_cycles = get_cycles();
+}
+
 /**
  * 如果驱动不特别指定
  * 通用块层调用此函数，获得IO调度层的服务。
@@ -793,11 +1158,9 @@ static int merge_bio_tail(struct blk_request_queue *queue,
 static int
 blk_generic_sumit_request(struct blk_request_queue *queue, struct block_io_desc *bio)
 {
-	sector_t start_sector = bio->start_sector;
 	int req_sectors = bio_sectors(bio);
 	bool write = bio_is_write(bio);
 	bool barrier = bio_is_barrier(bio);
-	int fire_sectors = bio_fire_sectors(bio);
 	struct blk_request *req= NULL;
 	struct blk_request *new_req = NULL;
 	/**
@@ -807,6 +1170,24 @@ blk_generic_sumit_request(struct blk_request_queue *queue, struct block_io_desc
 	int merge_pos;
 	int err = -EWOULDBLOCK;
 
+	/**
+	 * 任务插上了插头，在本地合并、暂存请求，不获取队列锁
+	 */
+	if (current->plug && !barrier) {
+		if (blk_attempt_list_merge(queue, &current->plug->list, bio,
+		    BLK_MAX_PLUG_REQUESTS))
+			return 0;
+
+		req = grab_request(queue, write, wait);
+		if (!req)
+			goto finished;
+
+		blk_init_request_from_bio(queue, req, bio);
+		blk_plug_add_request(current->plug, req);
+
+		return 0;
+	}
+
 	if (barrier) {
 		new_req = grab_request(queue, write, wait);
 		if (!new_req)
@@ -888,30 +1269,7 @@ new:
 	req = new_req;
 	new_req = NULL;
 
-	/**
-	 * 一次标准的读或写操作标志
-	 */
-	req->flags |= BLKREQ_DATA;
-
-	/**
-	 * 是一次预读。
-	 * 或者调用者不希望重试。
-	 * 那么，失败时就直接返回不用重试。
-	 */
-	if (bio_rw_ahead(bio) || bio_noretry(bio))
-		req->flags |= BLKREQ_NORETRY;
-
-	/**
-	 * 初始化请求描述符中的字段。
-	 */
-	req->remain_sector_start = req->start_sector = start_sector;
-	req->remain_sector_count = req->sector_count = req_sectors;
-	req->sectors_seg_drv = req->sectors_seg = fire_sectors;
-	req->segcount_hw = blkio_hw_segments(queue, bio);
-	req->buffer = bio_data(bio);
-	req->bio_head = req->bio_tail = bio;
-	req->disk = bio->bi_bdev->disk;
-	req->start_time = jiffies;
+	blk_init_request_from_bio(queue, req, bio);
 
 	/**
 	 * 将bio插入请求链表。
@@ -1189,12 +1547,17 @@ struct blk_request_queue *blk_create_queue(blkdev_engorge_queue_f engorge, struc
 	init_waitqueue(&queue->request_pools[WRITE].wait);
 	init_waitqueue(&queue->wait_drain);
 
+	queue->latency = alloc_percpu(struct blk_latency_stat);
+	if (!queue->latency)
+		goto fail;
+
 	/**
 	 * 初始化IO调度器
 	 */
 	if (!iosched_init(queue, NULL))
 		return queue;
 
+fail:
 	/**
 	 * 失败后，释放引用计数，这里会释放内存
 	 */
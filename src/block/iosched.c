@@ -1,6 +1,8 @@
 #include <dim-sum/beehive.h>
 #include <dim-sum/blk_dev.h>
 #include <dim-sum/blkio.h>
+#include <dim-sum/blk_mq.h>
+#include <dim-sum/hash.h>
 
 static struct smp_lock ioscheduler_list_lock =
 	SMP_LOCK_UNLOCKED(ioscheduler_list_lock);
@@ -8,17 +10,210 @@ static struct double_list ioscheduler_list =
 	LIST_HEAD_INITIALIZER(ioscheduler_list);
 
 
+static inline sector_t request_end_sector(struct blk_request *req)
+{
+	return req->start_sector + req->sector_count;
+}
+
+static inline struct hash_list_bucket *
+merge_hash_bucket(struct blk_request_queue *queue, sector_t sector)
+{
+	return &queue->merge_hash[hash_long(sector, IOSCHED_HASH_BITS)];
+}
+
+static void iosched_hash_add(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	hlist_add_head(&req->hash,
+		merge_hash_bucket(queue, request_end_sector(req)));
+}
+
+static inline void iosched_hash_del(struct blk_request *req)
+{
+	hlist_del_init(&req->hash);
+}
+
+/**
+ * 将请求插入排序树
+ * 起始扇区相同的请求放在右边
+ */
+static void iosched_rb_add(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	struct rb_root *root = &queue->merge_tree[blk_request_is_write(req)];
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct blk_request *tmp;
+
+		parent = *p;
+		tmp = rb_entry(parent, struct blk_request, rb_node);
+		if (req->start_sector < tmp->start_sector)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	rb_link_node(&req->rb_node, parent, p);
+	rb_insert_color(&req->rb_node, root);
+}
+
+static void iosched_rb_del(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	rb_erase(&req->rb_node, &queue->merge_tree[blk_request_is_write(req)]);
+	RB_CLEAR_NODE(&req->rb_node);
+}
+
+/**
+ * 请求进入调度器，可以参与合并
+ */
+void iosched_add_sorted(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	BUG_ON(blk_request_sorted(req));
+
+	iosched_hash_add(queue, req);
+	iosched_rb_add(queue, req);
+}
+
+/**
+ * 请求被派发、合并或者移除，不再参与合并
+ */
+void iosched_del_sorted(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	if (!blk_request_sorted(req))
+		return;
+
+	iosched_hash_del(req);
+	iosched_rb_del(queue, req);
+}
+
+/**
+ * 屏障之前的请求都不能再参与合并
+ */
+static void iosched_del_all_sorted(struct blk_request_queue *queue)
+{
+	struct rb_node *node;
+	int rw;
+
+	for (rw = READ; rw <= WRITE; rw++)
+		while ((node = rb_first(&queue->merge_tree[rw])) != NULL)
+			iosched_del_sorted(queue,
+				rb_entry(node, struct blk_request, rb_node));
+}
+
+/**
+ * BIO被合并到请求中，更新索引和统计
+ */
+void iosched_merged_bio(struct blk_request_queue *queue,
+	struct blk_request *req, int pos)
+{
+	if (pos == IOSCHED_BACK_MERGE) {
+		queue->stat.back_merges++;
+		/**
+		 * 结束扇区变了
+		 */
+		if (blk_request_sorted(req)) {
+			iosched_hash_del(req);
+			iosched_hash_add(queue, req);
+		}
+	} else {
+		queue->stat.front_merges++;
+		/**
+		 * 起始扇区变了
+		 */
+		if (blk_request_sorted(req)) {
+			iosched_rb_del(queue, req);
+			iosched_rb_add(queue, req);
+		}
+	}
+}
+
+/**
+ * 通过哈希表查找在bio开始处结束的请求
+ */
+static struct blk_request *
+iosched_find_back_merge(struct blk_request_queue *queue, struct block_io_desc *bio)
+{
+	struct hash_list_bucket *bucket = merge_hash_bucket(queue, bio->start_sector);
+	struct hash_list_node *node;
+
+	hlist_for_each(node, bucket) {
+		struct blk_request *req =
+			hlist_entry(node, struct blk_request, hash);
+
+		if (request_end_sector(req) == bio->start_sector
+		    && iosched_can_merge(req, bio))
+			return req;
+	}
+
+	return NULL;
+}
+
+/**
+ * 通过排序树查找在bio结束处开始的请求
+ */
+static struct blk_request *
+iosched_find_front_merge(struct blk_request_queue *queue, struct block_io_desc *bio)
+{
+	struct rb_node *n = queue->merge_tree[bio_is_write(bio)].rb_node;
+	sector_t sector = bio->start_sector + bio_sectors(bio);
+
+	while (n) {
+		struct blk_request *req = rb_entry(n, struct blk_request, rb_node);
+
+		if (sector < req->start_sector)
+			n = n->rb_left;
+		else if (sector > req->start_sector)
+			n = n->rb_right;
+		else if (iosched_can_merge(req, bio))
+			return req;
+		else
+			n = n->rb_right;
+	}
+
+	return NULL;
+}
+
 /**
  * 在队列中查找，找到请求的合并位置
+ * 调度器没有特别指定时，使用哈希表和排序树查找
  */
 int iosched_get_merge_pos(struct blk_request_queue *queue, struct blk_request **req, struct block_io_desc *bio)
 {
 	struct ioscheduler *sched = queue->scheduler;
+	struct blk_request *request;
+	int ret;
 
 	if (sched->ops->get_merge_pos)
 		return sched->ops->get_merge_pos(queue, req, bio);
 
-	return IOSCHED_NO_MERGE;
+	/**
+	 * 快速路径，一般可以和上一个请求合并
+	 */
+	if ((ret = iosched_try_last_merge(queue, bio)) != IOSCHED_NO_MERGE) {
+		*req = queue->preferred_merge;
+		return ret;
+	}
+
+	if ((request = iosched_find_back_merge(queue, bio)) != NULL)
+		ret = IOSCHED_BACK_MERGE;
+	else if ((request = iosched_find_front_merge(queue, bio)) != NULL)
+		ret = IOSCHED_FRONT_MERGE;
+	else
+		return IOSCHED_NO_MERGE;
+
+	/**
+	 * 记录最后一次合并的请求
+	 * 加快下次合并速度
+	 */
+	*req = request;
+	queue->preferred_merge = request;
+
+	return ret;
 }
 
 /**
@@ -80,12 +275,33 @@ void iosched_add_request(struct blk_request_queue *queue,
 	 */
 	if ((request->flags & BLKREQ_BARRIER) && (where == IOSCHED_INSERT_ORDERED))
 		where = IOSCHED_INSERT_TAIL;
+	if (where == IOSCHED_INSERT_ORDERED)
+		iosched_add_sorted(queue, request);
+
+	/**
+	 * 驱动退回的请求重新排队，撤销上次派发时的计数
+	 * 它离开调度器时已经不再计入queued，这里只计入一次
+	 */
+	if (request->flags & BLKREQ_STARTED) {
+		request->flags &= ~BLKREQ_STARTED;
+		queue->stat.dispatched--;
+		queue->stat.completed--;
+	}
+
+	if (++queue->stat.queued > queue->stat.max_queued)
+		queue->stat.max_queued = queue->stat.queued;
 
 	/**
 	 * 对noop算法来说，回调函数是noop_add_request，直接插入链表即可
 	 */
 	queue->scheduler->ops->add_request(queue, request, where);
 
+	/**
+	 * 屏障前面的请求都不能再参与合并
+	 */
+	if (request->flags & BLKREQ_BARRIER)
+		iosched_del_all_sorted(queue);
+
 	/**
 	 * 队列与设备绑定了
 	 */
@@ -117,6 +333,12 @@ void iosched_remove_request(struct blk_request_queue *queue,
 	 */
 	list_del_init(&request->list);
 
+	if (request->flags & BLKREQ_STARTED) {
+		queue->stat.in_flight--;
+		queue->stat.completed++;
+	} else
+		queue->stat.queued--;
+
 	/**
 	 * 请求队列需要管理自己的内存池
 	 */
@@ -125,8 +347,10 @@ void iosched_remove_request(struct blk_request_queue *queue,
 
 		/**
 		 * 被驱动接收的IO请求
+		 * 多队列路径的请求完成时直接归还标签，不在这里计数
 		 */
-		if ((request->flags & BLKREQ_DATA) && (request->flags & BLKREQ_STARTED))
+		if ((request->flags & BLKREQ_DATA) && (request->flags & BLKREQ_STARTED)
+		    && !(request->flags & BLKREQ_MQ))
 			queue->running_count++;
 
 		/**
@@ -141,6 +365,8 @@ void iosched_remove_request(struct blk_request_queue *queue,
 		if (sched->ops->remove_request)
 			sched->ops->remove_request(queue, request);
 	}
+
+	iosched_del_sorted(queue, request);
 }
 
 /**
@@ -172,6 +398,18 @@ void iosched_merge_requests(struct blk_request_queue *queue, struct blk_request
 
 	if (sched->ops->merge)
 		sched->ops->merge(queue, request, next);
+
+	/**
+	 * request的结束扇区变了，next不再独立存在
+	 */
+	iosched_del_sorted(queue, next);
+	if (blk_request_sorted(request)) {
+		iosched_hash_del(request);
+		iosched_hash_add(queue, request);
+	}
+
+	queue->stat.request_merges++;
+	queue->stat.queued--;
 }
 
 /**
@@ -185,34 +423,46 @@ void iosched_merge_post(struct blk_request_queue *queue, struct blk_request *req
 		sched->ops->merge_post(queue, request);
 }
 
+/**
+ * 查找扇区顺序上的前一个请求，用于合并相邻请求
+ */
 struct blk_request *iosched_get_front_request(struct blk_request_queue *queue, struct blk_request *request)
 {
-	struct double_list *prev;
+	struct rb_node *prev;
 
 	struct ioscheduler *sched = queue->scheduler;
 
 	if (sched->ops->get_front_request)
 		return sched->ops->get_front_request(queue, request);
 
-	prev = request->list.prev;
-	if (!list_is_empty(&request->list) && prev != &queue->requests)
-		return TO_BLK_REQUEST(prev);
+	if (!blk_request_sorted(request))
+		return NULL;
+
+	prev = rb_prev(&request->rb_node);
+	if (prev)
+		return rb_entry(prev, struct blk_request, rb_node);
 
 	return NULL;
 }
 
+/**
+ * 查找扇区顺序上的后一个请求
+ */
 struct blk_request *iosched_get_behind_request(struct blk_request_queue *queue, struct blk_request *request)
 {
-	struct double_list *next;
+	struct rb_node *next;
 
 	struct ioscheduler *sched = queue->scheduler;
 
 	if (sched->ops->get_behind_request)
 		return sched->ops->get_behind_request(queue, request);
 
-	next = request->list.next;
-	if (!list_is_empty(&request->list) && next != &queue->requests)
-		return TO_BLK_REQUEST(next);
+	if (!blk_request_sorted(request))
+		return NULL;
+
+	next = rb_next(&request->rb_node);
+	if (next)
+		return rb_entry(next, struct blk_request, rb_node);
 
 	return NULL;
 }
@@ -255,7 +505,13 @@ struct blk_request *iosched_get_first_request(struct blk_request_queue *queue)
 	 * 从请求队列中取出一个请求进行处理
 	 */
 	if (request != NULL) {
+		if (!(request->flags & BLKREQ_STARTED)) {
+			queue->stat.queued--;
+			queue->stat.in_flight++;
+			queue->stat.dispatched++;
+		}
 		request->flags |= BLKREQ_STARTED;
+		iosched_del_sorted(queue, request);
 
 		/**
 		 * 当前请求是队列中的请求边界(IO屏障) 
@@ -389,9 +645,10 @@ void unregister_ioscheduler(struct ioscheduler_type *sched)
 }
 
 /**
- * 初始化请求队列的调度器
+ * 按名称分配调度器对象并初始化
  */
-int iosched_init(struct blk_request_queue *queue, char *name)
+static struct ioscheduler *
+iosched_alloc(struct blk_request_queue *queue, char *name, int *err)
 {
 	struct ioscheduler_type *type = NULL;
 	struct ioscheduler *sched;
@@ -401,15 +658,19 @@ int iosched_init(struct blk_request_queue *queue, char *name)
 		name = default_ioscheduler_name;
 
 	type = lookup_ioscheduler(name);
-	if (!type)
-		return -EINVAL;
+	if (!type) {
+		*err = -EINVAL;
+		return NULL;
+	}
 
 	/**
 	 * 为队列分配调度器对象
 	 */
 	sched = kmalloc(sizeof(struct ioscheduler), PAF_KERNEL | __PAF_ZERO);
-	if (!sched)
-		return -ENOMEM;
+	if (!sched) {
+		*err = -ENOMEM;
+		return NULL;
+	}
 
 	/**
 	 * 初始化调度器
@@ -418,15 +679,82 @@ int iosched_init(struct blk_request_queue *queue, char *name)
 	sched->type = type;
 	if (sched->ops->init)
 		ret = sched->ops->init(queue, sched);
-	if (ret)
+	if (ret) {
 		kfree(sched);
-	else {
-		queue->scheduler = sched;
-		list_init(&queue->requests);
-		queue->preferred_merge = NULL;
+		*err = ret;
+		return NULL;
 	}
 
-	return ret;
+	return sched;
+}
+
+/**
+ * 初始化请求队列的调度器
+ * name为NULL时使用默认调度器
+ */
+int iosched_init(struct blk_request_queue *queue, char *name)
+{
+	struct ioscheduler *sched;
+	int ret = 0;
+	int i;
+
+	sched = iosched_alloc(queue, name, &ret);
+	if (!sched)
+		return ret;
+
+	queue->scheduler = sched;
+	list_init(&queue->requests);
+	for (i = 0; i < IOSCHED_HASH_SIZE; i++)
+		hash_list_init_bucket(&queue->merge_hash[i]);
+	queue->merge_tree[READ] = RB_ROOT;
+	queue->merge_tree[WRITE] = RB_ROOT;
+	queue->preferred_merge = NULL;
+
+	return 0;
+}
+
+/**
+ * 为队列更换调度器
+ * 请求的私有数据属于旧调度器，因此只能在队列空闲时更换
+ * 多队列路径上，请求只在进入调度器时才有私有数据
+ * 因此调度器中没有请求即可更换
+ */
+int iosched_switch(struct blk_request_queue *queue, char *name)
+{
+	struct ioscheduler *sched, *old;
+	int ret = 0;
+
+	sched = iosched_alloc(queue, name, &ret);
+	if (!sched)
+		return ret;
+
+	smp_lock_irq(queue->queue_lock);
+	/**
+	 * 还有已经分配的请求，它们可能还没有进入调度器
+	 */
+	if ((!blk_queue_mq(queue)
+	    && (queue->request_pools[READ].request_count
+	    || queue->request_pools[WRITE].request_count))
+	    || !iosched_is_empty(queue)) {
+		smp_unlock_irq(queue->queue_lock);
+		iosched_exit(sched);
+		return -EBUSY;
+	}
+
+	old = queue->scheduler;
+	queue->scheduler = sched;
+	queue->preferred_merge = NULL;
+	if (blk_queue_mq(queue)) {
+		if (strcmp(sched->type->name, "noop"))
+			atomic_set_bit(__BLKQUEUE_MQ_SCHED, &queue->state);
+		else
+			atomic_clear_bit(__BLKQUEUE_MQ_SCHED, &queue->state);
+	}
+	smp_unlock_irq(queue->queue_lock);
+
+	iosched_exit(old);
+
+	return 0;
 }
 
 void init_iosched(void)
@@ -0,0 +1,385 @@
+#include <dim-sum/beehive.h>
+#include <dim-sum/blk_dev.h>
+#include <dim-sum/blkio.h>
+#include <dim-sum/init.h>
+
+/**
+ * 读请求的最长等待时间
+ */
+#define DEADLINE_READ_EXPIRE	(HZ / 2)
+/**
+ * 写请求的最长等待时间
+ */
+#define DEADLINE_WRITE_EXPIRE	(5 * HZ)
+/**
+ * 写请求最多被读请求抢先的次数
+ */
+#define DEADLINE_WRITES_STARVED	2
+/**
+ * 按扇区顺序连续派发的最大请求数
+ */
+#define DEADLINE_FIFO_BATCH	16
+
+/**
+ * 最后期限调度器的队列私有数据
+ */
+struct deadline_data {
+	/**
+	 * 按到达时间排序的FIFO链表，读写分开
+	 * 请求通过其list字段链接到此
+	 */
+	struct double_list fifo_list[2];
+	/**
+	 * 按扇区顺序下一个要派发的请求
+	 */
+	struct blk_request *next_req[2];
+	/**
+	 * 当前批次已经派发的请求数
+	 */
+	unsigned int batching;
+	/**
+	 * 最后一个派发的请求的结束扇区
+	 */
+	sector_t last_sector;
+	/**
+	 * 写请求被读请求抢先的次数
+	 */
+	unsigned int starved;
+	/**
+	 * 可调参数
+	 */
+	unsigned long fifo_expire[2];
+	unsigned int fifo_batch;
+	unsigned int writes_starved;
+};
+
+/**
+ * 请求的调度器私有数据
+ */
+struct deadline_request {
+	struct blk_request *request;
+	/**
+	 * 请求的最后期限，以jiffies为单位
+	 */
+	unsigned long expires;
+};
+
+static struct beehive_allotter *drq_allotter;
+
+#define RQ_DATA(req)	((struct deadline_request *)(req)->sched_data)
+
+static inline struct deadline_data *
+queue_to_deadline(struct blk_request_queue *queue)
+{
+	return queue->scheduler->elevator_data;
+}
+
+static inline sector_t request_end_sector(struct blk_request *req)
+{
+	return req->start_sector + req->sector_count;
+}
+
+/**
+ * 排序树中扇区顺序上的下一个请求
+ * 请求按起始扇区排序，保存在队列的merge_tree中
+ */
+static inline struct blk_request *deadline_next_sorted(struct blk_request *req)
+{
+	struct rb_node *next = rb_next(&req->rb_node);
+
+	return next ? rb_entry(next, struct blk_request, rb_node) : NULL;
+}
+
+/**
+ * 请求即将离开排序树，不能再作为下一个派发的请求
+ */
+static void deadline_forget(struct deadline_data *dd, struct blk_request *req)
+{
+	bool write = blk_request_is_write(req);
+
+	if (dd->next_req[write] == req)
+		dd->next_req[write] = deadline_next_sorted(req);
+}
+
+/**
+ * 将请求从排序树和FIFO中取出，放入派发链表的末尾
+ */
+static void
+deadline_move_request(struct deadline_data *dd, struct blk_request *req)
+{
+	struct blk_request_queue *queue = req->queue;
+	bool write = blk_request_is_write(req);
+
+	dd->next_req[READ] = NULL;
+	dd->next_req[WRITE] = NULL;
+	dd->next_req[write] = deadline_next_sorted(req);
+
+	dd->last_sector = request_end_sector(req);
+
+	iosched_del_sorted(queue, req);
+	list_del_init(&req->list);
+	list_insert_behind(&req->list, &queue->requests);
+}
+
+/**
+ * FIFO头部的请求是否已经超过最后期限
+ */
+static inline int deadline_check_fifo(struct deadline_data *dd, int dir)
+{
+	struct blk_request *req;
+
+	if (list_is_empty(&dd->fifo_list[dir]))
+		return 0;
+
+	req = BLK_FIRST_REQUEST(&dd->fifo_list[dir]);
+
+	return time_after(jiffies, RQ_DATA(req)->expires);
+}
+
+/**
+ * 选择一个请求放入派发链表
+ * 优先按扇区顺序成批派发，有请求超时或者批次用完时重新选择方向
+ * 读请求优先，但是写请求最多被抢先writes_starved次
+ */
+static int deadline_dispatch_requests(struct deadline_data *dd)
+{
+	int reads = !list_is_empty(&dd->fifo_list[READ]);
+	int writes = !list_is_empty(&dd->fifo_list[WRITE]);
+	struct blk_request *req;
+	int dir;
+
+	/**
+	 * 继续上一个批次
+	 */
+	if (dd->next_req[WRITE])
+		req = dd->next_req[WRITE];
+	else
+		req = dd->next_req[READ];
+
+	if (req) {
+		/**
+		 * 不连续的请求结束当前批次
+		 */
+		if (dd->last_sector != req->start_sector)
+			dd->batching += dd->fifo_batch;
+
+		if (dd->batching < dd->fifo_batch)
+			goto dispatch;
+	}
+
+	if (reads) {
+		if (writes && (dd->starved++ >= dd->writes_starved))
+			goto dispatch_writes;
+
+		dir = READ;
+		goto dispatch_find;
+	}
+
+	if (writes) {
+dispatch_writes:
+		dd->starved = 0;
+		dir = WRITE;
+		goto dispatch_find;
+	}
+
+	return 0;
+
+dispatch_find:
+	/**
+	 * 有请求超时，或者该方向上已经没有更高扇区的请求
+	 * 从FIFO头部重新开始，否则沿着扇区顺序继续
+	 */
+	if (deadline_check_fifo(dd, dir) || !dd->next_req[dir])
+		req = BLK_FIRST_REQUEST(&dd->fifo_list[dir]);
+	else
+		req = dd->next_req[dir];
+
+	dd->batching = 0;
+
+dispatch:
+	dd->batching++;
+	deadline_move_request(dd, req);
+
+	return 1;
+}
+
+/**
+ * next被合并到req中
+ */
+static void deadline_merge(struct blk_request_queue *queue,
+	struct blk_request *req, struct blk_request *next)
+{
+	struct deadline_data *dd = queue_to_deadline(queue);
+	struct deadline_request *drq = RQ_DATA(req);
+	struct deadline_request *dnext = RQ_DATA(next);
+
+	/**
+	 * 继承next的最后期限，以及它在FIFO中的位置
+	 */
+	if (blk_request_sorted(req) && blk_request_sorted(next)
+	    && time_before(dnext->expires, drq->expires)) {
+		list_del(&req->list);
+		list_insert_front(&req->list, &next->list);
+		drq->expires = dnext->expires;
+	}
+
+	if (blk_request_sorted(next))
+		deadline_forget(dd, next);
+	list_del_init(&next->list);
+}
+
+static void deadline_add_request(struct blk_request_queue *queue,
+	struct blk_request *req, int where)
+{
+	struct deadline_data *dd = queue_to_deadline(queue);
+	struct deadline_request *drq = RQ_DATA(req);
+	bool write = blk_request_is_write(req);
+
+	/**
+	 * 通用层已经将有序插入的请求加入排序树
+	 */
+	switch (where) {
+	case IOSCHED_INSERT_HEAD:
+		list_insert_front(&req->list, &queue->requests);
+		break;
+	case IOSCHED_INSERT_TAIL:
+		/**
+		 * 屏障之前的请求必须先于它派发
+		 */
+		while (deadline_dispatch_requests(dd))
+			;
+		list_insert_behind(&req->list, &queue->requests);
+		break;
+	default:
+		drq->expires = jiffies + dd->fifo_expire[write];
+		list_insert_behind(&req->list, &dd->fifo_list[write]);
+		break;
+	}
+
+	/**
+	 * 讨厌的屏障，前面的所有请求都不能参与合并
+	 */
+	if (req->flags & BLKREQ_BARRIER)
+		queue->preferred_merge = NULL;
+	else if (rq_mergeable(req))
+		queue->preferred_merge = req;
+}
+
+/**
+ * 请求从派发链表中移除，它的list字段已经被通用层摘除
+ */
+static void deadline_remove_request(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	if (blk_request_sorted(req))
+		deadline_forget(queue_to_deadline(queue), req);
+}
+
+static int deadline_is_empty(struct blk_request_queue *queue)
+{
+	struct deadline_data *dd = queue_to_deadline(queue);
+
+	return list_is_empty(&queue->requests)
+		&& list_is_empty(&dd->fifo_list[READ])
+		&& list_is_empty(&dd->fifo_list[WRITE]);
+}
+
+static struct blk_request *
+deadline_get_first_request(struct blk_request_queue *queue)
+{
+	struct deadline_data *dd = queue_to_deadline(queue);
+
+	if (list_is_empty(&queue->requests))
+		deadline_dispatch_requests(dd);
+
+	if (!list_is_empty(&queue->requests))
+		return BLK_FIRST_REQUEST(&queue->requests);
+
+	return NULL;
+}
+
+static int deadline_init_request(struct blk_request_queue *queue,
+	struct blk_request *req, int alloc_flags)
+{
+	struct deadline_request *drq;
+
+	drq = beehive_alloc(drq_allotter, alloc_flags);
+	if (!drq)
+		return -ENOMEM;
+
+	memset(drq, 0, sizeof(*drq));
+	drq->request = req;
+	req->sched_data = drq;
+
+	return 0;
+}
+
+static void deadline_uninit_request(struct blk_request_queue *queue,
+	struct blk_request *req)
+{
+	struct deadline_request *drq = RQ_DATA(req);
+
+	if (drq) {
+		beehive_free(drq_allotter, drq);
+		req->sched_data = NULL;
+	}
+}
+
+static int deadline_init(struct blk_request_queue *queue,
+	struct ioscheduler *sched)
+{
+	struct deadline_data *dd;
+
+	dd = kmalloc(sizeof(*dd), PAF_KERNEL | __PAF_ZERO);
+	if (!dd)
+		return -ENOMEM;
+
+	list_init(&dd->fifo_list[READ]);
+	list_init(&dd->fifo_list[WRITE]);
+	dd->fifo_expire[READ] = DEADLINE_READ_EXPIRE;
+	dd->fifo_expire[WRITE] = DEADLINE_WRITE_EXPIRE;
+	dd->writes_starved = DEADLINE_WRITES_STARVED;
+	dd->fifo_batch = DEADLINE_FIFO_BATCH;
+	sched->elevator_data = dd;
+
+	return 0;
+}
+
+static void deadline_uninit(struct ioscheduler *sched)
+{
+	struct deadline_data *dd = sched->elevator_data;
+
+	BUG_ON(!list_is_empty(&dd->fifo_list[READ]));
+	BUG_ON(!list_is_empty(&dd->fifo_list[WRITE]));
+
+	kfree(dd);
+}
+
+static struct ioscheduler_type iosched_deadline = {
+	.ops = {
+		.merge		= deadline_merge,
+		.get_first_request		= deadline_get_first_request,
+		.add_request		= deadline_add_request,
+		.remove_request		= deadline_remove_request,
+		.is_empty		= deadline_is_empty,
+		.init_request		= deadline_init_request,
+		.uninit_request		= deadline_uninit_request,
+		.init		= deadline_init,
+		.uninit		= deadline_uninit,
+	},
+	.name = "deadline",
+};
+
+int __init init_iosched_deadline(void)
+{
+	drq_allotter = beehive_create("deadline_request",
+			sizeof(struct deadline_request), 0, BEEHIVE_PANIC, NULL);
+
+	return register_ioscheduler(&iosched_deadline);
+}
+
+__maybe_unused void iosched_deadline_exit(void)
+{
+	unregister_ioscheduler(&iosched_deadline);
+	beehive_destroy(drq_allotter);
+}
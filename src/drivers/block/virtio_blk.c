@@ -2,6 +2,7 @@
 #include <dim-sum/fs.h>
 #include <dim-sum/disk.h>
 #include <dim-sum/blk_dev.h>
+#include <dim-sum/blk_mq.h>
 #include <dim-sum/disk.h>
 #include <dim-sum/irq.h>
 #include <dim-sum/smp_lock.h>
@@ -28,25 +29,30 @@ enum {
 	VBLK_REQ_TEST		= 32,
 };
 
+struct virtio_blk_vq {
+	struct virtqueue *vq;
+	/* Serializes virtqueue access between dispatch and completion. */
+	struct smp_lock lock;
+	char name[16];
+} ____cacheline_aligned;
+
 struct virtio_blk
 {
 	struct virtio_device *vdev;
-	struct virtqueue *vq;
 	struct wait_queue queue_wait;
 
 	/* The disk structure for the kernel. */
 	struct disk_device *disk;
 
-	struct beehive_allotter *mem_cache;
-
 	/* What host tells us, plus 2 for header & tailer. */
 	unsigned int sg_elems;
 
 	/* Ida index - used to track minor number allocations. */
 	int index;
 
-	/* Scatterlist: can be too big for stack. */
-	struct scatterlist sg[/*sg_elems*/];
+	/* One virtqueue per hardware queue, completed on the CPU it serves. */
+	int num_vqs;
+	struct virtio_blk_vq *vqs;
 };
 
 struct virtblk_req
@@ -72,20 +78,6 @@ static inline int virtblk_result(struct virtblk_req *vbr)
 	}
 }
 
-static inline struct virtblk_req *virtblk_alloc_req(struct virtio_blk *vblk,
-						    paf_t paf_mask)
-{
-	struct virtblk_req *vbr;
-
-	vbr = beehive_alloc(vblk->mem_cache, paf_mask);
-	if (!vbr)
-		return NULL;
-
-	vbr->vblk = vblk;
-
-	return vbr;
-}
-
 static int __virtblk_add_req(struct virtqueue *vq,
 			     struct virtblk_req *vbr,
 			     struct scatterlist *data_sg,
@@ -129,37 +121,13 @@ static int __virtblk_add_req(struct virtqueue *vq,
 	return virtqueue_add_sgs(vq, sgs, num_out, num_in, vbr, PAF_ATOMIC);
 }
 
-__maybe_unused static void virtblk_add_req(struct virtblk_req *vbr, bool have_data)
-{
-	struct virtio_blk *vblk = vbr->vblk;
-	DEFINE_WAIT(wait);
-	int ret;
-
-	smp_lock_irq(vblk->disk->queue->queue_lock);
-	while (unlikely((ret = __virtblk_add_req(vblk->vq, vbr, vbr->sg,
-						 have_data)) < 0)) {
-		prepare_to_wait_exclusive(&vblk->queue_wait, &wait,
-					  TASK_UNINTERRUPTIBLE);
-
-		smp_unlock_irq(vblk->disk->queue->queue_lock);
-		io_schedule();
-		smp_lock_irq(vblk->disk->queue->queue_lock);
-
-		finish_wait(&vblk->queue_wait, &wait);
-	}
-
-	virtqueue_kick(vblk->vq);
-	smp_unlock_irq(vblk->disk->queue->queue_lock);
-}
-
 static inline void virtblk_request_done(struct virtblk_req *vbr)
 {
-	struct virtio_blk *vblk = vbr->vblk;
 	struct blk_request *req = vbr->req;
 	int error = virtblk_result(vbr);
 
+	/* The request and its virtblk_req go back to the tag pool. */
 	blkdev_finish_request(req, error);
-	beehive_free(vblk->mem_cache, vbr);
 }
 
 static struct page_frame *test_page;
@@ -181,15 +149,16 @@ static void virtblk_test_done(struct virtblk_req *vbr)
 static void virtblk_done(struct virtqueue *vq)
 {
 	struct virtio_blk *vblk = vq->vdev->priv;
+	struct virtio_blk_vq *vbq = &vblk->vqs[vq->index];
 	bool bio_done = false, req_done = false;
 	struct virtblk_req *vbr;
-	//unsigned long flags;
+	unsigned long flags;
 	unsigned int len;
 
-	//smp_lock_irqsave(vblk->disk->queue->queue_lock, flags);
+	smp_lock_irqsave(&vbq->lock, flags);
 	do {
 		virtqueue_disable_cb(vq);
-		while ((vbr = virtqueue_get_buf(vblk->vq, &len)) != NULL) {
+		while ((vbr = virtqueue_get_buf(vq, &len)) != NULL) {
 			if (vbr->flags & VBLK_REQ_TEST) {
 				virtblk_test_done(vbr);
 				bio_done = true;
@@ -199,75 +168,100 @@ static void virtblk_done(struct virtqueue *vq)
 			}
 		}
 	} while (!virtqueue_enable_cb(vq));
+	smp_unlock_irqrestore(&vbq->lock, flags);
+
 	/* In case queue is stopped waiting for more buffers. */
 	if (req_done)
-		blkdev_start_quest(vblk->disk->queue);
-	//smp_unlock_irqrestore(vblk->disk->queue->queue_lock, flags);
+		blk_mq_start_stopped_hw_queue(vblk->disk->queue->hw_ctxs[vq->index],
+					      true);
 
 	if (bio_done)
 		wake_up(&vblk->queue_wait);
 }
 
-static bool do_req(struct blk_request_queue *q, struct virtio_blk *vblk,
-		   struct blk_request *req)
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx,
+			    struct blk_request *req, bool last)
 {
+	struct virtio_blk_vq *vbq = hctx->driver_data;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+	struct virtio_blk *vblk = vbr->vblk;
+	unsigned long flags;
 	unsigned int num;
-	struct virtblk_req *vbr;
+	bool notify = false;
+	int err;
 
-	vbr = virtblk_alloc_req(vblk, PAF_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
+	BUG_ON(req->segcount_hw + 2 > vblk->sg_elems);
 
 	vbr->req = req;
-
-
+	vbr->flags = 0;
 	vbr->out_hdr.type = 0;
-	vbr->out_hdr.sector = blk_rq_pos(vbr->req);
-	vbr->out_hdr.ioprio = 0;//req_get_ioprio(vbr->req);
-
-	num = blk_gather_bio(q, vbr->req, vblk->sg);
+	vbr->out_hdr.sector = blk_rq_pos(req);
+	vbr->out_hdr.ioprio = 0;
 
+	num = blk_gather_bio(hctx->queue, req, vbr->sg);
 	if (num) {
-		if (blk_request_is_write(vbr->req) == WRITE)
+		if (blk_request_is_write(req))
 			vbr->out_hdr.type |= VIRTIO_BLK_T_OUT;
 		else
 			vbr->out_hdr.type |= VIRTIO_BLK_T_IN;
 	}
 
-	if (__virtblk_add_req(vblk->vq, vbr, vblk->sg, num) < 0) {
-		beehive_free(vblk->mem_cache, vbr);
-		return false;
+	smp_lock_irqsave(&vbq->lock, flags);
+	err = __virtblk_add_req(vbq->vq, vbr, vbr->sg, num);
+	if (err < 0) {
+		/*
+		 * The ring is full: kick what we have queued so far and
+		 * wait for virtblk_done() to restart the hardware queue.
+		 * The request is requeued by the block layer, not failed.
+		 */
+		virtqueue_kick(vbq->vq);
+		blk_mq_stop_hw_queue(hctx);
+		smp_unlock_irqrestore(&vbq->lock, flags);
+		return BLK_MQ_RQ_BUSY;
 	}
 
-	return true;
+	if (last && virtqueue_kick_prepare(vbq->vq))
+		notify = true;
+	smp_unlock_irqrestore(&vbq->lock, flags);
+
+	if (notify)
+		virtqueue_notify(vbq->vq);
+
+	return BLK_MQ_RQ_OK;
 }
 
-static void virtblk_request(struct blk_request_queue *q)
+static void virtblk_commit_rqs(struct blk_mq_hw_ctx *hctx)
 {
-	struct virtio_blk *vblk = q->queuedata;
-	struct blk_request *req;
-	unsigned int issued = 0;
-
-	while ((req = iosched_get_first_request(q)) != NULL) {
-		//unsigned long offset = req->sector << 9;
-		//size_t len = req->sectors_seg_drv << 9;
-		
-		BUG_ON(req->segcount_hw + 2 > vblk->sg_elems);
-
-		/* If this request fails, stop queue and wait for something to
-		   finish to restart it. */
-		if (!do_req(q, vblk, req)) {
-			blk_end_request(req, 0);
-		} else {
-			issued++;
-		}
-		blkdev_dequeue_request(req);
-	}
-	if (issued)
-		virtqueue_kick(vblk->vq);
+	struct virtio_blk_vq *vbq = hctx->driver_data;
+	unsigned long flags;
+	bool notify;
+
+	smp_lock_irqsave(&vbq->lock, flags);
+	notify = virtqueue_kick_prepare(vbq->vq);
+	smp_unlock_irqrestore(&vbq->lock, flags);
+
+	if (notify)
+		virtqueue_notify(vbq->vq);
 }
 
+static int virtblk_init_request(void *data, struct blk_request *req,
+				unsigned int hctx_idx, unsigned int tag)
+{
+	struct virtio_blk *vblk = data;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+
+	vbr->vblk = vblk;
+	sg_init_table(vbr->sg, vblk->sg_elems);
+
+	return 0;
+}
+
+static struct blk_mq_ops virtio_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+	.commit_rqs	= virtblk_commit_rqs,
+	.init_request	= virtblk_init_request,
+};
+
 static int virtblk_ioctl(struct block_device *bdev, fmode_t mode,
 			     unsigned int cmd, unsigned long data)
 {
@@ -288,18 +282,89 @@ static const struct block_device_operations virtblk_fops = {
 	.ioctl  = virtblk_ioctl,
 };
 
+/*
+ * One request virtqueue per CPU when the device offers VIRTIO_BLK_F_MQ.
+ * Devices are probed before the secondary CPUs are launched, so size
+ * the queues by possible CPUs.
+ */
 static int init_vq(struct virtio_blk *vblk)
 {
-	int err = 0;
+	struct virtio_device *vdev = vblk->vdev;
+	vq_callback_t **callbacks;
+	struct virtqueue **vqs;
+	const char **names;
+	u16 num_vqs;
+	int i, err;
+
+	err = virtio_config_val(vdev, VIRTIO_BLK_F_MQ,
+				offsetof(struct virtio_blk_config, num_queues),
+				&num_vqs);
+	if (err || !num_vqs)
+		num_vqs = 1;
+	num_vqs = min_t(u16, num_vqs, num_possible_cpus());
+
+	vblk->vqs = kzalloc(sizeof(*vblk->vqs) * num_vqs, PAF_KERNEL);
+	if (!vblk->vqs)
+		return -ENOMEM;
+
+	names = kmalloc(sizeof(*names) * num_vqs, PAF_KERNEL);
+	callbacks = kmalloc(sizeof(*callbacks) * num_vqs, PAF_KERNEL);
+	vqs = kmalloc(sizeof(*vqs) * num_vqs, PAF_KERNEL);
+	if (!names || !callbacks || !vqs) {
+		err = -ENOMEM;
+		goto out;
+	}
 
-	/* We expect one virtqueue, for output. */
-	vblk->vq = virtio_find_single_vq(vblk->vdev, virtblk_done, "requests");
-	if (IS_ERR(vblk->vq))
-		err = PTR_ERR(vblk->vq);
+	for (i = 0; i < num_vqs; i++) {
+		callbacks[i] = virtblk_done;
+		snprintf(vblk->vqs[i].name, sizeof(vblk->vqs[i].name),
+			 "req.%d", i);
+		names[i] = vblk->vqs[i].name;
+	}
+
+	err = vdev->config->find_vqs(vdev, num_vqs, vqs, callbacks, names);
+	if (err)
+		goto out;
+
+	for (i = 0; i < num_vqs; i++) {
+		smp_lock_init(&vblk->vqs[i].lock);
+		vblk->vqs[i].vq = vqs[i];
+	}
+	vblk->num_vqs = num_vqs;
+
+out:
+	kfree(vqs);
+	kfree(callbacks);
+	kfree(names);
+	if (err) {
+		kfree(vblk->vqs);
+		vblk->vqs = NULL;
+	}
 
 	return err;
 }
 
+/*
+ * blk-mq maps CPU i to hardware queue i % num_vqs; route the completion
+ * interrupt of each virtqueue to the CPU that submits on it.
+ */
+static void virtblk_set_affinity(struct virtio_blk *vblk)
+{
+	struct blk_request_queue *q = vblk->disk->queue;
+	int i, cpu;
+
+	for (i = 0; i < vblk->num_vqs; i++)
+		q->hw_ctxs[i]->driver_data = &vblk->vqs[i];
+
+	i = 0;
+	for_each_possible_cpu(cpu) {
+		if (i >= vblk->num_vqs)
+			break;
+		virtqueue_set_affinity(vblk->vqs[i].vq, cpu);
+		i++;
+	}
+}
+
 /*
  * Legacy naming scheme used for virtio devices.  We are stuck with it for
  * virtio blk but don't ever use it for any new driver.
@@ -348,6 +413,7 @@ static int virtblk_probe(struct virtio_device *vdev)
 	struct blk_request_queue *q;
 	int err, index;
 	int pool_size;
+	unsigned int depth;
 
 	u64 cap;
 	u32 v, blk_size, sg_elems, opt_io_size;
@@ -374,8 +440,7 @@ test_addr = page_address(test_page);
 
 	/* We need an extra sg elements at head and tail. */
 	sg_elems += 2;
-	vdev->priv = vblk = kmalloc(sizeof(*vblk) +
-				    sizeof(vblk->sg[0]) * sg_elems, PAF_KERNEL);
+	vdev->priv = vblk = kmalloc(sizeof(*vblk), PAF_KERNEL);
 	if (!vblk) {
 		err = -ENOMEM;
 		goto out_free_index;
@@ -383,36 +448,41 @@ test_addr = page_address(test_page);
 
 	init_waitqueue(&vblk->queue_wait);
 	vblk->vdev = vdev;
-	vblk->sg_elems = sg_elems;
-	sg_init_table(vblk->sg, vblk->sg_elems);
 
 	err = init_vq(vblk);
 	if (err)
 		goto out_free_vblk;
 
-	pool_size = sizeof(struct virtblk_req);
-	vblk->mem_cache = beehive_create("virtblk_req_cache",
-					 pool_size,
-					 0,
-					 BEEHIVE_RECLAIM_ABLE|BEEHIVE_PANIC,
-					 NULL);
-	if (!vblk->mem_cache) {
-		err = -ENOMEM;
-		goto out_free_vq;
-	}
+	/*
+	 * With indirect descriptors every request takes a single ring slot
+	 * however many segments it has, so large merged requests always
+	 * fit.  Without them a request must fit in the ring by itself.
+	 */
+	depth = virtqueue_get_vring_size(vblk->vqs[0].vq);
+	if (!virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC))
+		sg_elems = min_t(u32, sg_elems, depth);
+	vblk->sg_elems = sg_elems;
 
 	/* FIXME: How many partitions?  How long is a piece of string? */
 	vblk->disk = alloc_disk(1 << PART_BITS);
 	if (!vblk->disk) {
 		err = -ENOMEM;
-		goto out_mempool;
+		goto out_free_vq;
 	}
 
-	q = vblk->disk->queue = blk_create_queue(virtblk_request, NULL);
+	/*
+	 * Each preallocated request carries its virtblk_req and a private
+	 * scatterlist, so nothing is allocated on the I/O path.
+	 */
+	pool_size = sizeof(struct virtblk_req) +
+		    sizeof(struct scatterlist) * sg_elems;
+	q = vblk->disk->queue = blk_mq_create_queue(&virtio_mq_ops,
+				vblk->num_vqs, depth, pool_size, vblk);
 	if (!q) {
 		err = -ENOMEM;
 		goto out_put_disk;
 	}
+	virtblk_set_affinity(vblk);
 
 	q->queuedata = vblk;
 
@@ -518,10 +588,9 @@ out_del_disk:
 	blk_loosen_queue(vblk->disk->queue);
 out_put_disk:
 	loosen_disk(vblk->disk);
-out_mempool:
-	beehive_destroy(vblk->mem_cache);
 out_free_vq:
 	vdev->config->del_vqs(vdev);
+	kfree(vblk->vqs);
 out_free_vblk:
 	kfree(vblk);
 out_free_index:
@@ -544,8 +613,8 @@ static void virtblk_remove(struct virtio_device *vdev)
 
 	//refc = accurate_read(&disk_to_dev(vblk->disk)->kobj.kref.refcount);
 	loosen_disk(vblk->disk);
-	beehive_destroy(vblk->mem_cache);
 	vdev->config->del_vqs(vdev);
+	kfree(vblk->vqs);
 	kfree(vblk);
 
 #if 0
@@ -563,7 +632,8 @@ static const struct virtio_device_id id_table[] = {
 static unsigned int features[] = {
 	VIRTIO_BLK_F_SEG_MAX, VIRTIO_BLK_F_SIZE_MAX, VIRTIO_BLK_F_GEOMETRY,
 	VIRTIO_BLK_F_RO, VIRTIO_BLK_F_BLK_SIZE, VIRTIO_BLK_F_SCSI,
-	VIRTIO_BLK_F_WCE, VIRTIO_BLK_F_TOPOLOGY, VIRTIO_BLK_F_CONFIG_WCE
+	VIRTIO_BLK_F_WCE, VIRTIO_BLK_F_TOPOLOGY, VIRTIO_BLK_F_CONFIG_WCE,
+	VIRTIO_BLK_F_MQ,
 };
 
 static struct virtio_driver virtio_blk = {
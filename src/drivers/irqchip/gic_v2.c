@@ -398,12 +398,40 @@ static int gic_set_type(struct irq_desc *d, unsigned int type)
 	return gic_configure_irq(gicirq, type, base, NULL);
 }
 
+/**
+ * 将SPI中断路由到指定CPU
+ * 每个中断在GIC_DIST_TARGET中占一个字节
+ */
+static int gic_set_affinity(struct irq_desc *d, int cpu)
+{
+	void __iomem *reg = gic_dist_base(d) + GIC_DIST_TARGET + (gic_irq(d) & ~3);
+	unsigned int shift = (gic_irq(d) % 4) * 8;
+	unsigned long flags;
+	u32 val, bit;
+
+	/* SGI/PPI的目标CPU是固定的 */
+	if (gic_irq(d) < 32)
+		return -EINVAL;
+
+	if (cpu < 0 || cpu >= NR_GIC_CPU_IF || !cpu_online(cpu))
+		return -EINVAL;
+
+	smp_lock_irqsave(&irq_controller_lock, flags);
+	val = readl_relaxed(reg) & ~(0xff << shift);
+	bit = gic_cpu_map[cpu] << shift;
+	writel_relaxed(val | bit, reg);
+	smp_unlock_irqrestore(&irq_controller_lock, flags);
+
+	return 0;
+}
+
 static struct irq_controller gic_chip = {
 	.name			= "GIC",
 	.mask		= gic_mask_irq,
 	.unmask		= gic_unmask_irq,
 	.eoi		= gic_eoi_irq,
 	.set_trigger_type		= gic_set_type,
+	.set_affinity	= gic_set_affinity,
 };
 
 #define gic_data_dist_base(d)	((d)->dist_base.common_base)
@@ -8,7 +8,17 @@
 #include <dim-sum/workqueue.h>
 #include <dim-sum/mutex.h>
 #include <dim-sum/percpu.h>
+#include <dim-sum/sched.h>
+#include <dim-sum/wait.h>
+#include <kapi/dim-sum/task.h>
+#include <dim-sum/hash.h>
+#include <dim-sum/cpu.h>
+#include <dim-sum/cpumask.h>
+#include <dim-sum/notifier.h>
 #include <lwip/inet.h>
+#include <lwip/pbuf.h>
+#include <lwip/ip.h>
+#include <netif/etharp.h>
 
 #include <asm/page.h>
 
@@ -24,6 +34,9 @@
 
 #define MAX_PACKET_LEN (ETH_HLEN + VLAN_HLEN + ETH_DATA_LEN)
 
+/* Max packets handled by one pass of the RX worker */
+#define VIRTNET_RX_BUDGET 64
+
 struct virtnet_stats {
 	u64 tx_bytes;
 	u64 tx_packets;
@@ -37,6 +50,16 @@ struct send_queue {
 	/* Virtqueue associated with this send _queue */
 	struct virtqueue *vq;
 
+	/* Serializes senders and completion reclaim on this queue */
+	struct smp_lock lock;
+
+	/* Pre-allocated TX descriptors, one per ring entry */
+	struct virtnet_txdesc *descs;
+	struct double_list free_descs;
+
+	/* Reclaims completed frames when no sender comes along */
+	struct work_struct reclaim_work;
+
 	/* TX: fragments + linear part + virtio header */
 	struct scatterlist sg[MAX_SKB_FRAGS + 2];
 
@@ -49,11 +72,23 @@ struct receive_queue {
 	/* Virtqueue associated with this receive_queue */
 	struct virtqueue *vq;
 
-	//struct napi_struct napi;
+	/* CPU the RX worker of this queue is bound to */
+	int cpu;
+
+	/* RX worker draining this queue */
+	struct task_desc *task;
+
+	/* RX worker, woken from skb_recv_done() like NAPI */
+	struct wait_queue napi_wait;
+	int napi_pending;
 
 	/* Number of input buffers, and max we've ever had. */
 	unsigned int num, max;
 
+	/* Receive buffers released by lwIP, ready to be posted again */
+	struct smp_lock buf_lock;
+	struct double_list free_bufs;
+
 	/* Chain pages by the private ptr. */
 	struct page_frame *pages;
 
@@ -109,10 +144,11 @@ struct virtnet_info {
 	/* Does the affinity hint is set for virtqueues? */
 	bool affinity_hint_set;
 
+	/* Binds the queues of a CPU once it comes online */
+	struct notifier_data cpu_notifier;
+
 	/* Per-cpu variable to show the space from CPU to virtqueue */
 	int __percpu *vq_index;
-	struct smp_lock packet_lock;
-	struct double_list packet_head;
 	struct dim_sum_netdev *netdev;
 };
 
@@ -134,12 +170,37 @@ struct skb_vnet_hdr {
 	};
 };
 
-struct virtnet_packet {
-	char buf[MAX_PACKET_LEN];
-	int len;
-	int cur;
+/*
+ * Transmit descriptor. The frame itself stays in the lwIP pbuf chain,
+ * which we hold a reference on until the device has consumed it.
+ */
+struct virtnet_txdesc {
+	struct double_list list;
+	/* Every pbuf the device reads from, each holding a reference */
+	struct pbuf *pbufs[MAX_SKB_FRAGS];
+	unsigned int nr_pbufs;
 	struct skb_vnet_hdr hdr;
+};
+
+/*
+ * Receive buffer posted to the RX virtqueue. Once filled it is handed
+ * to lwIP as a custom PBUF_RAM pbuf that points straight into buf, and
+ * comes back to rq->free_bufs when lwIP frees the pbuf.
+ *
+ * lwIP only moves the payload of RAM/POOL pbufs back over headers it
+ * has already stripped (icmp_input() for echo replies, udp_input() for
+ * port unreachable), and it checks that against the end of the pbuf
+ * struct, so keep a link + IP header worth of room right before buf.
+ */
+#define VIRTNET_RX_HEADROOM	(PBUF_LINK_HLEN + PBUF_IP_HLEN)
+
+struct virtnet_rxbuf {
+	struct pbuf_custom pc;
+	struct receive_queue *rq;
 	struct double_list list;
+	struct virtio_net_hdr hdr;
+	char headroom[VIRTNET_RX_HEADROOM];
+	char buf[MAX_PACKET_LEN];
 };
 
 
@@ -195,35 +256,90 @@ static struct page_frame *get_a_page(struct receive_queue *rq, paf_t paf_mask)
 	return p;
 }
 
-static int add_recvbuf_small(struct receive_queue *rq, paf_t paf)
+/* Receive buffers are refilled from the allotter this many at a time */
+#define VIRTNET_RX_BULK	16
+
+static struct beehive_allotter *virtnet_rxbuf_allotter;
+
+/*
+ * Grab a batch of buffers with interrupts disabled only once, and
+ * park them on the recycle list for get_rxbuf() to hand out.
+ */
+static int refill_rxbufs(struct receive_queue *rq, paf_t paf)
 {
-	//struct virtnet_info *vi = rq->vq->vdev->priv;
-	struct virtnet_packet *packet;
-	int err;
-	struct skb_vnet_hdr *hdr;
+	void *bufs[VIRTNET_RX_BULK];
+	unsigned long flags;
+	size_t nr, i;
 
-	packet = kmalloc(sizeof(*packet), paf);
-	if (unlikely(!packet))
+	nr = clamp_t(size_t, rq->vq->num_free, 1, VIRTNET_RX_BULK);
+	if (unlikely(!beehive_alloc_bulk(virtnet_rxbuf_allotter, paf, nr, bufs)))
 		return -ENOMEM;
 
-#if 0
-	hdr = kmalloc(sizeof hdr->hdr, paf);
-	sg_set_buf(rq->sg, &hdr->hdr, sizeof hdr->hdr);
-	
-	sg_set_buf(rq->sg + 1, skb, MAX_PACKET_LEN);
+	smp_lock_irqsave(&rq->buf_lock, flags);
+	for (i = 0; i < nr; i++) {
+		struct virtnet_rxbuf *rxbuf = bufs[i];
 
-	err = virtqueue_add_inbuf(rq->vq, rq->sg, 2, skb, paf);
-#else
-	memset(packet, 0, sizeof(*packet));
-	list_init(&packet->list);
-	sg_set_buf(rq->sg, &packet->hdr, sizeof hdr->hdr);
-	sg_set_buf(rq->sg + 1, packet->buf, MAX_PACKET_LEN);
+		list_init(&rxbuf->list);
+		rxbuf->rq = rq;
+		list_insert_front(&rxbuf->list, &rq->free_bufs);
+	}
+	smp_unlock_irqrestore(&rq->buf_lock, flags);
 
-	err = virtqueue_add_inbuf(rq->vq, rq->sg, 2, packet, paf);
-#endif
+	return 0;
+}
+
+static struct virtnet_rxbuf *get_rxbuf(struct receive_queue *rq, paf_t paf)
+{
+	struct virtnet_rxbuf *rxbuf;
+	unsigned long flags;
+
+	do {
+		rxbuf = NULL;
+		smp_lock_irqsave(&rq->buf_lock, flags);
+		if (!list_is_empty(&rq->free_bufs)) {
+			rxbuf = list_first_container(&rq->free_bufs,
+						struct virtnet_rxbuf, list);
+			list_del_init(&rxbuf->list);
+		}
+		smp_unlock_irqrestore(&rq->buf_lock, flags);
+	} while (!rxbuf && refill_rxbufs(rq, paf) == 0);
+
+	return rxbuf;
+}
+
+static void put_rxbuf(struct receive_queue *rq, struct virtnet_rxbuf *rxbuf)
+{
+	unsigned long flags;
 
+	smp_lock_irqsave(&rq->buf_lock, flags);
+	list_insert_front(&rxbuf->list, &rq->free_bufs);
+	smp_unlock_irqrestore(&rq->buf_lock, flags);
+}
+
+/* Called by pbuf_free() once lwIP is done with a received frame */
+static void virtnet_free_rxbuf(struct pbuf *p)
+{
+	struct virtnet_rxbuf *rxbuf =
+		container_of((struct pbuf_custom *)p, struct virtnet_rxbuf, pc);
+
+	put_rxbuf(rxbuf->rq, rxbuf);
+}
+
+static int add_recvbuf_small(struct receive_queue *rq, paf_t paf)
+{
+	struct virtnet_rxbuf *rxbuf;
+	int err;
+
+	rxbuf = get_rxbuf(rq, paf);
+	if (unlikely(!rxbuf))
+		return -ENOMEM;
+
+	sg_set_buf(rq->sg, &rxbuf->hdr, sizeof rxbuf->hdr);
+	sg_set_buf(rq->sg + 1, rxbuf->buf, MAX_PACKET_LEN);
+
+	err = virtqueue_add_inbuf(rq->vq, rq->sg, 2, rxbuf, paf);
 	if (err < 0)
-		kfree(packet);
+		put_rxbuf(rq, rxbuf);
 
 	return err;
 }
@@ -231,13 +347,11 @@ static int add_recvbuf_small(struct receive_queue *rq, paf_t paf)
 /*
  * Returns false if we couldn't fill entirely (OOM).
  *
- * Normally run in the receive path, but can also be run from ndo_open
- * before we're receiving packets, or from refill_work which is
- * careful to disable receiving (using napi_disable).
+ * Fills the whole ring and kicks the device once. Only the RX worker
+ * and probe call this, so the receive virtqueue needs no extra lock.
  */
 static bool try_fill_recv(struct receive_queue *rq, paf_t paf)
 {
-	//struct virtnet_info *vi = rq->vq->vdev->priv;
 	int err;
 	bool oom;
 
@@ -248,13 +362,20 @@ static bool try_fill_recv(struct receive_queue *rq, paf_t paf)
 		if (err)
 			break;
 		++rq->num;
-	} while (rq->vq->num_free && 0);
+	} while (rq->vq->num_free);
 	if (unlikely(rq->num > rq->max))
 		rq->max = rq->num;
 	virtqueue_kick(rq->vq);
 	return !oom;
 }
 
+static void virtnet_napi_schedule(struct receive_queue *rq)
+{
+	rq->napi_pending = 1;
+	smp_mb();
+	wake_up(&rq->napi_wait);
+}
+
 static void refill_work(void *data)
 {
 	struct virtnet_info *vi = (struct virtnet_info *)data;
@@ -264,9 +385,9 @@ static void refill_work(void *data)
 	for (i = 0; i < vi->curr_queue_pairs; i++) {
 		struct receive_queue *rq = &vi->rq[i];
 
-		//napi_disable(&rq->napi);
-		still_empty = !try_fill_recv(rq, PAF_KERNEL);
-		//virtnet_napi_enable(rq);
+		/* Let the RX worker refill, it owns the receive virtqueue */
+		still_empty = rq->num == 0;
+		virtnet_napi_schedule(rq);
 
 		/* In theory, this can happen: if we don't get any buffers in
 		 * we will *never* try to fill again.
@@ -290,6 +411,12 @@ static int virtnet_alloc_queues(struct virtnet_info *vi)
 	INIT_WORK(&vi->refill, refill_work, vi);
 	for (i = 0; i < vi->max_queue_pairs; i++) {
 		vi->rq[i].pages = NULL;
+		init_waitqueue(&vi->rq[i].napi_wait);
+		smp_lock_init(&vi->rq[i].buf_lock);
+		list_init(&vi->rq[i].free_bufs);
+
+		smp_lock_init(&vi->sq[i].lock);
+		list_init(&vi->sq[i].free_descs);
 
 		sg_init_table(vi->rq[i].sg, ARRAY_SIZE(vi->rq[i].sg));
 		sg_init_table(vi->sq[i].sg, ARRAY_SIZE(vi->sq[i].sg));
@@ -304,6 +431,11 @@ err_sq:
 }
 
 
+static int vq2txq(struct virtqueue *vq)
+{
+	return (vq->index - 1) / 2;
+}
+
 static int vq2rxq(struct virtqueue *vq)
 {
 	return vq->index / 2;
@@ -322,83 +454,241 @@ static int txq2vq(int txq)
 static void receive_buf(struct virtnet_info *vi, struct receive_queue *rq,
 			void *buf, unsigned int len)
 {
-	//struct dim_sum_netdev *dev = vi->netdev;
-	//struct virtnet_stats *stats = this_cpu_ptr(vi->stats);
-	//struct page *page;
-	//struct skb_vnet_hdr *hdr;
-	//char *skb;
-	//char cb[48];
-	struct virtnet_packet *packet;
-	unsigned long flags;
+	struct virtnet_rxbuf *rxbuf = buf;
+	struct virtnet_stats *stats;
+	struct pbuf *p;
 
 	if (unlikely(len < sizeof(struct virtio_net_hdr) + ETH_HLEN)) {
-		//dev->stats.rx_length_errors++;
-		kfree(buf);
+		put_rxbuf(rq, rxbuf);
 		return;
 	}
 
-	//skb = buf;
-	//len -= sizeof(struct virtio_net_hdr);
-	//skb = buf + sizeof(struct virtio_net_hdr);
+	len -= sizeof(struct virtio_net_hdr);
 
-	//hdr = cb;
-
-	packet = buf;//kmalloc(sizeof(*packet), PAF_ATOMIC);
-	if (!packet) {
-		kfree(buf);
+	/* Zero copy: the pbuf references the buffer the device filled */
+	rxbuf->pc.custom_free_function = virtnet_free_rxbuf;
+	p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_RAM, &rxbuf->pc,
+				rxbuf->buf, MAX_PACKET_LEN);
+	if (unlikely(!p)) {
+		put_rxbuf(rq, rxbuf);
 		return;
 	}
 
-	list_init(&packet->list);
-	//packet->buf = skb;
-	packet->len = len;
-	packet->cur = 0;
-	smp_lock_irqsave(&vi->packet_lock, flags);
-	list_insert_behind(&packet->list, &vi->packet_head);
-	smp_unlock_irqrestore(&vi->packet_lock, flags);
+	stats = hold_percpu_ptr(vi->stats);
+	stats->rx_bytes += len;
+	stats->rx_packets++;
+	loosen_percpu_ptr(stats);
 
-	return;
+	dim_sum_netdev_input(vi->netdev, p);
 }
 
-static int virtnet_receive(struct receive_queue *rq)
+static int virtnet_poll(struct receive_queue *rq, int budget)
 {
 	struct virtnet_info *vi = rq->vq->vdev->priv;
 	unsigned int len, received = 0;
 	void *buf;
 
-	while ((buf = virtqueue_get_buf(rq->vq, &len)) != NULL) {
+	while (received < budget &&
+	       (buf = virtqueue_get_buf(rq->vq, &len)) != NULL) {
+		--rq->num;
 		receive_buf(vi, rq, buf, len);
 		received++;
 	}
 
-	if (!try_fill_recv(rq, PAF_ATOMIC))
-		schedule_delayed_work(&vi->refill, 0);
+	if (rq->num < rq->max / 2 || !rq->num)
+		if (!try_fill_recv(rq, PAF_KERNEL))
+			schedule_delayed_work(&vi->refill, HZ/2);
 
 	return received;
 }
 
+/*
+ * RX worker: drains the virtqueue in batches of VIRTNET_RX_BUDGET and
+ * re-enables the callback only once the ring is empty.
+ */
+static int virtnet_rx_task(void *data)
+{
+	struct receive_queue *rq = data;
+	int received;
+
+	while (1) {
+		cond_wait(rq->napi_wait, rq->napi_pending);
+		rq->napi_pending = 0;
+		smp_mb();
+
+again:
+		received = virtnet_poll(rq, VIRTNET_RX_BUDGET);
+		if (received >= VIRTNET_RX_BUDGET) {
+			/* Give other tasks of our priority a chance */
+			sys_sched_yield();
+			goto again;
+		}
+
+		/* Packets may have arrived before the callback was re-armed */
+		if (unlikely(!virtqueue_enable_cb(rq->vq))) {
+			virtqueue_disable_cb(rq->vq);
+			goto again;
+		}
+	}
+
+	return 0;
+}
+
 static void skb_recv_done(struct virtqueue *rvq)
 {
 	struct virtnet_info *vi = rvq->vdev->priv;
 	struct receive_queue *rq = &vi->rq[vq2rxq(rvq)];
 
-	/* Schedule NAPI, Suppress further interrupts if successful. */
-	//virtqueue_disable_cb(rvq);
-	virtnet_receive(rq);
+	/* Schedule the RX worker, suppress further interrupts until done. */
+	virtqueue_disable_cb(rvq);
+	virtnet_napi_schedule(rq);
 }
 
 
 static void skb_xmit_done(struct virtqueue *vq)
 {
-	//struct virtnet_info *vi = vq->vdev->priv;
+	struct virtnet_info *vi = vq->vdev->priv;
+
+	/*
+	 * Suppress further interrupts until the reclaim work has run,
+	 * pbuf_free() must not run in irq context.
+	 */
+	virtqueue_disable_cb(vq);
+	schedule_work(&vi->sq[vq2txq(vq)].reclaim_work);
+}
+
+
+/*
+ * Send command via the control virtqueue and check status.  Commands
+ * supported by the hypervisor, as indicated by feature bits, should
+ * never fail unless improperly formated.
+ */
+static bool virtnet_send_command(struct virtnet_info *vi, u8 class, u8 cmd,
+				 struct scatterlist *out)
+{
+	struct scatterlist *sgs[4], hdr, stat;
+	struct virtio_net_ctrl_hdr ctrl;
+	virtio_net_ctrl_ack status = ~0;
+	unsigned out_num = 0, tmp;
+
+	/* Caller should know better */
+	BUG_ON(!virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VQ));
+
+	ctrl.class = class;
+	ctrl.cmd = cmd;
+	/* Add header */
+	sg_init_one(&hdr, &ctrl, sizeof(ctrl));
+	sgs[out_num++] = &hdr;
+
+	if (out)
+		sgs[out_num++] = out;
+
+	/* Add return status. */
+	sg_init_one(&stat, &status, sizeof(status));
+	sgs[out_num] = &stat;
+
+	BUG_ON(out_num + 1 > ARRAY_SIZE(sgs));
+	if (virtqueue_add_sgs(vi->cvq, sgs, out_num, 1, vi, PAF_ATOMIC) < 0)
+		return false;
+
+	virtqueue_kick(vi->cvq);
+
+	/* Spin for a response, the kick causes an ioport write, trapping
+	 * into the hypervisor, so the request should be handled immediately.
+	 */
+	while (!virtqueue_get_buf(vi->cvq, &tmp))
+		cpu_relax();
+
+	return status == VIRTIO_NET_OK;
+}
+
+static int virtnet_set_queues(struct virtnet_info *vi, u16 queue_pairs)
+{
+	struct scatterlist sg;
+	struct virtio_net_ctrl_mq s;
+
+	if (!vi->has_cvq || !virtio_has_feature(vi->vdev, VIRTIO_NET_F_MQ))
+		return 0;
+
+	s.virtqueue_pairs = queue_pairs;
+	sg_init_one(&sg, &s, sizeof(s));
+
+	if (!virtnet_send_command(vi, VIRTIO_NET_CTRL_MQ,
+				  VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &sg)) {
+		printk("virtio-net: fail to set num of queue pairs to %d\n",
+			queue_pairs);
+		return -EINVAL;
+	}
+
+	vi->curr_queue_pairs = queue_pairs;
+	return 0;
+}
+
+/*
+ * Point the interrupts and RX workers of the queues mapped to @cpu at
+ * it. Both the IRQ controller and the scheduler refuse CPUs that are
+ * not online, so this runs for each CPU as it comes up.
+ */
+static int virtnet_bind_cpu(struct virtnet_info *vi, int cpu)
+{
+	int i, err, ret = 0;
+
+	for (i = 0; i < vi->curr_queue_pairs; i++) {
+		if (vi->rq[i].cpu != cpu)
+			continue;
+
+		err = virtqueue_set_affinity(vi->rq[i].vq, cpu);
+		if (!err)
+			err = virtqueue_set_affinity(vi->sq[i].vq, cpu);
+		if (!err && vi->rq[i].task)
+			err = set_task_affinity(vi->rq[i].task, cpu);
+		if (err) {
+			pr_warn("virtio_net: failed to bind queue %d to CPU%d: %d\n",
+				i, cpu, err);
+			ret = err;
+		}
+	}
+
+	return ret;
+}
+
+static int virtnet_cpu_callback(struct notifier_data *this,
+				unsigned long id, void *data)
+{
+	struct virtnet_info *vi = container_of(this, struct virtnet_info,
+					       cpu_notifier);
 
-	/* Suppress further interrupts. */
-	//virtqueue_disable_cb(vq);
+	if (id == CPU_ONLINE)
+		virtnet_bind_cpu(vi, (int)(unsigned long)data);
 
-	/* We were probably waiting for more output buffers. */
-	//netif_wake_subqueue(vi->dev, vq2txq(vq));
+	return 0;
 }
 
+/*
+ * One queue pair per CPU: queue i interrupts CPU i and its RX worker
+ * runs there. CPUs beyond the number of queue pairs share them round
+ * robin for frames that carry no flow.
+ *
+ * Devices are probed before the secondary CPUs are launched, so only
+ * the queues of online CPUs are bound here; the others are bound by
+ * virtnet_cpu_callback() when their CPU comes online.
+ */
+static void virtnet_set_affinity(struct virtnet_info *vi)
+{
+	int i = 0, cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (i < vi->curr_queue_pairs)
+			vi->rq[i].cpu = cpu;
+		*__percpu_ptr(vi->vq_index, cpu) = i % vi->curr_queue_pairs;
+		i++;
+	}
+
+	for_each_online_cpu(cpu)
+		virtnet_bind_cpu(vi, cpu);
+
+	vi->affinity_hint_set = true;
+}
 
 static int virtnet_find_vqs(struct virtnet_info *vi)
 {
@@ -479,10 +769,39 @@ err_vq:
 
 static void virtnet_free_queues(struct virtnet_info *vi)
 {
+	int i;
+
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		kfree(vi->sq[i].descs);
 	kfree(vi->rq);
 	kfree(vi->sq);
 }
 
+/* Size the TX descriptor pool to the ring, so a full ring never allocates */
+static int virtnet_alloc_txdescs(struct virtnet_info *vi)
+{
+	unsigned int i, j, num;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		struct send_queue *sq = &vi->sq[i];
+
+		num = virtqueue_get_vring_size(sq->vq);
+		sq->descs = kzalloc(num * sizeof(*sq->descs), PAF_KERNEL);
+		if (!sq->descs)
+			return -ENOMEM;
+
+		for (j = 0; j < num; j++) {
+			struct virtnet_txdesc *desc = &sq->descs[j];
+
+			list_init(&desc->list);
+			desc->hdr.hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+			list_insert_behind(&desc->list, &sq->free_descs);
+		}
+	}
+
+	return 0;
+}
+
 static int init_vqs(struct virtnet_info *vi)
 {
 	int ret;
@@ -496,12 +815,18 @@ static int init_vqs(struct virtnet_info *vi)
 	if (ret)
 		goto err_free;
 
+	ret = virtnet_alloc_txdescs(vi);
+	if (ret)
+		goto err_del;
+
 	//get_online_cpus();
 	//virtnet_set_affinity(vi);
 	//put_online_cpus();
 
 	return 0;
 
+err_del:
+	vi->vdev->config->del_vqs(vi->vdev);
 err_free:
 	virtnet_free_queues(vi);
 err:
@@ -509,25 +834,78 @@ err:
 }
 
 
+/*
+ * Take a reference on every pbuf the device reads from, so none of
+ * them is freed or reused while the frame is in flight, even if its
+ * owner unlinks it from the chain meanwhile.
+ */
+static void xmit_hold_pbufs(struct virtnet_txdesc *desc, struct pbuf *p)
+{
+	struct pbuf *q;
+
+	desc->nr_pbufs = 0;
+	for (q = p; q != NULL; q = q->next) {
+		pbuf_ref(q);
+		desc->pbufs[desc->nr_pbufs++] = q;
+	}
+}
+
+/*
+ * Drop the references once the device has completed the frame. Going
+ * from the head, a pbuf freed here only drops its chain reference on
+ * the next one, which still holds ours.
+ */
+static void xmit_put_pbufs(struct virtnet_txdesc *desc)
+{
+	unsigned int i;
+
+	for (i = 0; i < desc->nr_pbufs; i++) {
+		pbuf_free(desc->pbufs[i]);
+		desc->pbufs[i] = NULL;
+	}
+	desc->nr_pbufs = 0;
+}
+
 static void free_unused_bufs(struct virtnet_info *vi)
 {
+	void *bufs[VIRTNET_RX_BULK];
 	void *buf;
+	size_t nr;
 	int i;
 
 	for (i = 0; i < vi->max_queue_pairs; i++) {
-		struct virtqueue *vq = vi->sq[i].vq;
-		while ((buf = virtqueue_detach_unused_buf(vq)) != NULL)
-			kfree(buf);
+		struct send_queue *sq = &vi->sq[i];
+		struct virtnet_txdesc *desc;
+
+		while ((desc = virtqueue_detach_unused_buf(sq->vq)) != NULL) {
+			xmit_put_pbufs(desc);
+			list_insert_behind(&desc->list, &sq->free_descs);
+		}
 	}
 
 	for (i = 0; i < vi->max_queue_pairs; i++) {
 		struct virtqueue *vq = vi->rq[i].vq;
 
 		while ((buf = virtqueue_detach_unused_buf(vq)) != NULL) {
-			kfree(buf);
+			beehive_free(virtnet_rxbuf_allotter, buf);
 			--vi->rq[i].num;
 		}
 		BUG_ON(vi->rq[i].num != 0);
+
+		nr = 0;
+		while (!list_is_empty(&vi->rq[i].free_bufs)) {
+			struct virtnet_rxbuf *rxbuf;
+
+			rxbuf = list_first_container(&vi->rq[i].free_bufs,
+					struct virtnet_rxbuf, list);
+			list_del(&rxbuf->list);
+			bufs[nr++] = rxbuf;
+			if (nr == VIRTNET_RX_BULK) {
+				beehive_free_bulk(virtnet_rxbuf_allotter, nr, bufs);
+				nr = 0;
+			}
+		}
+		beehive_free_bulk(virtnet_rxbuf_allotter, nr, bufs);
 	}
 }
 
@@ -554,108 +932,223 @@ static void virtnet_del_vqs(struct virtnet_info *vi)
 	virtnet_free_queues(vi);
 }
 
-static int xmit_skb(struct send_queue *sq, char *skb, int len)
+/*
+ * Reclaim descriptors the device has finished with. The pbufs are
+ * handed back to the caller in @done and freed once sq->lock is
+ * dropped, lwIP's allocator must not be entered under a spinlock.
+ */
+static void free_old_xmit_skbs(struct send_queue *sq, struct double_list *done)
+{
+	struct virtnet_txdesc *desc;
+	unsigned int len;
+
+	while ((desc = virtqueue_get_buf(sq->vq, &len)) != NULL)
+		list_insert_behind(&desc->list, done);
+}
+
+static void release_xmit_descs(struct send_queue *sq, struct double_list *done)
 {
-	struct skb_vnet_hdr *hdr;
-	struct virtnet_packet *packet;
-	//struct virtnet_info *vi = sq->vq->vdev->priv;
-	unsigned num_sg;
-	unsigned hdr_len;
-	//bool can_push;
+	struct virtnet_txdesc *desc, *next;
+	unsigned long flags;
 
-	packet = kmalloc(sizeof(*packet), PAF_KERNEL);
-	if (unlikely(!packet))
-		return -ENOMEM;
+	if (list_is_empty(done))
+		return;
 
-	memset(packet, 0, sizeof(*packet));
-	list_init(&packet->list);
+	list_for_each_entry_safe(desc, next, done, list)
+		xmit_put_pbufs(desc);
 
-	memcpy(packet->buf, skb, len);
-	hdr_len = sizeof hdr->hdr;
-	hdr = &packet->hdr;
+	smp_lock_irqsave(&sq->lock, flags);
+	list_combine_behind_init(done, &sq->free_descs);
+	smp_unlock_irqrestore(&sq->lock, flags);
+}
 
-	hdr->hdr.flags = 0;
-	hdr->hdr.csum_offset = hdr->hdr.csum_start = 0;
-	
-	hdr->hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
-	hdr->hdr.gso_size = hdr->hdr.hdr_len = 0;
+/*
+ * Reclaim work, scheduled by skb_xmit_done(). Re-enable the callback
+ * once the ring is empty, and go round again if the device completed
+ * more frames meanwhile so that no completion is left unreclaimed.
+ */
+static void virtnet_tx_reclaim(void *data)
+{
+	struct send_queue *sq = data;
+	struct double_list done;
+	unsigned long flags;
 
-	sg_set_buf(sq->sg, hdr, hdr_len);
-	sg_set_buf(sq->sg + 1, &packet->buf[0], len);
-	num_sg = 2;
+	list_init(&done);
+	smp_lock_irqsave(&sq->lock, flags);
+	do {
+		virtqueue_disable_cb(sq->vq);
+		free_old_xmit_skbs(sq, &done);
+	} while (unlikely(!virtqueue_enable_cb(sq->vq)));
+	smp_unlock_irqrestore(&sq->lock, flags);
 
-	return virtqueue_add_outbuf(sq->vq, sq->sg, num_sg, packet, PAF_ATOMIC);
+	release_xmit_descs(sq, &done);
 }
 
-static void free_old_xmit_skbs(struct send_queue *sq)
+/*
+ * The device reads the frame straight out of the pbuf chain. Chains
+ * longer than our sg table, and PBUF_REF pbufs whose memory belongs
+ * to the caller, are first flattened into a single PBUF_RAM pbuf,
+ * which the caller must free once the frame is queued.
+ */
+static struct pbuf *xmit_prepare_pbuf(struct pbuf *p)
 {
-	struct virtnet_packet *packet;
-	unsigned int len;
-	//struct virtnet_info *vi = sq->vq->vdev->priv;
-	
-	while ((packet = virtqueue_get_buf(sq->vq, &len)) != NULL) {
-		list_del_init(&packet->list);
-		//kfree(packet);
+	struct pbuf *q, *copy;
+	unsigned int nr = 0;
+	bool volatile_ref = false;
+
+	for (q = p; q != NULL; q = q->next) {
+		nr++;
+		if (q->type == PBUF_REF && !(q->flags & PBUF_FLAG_IS_CUSTOM))
+			volatile_ref = true;
+	}
+
+	if (likely(nr <= MAX_SKB_FRAGS && !volatile_ref))
+		return p;
+
+	copy = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+	if (unlikely(!copy))
+		return NULL;
+	if (pbuf_copy(copy, p) != ERR_OK) {
+		pbuf_free(copy);
+		return NULL;
+	}
+
+	return copy;
+}
+
+static int xmit_skb(struct send_queue *sq, struct virtnet_txdesc *desc)
+{
+	struct pbuf *q;
+	unsigned num_sg = 1;
+	unsigned int i;
+
+	sg_set_buf(sq->sg, &desc->hdr, sizeof desc->hdr.hdr);
+	for (i = 0; i < desc->nr_pbufs; i++) {
+		q = desc->pbufs[i];
+		if (!q->len)
+			continue;
+		sg_set_buf(sq->sg + num_sg, q->payload, q->len);
+		num_sg++;
+	}
+
+	return virtqueue_add_outbuf(sq->vq, sq->sg, num_sg, desc, PAF_ATOMIC);
+}
+
+/*
+ * Pick the TX queue by flow, so every frame of a connection leaves
+ * through the same queue. The device steers the flow's received
+ * frames to the paired RX queue, whose worker is bound to one CPU.
+ */
+static u16 virtnet_select_queue(struct virtnet_info *vi, struct pbuf *p)
+{
+	struct eth_hdr *ethhdr = p->payload;
+	struct ip_hdr *iphdr;
+	u32 hash, ports;
+	u16 hlen, qnum;
+
+	if (vi->curr_queue_pairs == 1)
+		return 0;
+
+	if (p->len < SIZEOF_ETH_HDR + IP_HLEN ||
+	    ethhdr->type != PP_HTONS(ETHTYPE_IP))
+		goto by_cpu;
+
+	iphdr = (struct ip_hdr *)((char *)p->payload + SIZEOF_ETH_HDR);
+	hash = iphdr->src.addr ^ iphdr->dest.addr;
+
+	/* Ports sit in the first 4 bytes of both TCP and UDP headers */
+	hlen = IPH_HL(iphdr) * 4;
+	if ((IPH_PROTO(iphdr) == IP_PROTO_TCP ||
+	     IPH_PROTO(iphdr) == IP_PROTO_UDP) &&
+	    !(IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK | IP_MF)) &&
+	    p->len >= SIZEOF_ETH_HDR + hlen + sizeof(ports)) {
+		memcpy(&ports, (char *)iphdr + hlen, sizeof(ports));
+		hash ^= ports;
 	}
+
+	return hash_long(hash, 16) % vi->curr_queue_pairs;
+
+by_cpu:
+	qnum = *hold_percpu_ptr(vi->vq_index);
+	loosen_percpu_ptr(vi->vq_index);
+
+	return qnum;
 }
 
-static int virtnet_send_pkt(struct dim_sum_netdev *netdev, void *packet, int length)
+static int virtnet_send_pbuf(struct dim_sum_netdev *netdev, struct pbuf *p)
 {
 	struct virtnet_info *vi = netdev->priv;
-	int qnum = 0;
+	int qnum = virtnet_select_queue(vi, p);
 	struct send_queue *sq = &vi->sq[qnum];
+	struct virtnet_txdesc *desc = NULL;
+	struct virtnet_stats *stats;
+	struct double_list done;
+	unsigned long flags;
+	u16 len = p->tot_len;
+	struct pbuf *orig = p;
+	bool kick;
 	int err;
 
+	p = xmit_prepare_pbuf(p);
+	if (unlikely(!p))
+		return -ENOMEM;
+
+	list_init(&done);
+	smp_lock_irqsave(&sq->lock, flags);
+
 	/* Free up any pending old buffers before queueing new ones. */
-	free_old_xmit_skbs(sq);
+	free_old_xmit_skbs(sq, &done);
 
-	/* Try to transmit */
-	err = xmit_skb(sq, packet, length);
+	if (!list_is_empty(&sq->free_descs)) {
+		desc = list_first_container(&sq->free_descs,
+					struct virtnet_txdesc, list);
+		list_del_init(&desc->list);
+	}
+	/* The ring is full of frames the device has not completed yet */
+	if (unlikely(!desc)) {
+		err = -ENOSPC;
+		goto out;
+	}
 
-	/* This should not happen! */
+	xmit_hold_pbufs(desc, p);
+	err = xmit_skb(sq, desc);
 	if (unlikely(err)) {
-		//kfree(skb);
-		return -1;
+		/* Dropped along with the reclaimed ones, outside the lock */
+		list_insert_behind(&desc->list, &done);
+		goto out;
 	}
-	virtqueue_kick(sq->vq);
 
-	virtqueue_enable_cb_delayed(sq->vq);
+	/*
+	 * Only ring the doorbell when the device asks for it. While the
+	 * host is still draining the ring, a burst of frames costs a
+	 * single notification.
+	 */
+	kick = virtqueue_kick_prepare(sq->vq);
+	smp_unlock_irqrestore(&sq->lock, flags);
+
+	if (kick)
+		virtqueue_notify(sq->vq);
 
-	return 0;
-}
+	release_xmit_descs(sq, &done);
+	/* The flattened copy is only held by the descriptor now */
+	if (p != orig)
+		pbuf_free(p);
 
-static int virtnet_recv_pkt(struct dim_sum_netdev *netdev, void *skb, int *length)
-{
-	struct virtnet_info *priv = netdev->priv;
-	int len;
-	unsigned long flags;
+	stats = hold_percpu_ptr(vi->stats);
+	stats->tx_bytes += len;
+	stats->tx_packets++;
+	loosen_percpu_ptr(stats);
 
-	smp_lock_irqsave(&priv->packet_lock, flags);
-	if (list_is_empty(&priv->packet_head)) {
-		len = -1;
-		smp_unlock_irqrestore(&priv->packet_lock, flags);
-		msleep(1);
-		return len;
-	} else {
-		struct virtnet_packet *packet = 
-			list_first_container(&priv->packet_head, struct virtnet_packet, list);
-		len = packet->len - packet->cur;
-		if (len > 2048)
-			len = 2048;
-		memcpy(skb, packet->buf + packet->cur, len);
-		*length = len;
-		packet->cur += len;
-		
-		if (packet->cur >= packet->len) {
-			//kfree(packet->buf);
-			list_del_init(&packet->list);
-			//kfree(packet);
-		}
-	}
+	return 0;
 
-	smp_unlock_irqrestore(&priv->packet_lock, flags);
-	return len;
+out:
+	smp_unlock_irqrestore(&sq->lock, flags);
+	release_xmit_descs(sq, &done);
+	if (p != orig)
+		pbuf_free(p);
+	return err;
 }
+
 static int virtnet_initialize(struct dim_sum_netdev *netdev)
 {
 	return 0;
@@ -688,8 +1181,7 @@ static int virtnet_register(struct virtnet_info *priv)
 
 	strcpy(virtnet_device->name, "virtio-net");
 	virtnet_device->initialize = virtnet_initialize;
-	virtnet_device->send_pkt = virtnet_send_pkt;
-	virtnet_device->recv_pkt = virtnet_recv_pkt;
+	virtnet_device->send_pbuf = virtnet_send_pbuf;
 	virtnet_device->halt_netdev = virtnet_halt_netdev;
 	memcpy(virtnet_device->enetaddr, mac_addr, sizeof(mac_addr));
 	/** 初始化IP地址为10.0.0.88/24 **/
@@ -730,8 +1222,6 @@ static int virtnet_probe(struct virtio_device *vdev)
 	virtio_config_val_len(vdev, VIRTIO_NET_F_MAC,
 				  offsetof(struct virtio_net_config, mac),
 				  vi->mac, ETH_ALEN);
-	list_init(&vi->packet_head);
-	smp_lock_init(&vi->packet_lock);
 	vi->vdev = vdev;
 	vdev->priv = vi;
 	vi->stats = alloc_percpu(struct virtnet_stats);
@@ -764,8 +1254,8 @@ static int virtnet_probe(struct virtio_device *vdev)
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ))
 		vi->has_cvq = true;
 
-	/* Use single tx/rx queue pair as default */
-	vi->curr_queue_pairs = 1;
+	/* One queue pair per CPU, the device is told so in virtnet_scan() */
+	vi->curr_queue_pairs = min_t(u16, max_queue_pairs, num_possible_cpus());
 	vi->max_queue_pairs = max_queue_pairs;
 
 	/* Allocate/initialize the rx/tx queues, and invoke find_vqs */
@@ -773,6 +1263,12 @@ static int virtnet_probe(struct virtio_device *vdev)
 	if (err)
 		goto free_index;
 
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		INIT_WORK(&vi->sq[i].reclaim_work, virtnet_tx_reclaim,
+			  &vi->sq[i]);
+
+	virtnet_set_affinity(vi);
+
 	/* Last of all, set up some receive buffers. */
 	for (i = 0; i < vi->curr_queue_pairs; i++) {
 		try_fill_recv(&vi->rq[i], PAF_KERNEL);
@@ -786,7 +1282,16 @@ static int virtnet_probe(struct virtio_device *vdev)
 	}
 
 	virtnet_register(vi);
-	
+
+	for (i = 0; i < vi->curr_queue_pairs; i++)
+		vi->rq[i].task = (struct task_desc *)create_process(virtnet_rx_task,
+						&vi->rq[i], "virtnet_rx", 10);
+
+	/* Workers exist now, bind them and follow CPUs that come up later */
+	virtnet_set_affinity(vi);
+	vi->cpu_notifier.callback = virtnet_cpu_callback;
+	register_cpu_notifier(&vi->cpu_notifier);
+
 	return 0;
 
 free_recv_bufs:
@@ -803,6 +1308,24 @@ free:
 }
 
 
+/*
+ * Called once the device is DRIVER_OK, the control virtqueue only
+ * works from now on.
+ */
+static void virtnet_scan(struct virtio_device *vdev)
+{
+	struct virtnet_info *vi = vdev->priv;
+
+	if (vi->curr_queue_pairs == 1)
+		return;
+
+	/* Fall back to the first queue pair, the others stay idle */
+	if (virtnet_set_queues(vi, vi->curr_queue_pairs)) {
+		vi->curr_queue_pairs = 1;
+		virtnet_set_affinity(vi);
+	}
+}
+
 static void virtnet_remove(struct virtio_device *vdev)
 {
 }
@@ -836,11 +1359,19 @@ static struct virtio_driver virtio_net_driver = {
 	.id_table =	id_table,
 	.probe =	virtnet_probe,
 	.remove =	virtnet_remove,
+	.scan =		virtnet_scan,
 	.config_changed = virtnet_config_changed,
 };
 
 int __init virtio_net_driver_init(void)
 {
+	virtnet_rxbuf_allotter = beehive_create("virtnet_rxbuf",
+		sizeof(struct virtnet_rxbuf), 0, 0, NULL);
+	if (virtnet_rxbuf_allotter == NULL) {
+		printk(KERN_EMERG "virtio_net: failed to create rxbuf cache\n");
+		return -ENOMEM;
+	}
+
 	return register_virtio_driver(&virtio_net_driver);
 }
 
@@ -329,6 +329,23 @@ static const char *vm_bus_name(struct virtio_device *vdev)
 	return vm_dev->pdev->name;
 }
 
+/*
+ * virtio-mmio has a single interrupt line shared by all virtqueues of
+ * a device, so the first virtqueue decides where the GIC routes it.
+ */
+static int vm_set_vq_affinity(struct virtqueue *vq, int cpu)
+{
+	struct virtio_mmio_device *vm_dev = to_virtio_mmio_device(vq->vdev);
+
+	if (vq->index)
+		return 0;
+
+	if (cpu < 0)
+		cpu = 0;
+
+	return set_irq_affinity(platform_get_irq(vm_dev->pdev, 0), cpu);
+}
+
 static const struct virtio_config_ops virtio_mmio_config_ops = {
 	.get		= vm_get,
 	.set		= vm_set,
@@ -340,6 +357,7 @@ static const struct virtio_config_ops virtio_mmio_config_ops = {
 	.get_features	= vm_get_features,
 	.finalize_features = vm_finalize_features,
 	.bus_name	= vm_bus_name,
+	.set_vq_affinity = vm_set_vq_affinity,
 };
 
 static int virtio_mmio_setup(int irq, phys_addr_t start, phys_addr_t end)
@@ -14,3 +14,19 @@ ssize_t fastcall wait_on_async_io(struct async_io_desc *aio)
 
 	return aio->user_data;
 }
+
+/**
+ * 异步IO完成，设置返回值并唤醒等待的任务
+ * 可能在中断上下文中调用
+ */
+void finish_async_io(struct async_io_desc *aio, long res)
+{
+	struct task_desc *tsk = aio->wait.task;
+
+	aio->user_data = res;
+	smp_mb();
+	aio->users--;
+
+	if (tsk)
+		wake_up_process(tsk);
+}
@@ -1,6 +1,7 @@
 #include <dim-sum/boot_allotter.h>
 #include <dim-sum/beehive.h>
 #include <dim-sum/blkio.h>
+#include <dim-sum/blk_dev.h>
 #include <dim-sum/blk_infrast.h>
 #include <dim-sum/block_buf.h>
 #include <dim-sum/delay.h>
@@ -623,8 +624,10 @@ int submit_block_request(int rw, struct blkbuf_desc *buf_desc)
  */
 void submit_block_requests(int rw, int nr, struct blkbuf_desc *blkbufs[])
 {
+	struct blk_plug plug;
 	int i;
 
+	blk_start_plug(&plug);
 	for (i = 0; i < nr; i++) {
 		struct blkbuf_desc *buf_desc = blkbufs[i];
 
@@ -666,6 +669,7 @@ void submit_block_requests(int rw, int nr, struct blkbuf_desc *blkbufs[])
 		blkbuf_unlock(buf_desc);
 		loosen_blkbuf(buf_desc);
 	}
+	blk_finish_plug(&plug);
 }
 
 /**
@@ -126,19 +126,69 @@ set_page_buffer(struct page_frame *page, struct blkbuf_desc *bh, int page_block)
 	} while (page_bh != head);
 }
 
+/**
+ * 预读多个页面时，保存上一次get_blocks映射的结果
+ * 一次映射的连续块可以跨越多个页面，后续页面不必再调用文件系统
+ */
+struct readpage_map {
+	get_blocks_f *get_blocks;
+	struct blkbuf_desc bh;
+	/**
+	 * bh映射的第一个逻辑块，以及块的数量
+	 */
+	sector_t first_block;
+	unsigned long count;
+};
+
+/**
+ * 映射页面中的一个块
+ * 优先使用上一次映射的结果，不在其范围内时一次映射到end_block为止
+ */
+static int readpage_map_block(struct file_node *file_node, sector_t block,
+	sector_t end_block, struct blkbuf_desc *bh, map_block_f map_block,
+	struct readpage_map *map)
+{
+	if (!map || !map->get_blocks) {
+		bh->state = 0;
+		return map_block(file_node, block, bh, 0);
+	}
+
+	if (block < map->first_block
+	    || block >= map->first_block + map->count) {
+		map->bh.state = 0;
+		map->bh.size = 0;
+		map->bh.page = bh->page;
+		map->count = 0;
+		if (map->get_blocks(file_node, block, end_block - block,
+					&map->bh, 0))
+			return -EIO;
+
+		map->first_block = block;
+		map->count = max_t(unsigned long,
+				map->bh.size >> file_node->block_size_order, 1);
+	}
+
+	bh->state = map->bh.state;
+	bh->blkdev = map->bh.blkdev;
+	bh->block_num_dev = map->bh.block_num_dev + (block - map->first_block);
+
+	return 0;
+}
+
 /**
  * 对大多数文件来说，本函数是其readpage的实现方法。
  */
 static struct block_io_desc *
 real_readpage(struct block_io_desc *bio, struct page_frame *page, unsigned page_count,
-			sector_t *last_block_in_bio, map_block_f map_block)
+			sector_t *last_block_in_bio, map_block_f map_block,
+			struct readpage_map *map)
 {
 	struct file_node *file_node = page->cache_space->fnode;
 	const unsigned block_size_order = file_node->block_size_order;
 	const unsigned blocks_per_page = PAGE_CACHE_SIZE >> block_size_order;
 	const unsigned blocksize = 1 << block_size_order;
 	sector_t block_in_file;
-	sector_t last_block;
+	sector_t last_block, end_block;
 	sector_t blocks[MAX_BUF_PER_PAGE];
 	unsigned page_block;
 	unsigned first_hole = blocks_per_page;
@@ -154,12 +204,19 @@ real_readpage(struct block_io_desc *bio, struct page_frame *page, unsigned page_
 
 	block_in_file = page->index << (PAGE_CACHE_SHIFT - block_size_order);
 	last_block = (fnode_size(file_node) + blocksize - 1) >> block_size_order;
+	/**
+	 * 本次预读范围内的最后一块，多块映射不超过此范围
+	 */
+	end_block = block_in_file + page_count * blocks_per_page;
+	if (end_block > last_block)
+		end_block = last_block;
 
 	bh.page = page;
 	for (page_block = 0; page_block < blocks_per_page; page_block++) {
 		bh.state = 0;
 		if (block_in_file < last_block) {
-			if (map_block(file_node, block_in_file, &bh, 0))
+			if (readpage_map_block(file_node, block_in_file,
+					end_block, &bh, map_block, map))
 				goto slow;
 		}
 
@@ -284,20 +341,29 @@ int generic_readpage(struct page_frame *page, map_block_f map_block)
 	sector_t last_block_in_bio = 0;
 	struct block_io_desc *bio = NULL;
 
-	bio = real_readpage(bio, page, 1, &last_block_in_bio, map_block);
+	bio = real_readpage(bio, page, 1, &last_block_in_bio, map_block, NULL);
 	if (bio)
 		submit_one_bio(READ, bio);
 
 	return 0;
 }
 
+/**
+ * 预读多个页面
+ * 提供了get_blocks时，一次映射多个连续的块
+ */
 int generic_readpages(struct file_cache_space *space,
 	struct double_list *pages, unsigned page_count,
-	map_block_f map_block)
+	map_block_f map_block, get_blocks_f get_blocks)
 {
 	struct block_io_desc *bio = NULL;
 	unsigned page_idx;
 	sector_t last_block_in_bio = 0;
+	struct readpage_map map;
+
+	map.get_blocks = get_blocks;
+	map.first_block = 0;
+	map.count = 0;
 
 	for (page_idx = 0; page_idx < page_count; page_idx++) {
 		struct page_frame *page = list_last_container(pages, struct page_frame, pgcache_list);
@@ -305,9 +371,11 @@ int generic_readpages(struct file_cache_space *space,
 		list_del(&page->pgcache_list);
 		if (!add_to_page_cache(page, space, page->index, PAF_KERNEL))
 			bio = real_readpage(bio, page, page_count - page_idx,
-					&last_block_in_bio, map_block);
-		else
-			loosen_page_cache(page);
+					&last_block_in_bio, map_block, &map);
+		/**
+		 * 页面缓存已经持有引用，释放分配时的引用
+		 */
+		loosen_page_cache(page);
 	}
 	BUG_ON(!list_is_empty(pages));
 
@@ -1,12 +1,14 @@
 #include <dim-sum/aio.h>
 #include <dim-sum/beehive.h>
 #include <dim-sum/blk_dev.h>
+#include <dim-sum/blkio.h>
 #include <dim-sum/block_buf.h>
 #include <dim-sum/err.h>
 #include <dim-sum/fs.h>
 #include <dim-sum/highmem.h>
 #include <dim-sum/journal.h>
 #include <dim-sum/rbtree.h>
+#include <dim-sum/sched.h>
 #include <dim-sum/uio.h>
 #include <dim-sum/pagemap.h>
 #include <dim-sum/timer.h>
@@ -14,12 +16,436 @@
 #include <asm/cacheflush.h>
 
 /**
- * 暂时不实现direct-io
+ * 直接IO描述符
+ * 用户缓冲区所在的页面直接作为请求的数据页，不经过页面缓存
+ * 系统只有一个地址空间，用户缓冲区就是内核线性地址，不需要再固定用户页面
+ * 调用者需要保证在IO完成之前不释放缓冲区
+ */
+struct direct_io {
+	int rw;
+	struct file_node *fnode;
+	struct block_device *bdev;
+	/**
+	 * 文件块长度的位数
+	 */
+	unsigned int blkbits;
+	get_blocks_f *get_blocks;
+	dio_iodone_t *end_io;
+	struct async_io_desc *aio;
+	/**
+	 * 请求在文件中的起始位置
+	 */
+	loff_t offset;
+	/**
+	 * 开始IO时的文件长度，读操作不超过文件末尾
+	 */
+	loff_t fnode_size;
+	/**
+	 * 下一个要处理的文件块
+	 */
+	sector_t block_in_file;
+	/**
+	 * 已经映射，但是还没有处理的块
+	 * 如果是空洞，则next_block_dev无意义
+	 */
+	sector_t next_block_dev;
+	unsigned long mapped_blocks;
+	bool hole;
+	/**
+	 * 还没有放入请求的页面片段
+	 * 同一页面中连续的块先在这里合并
+	 */
+	struct page_frame *cur_page;
+	unsigned int cur_offset;
+	unsigned int cur_len;
+	sector_t cur_sector;
+	/**
+	 * 正在组装的请求，以及与其末尾相邻的扇区
+	 */
+	struct block_io_desc *bio;
+	sector_t next_sector;
+	/**
+	 * 已经提交或者清零的字节数
+	 */
+	size_t done;
+	/**
+	 * 提交者持有一个引用，每个未完成的请求持有一个引用
+	 */
+	struct accurate_counter refcount;
+	/**
+	 * 请求完成时发生的错误
+	 */
+	int io_error;
+	/**
+	 * 是否不等待IO完成就返回-EIOCBQUEUED
+	 */
+	bool is_async;
+	struct task_desc *waiter;
+};
+
+/**
+ * 汇总IO结果，并通知文件系统
+ */
+static ssize_t dio_complete(struct direct_io *dio, int err)
+{
+	ssize_t ret = dio->done;
+
+	/**
+	 * 读取的最后一块可能超过文件末尾
+	 */
+	if (dio->rw == READ && dio->offset + ret > dio->fnode_size)
+		ret = max_t(loff_t, dio->fnode_size - dio->offset, 0);
+
+	if (dio->io_error)
+		ret = dio->io_error;
+	else if (ret == 0)
+		ret = err;
+
+	if (dio->end_io && ret > 0)
+		dio->end_io(dio->fnode, dio->offset, ret, dio->aio->private);
+
+	return ret;
+}
+
+/**
+ * 释放一个引用，最后一个引用释放时结束异步请求
+ */
+static void dio_put(struct direct_io *dio)
+{
+	/**
+	 * 同步等待的任务可能在计数递减后就释放了描述符
+	 * 因此在递减之前取出需要的字段
+	 */
+	struct task_desc *waiter = dio->waiter;
+	bool is_async = dio->is_async;
+
+	if (accurate_dec_and_test_zero(&dio->refcount)) {
+		finish_async_io(dio->aio, dio_complete(dio, 0));
+		kfree(dio);
+	} else if (!is_async)
+		wake_up_process(waiter);
+}
+
+static int dio_bio_finish(struct block_io_desc *bio,
+	unsigned int bytes_done, int err)
+{
+	struct direct_io *dio = bio->bi_private;
+
+	if (bio->remain_size)
+		return 1;
+
+	if (!(bio->bi_flags & BIOFLAG_UPTODATE))
+		dio->io_error = -EIO;
+
+	loosen_blkio(bio);
+	dio_put(dio);
+
+	return 0;
+}
+
+static void dio_bio_submit(struct direct_io *dio)
+{
+	struct block_io_desc *bio = dio->bio;
+
+	bio->bi_private = dio;
+	bio->finish = dio_bio_finish;
+	accurate_inc(&dio->refcount);
+	dio->bio = NULL;
+
+	blk_submit_request(dio->rw == WRITE, bio);
+}
+
+static int dio_new_bio(struct direct_io *dio, sector_t sector)
+{
+	struct block_io_desc *bio;
+
+	bio = blkio_alloc(PAF_KERNEL, blkdev_get_max_pages(dio->bdev));
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = dio->bdev;
+	bio->start_sector = sector;
+	dio->bio = bio;
+	dio->next_sector = sector;
+
+	return 0;
+}
+
+/**
+ * 将缓存的页面片段放入请求
+ * 磁盘上不连续，或者请求已满时，先提交当前请求
+ */
+static int dio_send_cur_page(struct direct_io *dio)
+{
+	int ret;
+
+	if (!dio->cur_page)
+		return 0;
+
+	if (dio->bio && dio->next_sector != dio->cur_sector)
+		dio_bio_submit(dio);
+
+	if (dio->bio && blkio_add_page(dio->bio, dio->cur_page,
+			dio->cur_len, dio->cur_offset) < dio->cur_len)
+		dio_bio_submit(dio);
+
+	if (!dio->bio) {
+		ret = dio_new_bio(dio, dio->cur_sector);
+		if (ret)
+			return ret;
+
+		if (blkio_add_page(dio->bio, dio->cur_page,
+				dio->cur_len, dio->cur_offset) < dio->cur_len)
+			return -EIO;
+	}
+
+	dio->next_sector = dio->cur_sector + (dio->cur_len >> 9);
+	dio->cur_page = NULL;
+
+	return 0;
+}
+
+/**
+ * 提交一个块
+ * 与前一个块在同一页面中并且在磁盘上相邻时，只扩展页面片段
+ */
+static int dio_send_block(struct direct_io *dio, char *buf)
+{
+	struct page_frame *page;
+	unsigned int offset;
+	unsigned int len = 1 << dio->blkbits;
+	sector_t sector;
+	int ret;
+
+	if (!linear_virt_addr_is_valid(buf))
+		return -EFAULT;
+
+	page = linear_virt_to_page(buf);
+	offset = offset_in_page(buf);
+	sector = dio->next_block_dev << (dio->blkbits - 9);
+
+	if (dio->cur_page == page
+	    && dio->cur_offset + dio->cur_len == offset
+	    && dio->cur_sector + (dio->cur_len >> 9) == sector) {
+		dio->cur_len += len;
+		return 0;
+	}
+
+	ret = dio_send_cur_page(dio);
+	if (ret)
+		return ret;
+
+	dio->cur_page = page;
+	dio->cur_offset = offset;
+	dio->cur_len = len;
+	dio->cur_sector = sector;
+
+	return 0;
+}
+
+/**
+ * 从当前文件块开始，最多映射max_blocks个块
+ * 写操作会为空洞分配新块
+ */
+static int dio_get_more_blocks(struct direct_io *dio, unsigned long max_blocks)
+{
+	struct blkbuf_desc map;
+	unsigned long i;
+	int ret;
+
+	map.state = 0;
+	map.size = 0;
+	map.block_num_dev = 0;
+	ret = dio->get_blocks(dio->fnode, dio->block_in_file, max_blocks,
+				&map, dio->rw == WRITE);
+	if (ret)
+		return ret;
+
+	if (!blkbuf_is_mapped(&map)) {
+		/**
+		 * 写操作总是会分配块
+		 */
+		if (dio->rw == WRITE)
+			return -EIO;
+
+		dio->hole = true;
+		dio->mapped_blocks = 1;
+
+		return 0;
+	}
+
+	dio->hole = false;
+	dio->next_block_dev = map.block_num_dev;
+	dio->mapped_blocks = map.size >> dio->blkbits;
+	if (!dio->mapped_blocks)
+		dio->mapped_blocks = 1;
+	if (dio->mapped_blocks > max_blocks)
+		dio->mapped_blocks = max_blocks;
+
+	/**
+	 * 新分配的块可能还在元数据缓存中，先将其写入磁盘
+	 * 避免随后的回写覆盖我们的数据
+	 */
+	if (blkbuf_is_new(&map))
+		for (i = 0; i < dio->mapped_blocks; i++)
+			blkbuf_sync_metablock(map.blkdev, map.block_num_dev + i);
+
+	return 0;
+}
+
+/**
+ * 处理一个用户缓冲区段
+ * 返回1表示读到了文件末尾
+ */
+static int dio_do_segment(struct direct_io *dio, char *buf, size_t len)
+{
+	unsigned int blocksize = 1 << dio->blkbits;
+	sector_t end_block;
+	int ret;
+
+	end_block = (dio->fnode_size + blocksize - 1) >> dio->blkbits;
+
+	while (len) {
+		if (!dio->mapped_blocks) {
+			if (dio->rw == READ && dio->block_in_file >= end_block)
+				return 1;
+
+			ret = dio_get_more_blocks(dio, len >> dio->blkbits);
+			if (ret)
+				return ret;
+		}
+
+		if (dio->hole) {
+			/**
+			 * 空洞直接清0，不需要访问磁盘
+			 */
+			memset(buf, 0, blocksize);
+		} else {
+			ret = dio_send_block(dio, buf);
+			if (ret)
+				return ret;
+			dio->next_block_dev++;
+		}
+
+		dio->mapped_blocks--;
+		dio->block_in_file++;
+		dio->done += blocksize;
+		buf += blocksize;
+		len -= blocksize;
+	}
+
+	return 0;
+}
+
+/**
+ * 等待所有请求完成
+ */
+static void dio_await_completion(struct direct_io *dio)
+{
+	while (accurate_read(&dio->refcount) > 1) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (accurate_read(&dio->refcount) <= 1)
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+/**
+ * 直接IO的通用实现
+ * 文件偏移、用户缓冲区的地址和长度都必须按文件块长度对齐
+ * 逻辑块通过get_blocks映射到磁盘，磁盘上连续的块合并为一个请求
+ * 同步请求等待IO完成后返回，异步请求返回-EIOCBQUEUED
+ * 在请求完成时通过aio通知调用者
  */
 ssize_t __blockdev_direct_IO(int rw, struct async_io_desc *aio,
 	struct file_node *fnode, struct block_device *bdev, const struct io_segment *iov,
 	loff_t offset, unsigned long nr_segs, get_blocks_f get_blocks,
 	dio_iodone_t end_io, int dio_lock_type)
 {
-	return -EINVAL;
+	unsigned int blkbits = fnode->block_size_order;
+	unsigned long mask = (1UL << blkbits) - 1;
+	struct direct_io *dio;
+	unsigned long seg;
+	size_t count = 0;
+	int ret = 0;
+	bool locked = false;
+
+	if (offset & mask)
+		return -EINVAL;
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		if (((unsigned long)iov[seg].base & mask) || (iov[seg].len & mask))
+			return -EINVAL;
+		count += iov[seg].len;
+	}
+
+	if (count == 0)
+		return 0;
+
+	dio = kmalloc(sizeof(*dio), PAF_KERNEL | __PAF_ZERO);
+	if (!dio)
+		return -ENOMEM;
+
+	dio->rw = rw;
+	dio->fnode = fnode;
+	dio->bdev = bdev;
+	dio->blkbits = blkbits;
+	dio->get_blocks = get_blocks;
+	dio->end_io = end_io;
+	dio->aio = aio;
+	dio->offset = offset;
+	dio->fnode_size = fnode_size(fnode);
+	dio->block_in_file = offset >> blkbits;
+	dio->waiter = current;
+	accurate_set(&dio->refcount, 1);
+	/**
+	 * 扩展文件的写操作完成后，调用者要更新文件长度
+	 * 因此只能同步等待
+	 */
+	dio->is_async = !is_sync_kiocb(aio)
+		&& !(rw == WRITE && offset + count > dio->fnode_size);
+
+	/**
+	 * 写操作的调用者已经持有文件节点的信号量
+	 * 读操作在映射期间持有信号量，避免与截断、块分配并发
+	 */
+	if (dio_lock_type == DIO_LOCKING && rw == READ) {
+		down(&fnode->sem);
+		locked = true;
+	}
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		ret = dio_do_segment(dio, iov[seg].base, iov[seg].len);
+		if (ret)
+			break;
+	}
+	if (ret == 1)
+		ret = 0;
+
+	if (locked)
+		up(&fnode->sem);
+
+	if (ret == 0)
+		ret = dio_send_cur_page(dio);
+	if (dio->bio)
+		dio_bio_submit(dio);
+
+	/**
+	 * 出错时，已经提交的部分仍然算作成功
+	 */
+	if (ret && dio->cur_page)
+		dio->done -= dio->cur_len;
+
+	if (dio->is_async && accurate_read(&dio->refcount) > 1) {
+		dio_put(dio);
+		return -EIOCBQUEUED;
+	}
+
+	dio_await_completion(dio);
+	accurate_dec(&dio->refcount);
+	ret = dio_complete(dio, ret);
+	kfree(dio);
+
+	return ret;
 }
@@ -1,4 +1,5 @@
 #include <dim-sum/blk_dev.h>
+#include <dim-sum/crc32.h>
 #include <dim-sum/journal.h>
 
 /**
@@ -382,6 +383,24 @@ static void submit_metadata_bulk(struct blkbuf_desc **blkbuf_bulk, int buf_count
 	}
 }
 
+/**
+ * 将即将写入日志的块累加到事务的校验和中
+ */
+static void checksum_log_blocks(struct journal *journal,
+	struct transaction *trans, struct blkbuf_desc **blkbuf_bulk,
+	int buf_count)
+{
+	int i;
+
+	if (!JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM))
+		return;
+
+	for (i = 0; i < buf_count; i++)
+		trans->log_crc = crc32_be(trans->log_crc,
+			(unsigned char *)blkbuf_bulk[i]->block_data,
+			blkbuf_bulk[i]->size);
+}
+
 /**
  * 提交本事务的元数据块
  */
@@ -409,6 +428,7 @@ submit_metadata(struct journal *journal, struct transaction *trans)
 	 * 首先标记事务状态
 	 */
 	trans->state = TRANS_COMMIT_METADATA;
+	trans->log_crc = ~0;
 
 	ctrlblk_jinfo = NULL;
 	buf_count = 0;
@@ -559,6 +579,7 @@ submit_metadata(struct journal *journal, struct transaction *trans)
 			/**
 			 * 积累了足够多的元数据块，一次性提交
 			 */
+			checksum_log_blocks(journal, trans, blkbuf_bulk, buf_count);
 			submit_metadata_bulk(blkbuf_bulk, buf_count);
 			ctrlblk_jinfo = NULL;
 			buf_count = 0;
@@ -674,18 +695,15 @@ wait_metadata(struct journal *journal, struct transaction *trans)
 }
 
 /**
- * 完成事务的元数据、数据块、控制块回写
- * 提交最后的日志完成块
+ * 构造并提交日志完成块，不等待IO结束
+ * 返回完成块，调用者通过wait_commitblock等待其写入
  */
-static int
-write_commitblock(struct journal *journal, struct transaction *trans)
+static struct blkbuf_journal_info *
+submit_commitblock(struct journal *journal, struct transaction *trans)
 {
 	struct blkbuf_journal_info *ctrlblk_jinfo;
-	struct journal_header *header;
+	struct journal_commit_header *header;
 	struct blkbuf_desc *blkbuf;
-	int barrier_done = 0;
-	int err = 0;
-	int ret;
 
 	/**
 	 * 获得一个日志描述符。
@@ -697,42 +715,72 @@ write_commitblock(struct journal *journal, struct transaction *trans)
 	 */
 	if (!ctrlblk_jinfo) {
 		__journal_abort_hard(journal);
-		err = -ENOSPC;
-		goto out;
+		return NULL;
 	}
 
 	blkbuf = journal_to_blkbuf(ctrlblk_jinfo);
 	/**
 	 * 标记描述符，表示它是一个提交描述符。
-	 */	
-	header = (struct journal_header *)blkbuf->block_data;
-	header->magic = cpu_to_be32(JFS_MAGIC_NUMBER);
-	header->type = cpu_to_be32(JFS_COMMIT_BLOCK);
-	header->trans_id = cpu_to_be32(trans->trans_id);
+	 */
+	header = (struct journal_commit_header *)blkbuf->block_data;
+	header->header.magic = cpu_to_be32(JFS_MAGIC_NUMBER);
+	header->header.type = cpu_to_be32(JFS_COMMIT_BLOCK);
+	header->header.trans_id = cpu_to_be32(trans->trans_id);
+	if (JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM)) {
+		header->chksum_type = JFS_CRC32_CHKSUM;
+		header->chksum_size = sizeof(u32);
+		header->chksum[0] = cpu_to_be32(trans->log_crc);
+	}
 
-	blkbuf_set_dirty(blkbuf);
 	/**
 	 * 日志所在的磁盘支持IO屏障
+	 * 必须标记本次IO的屏障属性
+	 * 防止与前面的操作乱序
 	 */
-	if (journal->flags & JSTATE_BARRIER) {
-		/**
-		 * 必须标记本次IO的屏障属性
-		 * 防止与前后的操作乱序
-		 */
+	if (journal->flags & JSTATE_BARRIER)
 		blkbuf_set_ordered(blkbuf);
-		barrier_done = 1;
-	}
+
 	/**
 	 * 将提交描述符写入到日志中。
 	 */
-	ret = sync_dirty_block(blkbuf);
+	blkbuf_lock(blkbuf);
+	blkbuf_clear_dirty(blkbuf);
+	hold_blkbuf(blkbuf);
+	blkbuf->finish_io = blkbuf_finish_write_block;
+	submit_block_request(WRITE, blkbuf);
+
+	return ctrlblk_jinfo;
+}
+
+/**
+ * 等待日志完成块写入
+ * 提交块写入完毕后，才可以进行检查点处理
+ */
+static int
+wait_commitblock(struct journal *journal,
+	struct blkbuf_journal_info *ctrlblk_jinfo)
+{
+	struct blkbuf_desc *blkbuf;
+	int err = 0;
+	int ret = 0;
+
+	if (!ctrlblk_jinfo)
+		return -ENOSPC;
+
+	blkbuf = journal_to_blkbuf(ctrlblk_jinfo);
+	blkbuf_wait_unlock(blkbuf);
+	if (blkbuf_is_eopnotsupp(blkbuf)) {
+		blkbuf_clear_eopnotsupp(blkbuf);
+		ret = -EOPNOTSUPP;
+	} else if (!blkbuf_is_uptodate(blkbuf))
+		ret = -EIO;
 
 	/**
 	 * EOPNOTSUPP表示设备不支持屏障操作
 	 * 这时，我们也没有办法
 	 * 另外一种可能性，是它本身就不乱序
 	 */
-	if (ret == -EOPNOTSUPP && barrier_done) {
+	if (ret == -EOPNOTSUPP && blkbuf_is_ordered(blkbuf)) {
 		/**
 		 * 设备不支持，去除此标志
 		 * 自求多福吧，我们暂且认为设备不会乱序
@@ -753,13 +801,10 @@ write_commitblock(struct journal *journal, struct transaction *trans)
 	if (unlikely(ret == -EIO))
 		err = -EIO;
 
+	blkbuf_clear_ordered(blkbuf);
 	loosen_blkbuf(blkbuf);
 	journal_info_loosen(ctrlblk_jinfo);
 
-	/**
-	 * 提交块已经写入完毕，现在可以进行检查点处理了。
-	 */
-out:
 	return err;
 }
 
@@ -936,8 +981,12 @@ commit_tail(struct journal *journal, struct transaction *trans)
  */
 void journal_commit_transaction(struct journal *journal)
 {
+	struct blkbuf_journal_info *ctrlblk_jinfo = NULL;
 	struct transaction *commit_transaction;
+	struct blk_plug plug;
+	int async_commit;
 	int err = 0;
+	int ret;
 
 	/**
 	 * 执行到这里，说明在记录新的事务日志
@@ -965,13 +1014,12 @@ void journal_commit_transaction(struct journal *journal)
 
 	/**
 	 * 第二阶段，将数据缓存块写入到磁盘。
+	 * 数据块、撤销块、元数据日志块的写请求一起下发
+	 * 所有请求都先积攒在插头中，最后统一推送
 	 */
-	journal_debug (1, "JBD: commit phase 2, sync data blocks\n");
+	journal_debug (1, "JBD: commit phase 2, submit data blocks\n");
+	blk_start_plug(&plug);
 	submit_data_blocks(journal, commit_transaction);
-	err = wait_data_blocks(journal, commit_transaction);
-	if (err)
-		__journal_abort_hard(journal);
-	ASSERT(list_is_empty(&commit_transaction->data_block_list));
 
 	/**
 	 * 构建撤销表
@@ -986,10 +1034,38 @@ void journal_commit_transaction(struct journal *journal)
 	journal_debug(1, "JBD: commit phase 4, submit metadata\n");
 	submit_metadata(journal, commit_transaction);
 
+	blk_finish_plug(&plug);
+
+	/**
+	 * 数据块和日志块的IO已经同时在进行
+	 * 先等待数据块，ordered模式要求数据块先于提交块落盘
+	 */
+	err = wait_data_blocks(journal, commit_transaction);
+	if (err)
+		__journal_abort_hard(journal);
+	ASSERT(list_is_empty(&commit_transaction->data_block_list));
+
+	/**
+	 * 异步提交模式下，提交块不必等待日志块写入完毕
+	 * 回放时依靠提交块中的校验和判断事务是否完整
+	 * 因此只有日志块与提交块的IO是重叠的
+	 */
+	async_commit = JFS_HAS_INCOMPAT_FEATURE(journal,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+	if (async_commit && !journal_is_aborted(journal)) {
+		journal_debug(1, "JBD: commit phase 5, submit commit block\n");
+		ctrlblk_jinfo = submit_commitblock(journal, commit_transaction);
+	}
+
 	/**
 	 * 等待文件系统元数据和日志元数据被写入到日志中
 	 */
 	err = wait_metadata(journal, commit_transaction);
+	if (async_commit && ctrlblk_jinfo) {
+		ret = wait_commitblock(journal, ctrlblk_jinfo);
+		if (!err)
+			err = ret;
+	}
 	if (err)
 		goto abort;
 	if (journal_is_aborted(journal))
@@ -1000,8 +1076,13 @@ void journal_commit_transaction(struct journal *journal)
 	 * 并且元数据已经保存到日志中。
 	 * 可以写入提交块，标记事务结束
 	 */
-	journal_debug(1, "JBD: commit phase 5, write commit block\n");
-	write_commitblock(journal, commit_transaction);
+	if (!async_commit) {
+		journal_debug(1, "JBD: commit phase 5, write commit block\n");
+		ctrlblk_jinfo = submit_commitblock(journal, commit_transaction);
+		err = wait_commitblock(journal, ctrlblk_jinfo);
+		if (err)
+			goto abort;
+	}
 
 	/**
 	 * 日志写入完毕，做一些收尾工作
@@ -1,6 +1,7 @@
 #include <dim-sum/beehive.h>
 #include <dim-sum/block_buf.h>
 #include <dim-sum/bug.h>
+#include <dim-sum/crc32.h>
 #include <dim-sum/errno.h>
 #include <dim-sum/journal.h>
 
@@ -213,6 +214,52 @@ static int count_tags(struct blkbuf_desc *blkbuf, int size)
 	return ret;
 }
 
+/**
+ * 累加描述符块及其后日志块的校验和
+ * 同时将块号移动到描述符块所描述的日志块之后
+ */
+static int calc_log_crc(struct journal *journal, struct blkbuf_desc *blkbuf,
+	unsigned long *pnext_block, u32 *crc)
+{
+	struct blkbuf_desc *blkbuf_log;
+	int i, count, err;
+
+	count = count_tags(blkbuf, journal->block_size);
+	*crc = crc32_be(*crc, (unsigned char *)blkbuf->block_data, blkbuf->size);
+	for (i = 0; i < count; i++) {
+		err = read_journal_block(&blkbuf_log, journal, *pnext_block);
+		if (err) {
+			printk(KERN_ERR "JBD: IO error %d calculating "
+				"checksum of block %lu in log\n", err, *pnext_block);
+			return err;
+		}
+
+		advance_journal_block(journal, pnext_block, 1);
+		*crc = crc32_be(*crc, (unsigned char *)blkbuf_log->block_data,
+			blkbuf_log->size);
+		loosen_blkbuf(blkbuf_log);
+	}
+
+	return 0;
+}
+
+/**
+ * 提交块中的校验和是否与事务日志块一致
+ * 没有记录校验和的提交块总是被认为有效
+ */
+static bool commit_crc_match(struct blkbuf_desc *blkbuf, u32 crc)
+{
+	struct journal_commit_header *header;
+
+	header = (struct journal_commit_header *)blkbuf->block_data;
+	if (header->chksum_type == 0)
+		return true;
+
+	return header->chksum_type == JFS_CRC32_CHKSUM
+		&& header->chksum_size == sizeof(u32)
+		&& be32_to_cpu(header->chksum[0]) == crc;
+}
+
 /**
  * 将日志回放到文件系统磁盘中
  */
@@ -296,7 +343,7 @@ static int do_replay(struct journal *journal, struct blkbuf_desc *blkbuf,
 			 * 因此日志中的数据被转义了
 			 */
 			if (flags & JTAG_FLAG_ESCAPE)
-				*((__be32 *)blkbuf->block_data) =
+				*((__be32 *)blkbuf_new->block_data) =
 					cpu_to_be32(JFS_MAGIC_NUMBER);
 
 			/**
@@ -374,7 +421,9 @@ scan_journal(struct journal *journal, struct recovery_info *info,
 	struct blkbuf_desc *blkbuf;
 	unsigned long next_block;
 	unsigned int trans_id;
+	u32 crc = ~0;
 	int header_type;
+	int checksum;
 	int err;
 
 	/**
@@ -389,6 +438,13 @@ scan_journal(struct journal *journal, struct recovery_info *info,
 	if (pass == PASS_SCAN)
 		info->start_transaction = first_id;
 
+	/**
+	 * 只需要在第一遍遍历时验证校验和
+	 * 校验失败的事务不会被后续两遍处理
+	 */
+	checksum = (pass == PASS_SCAN) &&
+		JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM);
+
 	/**
 	 * 遍历所有块，依次处理每个事务
 	 * 确保事务的完整性
@@ -447,6 +503,18 @@ scan_journal(struct journal *journal, struct recovery_info *info,
 		 * 描述符块，后跟元数据
 		 */
 		case JFS_DESCRIPTOR_BLOCK:
+			if (checksum) {
+				err = calc_log_crc(journal, blkbuf, &next_block, &crc);
+				loosen_blkbuf(blkbuf);
+				/**
+				 * 日志块读不出来，视为日志在此结束
+				 */
+				if (err)
+					goto done;
+
+				continue;
+			}
+
 			if (pass != PASS_REPLAY) {
 				/**
 				 * 不是回放阶段，直接计算数据块有多少
@@ -471,6 +539,18 @@ scan_journal(struct journal *journal, struct recovery_info *info,
 		 * 提交块，应当开启下一个事务
 		 */
 		case JFS_COMMIT_BLOCK:
+			/**
+			 * 异步提交时，提交块可能先于日志块写入磁盘
+			 * 校验和不符说明事务并不完整，日志在此结束
+			 */
+			if (checksum && !commit_crc_match(blkbuf, crc)) {
+				printk(KERN_ERR "JBD: checksum mismatch in "
+					"transaction %u\n", next_id);
+				loosen_blkbuf(blkbuf);
+				goto done;
+			}
+
+			crc = ~0;
 			loosen_blkbuf(blkbuf);
 			next_id++;
 			continue;
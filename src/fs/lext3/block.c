@@ -263,33 +263,279 @@ find_free_block(int expect, struct blkbuf_desc *blkbuf, int max)
 	return -1;
 }
 
-/*
- * 分配数据块的主函数
- * 在一个块组的位图里面查找空闲块
+/**
+ * 在内存位图中占用一个块
+ * 如果日志提交块中该块还没有被释放，则放弃
  */
-static int
-__lext3_alloc_block(struct super_block *super, struct journal_handle *handle,
-	unsigned int group, struct blkbuf_desc *blkbuf_bitmap, int excepted_block,
-	int *perr)
+static int claim_block(int offset, struct blkbuf_desc *blkbuf)
 {
-	struct blkbuf_journal_info *blkbuf_jinfo;
-	int credits = 0;
-	int start, end;
-	int ret = 0;
-	bool got;
-	int err;
-	int i;
+	struct blkbuf_journal_info *blkbuf_jinfo = blkbuf_to_journal(blkbuf);
+	int ret;
 
-	*perr = 0;
+	/**
+	 * 首先标记内存中的位图
+	 */
+	if (lext3_set_bit_atomic(offset, blkbuf->block_data))
+		return 0;
 
-	/*
-	 * 获得位图块的undo权限
+	/**
+	 * 获得事务锁的情况下，判断事务中的提交块
 	 */
-	err = lext3_journal_get_undo_access(handle, blkbuf_bitmap, &credits);
-	if (err) {
-		*perr = err;
-		return -1;
+	blkbuf_lock_state(blkbuf);
+	if (blkbuf_jinfo->undo_copy &&
+	    lext3_test_bit(offset, blkbuf_jinfo->undo_copy)) {
+		/**
+		 * 事务提交块不允许分配此块，清除内存标记
+		 */
+		lext3_clear_bit_atomic(offset, blkbuf->block_data);
+		ret = 0;
+	} else
+		ret = 1;
+	blkbuf_unlock_state(blkbuf);
+
+	return ret;
+}
+
+/**
+ * 已经占用了first，继续占用紧随其后的空闲块
+ * 直到end，或者凑够count个块为止
+ */
+static unsigned long claim_run(int first, int end, unsigned long count,
+	struct blkbuf_desc *blkbuf)
+{
+	unsigned long num = 1;
+
+	while (num < count && first + num < end
+	    && claim_block(first + num, blkbuf))
+		num++;
+
+	return num;
+}
+
+static inline unsigned long
+group_first_block(struct super_block *super, unsigned int group)
+{
+	struct lext3_superblock_phy *super_phy;
+
+	super_phy = super_to_lext3(super)->phy_super;
+
+	return group * LEXT3_BLOCKS_PER_GROUP(super)
+		+ le32_to_cpu(super_phy->first_data_block);
+}
+
+static inline bool rsv_is_empty(struct lext3_reserve_window *rsv)
+{
+	return rsv->end == 0;
+}
+
+#define rb_to_rsv(node)	rb_entry((node), struct lext3_reserve_window, rb_node)
+
+static inline struct lext3_reserve_window *
+rsv_window_next(struct lext3_reserve_window *rsv)
+{
+	struct rb_node *next = rb_next(&rsv->rb_node);
+
+	return next ? rb_to_rsv(next) : NULL;
+}
+
+/**
+ * 查找第一个结束位置不小于block的窗口
+ * 窗口互不重叠，因此它们的结束位置也是有序的
+ * 调用者持有rsv_lock
+ */
+static struct lext3_reserve_window *
+__rsv_window_search(struct lext3_superblock *lext3_super, unsigned long block)
+{
+	struct rb_node *node = lext3_super->rsv_root.rb_node;
+	struct lext3_reserve_window *found = NULL;
+
+	while (node) {
+		struct lext3_reserve_window *rsv = rb_to_rsv(node);
+
+		if (block <= rsv->end) {
+			found = rsv;
+			node = node->rb_left;
+		} else
+			node = node->rb_right;
+	}
+
+	return found;
+}
+
+static void __rsv_window_insert(struct lext3_superblock *lext3_super,
+	struct lext3_reserve_window *rsv)
+{
+	struct rb_node **link = &lext3_super->rsv_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*link) {
+		parent = *link;
+		if (rsv->start < rb_to_rsv(parent)->start)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	rb_link_node(&rsv->rb_node, parent, link);
+	rb_insert_color(&rsv->rb_node, &lext3_super->rsv_root);
+}
+
+static void __rsv_window_remove(struct lext3_superblock *lext3_super,
+	struct lext3_reserve_window *rsv)
+{
+	rb_erase(&rsv->rb_node, &lext3_super->rsv_root);
+	rsv->start = rsv->end = 0;
+	rsv->alloc_hit = 0;
+}
+
+/**
+ * 在块组中，从goal开始为文件找一个新的预留窗口
+ * 窗口不能与其他文件的窗口重叠，并且第一个块必须是空闲的
+ */
+static int alloc_new_reservation(struct super_block *super, unsigned int group,
+	struct blkbuf_desc *blkbuf_bitmap, int goal,
+	struct lext3_reserve_window *rsv)
+{
+	struct lext3_superblock *lext3_super = super_to_lext3(super);
+	unsigned long group_first, group_last;
+	struct lext3_reserve_window *next;
+	unsigned long start, size;
+	int free;
+
+	group_first = group_first_block(super, group);
+	group_last = group_first + LEXT3_BLOCKS_PER_GROUP(super) - 1;
+	start = group_first + (goal > 0 ? goal : 0);
+
+	/**
+	 * 上一个窗口的大部分块都分配给了本文件
+	 * 说明是顺序写，加大窗口
+	 */
+	if (!rsv_is_empty(rsv)
+	    && rsv->alloc_hit > (rsv->end - rsv->start + 1) / 2)
+		rsv->goal_size = min(rsv->goal_size * 2,
+					(unsigned int)LEXT3_MAX_RESERVE_BLOCKS);
+	size = rsv->goal_size;
+
+	smp_lock(&lext3_super->rsv_lock);
+	if (!rsv_is_empty(rsv))
+		__rsv_window_remove(lext3_super, rsv);
+
+	next = __rsv_window_search(lext3_super, start);
+	while (1) {
+		if (start > group_last)
+			goto fail;
+
+		/**
+		 * 跳过与候选窗口重叠的其他窗口
+		 */
+		if (next && next->start < start + size) {
+			start = next->end + 1;
+			next = rsv_window_next(next);
+			continue;
+		}
+
+		/**
+		 * 窗口的第一个块必须空闲，否则后移窗口
+		 */
+		free = lext3_find_next_zero_bit(blkbuf_bitmap->block_data,
+			LEXT3_BLOCKS_PER_GROUP(super), start - group_first);
+		if (free >= LEXT3_BLOCKS_PER_GROUP(super))
+			goto fail;
+
+		if (group_first + free == start)
+			break;
+
+		start = group_first + free;
+		while (next && next->end < start)
+			next = rsv_window_next(next);
+	}
+
+	rsv->start = start;
+	rsv->end = min(start + size - 1, group_last);
+	rsv->alloc_hit = 0;
+	__rsv_window_insert(lext3_super, rsv);
+	smp_unlock(&lext3_super->rsv_lock);
+
+	return 0;
+
+fail:
+	smp_unlock(&lext3_super->rsv_lock);
+
+	return -1;
+}
+
+/**
+ * 在文件的预留窗口中分配块
+ * 目标块不在窗口中，或者窗口已经用完时，分配新的窗口
+ */
+static int
+alloc_with_reservation(struct super_block *super, unsigned int group,
+	struct blkbuf_desc *blkbuf_bitmap, int goal,
+	struct lext3_reserve_window *rsv, unsigned long *count)
+{
+	unsigned long group_first, group_last;
+	int start, end, found;
+	bool renew;
+
+	group_first = group_first_block(super, group);
+	group_last = group_first + LEXT3_BLOCKS_PER_GROUP(super) - 1;
+
+	while (1) {
+		if (rsv_is_empty(rsv))
+			renew = true;
+		else if (goal >= 0)
+			renew = group_first + goal < rsv->start
+				|| group_first + goal > rsv->end;
+		else
+			renew = rsv->start < group_first || rsv->start > group_last;
+
+		if (renew && alloc_new_reservation(super, group,
+				blkbuf_bitmap, goal, rsv) < 0)
+			return -1;
+
+		start = rsv->start - group_first;
+		if (goal > start)
+			start = goal;
+		end = rsv->end - group_first + 1;
+
+		while (start < end) {
+			found = lext3_find_next_zero_bit(blkbuf_bitmap->block_data,
+				end, start);
+			if (found >= end)
+				break;
+
+			if (claim_block(found, blkbuf_bitmap)) {
+				*count = claim_run(found, end, *count, blkbuf_bitmap);
+				rsv->alloc_hit += *count;
+
+				return found;
+			}
+
+			/**
+			 * 点背，被别人抢走了，试下一个块
+			 */
+			start = found + 1;
+		}
+
+		/**
+		 * 窗口已经用完，在它后面找新的窗口
+		 */
+		goal = end;
+		if (goal >= LEXT3_BLOCKS_PER_GROUP(super))
+			return -1;
 	}
+}
+
+/**
+ * 不使用预留窗口，在位图中就近分配
+ */
+static int
+alloc_without_reservation(struct super_block *super,
+	struct blkbuf_desc *blkbuf_bitmap, int excepted_block,
+	unsigned long *count)
+{
+	int start, end;
+	int i;
 
 	if (excepted_block > 0)
 		start = excepted_block;
@@ -308,66 +554,70 @@ repeat:
 		/**
 		 * 完全没有空闲块，退
 		 */
-		if (excepted_block < 0) {
-			ret = -1;
-			goto out;
-		}
+		if (excepted_block < 0)
+			return -1;
 
 		/**
 		 * 往前面找几个空闲块
 		 */
-		for (i = 0; i < 7; i++) {
+		for (i = 0; i < 7 && excepted_block > start; i++) {
 			if (!test_allocatable(excepted_block - 1, blkbuf_bitmap))
 				break;
 
 			excepted_block--;
-			if (excepted_block <= start)
-				break;
 		}
 	}
 
 	start = excepted_block;
 
-	blkbuf_jinfo = blkbuf_to_journal(blkbuf_bitmap);
-	/**
-	 * 首先标记内存中的位图
-	 */
-	if (lext3_set_bit_atomic(excepted_block, blkbuf_bitmap->block_data))
-		got = 0;
-	else {
-		/**
-		 * 获得事务锁的情况下，判断事务中的提交块
-		 */
-		blkbuf_lock_state(blkbuf_bitmap);
-		if (blkbuf_jinfo->undo_copy &&
-		    lext3_test_bit(excepted_block, blkbuf_jinfo->undo_copy)) {
-		    	/**
-		    	 * 事务提交块不允许分配此块，清除内存标记
-		    	 */
-			lext3_clear_bit_atomic(excepted_block,
-				blkbuf_bitmap->block_data);
-			got = 0;
-		} else
-			got = 1;
-
-		blkbuf_unlock_state(blkbuf_bitmap);
-	}
-	
-	if (!got) {
+	if (!claim_block(excepted_block, blkbuf_bitmap)) {
 		/**
 		 * 点背，预期的块被别人抢走了，试下一个块
 		 */
 		start++;
 		excepted_block++;
-		if (start >= end) {
-			ret = -1;
-			goto out;
-		}
+		if (start >= end)
+			return -1;
 
 		goto repeat;
 	}
 
-	ret = excepted_block;
+	*count = claim_run(excepted_block, end, *count, blkbuf_bitmap);
+
+	return excepted_block;
+}
+
+/*
+ * 分配数据块的主函数
+ * 在一个块组的位图里面查找空闲块
+ * 返回块组内第一个块的偏移，*count返回连续分配的块数
+ */
+static int
+__lext3_alloc_block(struct super_block *super, struct journal_handle *handle,
+	unsigned int group, struct blkbuf_desc *blkbuf_bitmap, int excepted_block,
+	struct lext3_reserve_window *rsv, unsigned long *count, int *perr)
+{
+	int credits = 0;
+	int ret;
+	int err;
+
+	*perr = 0;
+
+	/*
+	 * 获得位图块的undo权限
+	 */
+	err = lext3_journal_get_undo_access(handle, blkbuf_bitmap, &credits);
+	if (err) {
+		*perr = err;
+		return -1;
+	}
+
+	if (rsv)
+		ret = alloc_with_reservation(super, group, blkbuf_bitmap,
+					excepted_block, rsv, count);
+	else
+		ret = alloc_without_reservation(super, blkbuf_bitmap,
+					excepted_block, count);
 
 	if (ret >= 0) {
 		err = lext3_journal_dirty_metadata(handle, blkbuf_bitmap);
@@ -379,29 +629,33 @@ repeat:
 		return ret;
 	}
 
-out:
 	journal_putback_credits(handle, blkbuf_bitmap, credits);
 
 	return ret;
 }
 
 /*
- * 在期望的目标块附近分配一个空闲块
+ * 在期望的目标块附近分配最多*count个连续的空闲块
+ * 返回第一个块的块号，*count返回实际分配的块数
+ * 普通文件优先在其预留窗口中分配
  */
-int lext3_alloc_block(struct journal_handle *handle, struct file_node *fnode,
-	unsigned long excepted_block, int *perr)
+unsigned long
+lext3_alloc_blocks(struct journal_handle *handle, struct file_node *fnode,
+	unsigned long excepted_block, unsigned long *count, int *perr)
 {
-	struct blkbuf_desc *blkbuf_bitmap = NULL;
+	struct lext3_reserve_window *rsv = NULL;
 	struct lext3_superblock_phy *super_phy;
 	struct lext3_superblock *lext3_super;
+	struct blkbuf_desc *blkbuf_bitmap;
 	struct blkbuf_desc *blkbuf_group;
 	struct lext3_group_desc *group;
 	unsigned long groups_count;
 	struct super_block *super;
-	int offset, ret_block;
+	int goal_group, group_num;
+	int offset, goal, ret_block;
+	unsigned long block;
 	int free_blocks;
-	int group_num;
-	int err, ret;
+	int err = 0, ret;
 	int i;
 
 	*perr = -ENOSPC;
@@ -412,57 +666,40 @@ int lext3_alloc_block(struct journal_handle *handle, struct file_node *fnode,
 	lext3_super = super_to_lext3(super);
 	super_phy = lext3_super->phy_super;
 
-	if (!has_free_blocks(lext3_super)) {
-		*perr = -ENOSPC;
+	if (!has_free_blocks(lext3_super))
 		goto fail;
-	}
+
+	/**
+	 * 只有普通文件使用预留窗口，目录等元数据仍然就近分配
+	 */
+	if (S_ISREG(fnode->mode))
+		rsv = &fnode_to_lext3(fnode)->rsv_window;
 
 	if (excepted_block < le32_to_cpu(super_phy->first_data_block) ||
 	    excepted_block >= le32_to_cpu(super_phy->block_count))
 		excepted_block = le32_to_cpu(super_phy->first_data_block);
 
-	group_num = block_to_group(excepted_block, super, &offset);
-	group = lext3_get_group_desc(super, group_num, &blkbuf_group);
-	if (!group) {
-		*perr = -EIO;
-		goto fail;
-	}
+	goal_group = block_to_group(excepted_block, super, &offset);
+	groups_count = lext3_super->groups_count;
 
+retry:
+	group_num = goal_group;
+	goal = offset;
 	/**
 	 * 先在预期的块组里面分配
+	 * 然后从预期的组后面依次查找块组
 	 */
-	free_blocks = le16_to_cpu(group->free_block_count);
-	if (free_blocks > 0) {
-		blkbuf_bitmap = lext3_read_bitmapblock(super, group_num);
-		if (!blkbuf_bitmap) {
-			*perr = -EIO;
-			goto fail;
-		}
-
-		ret_block = __lext3_alloc_block(super, handle, group_num,
-			blkbuf_bitmap, offset, &err);
-		loosen_blkbuf(blkbuf_bitmap);
-
-		if (err)
-			goto fail;
-
-		if (ret_block >= 0)
-			goto got;
-	}
-
-	/**
-	 * 预期的块组已经没有空间了，在其他块组里面找
-	 * 从预期的组后面依次查找块组
-	 */
-	groups_count = super_to_lext3(super)->groups_count;
 	for (i = 0; i < groups_count; i++) {
-		group_num++;
-		if (group_num >= groups_count)
-			group_num = 0;
+		if (i) {
+			group_num++;
+			if (group_num >= groups_count)
+				group_num = 0;
+			goal = -1;
+		}
 
 		group = lext3_get_group_desc(super, group_num, &blkbuf_group);
 		if (!group) {
-			*perr = -EIO;
+			err = -EIO;
 			goto fail;
 		}
 
@@ -470,23 +707,38 @@ int lext3_alloc_block(struct journal_handle *handle, struct file_node *fnode,
 		if (free_blocks <= 0)
 			continue;
 
+		/**
+		 * 空闲块太少的块组容纳不下预留窗口，跳过
+		 */
+		if (i && rsv && free_blocks <= rsv->goal_size / 2)
+			continue;
+
 		blkbuf_bitmap = lext3_read_bitmapblock(super, group_num);
 		if (!blkbuf_bitmap) {
-			*perr = -EIO;
+			err = -EIO;
 			goto fail;
 		}
 
 		ret_block = __lext3_alloc_block(super, handle, group_num,
-					blkbuf_bitmap, -1, &err);
+			blkbuf_bitmap, goal, rsv, count, &err);
 		loosen_blkbuf(blkbuf_bitmap);
 
 		if (err)
 			goto fail;
 
-		if (ret_block >= 0) 
+		if (ret_block >= 0)
 			goto got;
 	}
 
+	/**
+	 * 空闲块被其他文件的预留窗口瓜分了
+	 * 不再使用预留窗口，再试一次
+	 */
+	if (rsv) {
+		rsv = NULL;
+		goto retry;
+	}
+
 	*perr = -ENOSPC;
 
 fail:
@@ -502,19 +754,15 @@ got:
 	if (err)
 		goto fail;
 
-	ret_block = ret_block + group_num * LEXT3_BLOCKS_PER_GROUP(super)
-					+ le32_to_cpu(super_phy->first_data_block);
+	block = ret_block + group_first_block(super, group_num);
 
-	if (ret_block == le32_to_cpu(group->datablock_bitmap) ||
-	    ret_block == le32_to_cpu(group->fnode_bitmap) ||
-	    block_overlap(ret_block, le32_to_cpu(group->first_fnode_block),
-		      super_to_lext3(super)->fnode_blocks_per_group))
-		lext3_enconter_error(super,
-			"Allocating block in system zone - block = %u", ret_block);
+	if (!verify_group_block(super, group, block, *count))
+		lext3_enconter_error(super, "Allocating block in system zone - "
+			"block = %lu, count = %lu", block, *count);
 
-	if (ret_block >= le32_to_cpu(super_phy->block_count)) {
-		lext3_enconter_error(super, "block(%d) >= blocks count(%d) - "
-			"block_group = %d, super_phy == %p ", ret_block,
+	if (block + *count > le32_to_cpu(super_phy->block_count)) {
+		lext3_enconter_error(super, "block(%lu) >= blocks count(%d) - "
+			"block_group = %d, super_phy == %p ", block,
 			le32_to_cpu(super_phy->block_count), group_num, super_phy);
 		goto fail;
 	}
@@ -524,9 +772,9 @@ got:
 	 */
 	smp_lock(lext3_block_group_lock(lext3_super, group_num));
 	group->free_block_count =
-			cpu_to_le16(le16_to_cpu(group->free_block_count) - 1);
+			cpu_to_le16(le16_to_cpu(group->free_block_count) - *count);
 	smp_unlock(lext3_block_group_lock(lext3_super, group_num));
-	approximate_counter_mod(&lext3_super->free_block_count, -1);
+	approximate_counter_mod(&lext3_super->free_block_count, -(long)*count);
 
 	ret = lext3_journal_dirty_metadata(handle, blkbuf_group);
 	if (!err)
@@ -538,7 +786,18 @@ got:
 
 	*perr = 0;
 
-	return ret_block;
+	return block;
+}
+
+/*
+ * 在期望的目标块附近分配一个空闲块
+ */
+int lext3_alloc_block(struct journal_handle *handle, struct file_node *fnode,
+	unsigned long excepted_block, int *perr)
+{
+	unsigned long count = 1;
+
+	return lext3_alloc_blocks(handle, fnode, excepted_block, &count, perr);
 }
 
 /**
@@ -570,7 +829,7 @@ lext3_free_blocks(struct journal_handle *handle, struct file_node *fnode,
 	/**
 	 * 验证逻辑块号是否正常
 	 */
-	if (verify_data_block(super_phy, block, count)) {
+	if (!verify_data_block(super_phy, block, count)) {
 		lext3_enconter_error (super, "block = %lu, count = %lu", block, count);
 		goto fail;
 	}
@@ -748,7 +1007,29 @@ unsigned long lext3_blkcount_groupdesc(struct super_block *super, int group)
 	return 0;
 }
 
-/* TO-DO */
-void lext3_discard_reservation(struct file_node *file_node)
+void lext3_init_reservation(struct file_node *fnode)
+{
+	struct lext3_reserve_window *rsv = &fnode_to_lext3(fnode)->rsv_window;
+
+	rsv->start = rsv->end = 0;
+	rsv->goal_size = LEXT3_DEFAULT_RESERVE_BLOCKS;
+	rsv->alloc_hit = 0;
+}
+
+/**
+ * 释放文件的预留窗口
+ * 窗口中未分配的块重新对其他文件可见
+ */
+void lext3_discard_reservation(struct file_node *fnode)
 {
+	struct lext3_reserve_window *rsv = &fnode_to_lext3(fnode)->rsv_window;
+	struct lext3_superblock *lext3_super = super_to_lext3(fnode->super);
+
+	if (rsv_is_empty(rsv))
+		return;
+
+	smp_lock(&lext3_super->rsv_lock);
+	if (!rsv_is_empty(rsv))
+		__rsv_window_remove(lext3_super, rsv);
+	smp_unlock(&lext3_super->rsv_lock);
 }
@@ -1,7 +1,9 @@
+#include <dim-sum/beehive.h>
 #include <dim-sum/block_buf.h>
 #include <dim-sum/err.h>
 #include <dim-sum/fs.h>
 #include <dim-sum/lext3_fs.h>
+#include <dim-sum/rbtree.h>
 
 #include "internal.h"
 
@@ -9,6 +11,70 @@ static unsigned char filetype_table[] = {
 	DT_UNKNOWN, DT_REG, DT_DIR, DT_CHR, DT_BLK, DT_FIFO, DT_SOCK, DT_LNK
 };
 
+static unsigned char get_dtype(struct super_block *super, int filetype)
+{
+	if (!LEXT3_HAS_INCOMPAT_FEATURE(super, LEXT3_FEATURE_INCOMPAT_FILETYPE)
+	    || (filetype >= LLEXT3_FT_MAX))
+		return DT_UNKNOWN;
+
+	return filetype_table[filetype];
+}
+
+/**
+ * 按哈希顺序读取目录时，缓存的目录项
+ */
+struct fname {
+	__u32		hash;
+	__u32		minor_hash;
+	struct rb_node	rb_hash;
+	/**
+	 * 哈希值完全相同的目录项链表
+	 */
+	struct fname	*next;
+	__u32		file_node_num;
+	__u8		name_len;
+	__u8		file_type;
+	char		name[0];
+};
+
+/**
+ * 索引目录的readdir状态，保存在file->private_data中
+ */
+struct dir_private_info {
+	/**
+	 * 按哈希值排序的目录项
+	 */
+	struct rb_root	root;
+	struct rb_node	*curr_node;
+	/**
+	 * 上次没有成功返回给调用者的目录项
+	 */
+	struct fname	*extra_fname;
+	loff_t		last_pos;
+	__u32		curr_hash;
+	__u32		curr_minor_hash;
+	__u32		next_hash;
+};
+
+/**
+ * 索引目录的读取位置就是哈希值
+ * 最低位总是0，右移一位保证位置为正数
+ */
+static inline loff_t hash2pos(__u32 major, __u32 minor)
+{
+	return major >> 1;
+}
+
+static inline __u32 pos2maj_hash(loff_t pos)
+{
+	return (pos << 1) & 0xffffffff;
+}
+
+static inline __u32 pos2min_hash(loff_t pos)
+{
+	return 0;
+}
+
 /**
  * 校验目录项是否正确，防止硬件问题引起错误
  */
@@ -41,6 +107,232 @@ int lext3_verify_dir_item(const char *function, struct file_node *dir,
 	return error_msg == NULL ? 1 : 0;
 }
 
+static void free_rb_tree_fname(struct rb_root *root)
+{
+	struct fname *fname, *next;
+	struct rb_node *node;
+
+	while ((node = rb_first(root))) {
+		rb_erase(node, root);
+		fname = rb_entry(node, struct fname, rb_hash);
+		while (fname) {
+			next = fname->next;
+			kfree(fname);
+			fname = next;
+		}
+	}
+}
+
+static struct dir_private_info *create_dir_info(loff_t pos)
+{
+	struct dir_private_info *info;
+
+	info = kzalloc(sizeof(struct dir_private_info), PAF_KERNEL);
+	if (!info)
+		return NULL;
+
+	info->root = RB_ROOT;
+	info->curr_hash = pos2maj_hash(pos);
+	info->curr_minor_hash = pos2min_hash(pos);
+
+	return info;
+}
+
+/**
+ * 将目录项按哈希值插入红黑树
+ * 哈希值完全相同的目录项链接在一起
+ */
+int lext3_htree_store_dirent(struct file *dir_file, __u32 hash,
+	__u32 minor_hash, struct lext3_dir_item *dir_item)
+{
+	struct rb_node **p, *parent = NULL;
+	struct dir_private_info *info;
+	struct fname *fname, *new;
+	int len;
+
+	info = dir_file->private_data;
+	p = &info->root.rb_node;
+
+	len = sizeof(struct fname) + dir_item->name_len + 1;
+	new = kzalloc(len, PAF_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	new->hash = hash;
+	new->minor_hash = minor_hash;
+	new->file_node_num = le32_to_cpu(dir_item->file_node_num);
+	new->name_len = dir_item->name_len;
+	new->file_type = dir_item->file_type;
+	memcpy(new->name, dir_item->name, dir_item->name_len);
+	new->name[dir_item->name_len] = 0;
+
+	while (*p) {
+		parent = *p;
+		fname = rb_entry(parent, struct fname, rb_hash);
+
+		if ((new->hash == fname->hash)
+		    && (new->minor_hash == fname->minor_hash)) {
+			new->next = fname->next;
+			fname->next = new;
+			return 0;
+		}
+
+		if (new->hash < fname->hash)
+			p = &(*p)->rb_left;
+		else if (new->hash > fname->hash)
+			p = &(*p)->rb_right;
+		else if (new->minor_hash < fname->minor_hash)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	rb_link_node(&new->rb_hash, parent, p);
+	rb_insert_color(&new->rb_hash, &info->root);
+
+	return 0;
+}
+
+/**
+ * 将哈希值相同的一组目录项返回给调用者
+ */
+static int call_filldir(struct file *file, void *dirent,
+	filldir_t filldir, struct fname *fname)
+{
+	struct dir_private_info *info = file->private_data;
+	struct super_block *super;
+	loff_t curr_pos;
+	int error;
+
+	super = file->fnode_cache->file_node->super;
+	curr_pos = hash2pos(fname->hash, fname->minor_hash);
+	while (fname) {
+		error = filldir(dirent, fname->name, fname->name_len, curr_pos,
+			fname->file_node_num, get_dtype(super, fname->file_type));
+		if (error) {
+			/**
+			 * 调用者的缓冲区满了，下次从这里继续
+			 */
+			file->pos = curr_pos;
+			info->extra_fname = fname;
+			return error;
+		}
+		fname = fname->next;
+	}
+
+	return 0;
+}
+
+/**
+ * 按哈希顺序读取索引目录
+ * 这样，读取过程中插入的目录项不会导致已经返回的目录项被重复返回
+ */
+static int lext3_dx_readdir(struct file *file, void *dirent, filldir_t filldir)
+{
+	struct dir_private_info *info = file->private_data;
+	struct file_node *fnode;
+	struct fname *fname;
+	int ret;
+
+	fnode = file->fnode_cache->file_node;
+	if (!info) {
+		info = create_dir_info(file->pos);
+		if (!info)
+			return -ENOMEM;
+		file->private_data = info;
+	}
+
+	if (file->pos == LEXT3_HTREE_EOF)
+		return 0;
+
+	/**
+	 * 有人修改了读取位置，重新开始
+	 */
+	if (info->last_pos != file->pos) {
+		free_rb_tree_fname(&info->root);
+		info->curr_node = NULL;
+		info->extra_fname = NULL;
+		info->curr_hash = pos2maj_hash(file->pos);
+		info->curr_minor_hash = pos2min_hash(file->pos);
+	}
+
+	/**
+	 * 先返回上次遗留的目录项
+	 */
+	if (info->extra_fname) {
+		if (call_filldir(file, dirent, filldir, info->extra_fname))
+			goto finished;
+
+		info->extra_fname = NULL;
+		goto next_node;
+	} else if (!info->curr_node)
+		info->curr_node = rb_first(&info->root);
+
+	while (1) {
+		/**
+		 * 红黑树中的目录项已经读完，或者目录被修改
+		 * 从当前哈希值开始重新填充
+		 */
+		if ((!info->curr_node) || (file->version != fnode->version)) {
+			info->curr_node = NULL;
+			free_rb_tree_fname(&info->root);
+			file->version = fnode->version;
+			ret = lext3_htree_fill_tree(file, info->curr_hash,
+				info->curr_minor_hash, &info->next_hash);
+			if (ret < 0)
+				return ret;
+
+			if (ret == 0) {
+				file->pos = LEXT3_HTREE_EOF;
+				break;
+			}
+			info->curr_node = rb_first(&info->root);
+		}
+
+		fname = rb_entry(info->curr_node, struct fname, rb_hash);
+		info->curr_hash = fname->hash;
+		info->curr_minor_hash = fname->minor_hash;
+		if (call_filldir(file, dirent, filldir, fname))
+			break;
+
+next_node:
+		info->curr_node = rb_next(info->curr_node);
+		if (info->curr_node) {
+			fname = rb_entry(info->curr_node, struct fname, rb_hash);
+			info->curr_hash = fname->hash;
+			info->curr_minor_hash = fname->minor_hash;
+		} else {
+			if (info->next_hash == ~0) {
+				file->pos = LEXT3_HTREE_EOF;
+				break;
+			}
+			info->curr_hash = info->next_hash;
+			info->curr_minor_hash = 0;
+		}
+	}
+
+finished:
+	info->last_pos = file->pos;
+
+	return 0;
+}
+
+/**
+ * 只有一个块的目录还没有建立索引，也按哈希顺序读取
+ * 这样它在转换为索引目录前后，读取位置的含义保持一致
+ */
+static int is_dx_dir(struct file_node *fnode)
+{
+	struct super_block *super = fnode->super;
+
+	if (LEXT3_HAS_COMPAT_FEATURE(super, LEXT3_FEATURE_COMPAT_DIR_INDEX)
+	    && ((fnode_to_lext3(fnode)->flags & LEXT3_INDEX_FL)
+	    || ((fnode->file_size >> super->block_size_order) == 1)))
+		return 1;
+
+	return 0;
+}
+
 static int lext3_readdir(struct file *file, void *dirent, filldir_t filldir)
 {
 	struct blkbuf_desc *blkbuf, *tmp, *ary_blkbuf[16];
@@ -58,6 +350,17 @@ static int lext3_readdir(struct file *file, void *dirent, filldir_t filldir)
 	fnode = file->fnode_cache->file_node;
 	super = fnode->super;
 
+	if (is_dx_dir(fnode)) {
+		err = lext3_dx_readdir(file, dirent, filldir);
+		if (err != ERR_BAD_DX_DIR)
+			return err;
+
+		/**
+		 * 索引损坏，按线性目录读取
+		 */
+		fnode_to_lext3(fnode)->flags &= ~LEXT3_INDEX_FL;
+	}
+
 	stored = 0;
 	blkbuf = NULL;
 	offset = file->pos & (super->block_size - 1);
@@ -163,20 +466,13 @@ revalidate:
 			 */
 			if (le32_to_cpu(dir_item->file_node_num)) {
 				unsigned long version = file->version;
-				unsigned long dir_type = DT_UNKNOWN;
-				unsigned long ft_feature;
-
-				ft_feature = LEXT3_HAS_INCOMPAT_FEATURE(super,
-					LEXT3_FEATURE_INCOMPAT_FILETYPE);
-				if (ft_feature && (dir_item->file_type >= LLEXT3_FT_MAX))
-					dir_type = filetype_table[dir_item->file_type];
 
 				/**
 				 * 回调，向调用者返回数据
 				 */
 				error = filldir(dirent, dir_item->name, dir_item->name_len,
 					file->pos, le32_to_cpu(dir_item->file_node_num),
-					dir_type);
+					get_dtype(super, dir_item->file_type));
 				if (error)
 					break;
 
@@ -194,10 +490,24 @@ out:
 	return ret;
 }
 
+static int lext3_release_dir(struct file_node *fnode, struct file *file)
+{
+	struct dir_private_info *info = file->private_data;
+
+	if (info) {
+		free_rb_tree_fname(&info->root);
+		kfree(info);
+		file->private_data = NULL;
+	}
+
+	return 0;
+}
+
 struct file_ops lext3_dir_fileops = {
 	.llseek = generic_file_llseek,
 	.read = generic_read_dir,
 	.readdir = lext3_readdir,
 	.ioctl	 = lext3_ioctl,
 	.fsync = lext3_sync_file,
+	.release = lext3_release_dir,
 };
@@ -5,6 +5,11 @@
 
 #include "internal.h"
 
+/**
+ * 格式化后的错误、警告信息最大长度
+ */
+#define LEXT3_MSG_LEN	256
+
 const char *
 lext3_error_msg(struct super_block *super, int errno, char msg_buf[16])
 {
@@ -83,26 +88,28 @@ void lext3_std_error(struct super_block *super, int errno)
 
 void lext3_enconter_error(struct super_block *super, const char *fmt, ...)
 {
+	char buf[LEXT3_MSG_LEN];
 	va_list args;
 
 	va_start(args, fmt);
-	printk(KERN_CRIT "EXT3-fs error (device %s): ",super->blkdev_name);
-	printk(fmt, args);
-	printk("\n");
+	vsnprintf(buf, sizeof(buf), fmt, args);
 	va_end(args);
+	printk(KERN_CRIT "EXT3-fs error (device %s): %s\n",
+		super->blkdev_name, buf);
 
 	enconter_error(super);
 }
 
 void lext3_abort_filesystem(struct super_block *super, const char *fmt, ...)
 {
+	char buf[LEXT3_MSG_LEN];
 	va_list args;
 
 	va_start(args, fmt);
-	printk(KERN_CRIT "LEXT3 error (device %s)",super->blkdev_name);
-	printk(fmt, args);
-	printk("\n");
+	vsnprintf(buf, sizeof(buf), fmt, args);
 	va_end(args);
+	printk(KERN_CRIT "LEXT3 error (device %s): %s\n",
+		super->blkdev_name, buf);
 	dump_stack();
 
 	if (lext3_test_opt(super, LEXT3_MOUNT_ERRORS_PANIC))
@@ -117,3 +124,19 @@ void lext3_abort_filesystem(struct super_block *super, const char *fmt, ...)
 	super_to_lext3(super)->mount_opt |= LEXT3_MOUNT_ABORT;
 	journal_abort(super_to_lext3(super)->journal, -EIO);
 }
+
+/**
+ * 可以恢复的错误，仅打印警告
+ */
+void lext3_warning(struct super_block *super, const char *function,
+	const char *fmt, ...)
+{
+	char buf[LEXT3_MSG_LEN];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	printk(KERN_WARNING "EXT3-fs warning (device %s): %s: %s\n",
+		super->blkdev_name, function, buf);
+}
@@ -0,0 +1,272 @@
+#include <dim-sum/beehive.h>
+#include <dim-sum/fs.h>
+#include <dim-sum/journal.h>
+#include <dim-sum/lext3_fs.h>
+#include <dim-sum/rbtree.h>
+#include <dim-sum/smp_lock.h>
+
+#include "internal.h"
+
+/**
+ * 每个文件最多缓存的区段数量
+ */
+#define LEXT3_MAX_EXTENTS	64
+
+/**
+ * 一段逻辑块和物理块都连续的映射
+ */
+struct lext3_extent {
+	struct rb_node rb_node;
+	/**
+	 * 起始逻辑块号
+	 */
+	unsigned long logic;
+	/**
+	 * 起始物理块号
+	 */
+	unsigned long phy;
+	/**
+	 * 块数量
+	 */
+	unsigned long count;
+};
+
+static struct beehive_allotter *extent_allotter;
+
+#define rb_to_extent(node)	rb_entry((node), struct lext3_extent, rb_node)
+
+static inline unsigned long extent_end(struct lext3_extent *extent)
+{
+	return extent->logic + extent->count;
+}
+
+/**
+ * 查找第一个结束位置在block之后的区段
+ * 区段互不重叠，因此它们的结束位置也是有序的
+ */
+static struct lext3_extent *
+__extent_search(struct lext3_file_node *lext3_fnode, unsigned long block)
+{
+	struct rb_node *node = lext3_fnode->extent_tree.rb_node;
+	struct lext3_extent *found = NULL;
+
+	while (node) {
+		struct lext3_extent *extent = rb_to_extent(node);
+
+		if (block < extent_end(extent)) {
+			found = extent;
+			node = node->rb_left;
+		} else
+			node = node->rb_right;
+	}
+
+	return found;
+}
+
+static void
+__extent_remove(struct lext3_file_node *lext3_fnode, struct lext3_extent *extent)
+{
+	rb_erase(&extent->rb_node, &lext3_fnode->extent_tree);
+	lext3_fnode->extent_count--;
+	beehive_free(extent_allotter, extent);
+}
+
+/**
+ * 删除[start, end)范围内的映射
+ * 调用者保证不会出现需要将一个区段拆成两段的情况
+ */
+static void __extent_remove_range(struct lext3_file_node *lext3_fnode,
+	unsigned long start, unsigned long end)
+{
+	struct lext3_extent *extent;
+	struct rb_node *next;
+
+	extent = __extent_search(lext3_fnode, start);
+	while (extent && extent->logic < end) {
+		next = rb_next(&extent->rb_node);
+
+		if (extent->logic < start) {
+			extent->count = start - extent->logic;
+		} else if (extent_end(extent) > end) {
+			extent->phy += end - extent->logic;
+			extent->count -= end - extent->logic;
+			extent->logic = end;
+		} else
+			__extent_remove(lext3_fnode, extent);
+
+		extent = next ? rb_to_extent(next) : NULL;
+	}
+}
+
+/**
+ * 与左右相邻，并且物理块也连续的区段合并
+ */
+static void __extent_try_merge(struct lext3_file_node *lext3_fnode,
+	struct lext3_extent *extent)
+{
+	struct rb_node *node;
+	struct lext3_extent *prev, *next;
+
+	node = rb_prev(&extent->rb_node);
+	if (node) {
+		prev = rb_to_extent(node);
+		if (extent_end(prev) == extent->logic
+		    && prev->phy + prev->count == extent->phy) {
+			prev->count += extent->count;
+			__extent_remove(lext3_fnode, extent);
+			extent = prev;
+		}
+	}
+
+	node = rb_next(&extent->rb_node);
+	if (node) {
+		next = rb_to_extent(node);
+		if (extent_end(extent) == next->logic
+		    && extent->phy + extent->count == next->phy) {
+			extent->count += next->count;
+			__extent_remove(lext3_fnode, next);
+		}
+	}
+}
+
+/**
+ * 缓存的版本号
+ * 在读取间接块之前获得，添加映射时用于判断期间是否发生过截断
+ */
+unsigned long lext3_extent_gen(struct file_node *fnode)
+{
+	struct lext3_file_node *lext3_fnode = fnode_to_lext3(fnode);
+	unsigned long gen;
+
+	smp_lock(&lext3_fnode->extent_lock);
+	gen = lext3_fnode->extent_gen;
+	smp_unlock(&lext3_fnode->extent_lock);
+
+	return gen;
+}
+
+/**
+ * 在缓存中查找逻辑块
+ * 返回从block开始连续映射的块数，0表示没有命中
+ */
+unsigned long lext3_extent_lookup(struct file_node *fnode,
+	unsigned long block, unsigned long *phy)
+{
+	struct lext3_file_node *lext3_fnode = fnode_to_lext3(fnode);
+	struct lext3_extent *extent;
+	unsigned long count = 0;
+
+	smp_lock(&lext3_fnode->extent_lock);
+	extent = __extent_search(lext3_fnode, block);
+	if (extent && extent->logic <= block) {
+		*phy = extent->phy + (block - extent->logic);
+		count = extent_end(extent) - block;
+	}
+	smp_unlock(&lext3_fnode->extent_lock);
+
+	return count;
+}
+
+/**
+ * 将一段映射加入缓存
+ * 如果从gen以来发生过截断，映射可能已经失效，放弃
+ */
+void lext3_extent_add(struct file_node *fnode, unsigned long gen,
+	unsigned long logic, unsigned long phy, unsigned long count)
+{
+	struct lext3_file_node *lext3_fnode = fnode_to_lext3(fnode);
+	struct rb_node **link, *parent = NULL;
+	struct lext3_extent *extent, *new;
+
+	new = beehive_alloc(extent_allotter, PAF_NOFS);
+	if (!new)
+		return;
+
+	smp_lock(&lext3_fnode->extent_lock);
+	if (gen != lext3_fnode->extent_gen)
+		goto out_free;
+
+	/**
+	 * 已经完整缓存了
+	 */
+	extent = __extent_search(lext3_fnode, logic);
+	if (extent && extent->logic <= logic
+	    && extent_end(extent) >= logic + count)
+		goto out_free;
+
+	__extent_remove_range(lext3_fnode, logic, logic + count);
+
+	/**
+	 * 缓存已满，丢弃最前面的区段
+	 */
+	if (lext3_fnode->extent_count >= LEXT3_MAX_EXTENTS)
+		__extent_remove(lext3_fnode,
+			rb_to_extent(rb_first(&lext3_fnode->extent_tree)));
+
+	link = &lext3_fnode->extent_tree.rb_node;
+	while (*link) {
+		parent = *link;
+		extent = rb_to_extent(parent);
+		if (logic < extent->logic)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	new->logic = logic;
+	new->phy = phy;
+	new->count = count;
+	rb_link_node(&new->rb_node, parent, link);
+	rb_insert_color(&new->rb_node, &lext3_fnode->extent_tree);
+	lext3_fnode->extent_count++;
+
+	__extent_try_merge(lext3_fnode, new);
+	smp_unlock(&lext3_fnode->extent_lock);
+
+	return;
+
+out_free:
+	smp_unlock(&lext3_fnode->extent_lock);
+	beehive_free(extent_allotter, new);
+}
+
+/**
+ * 文件被截断，删除from之后的所有映射
+ * 同时使正在进行的查找结果失效
+ */
+void lext3_extent_truncate(struct file_node *fnode, unsigned long from)
+{
+	struct lext3_file_node *lext3_fnode = fnode_to_lext3(fnode);
+
+	smp_lock(&lext3_fnode->extent_lock);
+	lext3_fnode->extent_gen++;
+	__extent_remove_range(lext3_fnode, from, ~0UL);
+	smp_unlock(&lext3_fnode->extent_lock);
+}
+
+/**
+ * 释放文件节点时，清空缓存
+ */
+void lext3_extent_destroy(struct file_node *fnode)
+{
+	struct lext3_file_node *lext3_fnode = fnode_to_lext3(fnode);
+	struct rb_node *node;
+
+	while ((node = rb_first(&lext3_fnode->extent_tree)))
+		__extent_remove(lext3_fnode, rb_to_extent(node));
+}
+
+void lext3_extent_init(struct file_node *fnode)
+{
+	struct lext3_file_node *lext3_fnode = fnode_to_lext3(fnode);
+
+	lext3_fnode->extent_tree = RB_ROOT;
+	lext3_fnode->extent_count = 0;
+	smp_lock_init(&lext3_fnode->extent_lock);
+}
+
+void init_lext3_extent(void)
+{
+	extent_allotter = beehive_create("lext3_extent",
+		sizeof(struct lext3_extent), 0, BEEHIVE_PANIC, NULL);
+}
@@ -12,6 +12,11 @@ struct journal_handle *lext3_start_trunc_journal(struct file_node *fnode);
 int lext3_find_block(struct journal_handle *handle, struct file_node *fnode,
 	sector_t iblock, struct blkbuf_desc *result,
 	int create, int extend_disksize);
+int lext3_map_blocks(struct journal_handle *handle, struct file_node *fnode,
+	sector_t iblock, unsigned long max_blocks, struct blkbuf_desc *result,
+	int create, int extend_disksize);
+int lext3_get_blocks(struct file_node *fnode, sector_t iblock,
+	unsigned long max_blocks, struct blkbuf_desc *result, int create);
 int lext3_get_datablock(struct file_node *fnode, sector_t block,
 	struct blkbuf_desc *result, int create);
 int lext3_load_fnode(struct file_node *fnode,
@@ -95,6 +100,21 @@ static unsigned char lext3_type_by_mode[S_IFMT >> S_SHIFT] = {
 	[S_IFLNK >> S_SHIFT]	= LEXT3_FT_SYMLINK,
 };
 
+/**
+ * 目录索引损坏，调用者应当退回到线性查找
+ */
+#define ERR_BAD_DX_DIR			-75000
+
+/**
+ * 目录是否使用哈希索引
+ */
+static inline int lext3_is_dx(struct file_node *dir)
+{
+	return LEXT3_HAS_COMPAT_FEATURE(dir->super,
+			LEXT3_FEATURE_COMPAT_DIR_INDEX)
+		&& (fnode_to_lext3(dir)->flags & LEXT3_INDEX_FL);
+}
+
 static inline void set_fnode_dir_index(struct file_node *fnode)
 {
 	struct super_block *super = fnode->super;
@@ -119,7 +139,7 @@ block_to_group(unsigned long block, struct super_block *super, int *poffset)
 	super_phy = super_to_lext3(super)->phy_super;
 	offset = block - le32_to_cpu(super_phy->first_data_block);
 
-	*poffset = offset * LEXT3_BLOCKS_PER_GROUP(super);
+	*poffset = offset % LEXT3_BLOCKS_PER_GROUP(super);
 
 	return offset / LEXT3_BLOCKS_PER_GROUP(super);
 }
@@ -671,11 +671,17 @@ static int find_near_block(struct file_node *fnode, long block, struct indirect_
 	return -EAGAIN;
 }
 
+/**
+ * 为逻辑块分配缺失的间接块和数据块
+ * 最后一层是数据块，尽量连续分配*count个，*count返回实际分配的数量
+ */
 static int
 alloc_branch(struct journal_handle *handle, struct file_node *fnode,
 	int num, unsigned long goal, int *offsets,
-	struct indirect_block_desc *branch)
+	struct indirect_block_desc *branch, unsigned long *count)
 {
+	unsigned long want = *count;
+	unsigned long run = 1;
 	int level = 0, keys = 0;
 	int blocksize;
 	int err = 0;
@@ -683,10 +689,15 @@ alloc_branch(struct journal_handle *handle, struct file_node *fnode,
 	int i;
 
 	blocksize = fnode->super->block_size;
-	parent = lext3_alloc_block(handle, fnode, goal, &err);
+	if (num == 1) {
+		run = want;
+		parent = lext3_alloc_blocks(handle, fnode, goal, &run, &err);
+	} else
+		parent = lext3_alloc_block(handle, fnode, goal, &err);
 	branch[0].child_block_num = cpu_to_le32(parent);
 
 	if (parent) {
+		keys = 1;
 		/**
 		 * 依次处理各层
 		 */
@@ -695,9 +706,14 @@ alloc_branch(struct journal_handle *handle, struct file_node *fnode,
 			int block;
 	
 			/**
-			 * 为每一层分配磁盘块
+			 * 为每一层分配磁盘块，最后一层是连续的数据块
 			 */
-			block = lext3_alloc_block(handle, fnode, parent, &err);
+			if (level == num - 1) {
+				run = want;
+				block = lext3_alloc_blocks(handle, fnode, parent,
+							&run, &err);
+			} else
+				block = lext3_alloc_block(handle, fnode, parent, &err);
 			if (!block)
 				break;
 
@@ -721,6 +737,10 @@ alloc_branch(struct journal_handle *handle, struct file_node *fnode,
 			memset(blkbuf->block_data, 0, blocksize);
 			branch[level].child_pos= (__le32*) blkbuf->block_data + offsets[level];
 			*branch[level].child_pos = branch[level].child_block_num;
+			if (level == num - 1)
+				for (i = 1; i < run; i++)
+					branch[level].child_pos[i] =
+						cpu_to_le32(block + i);
 			blkbuf_set_uptodate(blkbuf);
 			blkbuf_unlock(blkbuf);
 
@@ -735,8 +755,10 @@ alloc_branch(struct journal_handle *handle, struct file_node *fnode,
 		}
 	}
 
-	if (level == num)
+	if (level == num) {
+		*count = run;
 		return 0;
+	}
 
 	/**
 	 * 分配失败
@@ -748,7 +770,8 @@ alloc_branch(struct journal_handle *handle, struct file_node *fnode,
 
 	for (i = 0; i < keys; i++)
 		lext3_free_blocks(handle, fnode,
-			le32_to_cpu(branch[i].child_block_num), 1);
+			le32_to_cpu(branch[i].child_block_num),
+			i == num - 1 ? run : 1);
 
 	return err;
 }
@@ -759,7 +782,7 @@ alloc_branch(struct journal_handle *handle, struct file_node *fnode,
 static int
 stick_branch(struct journal_handle *handle, struct file_node *fnode,
 	long block, struct indirect_block_desc chain[4],
-	struct indirect_block_desc *where, int num)
+	struct indirect_block_desc *where, int num, unsigned long count)
 {
 	struct lext3_file_node *lext3_fnode;
 	int err = 0;
@@ -782,8 +805,16 @@ stick_branch(struct journal_handle *handle, struct file_node *fnode,
 		goto changed;
 
 	*where->child_pos = where->child_block_num;
-	lext3_fnode->last_logic_block = block;
-	lext3_fnode->last_phy_block = le32_to_cpu(where[num-1].child_block_num);
+	/**
+	 * 数据块直接挂在已有的间接块中，依次填入其余的连续块
+	 */
+	if (num == 1)
+		for (i = 1; i < count; i++)
+			where->child_pos[i] =
+				cpu_to_le32(le32_to_cpu(where->child_block_num) + i);
+	lext3_fnode->last_logic_block = block + count - 1;
+	lext3_fnode->last_phy_block =
+		le32_to_cpu(where[num-1].child_block_num) + count - 1;
 
 	fnode->meta_modify_time = CURRENT_TIME_SEC;
 	lext3_mark_fnode_dirty(handle, fnode);
@@ -808,20 +839,80 @@ err_out:
 
 	if (err == -EAGAIN)
 		for (i = 0; i < num; i++)
-			lext3_free_blocks(handle, fnode, 
-					 le32_to_cpu(where[i].child_block_num), 1);
+			lext3_free_blocks(handle, fnode,
+					 le32_to_cpu(where[i].child_block_num),
+					 i == num - 1 ? count : 1);
 
 	return err;
 }
 
+/**
+ * 末级间接块中，从逻辑块开始(含)剩余的指针数量
+ */
+static inline unsigned long
+leaf_slots_left(struct file_node *fnode, int depth, int *offsets)
+{
+	if (depth == 1)
+		return LEXT3_DIRECT_BLOCKS - offsets[0];
+
+	return LEXT3_ADDR_PER_BLOCK(fnode->super) - offsets[depth - 1];
+}
+
+/**
+ * 统计末级间接块中，从逻辑块开始物理上连续的块数
+ */
+static unsigned long
+count_leaf_run(struct file_node *fnode, int depth, int *offsets,
+	struct indirect_block_desc *leaf)
+{
+	unsigned long first = le32_to_cpu(leaf->child_block_num);
+	unsigned long limit, count;
+
+	limit = leaf_slots_left(fnode, depth, offsets);
+	for (count = 1; count < limit; count++)
+		if (le32_to_cpu(leaf->child_pos[count]) != first + count)
+			break;
+
+	return count;
+}
+
+/**
+ * 统计可以一次分配的数据块数量，最多max_blocks个
+ * 末级间接块已经存在时，只能使用其中连续的空位
+ */
+static unsigned long
+count_leaf_holes(struct file_node *fnode, int depth, int *offsets,
+	struct indirect_block_desc *partial, int left, unsigned long max_blocks)
+{
+	unsigned long limit, count;
+
+	limit = min(leaf_slots_left(fnode, depth, offsets), max_blocks);
+	/**
+	 * 末级间接块也要新分配，所有位置都是空的
+	 */
+	if (left > 1)
+		return limit;
+
+	for (count = 1; count < limit; count++)
+		if (partial->child_pos[count])
+			break;
+
+	return count;
+}
+
 /**
  * 查找或者创建文件节点的逻辑块
+ * 返回从iblock开始，物理上连续映射的块数，最多max_blocks个
+ * 返回0表示是空洞，创建时尽量一次分配连续的多个块
+ * 先查找区段缓存，未命中时再遍历间接块，并将结果加入缓存
  */
-int lext3_find_block(struct journal_handle *handle, struct file_node *fnode,
-	sector_t iblock, struct blkbuf_desc *blkbuf, int create, int extend)
+int lext3_map_blocks(struct journal_handle *handle, struct file_node *fnode,
+	sector_t iblock, unsigned long max_blocks, struct blkbuf_desc *blkbuf,
+	int create, int extend)
 {
 	struct lext3_file_node *lext3_fnode;
-	unsigned long goal;
+	unsigned long goal, phy, gen;
+	unsigned long count;
 	int boundary = 0;
 	struct indirect_block_desc chain[4];
 	struct indirect_block_desc *partial;
@@ -832,6 +923,17 @@ int lext3_find_block(struct journal_handle *handle, struct file_node *fnode,
 
 	ASSERT(handle || !create);
 
+	if (!max_blocks)
+		max_blocks = 1;
+
+	count = lext3_extent_lookup(fnode, iblock, &phy);
+	if (count) {
+		blkbuf_clear_new(blkbuf);
+		blkbuf_set_map_data(blkbuf, fnode->super, phy);
+
+		return min(count, max_blocks);
+	}
+
 	depth = lext3_block_to_path(fnode, iblock, offsets, &boundary);
 	lext3_fnode = fnode_to_lext3(fnode);
 
@@ -842,6 +944,11 @@ int lext3_find_block(struct journal_handle *handle, struct file_node *fnode,
 		goto out;
 
 reread:
+	/**
+	 * 在读取间接块之前获得缓存版本号
+	 * 如果期间发生了截断，读到的映射不能加入缓存
+	 */
+	gen = lext3_extent_gen(fnode);
 	partial = lext3_read_branch(fnode, depth, offsets, chain, &err);
 
 	/**
@@ -849,6 +956,16 @@ reread:
 	 */
 	if (!partial) {
 		blkbuf_clear_new(blkbuf);
+		count = count_leaf_run(fnode, depth, offsets, chain + depth - 1);
+		lext3_extent_add(fnode, gen, iblock,
+			le32_to_cpu(chain[depth - 1].child_block_num), count);
+		/**
+		 * 映射的最后一块不是末级间接块的最后一项
+		 */
+		if (count > max_blocks) {
+			count = max_blocks;
+			boundary = 0;
+		}
 		goto got_it;
 	}
 
@@ -875,17 +992,19 @@ reread:
 	}
 
 	left = (chain + depth) - partial;
+	count = count_leaf_holes(fnode, depth, offsets, partial, left, max_blocks);
 	/**
 	 * 为逻辑块创建中间间接块
 	 */
 	err = alloc_branch(handle, fnode, left, goal,
-		offsets + (partial - chain), partial);
+		offsets + (partial - chain), partial, &count);
 
 	/**
 	 * 将已经分配的间接块与文件节点关联起来 
 	 */
 	if (!err)
-		err = stick_branch(handle, fnode, iblock, chain, partial, left);
+		err = stick_branch(handle, fnode, iblock, chain, partial,
+					left, count);
 
 	if (!err && extend && fnode->file_size > lext3_fnode->filesize_disk)
 		lext3_fnode->filesize_disk = fnode->file_size;
@@ -902,6 +1021,8 @@ reread:
 	 * 新分配的块
 	 */
 	blkbuf_set_new(blkbuf);
+	lext3_extent_add(fnode, gen,
+		iblock, le32_to_cpu(chain[depth - 1].child_block_num), count);
 
 	goto got_it;
 
@@ -926,7 +1047,20 @@ cleanup:
 		partial--;
 	}
 out:
-	return err;
+	return err ? err : count;
+}
+
+/**
+ * 查找或者创建文件节点的单个逻辑块
+ */
+int lext3_find_block(struct journal_handle *handle, struct file_node *fnode,
+	sector_t iblock, struct blkbuf_desc *blkbuf, int create, int extend)
+{
+	int ret;
+
+	ret = lext3_map_blocks(handle, fnode, iblock, 1, blkbuf, create, extend);
+
+	return ret > 0 ? 0 : ret;
 }
 
 /**
@@ -948,6 +1082,31 @@ int lext3_get_datablock(struct file_node *fnode, sector_t iblock,
 	return ret;
 }
 
+/**
+ * 一次映射多个连续的数据块
+ * 映射的长度通过blkbuf->size返回
+ */
+int lext3_get_blocks(struct file_node *fnode, sector_t iblock,
+	unsigned long max_blocks, struct blkbuf_desc *blkbuf, int create)
+{
+	struct journal_handle *handle = NULL;
+	int ret;
+
+	if (create) {
+		handle = lext3_get_journal_handle();
+		ASSERT(handle);
+	}
+
+	ret = lext3_map_blocks(handle, fnode, iblock, max_blocks,
+				blkbuf, create, 1);
+	if (ret < 0)
+		return ret;
+
+	blkbuf->size = max(ret, 1) << fnode->block_size_order;
+
+	return 0;
+}
+
 int lext3_get_datablock_direct(struct file_node *fnode, sector_t iblock,
 	unsigned long max_blocks, struct blkbuf_desc *bh_result, int create)
 {
@@ -975,9 +1134,11 @@ int lext3_get_datablock_direct(struct file_node *fnode, sector_t iblock,
 
 get_block:
 	if (ret == 0)
-		ret = lext3_find_block(handle, fnode, iblock,
+		ret = lext3_map_blocks(handle, fnode, iblock, max_blocks,
 					bh_result, create, 0);
-	bh_result->size = (1 << fnode->block_size_order);
+	bh_result->size = max(ret, 1) << fnode->block_size_order;
+	if (ret > 0)
+		ret = 0;
 
 	return ret;
 }
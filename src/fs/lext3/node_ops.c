@@ -201,6 +201,1094 @@ static struct blkbuf_desc *create_metablock(struct journal_handle *handle,
 	return blkbuf;
 }
 
+/**
+ * 哈希索引目录(htree)
+ * 0号块是根，"."和".."之后存放索引项
+ * 中间索引块以一个空目录项开头，其后是索引项
+ * 叶子块仍然是普通的目录块，按哈希值范围划分
+ * 磁盘格式与ext3兼容
+ */
+
+/**
+ * 索引块中占位的空目录项
+ */
+struct fake_dir_item {
+	__le32	file_node_num;
+	__le16	rec_len;
+	__u8	name_len;
+	__u8	file_type;
+};
+
+/**
+ * 第一个索引项的哈希字段保存索引项数量和上限
+ */
+struct dx_countlimit {
+	__le16 limit;
+	__le16 count;
+};
+
+struct dx_entry {
+	__le32 hash;
+	__le32 block;
+};
+
+/**
+ * 根索引块
+ */
+struct dx_root {
+	struct fake_dir_item dot;
+	char dot_name[4];
+	struct fake_dir_item dotdot;
+	char dotdot_name[4];
+	struct dx_root_info {
+		__le32 reserved_zero;
+		/**
+		 * 哈希算法
+		 */
+		u8 hash_version;
+		/**
+		 * 本结构的长度，为8
+		 */
+		u8 info_length;
+		/**
+		 * 中间索引块的层数，最多为1
+		 */
+		u8 indirect_levels;
+		u8 unused_flags;
+	} info;
+	struct dx_entry	entries[0];
+};
+
+/**
+ * 中间索引块
+ */
+struct dx_node {
+	struct fake_dir_item fake;
+	struct dx_entry	entries[0];
+};
+
+/**
+ * 从根到叶子的查找路径
+ */
+struct dx_frame {
+	struct blkbuf_desc *blkbuf;
+	struct dx_entry *entries;
+	struct dx_entry *at;
+};
+
+/**
+ * 分裂叶子块时，按哈希值排序目录项用
+ */
+struct dx_map_entry {
+	u32 hash;
+	u16 offs;
+	u16 size;
+};
+
+static inline unsigned dx_get_block(struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->block) & 0x00ffffff;
+}
+
+static inline void dx_set_block(struct dx_entry *entry, unsigned value)
+{
+	entry->block = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_hash(struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->hash);
+}
+
+static inline void dx_set_hash(struct dx_entry *entry, unsigned value)
+{
+	entry->hash = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_count(struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *)entries)->count);
+}
+
+static inline unsigned dx_get_limit(struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *)entries)->limit);
+}
+
+static inline void dx_set_count(struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *)entries)->count = cpu_to_le16(value);
+}
+
+static inline void dx_set_limit(struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *)entries)->limit = cpu_to_le16(value);
+}
+
+static inline unsigned dx_root_limit(struct file_node *dir, unsigned infosize)
+{
+	unsigned entry_space = dir->super->block_size - lext3_dir_item_size(1)
+			- lext3_dir_item_size(2) - infosize;
+
+	return entry_space / sizeof(struct dx_entry);
+}
+
+static inline unsigned dx_node_limit(struct file_node *dir)
+{
+	unsigned entry_space = dir->super->block_size - lext3_dir_item_size(0);
+
+	return entry_space / sizeof(struct dx_entry);
+}
+
+static inline void dx_hash_init(struct file_node *dir,
+	struct lext3_dx_hash_info *hinfo, int hash_version)
+{
+	hinfo->hash_version = hash_version;
+	hinfo->seed = super_to_lext3(dir->super)->hash_seed;
+}
+
+/**
+ * 从根开始，沿着索引找到哈希值所在的叶子块
+ * 查找路径保存在frame_in中，返回最后一级
+ */
+static struct dx_frame *
+dx_probe(struct filenode_cache *fnode_cache, struct file_node *dir,
+	struct lext3_dx_hash_info *hinfo, struct dx_frame *frame_in, int *err)
+{
+	struct dx_entry *at, *entries, *p, *q, *m;
+	struct dx_frame *frame = frame_in;
+	struct blkbuf_desc *blkbuf;
+	unsigned count, indirect;
+	struct dx_root *root;
+	u32 hash;
+
+	frame->blkbuf = NULL;
+	if (fnode_cache)
+		dir = fnode_cache->parent->file_node;
+
+	blkbuf = lext3_read_metablock(NULL, dir, 0, 0, err);
+	if (!blkbuf)
+		goto fail;
+
+	root = (struct dx_root *)blkbuf->block_data;
+	if (root->info.hash_version != DX_HASH_TEA
+	    && root->info.hash_version != DX_HASH_HALF_MD4
+	    && root->info.hash_version != DX_HASH_LEGACY) {
+		lext3_warning(dir->super, __FUNCTION__,
+			"Unrecognised file_node hash code %d",
+			root->info.hash_version);
+		goto bad;
+	}
+
+	dx_hash_init(dir, hinfo, root->info.hash_version);
+	if (fnode_cache)
+		lext3_dirhash(fnode_cache->file_name.name,
+			fnode_cache->file_name.len, hinfo);
+	hash = hinfo->hash;
+
+	if (root->info.unused_flags & 1) {
+		lext3_warning(dir->super, __FUNCTION__,
+			"Unimplemented file_node hash flags: %#06x",
+			root->info.unused_flags);
+		goto bad;
+	}
+
+	indirect = root->info.indirect_levels;
+	if (indirect > 1) {
+		lext3_warning(dir->super, __FUNCTION__,
+			"Unimplemented file_node hash depth: %#06x",
+			root->info.indirect_levels);
+		goto bad;
+	}
+
+	entries = (struct dx_entry *)(((char *)&root->info)
+				+ root->info.info_length);
+	if (dx_get_limit(entries) != dx_root_limit(dir,
+	    root->info.info_length)) {
+		lext3_warning(dir->super, __FUNCTION__,
+			"dx entry: limit != root limit");
+		goto bad;
+	}
+
+	while (1) {
+		count = dx_get_count(entries);
+		if (!count || count > dx_get_limit(entries)) {
+			lext3_warning(dir->super, __FUNCTION__,
+				"dx entry: no count or count > limit");
+			goto bad;
+		}
+
+		/**
+		 * 二分查找最后一个哈希值不大于hash的索引项
+		 * 第一个索引项没有哈希值，覆盖最小的哈希范围
+		 */
+		p = entries + 1;
+		q = entries + count - 1;
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (dx_get_hash(m) > hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+
+		at = p - 1;
+		frame->blkbuf = blkbuf;
+		frame->entries = entries;
+		frame->at = at;
+		if (!indirect--)
+			return frame;
+
+		blkbuf = lext3_read_metablock(NULL, dir, dx_get_block(at), 0, err);
+		if (!blkbuf)
+			goto fail2;
+
+		at = entries = ((struct dx_node *)blkbuf->block_data)->entries;
+		if (dx_get_limit(entries) != dx_node_limit(dir)) {
+			lext3_warning(dir->super, __FUNCTION__,
+				"dx entry: limit != node limit");
+			goto bad;
+		}
+
+		frame++;
+		frame->blkbuf = NULL;
+	}
+
+bad:
+	loosen_blkbuf(blkbuf);
+	*err = ERR_BAD_DX_DIR;
+fail2:
+	while (frame >= frame_in) {
+		loosen_blkbuf(frame->blkbuf);
+		frame--;
+	}
+fail:
+	if (!*err)
+		*err = ERR_BAD_DX_DIR;
+	if (*err == ERR_BAD_DX_DIR)
+		lext3_warning(dir->super, __FUNCTION__,
+			"Corrupt dir file_node %ld, running e2fsck is "
+			"recommended.", dir->node_num);
+
+	return NULL;
+}
+
+static void dx_release(struct dx_frame *frames)
+{
+	struct dx_root *root;
+
+	if (frames[0].blkbuf == NULL)
+		return;
+
+	root = (struct dx_root *)frames[0].blkbuf->block_data;
+	if (root->info.indirect_levels)
+		loosen_blkbuf(frames[1].blkbuf);
+	loosen_blkbuf(frames[0].blkbuf);
+}
+
+/**
+ * 沿着索引移动到下一个叶子块
+ * hash的最低位为1时，总是移动，readdir使用
+ * 否则仅当下一个叶子块是哈希冲突的延续时才移动
+ * 返回1表示移动成功，0表示没有可继续查找的块
+ */
+static int dx_next_block(struct file_node *dir, u32 hash,
+	struct dx_frame *frame, struct dx_frame *frames, u32 *start_hash)
+{
+	struct blkbuf_desc *blkbuf;
+	int err, num_frames = 0;
+	struct dx_frame *p;
+	u32 bhash;
+
+	p = frame;
+	/**
+	 * 本级索引块已经遍历完毕，回到上一级
+	 */
+	while (1) {
+		if (++(p->at) < p->entries + dx_get_count(p->entries))
+			break;
+		if (p == frames)
+			return 0;
+		num_frames++;
+		p--;
+	}
+
+	bhash = dx_get_hash(p->at);
+	if (start_hash)
+		*start_hash = bhash;
+	if ((hash & 1) == 0) {
+		if ((bhash & ~1) != hash)
+			return 0;
+	}
+
+	/**
+	 * 重新读入下面各级的索引块
+	 */
+	while (num_frames--) {
+		blkbuf = lext3_read_metablock(NULL, dir, dx_get_block(p->at),
+			0, &err);
+		if (!blkbuf)
+			return err;
+		p++;
+		loosen_blkbuf(p->blkbuf);
+		p->blkbuf = blkbuf;
+		p->at = p->entries = ((struct dx_node *)blkbuf->block_data)->entries;
+	}
+
+	return 1;
+}
+
+/**
+ * 将一个叶子块中，哈希值不小于起始值的目录项加入readdir的红黑树
+ * 返回加入的目录项数量
+ */
+static int dx_dirblock_to_tree(struct file *dir_file, struct file_node *dir,
+	int block, struct lext3_dx_hash_info *hinfo,
+	u32 start_hash, u32 start_minor_hash)
+{
+	struct lext3_dir_item *dir_item, *top;
+	struct blkbuf_desc *blkbuf;
+	int err, count = 0;
+
+	blkbuf = lext3_read_metablock(NULL, dir, block, 0, &err);
+	if (!blkbuf)
+		return err;
+
+	dir_item = first_dir_item(blkbuf);
+	top = (struct lext3_dir_item *)(blkbuf->block_data
+			+ dir->super->block_size - lext3_dir_item_size(0));
+	for (; dir_item < top; dir_item = next_dir_item(dir_item)) {
+		if (!lext3_verify_dir_item("dx_dirblock_to_tree", dir,
+		    dir_item, blkbuf, (block << dir->super->block_size_order)
+		    + ((char *)dir_item - blkbuf->block_data))) {
+			/**
+			 * 出错了，跳到下一块
+			 */
+			dir_file->pos = (dir_file->pos |
+				(dir->super->block_size - 1)) + 1;
+			loosen_blkbuf(blkbuf);
+			return count;
+		}
+
+		lext3_dirhash(dir_item->name, dir_item->name_len, hinfo);
+		if ((hinfo->hash < start_hash)
+		    || ((hinfo->hash == start_hash)
+		    && (hinfo->minor_hash < start_minor_hash)))
+			continue;
+
+		if (dir_item->file_node_num == 0)
+			continue;
+
+		err = lext3_htree_store_dirent(dir_file, hinfo->hash,
+					hinfo->minor_hash, dir_item);
+		if (err) {
+			loosen_blkbuf(blkbuf);
+			return err;
+		}
+		count++;
+	}
+	loosen_blkbuf(blkbuf);
+
+	return count;
+}
+
+/**
+ * 从start_hash开始，按哈希顺序将目录项加入readdir的红黑树
+ * 至少读取一个叶子块，并且不会把一组哈希冲突的目录项拆开
+ * next_hash返回下一次开始的哈希值，~0表示没有了
+ */
+int lext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
+	__u32 start_minor_hash, __u32 *next_hash)
+{
+	struct lext3_dx_hash_info hinfo;
+	struct lext3_dir_item *dir_item;
+	struct dx_frame frames[2], *frame;
+	struct lext3_superblock *lext3_super;
+	struct file_node *dir;
+	int block, err;
+	int count = 0;
+	u32 hashval;
+	int ret;
+
+	dir = dir_file->fnode_cache->file_node;
+	lext3_super = super_to_lext3(dir->super);
+	/**
+	 * 只有一个块的目录还没有索引，直接按哈希排序
+	 */
+	if (!(fnode_to_lext3(dir)->flags & LEXT3_INDEX_FL)) {
+		dx_hash_init(dir, &hinfo, lext3_super->def_hash_version);
+		count = dx_dirblock_to_tree(dir_file, dir, 0, &hinfo,
+					start_hash, start_minor_hash);
+		*next_hash = ~0;
+		return count;
+	}
+
+	hinfo.hash = start_hash;
+	hinfo.minor_hash = 0;
+	frame = dx_probe(NULL, dir, &hinfo, frames, &err);
+	if (!frame)
+		return err;
+
+	/**
+	 * 根块中的"."和".."，哈希值分别看作0和2
+	 */
+	if (!start_hash && !start_minor_hash) {
+		dir_item = (struct lext3_dir_item *)frames[0].blkbuf->block_data;
+		err = lext3_htree_store_dirent(dir_file, 0, 0, dir_item);
+		if (err)
+			goto out;
+		count++;
+	}
+	if (start_hash < 2 || (start_hash == 2 && start_minor_hash == 0)) {
+		dir_item = (struct lext3_dir_item *)frames[0].blkbuf->block_data;
+		dir_item = next_dir_item(dir_item);
+		err = lext3_htree_store_dirent(dir_file, 2, 0, dir_item);
+		if (err)
+			goto out;
+		count++;
+	}
+
+	while (1) {
+		block = dx_get_block(frame->at);
+		ret = dx_dirblock_to_tree(dir_file, dir, block, &hinfo,
+					start_hash, start_minor_hash);
+		if (ret < 0) {
+			err = ret;
+			goto out;
+		}
+		count += ret;
+
+		hashval = ~0;
+		ret = dx_next_block(dir, 1, frame, frames, &hashval);
+		*next_hash = hashval;
+		if (ret < 0) {
+			err = ret;
+			goto out;
+		}
+
+		/**
+		 * 没有更多的块，或者已经读到了目录项
+		 * 并且下一块不是哈希冲突的延续
+		 */
+		if ((ret == 0) || (count && ((hashval & 1) == 0)))
+			break;
+	}
+	dx_release(frames);
+
+	return count;
+
+out:
+	dx_release(frames);
+
+	return err;
+}
+
+/**
+ * 在磁盘块缓冲区中，查找特定名称的文件名
+ */
+static int find_in_block(struct blkbuf_desc *blkbuf, struct file_node *dir,
+	struct filenode_cache *fnode_cache, unsigned long offset,
+	struct lext3_dir_item **res_dir)
+{
+	struct lext3_dir_item *dir_item;
+	char *blkbuf_end;
+	int name_len;
+	int item_len;
+	char *name;
+
+	blkbuf_end = blkbuf->block_data + dir->super->block_size;
+	dir_item = (struct lext3_dir_item *) blkbuf->block_data;
+	name = fnode_cache->file_name.name;
+	name_len = fnode_cache->file_name.len;
+
+	/**
+	 * 遍历块缓冲区，查找每一个目录项
+	 */
+	while ((char *)dir_item < blkbuf_end) {
+		/**
+		 * 防止磁盘坏数据引起死循环
+		 */
+		item_len = le16_to_cpu(dir_item->rec_len);
+		if (item_len <= 0)
+			return -1;
+
+		if ((char *)next_dir_item(dir_item) <= blkbuf_end &&
+		    file_equal (name_len, name, dir_item)) {
+			/**
+			 * 验证目录项是否正确
+			 */
+			if (!lext3_verify_dir_item("find_in_dir", dir, dir_item,
+			    blkbuf, offset))
+				return -1;
+
+			/**
+			 * 文件名称匹配，并且目录项有效
+			 */
+			*res_dir = dir_item;
+			return 1;
+		}
+
+		offset += item_len;
+		dir_item = next_dir_item(dir_item);
+	}
+
+	return 0;
+}
+
+/**
+ * 在索引目录中查找文件，只需要读取哈希值对应的叶子块
+ */
+static struct blkbuf_desc *dx_find_in_dir(struct filenode_cache *fnode_cache,
+	struct lext3_dir_item **res, int *err)
+{
+	struct dx_frame frames[2], *frame;
+	struct lext3_dx_hash_info hinfo;
+	struct blkbuf_desc *blkbuf;
+	struct super_block *super;
+	struct file_node *dir;
+	unsigned long block;
+	int found, ret;
+
+	dir = fnode_cache->parent->file_node;
+	super = dir->super;
+
+	frame = dx_probe(fnode_cache, NULL, &hinfo, frames, err);
+	if (!frame)
+		return NULL;
+
+	do {
+		block = dx_get_block(frame->at);
+		blkbuf = lext3_read_metablock(NULL, dir, block, 0, err);
+		if (!blkbuf)
+			goto out;
+
+		/**
+		 * 叶子块与普通目录块格式相同，逐项检查目录项长度
+		 * 以防损坏的目录项造成死循环
+		 */
+		found = find_in_block(blkbuf, dir, fnode_cache,
+			block << super->block_size_order, res);
+		if (found == 1) {
+			dx_release(frames);
+			return blkbuf;
+		}
+
+		if (found < 0) {
+			lext3_enconter_error(super, "bad entry in leaf block %lu "
+				"of directory #%lu", block, dir->node_num);
+			loosen_blkbuf(blkbuf);
+			*err = -EIO;
+			goto out;
+		}
+		loosen_blkbuf(blkbuf);
+
+		/**
+		 * 哈希冲突的目录项可能延续到下一个叶子块
+		 */
+		ret = dx_next_block(dir, hinfo.hash, frame, frames, NULL);
+		if (ret < 0) {
+			lext3_warning(super, __FUNCTION__,
+				"error reading index page in directory #%lu",
+				dir->node_num);
+			*err = ret;
+			goto out;
+		}
+	} while (ret == 1);
+
+	*err = -ENOENT;
+out:
+	dx_release(frames);
+
+	return NULL;
+}
+
+/**
+ * 计算块中每个有效目录项的哈希值，从map_tail向前存放
+ */
+static int dx_make_map(struct lext3_dir_item *dir_item, int size,
+	struct lext3_dx_hash_info *hinfo, struct dx_map_entry *map_tail)
+{
+	struct lext3_dx_hash_info h = *hinfo;
+	char *base = (char *)dir_item;
+	int count = 0;
+
+	while ((char *)dir_item < base + size) {
+		if (dir_item->name_len && dir_item->file_node_num) {
+			lext3_dirhash(dir_item->name, dir_item->name_len, &h);
+			map_tail--;
+			map_tail->hash = h.hash;
+			map_tail->offs = (u16)((char *)dir_item - base);
+			map_tail->size = lext3_dir_item_size(dir_item->name_len);
+			count++;
+		}
+		dir_item = next_dir_item(dir_item);
+	}
+
+	return count;
+}
+
+static inline void dx_swap_map(struct dx_map_entry *a, struct dx_map_entry *b)
+{
+	struct dx_map_entry tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/**
+ * 梳排序，然后冒泡收尾
+ */
+static void dx_sort_map(struct dx_map_entry *map, unsigned count)
+{
+	struct dx_map_entry *p, *q, *top = map + count - 1;
+	int more;
+
+	while (count > 2) {
+		count = count * 10 / 13;
+		if (count - 9 < 2)
+			count = 11;
+		for (p = top, q = p - count; q >= map; p--, q--)
+			if (p->hash < q->hash)
+				dx_swap_map(p, q);
+	}
+
+	do {
+		more = 0;
+		q = top;
+		while (q-- > map) {
+			if (q[1].hash >= q[0].hash)
+				continue;
+			dx_swap_map(q + 1, q);
+			more = 1;
+		}
+	} while (more);
+}
+
+/**
+ * 在frame->at之后插入一个索引项
+ */
+static void dx_insert_block(struct dx_frame *frame, u32 hash, u32 block)
+{
+	struct dx_entry *entries = frame->entries;
+	struct dx_entry *old = frame->at, *new = old + 1;
+	int count = dx_get_count(entries);
+
+	ASSERT(count < dx_get_limit(entries));
+	ASSERT(old < entries + count);
+	memmove(new + 1, new, (char *)(entries + count) - (char *)(new));
+	dx_set_hash(new, hash);
+	dx_set_block(new, block);
+	dx_set_count(entries, count + 1);
+}
+
+/**
+ * 将map中的count个目录项从from块移动到to块
+ * 返回最后一个移动的目录项
+ */
+static struct lext3_dir_item *
+dx_move_dirents(char *from, char *to, struct dx_map_entry *map, int count)
+{
+	unsigned rec_len = 0;
+
+	while (count--) {
+		struct lext3_dir_item *dir_item;
+
+		dir_item = (struct lext3_dir_item *)(from + map->offs);
+		rec_len = lext3_dir_item_size(dir_item->name_len);
+		memcpy(to, dir_item, rec_len);
+		((struct lext3_dir_item *)to)->rec_len = cpu_to_le16(rec_len);
+		dir_item->file_node_num = 0;
+		map++;
+		to += rec_len;
+	}
+
+	return (struct lext3_dir_item *)(to - rec_len);
+}
+
+/**
+ * 将块中剩余的目录项压缩到块的前部
+ * 返回最后一个目录项
+ */
+static struct lext3_dir_item *dx_pack_dirents(char *base, int size)
+{
+	struct lext3_dir_item *next, *to, *prev;
+	struct lext3_dir_item *dir_item;
+	unsigned rec_len = 0;
+
+	dir_item = (struct lext3_dir_item *)base;
+	prev = to = dir_item;
+	while ((char *)dir_item < base + size) {
+		next = next_dir_item(dir_item);
+		if (dir_item->file_node_num && dir_item->name_len) {
+			rec_len = lext3_dir_item_size(dir_item->name_len);
+			if (dir_item > to)
+				memmove(to, dir_item, rec_len);
+			to->rec_len = cpu_to_le16(rec_len);
+			prev = to;
+			to = (struct lext3_dir_item *)((char *)to + rec_len);
+		}
+		dir_item = next;
+	}
+
+	return prev;
+}
+
+/**
+ * 分裂已满的叶子块
+ * 按哈希值排序后，将大约一半的目录项移动到新块，并在索引中插入新块
+ * 返回新目录项应当插入的块中的最后一个目录项
+ */
+static struct lext3_dir_item *
+dx_split_leaf(struct journal_handle *handle, struct file_node *dir,
+	struct blkbuf_desc **pblkbuf, struct dx_frame *frame,
+	struct lext3_dx_hash_info *hinfo, int *perr)
+{
+	unsigned blocksize = dir->super->block_size;
+	struct lext3_dir_item *dir_item, *dir_item2;
+	char *data1 = (*pblkbuf)->block_data, *data2;
+	unsigned count, continued;
+	struct blkbuf_desc *blkbuf2;
+	struct dx_map_entry *map;
+	unsigned split, move, size;
+	u32 newblock, hash2;
+	int err = 0;
+	int i;
+
+	blkbuf2 = create_metablock(handle, dir, &newblock, &err);
+	if (!blkbuf2) {
+		loosen_blkbuf(*pblkbuf);
+		*pblkbuf = NULL;
+		goto out;
+	}
+
+	err = lext3_journal_get_write_access(handle, *pblkbuf);
+	if (err)
+		goto journal_error;
+
+	err = lext3_journal_get_write_access(handle, frame->blkbuf);
+	if (err)
+		goto journal_error;
+
+	data2 = blkbuf2->block_data;
+
+	/**
+	 * 临时将排序表放在新块的末尾
+	 */
+	map = (struct dx_map_entry *)(data2 + blocksize);
+	count = dx_make_map((struct lext3_dir_item *)data1, blocksize, hinfo, map);
+	map -= count;
+	dx_sort_map(map, count);
+
+	/**
+	 * 按占用空间，将块从中间一分为二
+	 */
+	size = 0;
+	move = 0;
+	for (i = count - 1; i > 0; i--) {
+		if (size + map[i].size / 2 > blocksize / 2)
+			break;
+		size += map[i].size;
+		move++;
+	}
+	split = count - move;
+	hash2 = map[split].hash;
+	/**
+	 * 分界两侧的哈希值相同，在索引项中打上冲突标记
+	 */
+	continued = hash2 == map[split - 1].hash;
+
+	dir_item2 = dx_move_dirents(data1, data2, map + split, count - split);
+	dir_item = dx_pack_dirents(data1, blocksize);
+	dir_item->rec_len = cpu_to_le16(data1 + blocksize - (char *)dir_item);
+	dir_item2->rec_len = cpu_to_le16(data2 + blocksize - (char *)dir_item2);
+
+	/**
+	 * 新目录项属于哪个块?
+	 */
+	if (hinfo->hash >= hash2) {
+		struct blkbuf_desc *tmp = *pblkbuf;
+
+		*pblkbuf = blkbuf2;
+		blkbuf2 = tmp;
+		dir_item = dir_item2;
+	}
+
+	dx_insert_block(frame, hash2 + continued, newblock);
+	err = lext3_journal_dirty_metadata(handle, blkbuf2);
+	if (err)
+		goto journal_error;
+
+	err = lext3_journal_dirty_metadata(handle, frame->blkbuf);
+	if (err)
+		goto journal_error;
+
+	loosen_blkbuf(blkbuf2);
+
+	return dir_item;
+
+journal_error:
+	loosen_blkbuf(*pblkbuf);
+	loosen_blkbuf(blkbuf2);
+	*pblkbuf = NULL;
+	lext3_std_error(dir->super, err);
+out:
+	*perr = err;
+
+	return NULL;
+}
+
+/**
+ * 在索引目录中添加目录项
+ * 叶子块已满时分裂，索引块已满时分裂索引块或者增加一级索引
+ */
+static int dx_add_dir_item(struct journal_handle *handle,
+	struct filenode_cache *fnode_cache, struct file_node *fnode)
+{
+	struct dx_frame frames[2], *frame;
+	struct lext3_dx_hash_info hinfo;
+	struct lext3_dir_item *dir_item;
+	struct dx_entry *entries, *at;
+	struct blkbuf_desc *blkbuf;
+	struct super_block *super;
+	struct file_node *dir;
+	int err;
+
+	dir = fnode_cache->parent->file_node;
+	super = dir->super;
+
+	frame = dx_probe(fnode_cache, NULL, &hinfo, frames, &err);
+	if (!frame)
+		return err;
+
+	entries = frame->entries;
+	at = frame->at;
+
+	blkbuf = lext3_read_metablock(handle, dir, dx_get_block(frame->at),
+				0, &err);
+	if (!blkbuf)
+		goto cleanup;
+
+	err = lext3_journal_get_write_access(handle, blkbuf);
+	if (err)
+		goto journal_error;
+
+	err = add_to_blkbuf(handle, fnode_cache, fnode, NULL, blkbuf);
+	if (err != -ENOSPC) {
+		blkbuf = NULL;
+		goto cleanup;
+	}
+
+	/**
+	 * 叶子块满了，要分裂。首先看索引块是否也满了
+	 */
+	if (dx_get_count(entries) == dx_get_limit(entries)) {
+		unsigned icount = dx_get_count(entries);
+		int levels = frame - frames;
+		struct blkbuf_desc *blkbuf2;
+		struct dx_entry *entries2;
+		struct dx_node *node2;
+		u32 newblock;
+
+		if (levels && (dx_get_count(frames->entries) ==
+		    dx_get_limit(frames->entries))) {
+			lext3_warning(super, __FUNCTION__,
+				"Directory index full!");
+			err = -ENOSPC;
+			goto cleanup;
+		}
+
+		blkbuf2 = create_metablock(handle, dir, &newblock, &err);
+		if (!blkbuf2)
+			goto cleanup;
+
+		node2 = (struct dx_node *)blkbuf2->block_data;
+		entries2 = node2->entries;
+		node2->fake.rec_len = cpu_to_le16(super->block_size);
+		node2->fake.file_node_num = 0;
+		err = lext3_journal_get_write_access(handle, frame->blkbuf);
+		if (err)
+			goto journal_error;
+
+		if (levels) {
+			unsigned icount1 = icount / 2, icount2 = icount - icount1;
+			unsigned hash2 = dx_get_hash(entries + icount1);
+
+			/**
+			 * 将中间索引块一分为二，在根中插入新的索引块
+			 */
+			err = lext3_journal_get_write_access(handle,
+						frames[0].blkbuf);
+			if (err)
+				goto journal_error;
+
+			memcpy((char *)entries2, (char *)(entries + icount1),
+				icount2 * sizeof(struct dx_entry));
+			dx_set_count(entries, icount1);
+			dx_set_count(entries2, icount2);
+			dx_set_limit(entries2, dx_node_limit(dir));
+
+			/**
+			 * 新目录项属于哪个索引块?
+			 */
+			if (at - entries >= icount1) {
+				struct blkbuf_desc *tmp = frame->blkbuf;
+
+				frame->at = at = at - entries - icount1 + entries2;
+				frame->entries = entries = entries2;
+				frame->blkbuf = blkbuf2;
+				blkbuf2 = tmp;
+			}
+			dx_insert_block(frames + 0, hash2, newblock);
+			err = lext3_journal_dirty_metadata(handle, blkbuf2);
+			if (err)
+				goto journal_error;
+			loosen_blkbuf(blkbuf2);
+		} else {
+			/**
+			 * 根索引满了，将根中的索引项移到新的中间索引块
+			 * 根中只保留一项，指向新块
+			 */
+			memcpy((char *)entries2, (char *)entries,
+				icount * sizeof(struct dx_entry));
+			dx_set_limit(entries2, dx_node_limit(dir));
+
+			dx_set_count(entries, 1);
+			dx_set_block(entries + 0, newblock);
+			((struct dx_root *)frames[0].blkbuf->block_data)
+				->info.indirect_levels = 1;
+
+			frame = frames + 1;
+			frame->at = at = at - entries + entries2;
+			frame->entries = entries = entries2;
+			frame->blkbuf = blkbuf2;
+			err = lext3_journal_get_write_access(handle,
+						frame->blkbuf);
+			if (err)
+				goto journal_error;
+		}
+		lext3_journal_dirty_metadata(handle, frames[0].blkbuf);
+	}
+
+	dir_item = dx_split_leaf(handle, dir, &blkbuf, frame, &hinfo, &err);
+	if (!dir_item)
+		goto cleanup;
+
+	err = add_to_blkbuf(handle, fnode_cache, fnode, dir_item, blkbuf);
+	blkbuf = NULL;
+	goto cleanup;
+
+journal_error:
+	lext3_std_error(dir->super, err);
+cleanup:
+	if (blkbuf)
+		loosen_blkbuf(blkbuf);
+	dx_release(frames);
+
+	return err;
+}
+
+/**
+ * 只有一个块的目录满了，将它转换为索引目录
+ * 0号块变为根，原有的目录项移动到新块中，再将新块分裂
+ */
+static int make_indexed_dir(struct journal_handle *handle,
+	struct filenode_cache *fnode_cache, struct file_node *fnode,
+	struct blkbuf_desc *blkbuf)
+{
+	struct lext3_dir_item *dir_item, *dir_item2;
+	struct dx_frame frames[2], *frame;
+	struct lext3_dx_hash_info hinfo;
+	struct fake_dir_item *fake;
+	struct blkbuf_desc *blkbuf2;
+	struct dx_entry *entries;
+	struct dx_root *root;
+	struct file_node *dir;
+	unsigned blocksize;
+	char *data1, *top;
+	unsigned len;
+	int retval;
+	u32 block;
+
+	dir = fnode_cache->parent->file_node;
+	blocksize = dir->super->block_size;
+
+	retval = lext3_journal_get_write_access(handle, blkbuf);
+	if (retval) {
+		lext3_std_error(dir->super, retval);
+		loosen_blkbuf(blkbuf);
+		return retval;
+	}
+	root = (struct dx_root *)blkbuf->block_data;
+
+	blkbuf2 = create_metablock(handle, dir, &block, &retval);
+	if (!blkbuf2) {
+		loosen_blkbuf(blkbuf);
+		return retval;
+	}
+	fnode_to_lext3(dir)->flags |= LEXT3_INDEX_FL;
+	data1 = blkbuf2->block_data;
+
+	/**
+	 * 将".."之后的目录项移到新块
+	 */
+	fake = &root->dotdot;
+	dir_item = (struct lext3_dir_item *)((char *)fake
+				+ le16_to_cpu(fake->rec_len));
+	len = ((char *)root) + blocksize - (char *)dir_item;
+	memcpy(data1, dir_item, len);
+	dir_item = (struct lext3_dir_item *)data1;
+	top = data1 + len;
+	while ((char *)(dir_item2 = next_dir_item(dir_item)) < top)
+		dir_item = dir_item2;
+	dir_item->rec_len = cpu_to_le16(data1 + blocksize - (char *)dir_item);
+
+	/**
+	 * 初始化根，"."和".."已经存在
+	 */
+	fake->rec_len = cpu_to_le16(blocksize - lext3_dir_item_size(1));
+	memset(&root->info, 0, sizeof(root->info));
+	root->info.info_length = sizeof(root->info);
+	root->info.hash_version = super_to_lext3(dir->super)->def_hash_version;
+	entries = root->entries;
+	dx_set_block(entries, block);
+	dx_set_count(entries, 1);
+	dx_set_limit(entries, dx_root_limit(dir, sizeof(root->info)));
+
+	dx_hash_init(dir, &hinfo, root->info.hash_version);
+	lext3_dirhash(fnode_cache->file_name.name,
+		fnode_cache->file_name.len, &hinfo);
+	frame = frames;
+	frame->entries = entries;
+	frame->at = entries;
+	frame->blkbuf = blkbuf;
+	blkbuf = blkbuf2;
+	dir_item = dx_split_leaf(handle, dir, &blkbuf, frame, &hinfo, &retval);
+	dx_release(frames);
+	if (!dir_item)
+		return retval;
+
+	return add_to_blkbuf(handle, fnode_cache, fnode, dir_item, blkbuf);
+}
+
+/**
+ * 目录的第一个块是否可以转换为根索引块
+ * 要求"."和".."位于块的开头
+ */
+static bool dx_can_index(struct file_node *dir, struct blkbuf_desc *blkbuf)
+{
+	struct lext3_dir_item *dot, *dotdot;
+
+	if (!LEXT3_HAS_COMPAT_FEATURE(dir->super, LEXT3_FEATURE_COMPAT_DIR_INDEX))
+		return false;
+
+	dot = first_dir_item(blkbuf);
+	dotdot = next_dir_item(dot);
+
+	return le16_to_cpu(dot->rec_len) == lext3_dir_item_size(1)
+		&& dot->name_len == 1 && dot->name[0] == '.'
+		&& dotdot->name_len == 2 && !memcmp(dotdot->name, "..", 2);
+}
+
 /**
  * 在目录的数据块中，增加一个目录项
  */
@@ -213,6 +1301,7 @@ static int add_dir_item (struct journal_handle *handle,
 	u32 block, block_count;
 	struct file_node *dir;
 	unsigned block_size;
+	int dx_fallback = 0;
 	int ret;
 
 	dir = fnode_cache->parent->file_node;
@@ -222,6 +1311,19 @@ static int add_dir_item (struct journal_handle *handle,
 	if (!fnode_cache->file_name.len)
 		return -EINVAL;
 
+	if (lext3_is_dx(dir)) {
+		ret = dx_add_dir_item(handle, fnode_cache, fnode);
+		if (ret != ERR_BAD_DX_DIR)
+			return ret;
+
+		/**
+		 * 索引损坏，退化为线性目录
+		 */
+		fnode_to_lext3(dir)->flags &= ~LEXT3_INDEX_FL;
+		dx_fallback = 1;
+		lext3_mark_fnode_dirty(handle, dir);
+	}
+
 	block_count = dir->file_size >> super->block_size_order;
 	for (block = 0; block < block_count; block++) {
 		blkbuf = lext3_read_metablock(handle, dir, block, 0, &ret);
@@ -235,6 +1337,12 @@ static int add_dir_item (struct journal_handle *handle,
 		if (ret != -ENOSPC)
 			return ret;
 
+		/**
+		 * 唯一的块满了，转换为索引目录
+		 */
+		if (block_count == 1 && !dx_fallback && dx_can_index(dir, blkbuf))
+			return make_indexed_dir(handle, fnode_cache, fnode, blkbuf);
+
 		loosen_blkbuf(blkbuf);
 	}
 
@@ -378,58 +1486,6 @@ retry:
 	return ret;
 }
 
-/**
- * 在磁盘块缓冲区中，查找特定名称的文件名
- */
-static int find_in_block(struct blkbuf_desc *blkbuf, struct file_node *dir,
-	struct filenode_cache *fnode_cache, unsigned long offset,
-	struct lext3_dir_item **res_dir)
-{
-	struct lext3_dir_item *dir_item;
-	char *blkbuf_end;
-	int name_len;
-	int item_len;
-	char *name;
-
-	blkbuf_end = blkbuf->block_data + dir->super->block_size;
-	dir_item = (struct lext3_dir_item *) blkbuf->block_data;
-	name = fnode_cache->file_name.name;
-	name_len = fnode_cache->file_name.len;
-
-	/**
-	 * 遍历块缓冲区，查找每一个目录项
-	 */
-	while ((char *)dir_item < blkbuf_end) {
-		/**
-		 * 防止磁盘坏数据引起死循环
-		 */
-		item_len = le16_to_cpu(dir_item->rec_len);
-		if (item_len <= 0)
-			return -1;
-
-		if ((char *)next_dir_item(dir_item) <= blkbuf_end &&
-		    file_equal (name_len, name, dir_item)) {
-			/**
-			 * 验证目录项是否正确
-			 */
-			if (!lext3_verify_dir_item("find_in_dir", dir, dir_item,
-			    blkbuf, offset))
-				return -1;
-
-			/**
-			 * 文件名称匹配，并且目录项有效
-			 */
-			*res_dir = dir_item;
-			return 1;
-		}
-
-		offset += item_len;
-		dir_item = next_dir_item(dir_item);
-	}
-
-	return 0;
-}
-
 /**
  * 在目录中搜索特定的文件
  */
@@ -453,6 +1509,16 @@ static struct blkbuf_desc *find_in_dir(struct filenode_cache *fnode_cache,
 	if (fnode_cache->file_name.len > LEXT3_NAME_LEN)
 		return NULL;
 
+	/**
+	 * 索引目录只需要读取一个叶子块
+	 * 索引损坏时退回到线性查找
+	 */
+	if (lext3_is_dx(dir)) {
+		blkbuf = dx_find_in_dir(fnode_cache, res, &err);
+		if (blkbuf || err != ERR_BAD_DX_DIR)
+			return blkbuf;
+	}
+
 	block_count = dir->file_size >> super->block_size_order;
 	lookup_start = fnode_to_lext3(dir)->lookup_start;
 	if (lookup_start >= block_count)
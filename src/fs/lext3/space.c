@@ -643,6 +643,10 @@ void lext3_truncate(struct file_node *fnode)
 	 * 使用该锁防止读写过程获得物理块号
 	 */
 	down(&lext3_fnode->truncate_sem);
+	/**
+	 * 丢弃被截断部分的区段缓存
+	 */
+	lext3_extent_truncate(fnode, last_block);
 
 	/**
 	 * 要保留的块与间接块无关，比较简单的情况
@@ -723,6 +727,11 @@ do_indirects:
 			;
 	}
 
+	/**
+	 * 释放期间并发的查找可能读到了正在释放的块
+	 * 再次递增版本号，使它们的结果不能进入缓存
+	 */
+	lext3_extent_truncate(fnode, last_block);
 	up(&lext3_fnode->truncate_sem);
 	/**
 	 * 记录文件访问时间
@@ -792,7 +801,8 @@ static int lext3_read_page(struct file *file, struct page_frame *page)
 static int lext3_read_pages(struct file *file, struct file_cache_space *space,
 		struct double_list *pages, unsigned nr_pages)
 {
-	return generic_readpages(space, pages, nr_pages, lext3_get_datablock);
+	return generic_readpages(space, pages, nr_pages,
+				lext3_get_datablock, lext3_get_blocks);
 }
 
 /**
@@ -853,13 +863,71 @@ static int lext3_release_page(struct page_frame *page, int wait)
 }
 
 /**
- * 暂不支持direct-IO
+ * 直接IO
+ * 写操作可能分配块，需要日志句柄
+ * 扩展文件时先将文件加入孤儿链表，避免崩溃后留下文件末尾之外的块
+ * IO完成后再更新文件长度
  */
 static ssize_t
 lext3_direct_IO(int rw, struct async_io_desc *aio, const struct io_segment *iov,
 	loff_t offset, unsigned long nr_segs)
 {
-	return -ENOSYS;
+	struct file_node *fnode = aio->file->cache_space->fnode;
+	struct lext3_file_node *lext3_fnode = fnode_to_lext3(fnode);
+	struct journal_handle *handle = NULL;
+	bool orphan = false;
+	ssize_t ret;
+	int err;
+
+	if (rw == WRITE) {
+		loff_t final_size = offset;
+		unsigned long seg;
+
+		for (seg = 0; seg < nr_segs; seg++)
+			final_size += iov[seg].len;
+
+		handle = lext3_start_journal(fnode, DIO_CREDITS);
+		if (IS_ERR(handle))
+			return PTR_ERR(handle);
+
+		if (final_size > fnode->file_size) {
+			ret = lext3_add_orphan(handle, fnode);
+			if (ret)
+				goto stop;
+			orphan = true;
+			lext3_fnode->filesize_disk = fnode->file_size;
+		}
+	}
+
+	ret = blockdev_direct_IO(rw, aio, fnode, fnode->super->blkdev, iov,
+			offset, nr_segs, lext3_get_datablock_direct, NULL);
+
+	/**
+	 * 分配块时可能重新启动了日志句柄
+	 */
+	handle = journal_current_handle();
+
+stop:
+	if (handle) {
+		if (orphan && fnode->link_count)
+			lext3_orphan_del(handle, fnode);
+
+		if (orphan && ret > 0) {
+			loff_t end = offset + ret;
+
+			if (end > fnode->file_size) {
+				lext3_fnode->filesize_disk = end;
+				fnode_set_size(fnode, end);
+				lext3_mark_fnode_dirty(handle, fnode);
+			}
+		}
+
+		err = lext3_stop_journal(handle);
+		if (ret == 0)
+			ret = err;
+	}
+
+	return ret;
 }
 
 static int lext3_get_write_access(struct journal_handle *handle,
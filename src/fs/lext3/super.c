@@ -25,20 +25,52 @@ static int setup_super(struct super_block *super, struct lext3_superblock_phy *p
 
 #define log2(n) ffz(~(n))
 
+/**
+ * 判断以逗号分隔的选项是否为name
+ */
+static int mount_opt_match(const char *opt, int len, const char *name)
+{
+	return len == strlen(name) && !strncmp(opt, name, len);
+}
+
 /**
  * 解析用户装载文件系统的选项
- * 目前省略，直接赋予默认值
+ * 目前只支持journal_async_commit，其他选项被忽略
  */
 static int parse_mount_opts(char *options, struct super_block *super,
 	unsigned long *journal_fnode_num, unsigned long *blocks_count,
 	int is_remount)
 {
+	struct lext3_superblock *lext3_super = super_to_lext3(super);
+	char *opt = options, *end;
+	int len;
+
 	if (journal_fnode_num)
 		*journal_fnode_num = 0;
 
 	if (blocks_count)
 		*blocks_count = 0;
-	
+
+	while (opt && *opt) {
+		end = strchr(opt, ',');
+		len = end ? end - opt : strlen(opt);
+
+		if (mount_opt_match(opt, len, "journal_async_commit")) {
+			/**
+			 * 会在日志超级块中设置不兼容标志
+			 * 只能在首次装载时指定
+			 */
+			if (is_remount)
+				printk(KERN_WARNING "LEXT3: can not change "
+				       "journal_async_commit on remount\n");
+			else
+				lext3_set_opt(lext3_super->mount_opt,
+					LEXT3_MOUNT_JOURNAL_ASYNC_COMMIT);
+		}
+
+		opt = end ? end + 1 : NULL;
+	}
+
 	return 1;
 }
 
@@ -133,6 +165,8 @@ static struct file_node *lext3_fnode_alloc(struct super_block *super)
 
 	list_init(&lext3_fnode->orphan);
 	sema_init(&lext3_fnode->truncate_sem, 1);
+	lext3_extent_init(&lext3_fnode->vfs_fnode);
+	lext3_init_reservation(&lext3_fnode->vfs_fnode);
 	lext3_fnode->vfs_fnode.version = 1;
 	fnode_init(&lext3_fnode->vfs_fnode);
 
@@ -141,6 +175,7 @@ static struct file_node *lext3_fnode_alloc(struct super_block *super)
 
 static void lext3_fnode_free(struct file_node *fnode)
 {
+	lext3_extent_destroy(fnode);
 	beehive_free(node_allotter, fnode_to_lext3(fnode));
 }
 
@@ -515,6 +550,7 @@ static int recognize_super(struct super_block *super,
 	unsigned long mount_opts = 0;
 	__le32 features;
 	int blocksize;
+	int i;
 
 	phy_super = lext3_super->phy_super;
 	/**
@@ -677,6 +713,10 @@ static int recognize_super(struct super_block *super,
 		+ lext3_super->blocks_per_group - 1)
 		/ lext3_super->blocks_per_group;
 
+	for (i = 0; i < 4; i++)
+		lext3_super->hash_seed[i] = le32_to_cpu(phy_super->hash_seed[i]);
+	lext3_super->def_hash_version = phy_super->def_hash_version;
+
 	return 0;
 
 fail_recognize:
@@ -835,6 +875,18 @@ static int load_journal(struct super_block *super,
 		return -EINVAL;
 	}
 
+	/**
+	 * 用户指定了journal_async_commit时启用异步提交
+	 * 先将功能标志写入日志超级块
+	 * 保证回放时会验证提交块中的校验和
+	 */
+	if (lext3_test_opt(super, LEXT3_MOUNT_JOURNAL_ASYNC_COMMIT)
+	    && !(super->mount_flags & MFLAG_RDONLY)
+	    && journal_set_features(lext3_super->journal,
+			JFS_FEATURE_COMPAT_CHECKSUM, 0,
+			JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
+		journal_update_superblock(lext3_super->journal, 1);
+
 	journal_revoke = journal_has_feature(lext3_super->journal,
 				0, 0, JFS_FEATURE_INCOMPAT_REVOKE);
 	switch (lext3_test_opt(super, LEXT3_MOUNT_DATA_FLAGS)) {
@@ -1094,6 +1146,8 @@ lext3_fill_super(struct super_block *super, void *data, int silent)
 	lext3_super->generation = jiffies;
 	smp_lock_init(&lext3_super->gen_lock);
 	list_init(&lext3_super->orphans);
+	lext3_super->rsv_root = RB_ROOT;
+	smp_lock_init(&lext3_super->rsv_lock);
 
 	super->root_fnode_cache = NULL;
 	super->ops = &lext3_superblock_ops;
@@ -1191,6 +1245,7 @@ void init_lext3(void)
 		sizeof(struct lext3_file_node), 0, BEEHIVE_RECLAIM_ABLE, NULL);
 	if (!node_allotter)
 		panic("fail to init lext3.\n");
+	init_lext3_extent();
 	
 	register_filesystem(&lext3_fs_type);
 }
@@ -16,6 +16,10 @@
  */
 aligned_cacheline_in_smp
 struct smp_lock mount_lock = SMP_LOCK_UNLOCKED(mount_lock);
+/**
+ * 供无锁路径查找验证穿越的挂载点
+ */
+struct smp_seq_count mount_seq;
 /**
  * 保护全局的mount/unmount操作
  */
@@ -68,17 +72,25 @@ static struct mount_desc *alloc_mount(const char *name)
 	return desc;
 }
 
-/**
- * 释放由mount描述符
- */
-static void free_mount(struct mount_desc *desc)
+static void free_mount_rcu(struct rcu_head *rcu)
 {
+	struct mount_desc *desc = container_of(rcu, struct mount_desc, rcu);
+
 	if (desc->dev_name)
 		kfree(desc->dev_name);
 
 	beehive_free(mount_allotter, desc);
 }
 
+/**
+ * 释放由mount描述符
+ * 无锁路径查找可能仍在访问它，因此等到宽限期结束
+ */
+static void free_mount(struct mount_desc *desc)
+{
+	call_rcu(&desc->rcu, free_mount_rcu);
+}
+
 static void release_mount(struct object *object)
 {
 	struct mount_desc *desc = container_of(object, struct mount_desc, object);
@@ -123,6 +135,27 @@ lookup_mount(struct mount_desc *mnt, struct filenode_cache *filenode_cache)
 	return ret;
 }
 
+/**
+ * 在RCU读端临界区中查找，不获取锁和引用
+ * 调用者通过mount_seq验证结果
+ */
+struct mount_desc *
+lookup_mount_rcu(struct mount_desc *mnt, struct filenode_cache *filenode_cache)
+{
+	struct hash_list_bucket *bucket = __hash + hash(mnt, filenode_cache);
+	struct hash_list_node *node;
+	struct mount_desc *mount;
+
+	hlist_for_each_rcu(node, bucket) {
+		mount = hlist_entry(node, struct mount_desc, hash_node);
+		if (READ_ONCE(mount->parent) == mnt
+		    && READ_ONCE(mount->mountpoint) == filenode_cache)
+			return mount;
+	}
+
+	return NULL;
+}
+
 /**
  * 内部调用，只加载文件系统，但是不暴露到目录树中
  * 参数有:文件系统类型.安装标志及块设备名.
@@ -223,6 +256,7 @@ static int bind_mount(struct mount_desc *desc, struct filenode_lookup_s *look)
 	}
 
 	smp_lock(&mount_lock);
+	smp_seq_count_write_begin(&mount_seq);
 	parent = hold_mount(look->mnt);
 	hold_mount(desc);
 	desc->parent = parent;
@@ -234,12 +268,13 @@ static int bind_mount(struct mount_desc *desc, struct filenode_lookup_s *look)
 	/**
 	 * !!应当加在桶前面!!
 	 */
-	hlist_add_head(&desc->hash_node, bucket);
+	hlist_add_head_rcu(&desc->hash_node, bucket);
 	/**
 	 * 加入上级对象的子对象链表中
 	 */
 	list_insert_behind(&desc->child, &parent->children);
 	look->filenode_cache->mount_count++;
+	smp_seq_count_write_end(&mount_seq);
 	smp_unlock(&mount_lock);
 
 	up(&look->filenode_cache->file_node->sem);
@@ -411,11 +446,13 @@ static void unbind_mount(struct mount_desc *mnt)
 		struct filenode_cache *mountpoint = mnt->mountpoint;
 		struct mount_desc *parent = mnt->parent;
 
+		smp_seq_count_write_begin(&mount_seq);
 		mnt->parent = mnt;
 		mnt->mountpoint = mnt->sticker;
 		list_del_init(&mnt->child);
-		hlist_del_init(&mnt->hash_node);
+		hlist_del_rcu(&mnt->hash_node);
 		mountpoint->mount_count--;
+		smp_seq_count_write_end(&mount_seq);
 		smp_unlock(&mount_lock);
 		loosen_filenode_cache(mountpoint);
 		loosen_mount(parent);
@@ -6,6 +6,7 @@
 #include <dim-sum/fs_context.h>
 #include <dim-sum/hash.h>
 #include <dim-sum/mount.h>
+#include <dim-sum/rcupdate.h>
 #include <dim-sum/sched.h>
 
 #include "internal.h"
@@ -67,6 +68,7 @@ fnode_cache_alloc(struct filenode_cache *parent,
 
 	accurate_set(&fnode_cache->ref_count, 1);
 	smp_lock_init(&fnode_cache->lock);
+	smp_seq_count_init(&fnode_cache->seq);
 	hash_list_init_node(&fnode_cache->hash_node);
 	list_init(&fnode_cache->children);
 	list_init(&fnode_cache->child);
@@ -82,6 +84,26 @@ fnode_cache_alloc(struct filenode_cache *parent,
 	return fnode_cache;
 }
 
+/**
+ * 设置缓存节点对应的文件节点
+ * 同时记录文件类型，无锁路径查找不需要访问文件节点
+ * 调用者持有filenode_cache_lock
+ */
+static void __fnode_cache_set_node(struct filenode_cache *fnode_cache,
+	struct file_node *fnode)
+{
+	smp_seq_count_write_begin(&fnode_cache->seq);
+	fnode_cache->file_node = fnode;
+	fnode_cache->flags &= ~(FNODECACHE_LOOKUP | FNODECACHE_SYMLINK);
+	if (fnode && fnode->node_ops) {
+		if (fnode->node_ops->follow_link)
+			fnode_cache->flags |= FNODECACHE_SYMLINK;
+		else if (fnode->node_ops->lookup)
+			fnode_cache->flags |= FNODECACHE_LOOKUP;
+	}
+	smp_seq_count_write_end(&fnode_cache->seq);
+}
+
 /**
  * 为文件系统根节点分配缓存描述符
  */
@@ -95,12 +117,25 @@ fnode_cache_alloc_root(struct file_node *root_node)
 
 		ret = fnode_cache_alloc(NULL, &name);
 		if (ret)
-			ret->file_node = root_node;
+			__fnode_cache_set_node(ret, root_node);
 	}
 
 	return ret;
 }
 
+static void fnode_cache_free_rcu(struct rcu_head *rcu)
+{
+	struct filenode_cache *fnode_cache =
+		container_of(rcu, struct filenode_cache, rcu);
+
+	/**
+	 * 释放名称字符串和对象描述符
+	 */
+ 	if (fnode_cache->flags & FNODECACHE_DYNAME)
+		kfree(fnode_cache->file_name.name);
+	beehive_free(fnode_cache_allotter, fnode_cache); 
+}
+
 /**
  * 释放文件节点缓存描述符
  */
@@ -114,11 +149,10 @@ static void fnode_cache_free(struct filenode_cache *fnode_cache)
 		fnode_cache->ops->d_release(fnode_cache);
 
 	/**
-	 * 释放名称字符串和对象描述符
+	 * 无锁查找可能仍在访问描述符及其名称
+	 * 等到宽限期结束再释放
 	 */
- 	if (fnode_cache->flags & FNODECACHE_DYNAME)
-		kfree(fnode_cache->file_name.name);
-	beehive_free(fnode_cache_allotter, fnode_cache); 
+	call_rcu(&fnode_cache->rcu, fnode_cache_free_rcu);
 }
 
 void loosen_fnode_look(struct filenode_lookup_s *look)
@@ -133,7 +167,7 @@ void loosen_fnode_look(struct filenode_lookup_s *look)
 void fnode_cache_stick(struct filenode_cache *fnode_cache, struct file_node *fnode)
 {
 	smp_lock(&filenode_cache_lock);
-	fnode_cache->file_node = fnode;
+	__fnode_cache_set_node(fnode_cache, fnode);
 	smp_unlock(&filenode_cache_lock);
 }
 
@@ -146,7 +180,7 @@ hash(struct filenode_cache *parent, unsigned long hash)
 static void __putin_fnode_cache(struct filenode_cache *fnode_cache, struct hash_list_bucket *list)
 {
  	fnode_cache->flags |= FNODECACHE_INHASH;
- 	hlist_add_head(&fnode_cache->hash_node, list);
+ 	hlist_add_head_rcu(&fnode_cache->hash_node, list);
 }
 
 void putin_fnode_cache(struct filenode_cache * fnode_cache)
@@ -164,8 +198,10 @@ void putin_fnode_cache(struct filenode_cache * fnode_cache)
 static void __takeout_fnode_cache(struct filenode_cache *fnode_cache)
 {
 	if (fnode_cache->flags & FNODECACHE_INHASH) {
+		smp_seq_count_write_begin(&fnode_cache->seq);
 		fnode_cache->flags &= ~FNODECACHE_INHASH;
-		hlist_del(&fnode_cache->hash_node);
+		hlist_del_rcu(&fnode_cache->hash_node);
+		smp_seq_count_write_end(&fnode_cache->seq);
 	}
 }
 
@@ -185,14 +221,23 @@ __find_in_cache(struct filenode_cache *parent, struct file_name *name)
 	struct filenode_cache *ret = NULL;
 	struct hash_list_bucket *bucket;
 	struct hash_list_node *node;
+	unsigned seq;
 
 	bucket = hash(parent, name_hash);
-	lock_hash_bucket(bucket);
+	rcu_read_lock();
+	seq = smp_seq_read_begin(&rename_lock);
 	
-	hlist_for_each(node, bucket) {
+	hlist_for_each_rcu(node, bucket) {
 		struct filenode_cache *fnode_cache; 
 		struct file_name *file_name;
 
+		/**
+		 * 节点可能被重命名到其他哈希桶中
+		 * 此时再也回不到本桶的链表头，由调用者重试
+		 */
+		if (smp_seq_read_retry(&rename_lock, seq))
+			break;
+
 		fnode_cache = hlist_entry(node, struct filenode_cache, hash_node);
 
 		if (fnode_cache->file_name.hash != name_hash)
@@ -242,7 +287,7 @@ conti:
 		smp_unlock(&fnode_cache->lock);
  	}
 
-	unlock_hash_bucket(bucket);
+	rcu_read_unlock();
 
  	return ret;
 }
@@ -285,6 +330,12 @@ void loosen_filenode_cache(struct filenode_cache *fnode_cache)
 		return;
 
 repeat:
+	/**
+	 * 不是最后一个引用，不需要获取全局锁
+	 */
+	if (accurate_add_ifneq(&fnode_cache->ref_count, -1, 1))
+		return;
+
 	smp_lock(&filenode_cache_lock);
 	if (!accurate_dec_and_test_zero(&fnode_cache->ref_count)) {
 		smp_unlock(&filenode_cache_lock);
@@ -318,7 +369,7 @@ kill_it:
 	if (fnode_cache->file_node) {
 		struct file_node *file_node = fnode_cache->file_node;
 
-		fnode_cache->file_node = NULL;
+		__fnode_cache_set_node(fnode_cache, NULL);
 		smp_unlock(&fnode_cache->lock);
 		smp_unlock(&filenode_cache_lock);
 
@@ -392,6 +443,8 @@ void rename_fnode_cache(struct filenode_cache *old, struct filenode_cache *new)
 		smp_lock(&old->lock);
 		smp_lock(&new->lock);
 	}
+	smp_seq_count_write_begin(&old->seq);
+	smp_seq_count_write_begin(&new->seq);
 
 	/**
 	 * 将节点从旧哈希桶里取出
@@ -425,6 +478,8 @@ void rename_fnode_cache(struct filenode_cache *old, struct filenode_cache *new)
 	list = hash(old->parent, old->file_name.hash);
 	__putin_fnode_cache(old, list);
 	list_insert_front(&old->child, &old->parent->children);
+	smp_seq_count_write_end(&new->seq);
+	smp_seq_count_write_end(&old->seq);
 	/**
 	 * 释放节点的锁，实际上这里的顺序并不重要
 	 */
@@ -460,7 +515,7 @@ void remove_fnode_cache(struct filenode_cache *fnode_cache)
 			/**
 			 * 解除缓存节点与文件节点之间的引用
 			 */
-			fnode_cache->file_node = NULL;
+			__fnode_cache_set_node(fnode_cache, NULL);
 			smp_unlock(&fnode_cache->lock);
 			smp_unlock(&filenode_cache_lock);
 
@@ -1130,6 +1185,281 @@ loosen_look:
 	return err;
 }
 
+/**
+ * 在RCU读端临界区中查找目录中的文件
+ * 不获取任何锁及引用，返回节点及其顺序计数
+ */
+static struct filenode_cache *
+__find_in_cache_rcu(struct filenode_cache *parent, struct file_name *name,
+	unsigned rename_seq, unsigned *seqp)
+{
+	struct hash_list_bucket *bucket = hash(parent, name->hash);
+	struct hash_list_node *node;
+
+	hlist_for_each_rcu(node, bucket) {
+		struct filenode_cache *fnode_cache;
+		struct file_name *file_name;
+		unsigned seq;
+
+		if (smp_seq_read_retry(&rename_lock, rename_seq))
+			return NULL;
+
+		fnode_cache = hlist_entry(node, struct filenode_cache, hash_node);
+		seq = smp_seq_count_begin(&fnode_cache->seq);
+
+		if (READ_ONCE(fnode_cache->parent) != parent)
+			continue;
+
+		file_name = &fnode_cache->file_name;
+		if (file_name->hash != name->hash || file_name->len != name->len)
+			continue;
+		if (memcmp(file_name->name, name->name, name->len))
+			continue;
+
+		/**
+		 * 比较过程中节点被修改，或者已经被移出哈希表
+		 */
+		if (!(READ_ONCE(fnode_cache->flags) & FNODECACHE_INHASH))
+			return NULL;
+		if (smp_seq_count_retry(&fnode_cache->seq, seq))
+			return NULL;
+
+		*seqp = seq;
+		return fnode_cache;
+	}
+
+	return NULL;
+}
+
+/**
+ * 无锁路径查找的状态
+ */
+struct rcu_walk {
+	struct mount_desc *mnt;
+	struct filenode_cache *fnode_cache;
+	/**
+	 * 当前节点的顺序计数
+	 */
+	unsigned seq;
+	unsigned rename_seq;
+	unsigned mount_seq;
+};
+
+/**
+ * 在当前目录中前进一步，并穿越其上的挂载点
+ */
+static int rcu_walk_step(struct rcu_walk *walk, struct file_name *name)
+{
+	struct filenode_cache *fnode_cache;
+	struct mount_desc *child;
+	unsigned seq;
+
+	fnode_cache = __find_in_cache_rcu(walk->fnode_cache, name,
+					walk->rename_seq, &seq);
+	if (!fnode_cache)
+		return 0;
+
+	/**
+	 * 查找期间，当前目录被删除或者修改了
+	 */
+	if (smp_seq_count_retry(&walk->fnode_cache->seq, walk->seq))
+		return 0;
+
+	while (READ_ONCE(fnode_cache->mount_count)) {
+		child = lookup_mount_rcu(walk->mnt, fnode_cache);
+		if (!child)
+			break;
+
+		walk->mnt = child;
+		fnode_cache = READ_ONCE(child->sticker);
+		seq = smp_seq_count_begin(&fnode_cache->seq);
+	}
+
+	walk->fnode_cache = fnode_cache;
+	walk->seq = seq;
+
+	return 1;
+}
+
+/**
+ * 获取无锁查找结果的引用
+ * 节点正在被释放时失败
+ */
+static int rcu_walk_hold(struct rcu_walk *walk)
+{
+	struct filenode_cache *fnode_cache = walk->fnode_cache;
+
+	if (!try_hold_mount(walk->mnt))
+		return 0;
+
+	if (!accurate_inc_not_zero(&fnode_cache->ref_count)) {
+		/**
+		 * 引用计数为0的节点只有在哈希表中才有效
+		 * 与__find_in_cache的规则相同
+		 */
+		smp_lock(&fnode_cache->lock);
+		if (!(fnode_cache->flags & FNODECACHE_INHASH)) {
+			smp_unlock(&fnode_cache->lock);
+			loosen_mount(walk->mnt);
+			return 0;
+		}
+		accurate_inc(&fnode_cache->ref_count);
+		smp_unlock(&fnode_cache->lock);
+	}
+
+	return 1;
+}
+
+/**
+ * 无锁路径查找(RCU-walk)
+ * 只使用顺序计数验证缓存中的路径分量，不获取锁，也不修改引用计数
+ * 直到最后才获取结果的引用
+ * 遇到缓存未命中、符号链接、".."及文件系统自定义的哈希方法时
+ * 返回-EAGAIN，由调用者回退到加锁查找
+ */
+static int rcu_load_filenode(char *dir_name, struct filenode_lookup_s *look)
+{
+	unsigned int lookup_flags = look->flags;
+	struct file_name *cur = &look->cur;
+	struct task_fs_context *fs_context;
+	struct rcu_walk walk;
+	unsigned int ch;
+
+	rcu_read_lock();
+	walk.rename_seq = smp_seq_read_begin(&rename_lock);
+	walk.mount_seq = smp_seq_count_begin(&mount_seq);
+
+	/**
+	 * 进程的根目录和当前目录在宽限期内不会被释放
+	 */
+	fs_context = current->fs_context;
+	smp_read_lock(&fs_context->lock);
+	if (*dir_name == '/') {
+		walk.mnt = fs_context->root_mount;
+		walk.fnode_cache = fs_context->root_fnode_cache;
+	} else {
+		walk.mnt = fs_context->curr_dir_mount;
+		walk.fnode_cache = fs_context->curr_dir_fnode_cache;
+	}
+	smp_read_unlock(&fs_context->lock);
+	walk.seq = smp_seq_count_begin(&walk.fnode_cache->seq);
+
+	while (*dir_name == '/')
+		dir_name++;
+	if (!*dir_name) {
+		look->path_type = PATHTYPE_ROOT;
+		goto hold;
+	}
+
+	while (1) {
+		struct fnode_cache_ops *ops = READ_ONCE(walk.fnode_cache->ops);
+
+		/**
+		 * 文件系统自定义的方法可能睡眠
+		 */
+		if (ops && (ops->d_hash || ops->d_compare))
+			goto fallback;
+
+		ch = *dir_name;
+		cur->name = dir_name;
+		cur->hash = 0;
+		do {
+			hash_append(ch, &cur->hash);
+			dir_name++;
+			ch = *dir_name;
+		} while (ch && (ch != '/'));
+		cur->len = dir_name - (const char *)cur->name;
+
+		if (!ch)
+			goto last;
+
+		do {
+			dir_name++;
+		} while (*dir_name == '/');
+		if (!*dir_name) {
+			lookup_flags |= FNODE_LOOKUP_READLINK | FNODE_LOOKUP_DIRECTORY;
+			goto last;
+		}
+
+		if ((cur->name[0] == '.') && (cur->len <= 2)) {
+			if (cur->len == 1)
+				continue;
+			if (cur->name[1] == '.')
+				goto fallback;
+		}
+
+		if (!rcu_walk_step(&walk, cur))
+			goto fallback;
+
+		/**
+		 * 只有目录才能继续查找
+		 * 符号链接、不存在的文件及错误情况，都交给加锁查找处理
+		 */
+		if (!(READ_ONCE(walk.fnode_cache->flags) & FNODECACHE_LOOKUP))
+			goto fallback;
+	}
+
+last:
+	if (lookup_flags & FNODE_LOOKUP_NOLAST) {
+		look->last = *cur;
+		look->path_type = PATHTYPE_NORMAL;
+		if (cur->name[0] != '.')
+			goto hold;
+
+		if (cur->len == 1)
+			look->path_type = PATHTYPE_DOT;
+		else if (cur->len == 2 && cur->name[1] == '.')
+			look->path_type = PATHTYPE_DOTDOT;
+
+		goto hold;
+	}
+
+	if ((cur->name[0] == '.') && (cur->len <= 2)) {
+		if (cur->len == 1)
+			goto hold;
+		if (cur->name[1] == '.')
+			goto fallback;
+	}
+
+	if (!rcu_walk_step(&walk, cur))
+		goto fallback;
+
+	if (!READ_ONCE(walk.fnode_cache->file_node))
+		goto fallback;
+	if ((lookup_flags & FNODE_LOOKUP_READLINK)
+	    && (READ_ONCE(walk.fnode_cache->flags) & FNODECACHE_SYMLINK))
+		goto fallback;
+	if ((lookup_flags & FNODE_LOOKUP_DIRECTORY)
+	    && !(READ_ONCE(walk.fnode_cache->flags) & FNODECACHE_LOOKUP))
+		goto fallback;
+
+hold:
+	if (!rcu_walk_hold(&walk))
+		goto fallback;
+	rcu_read_unlock();
+
+	/**
+	 * 已经持有引用，最后验证查找期间没有发生重命名、卸载
+	 * 结果节点也没有被修改
+	 */
+	if (smp_seq_count_retry(&walk.fnode_cache->seq, walk.seq)
+	    || smp_seq_read_retry(&rename_lock, walk.rename_seq)
+	    || smp_seq_count_retry(&mount_seq, walk.mount_seq)) {
+		loosen_filenode_cache(walk.fnode_cache);
+		loosen_mount(walk.mnt);
+		return -EAGAIN;
+	}
+
+	look->mnt = walk.mnt;
+	look->filenode_cache = walk.fnode_cache;
+
+	return 0;
+
+fallback:
+	rcu_read_unlock();
+	return -EAGAIN;
+}
+
 /**
  * 查找路径名
  *	name:要查找的文件路径名
@@ -1153,6 +1483,14 @@ int fastcall load_filenode_cache(char *dir_name, unsigned int flags,
 	current->fs_search.link_count = 0;
 	current->fs_search.nested_count = 0;
 
+	/**
+	 * 先尝试无锁查找，路径分量都在缓存中时不需要获取任何锁
+	 */
+	ret = rcu_load_filenode(dir_name, look);
+	if (ret != -EAGAIN)
+		return ret;
+
+	look->path_type = PATHTYPE_NOTHING;
 	/**
 	 * 设置开始搜索的初始目录
 	 */
@@ -717,6 +717,7 @@ void unload_common_filesystem(struct super_block *super)
 void __init init_file_systems(void)
 {
 	init_iosched_noop();
+	init_iosched_deadline();
 	init_devfs();
 	init_journal();
 	init_lext3();
@@ -626,9 +626,14 @@ static void writeback_file_nodes(struct writeback_control *control)
 {
 	struct super_block *super;
 	struct double_list *list;
+	struct blk_plug plug;
 
 	might_sleep();
 
+	/**
+	 * 积攒各个文件节点的回写请求，排序合并后一次推送
+	 */
+	blk_start_plug(&plug);
 	smp_lock(&super_block_lock);
 try_again:
 	/**
@@ -678,6 +683,7 @@ try_again:
 			break;
 	}
 	smp_unlock(&super_block_lock);
+	blk_finish_plug(&plug);
 }
 
 /**
@@ -68,5 +68,6 @@ struct async_io_desc {
 	} while (0)
 
 extern ssize_t wait_on_async_io(struct async_io_desc *aio);
+extern void finish_async_io(struct async_io_desc *aio, long res);
 
 #endif
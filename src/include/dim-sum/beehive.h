@@ -107,6 +107,12 @@ struct beehive_cpu_cache {
 	 * 缓存页所在的节点
 	 */
 	int node;
+	/**
+	 * 本CPU暂存的半满页面
+	 * 页面设置了PG_BEEHIVE_INCACHE标志，只由本CPU分配
+	 */
+	struct double_list partial;
+	int partial_count;
 };
 
 struct beehive_allotter {
@@ -140,6 +146,8 @@ struct beehive_allotter {
 		unsigned int		align;
 		/* 半满链表中，数量不能低于这个数 */
 		unsigned long min_partial;
+		/* 每CPU最多暂存的半满页面数量 */
+		int cpu_partial;
 		void (*ctor)(struct beehive_allotter *, void *);
 	} attrs;
 
@@ -167,6 +175,10 @@ static inline void *beehive_zalloc(struct beehive_allotter *k, paf_t flags)
 	return beehive_alloc(k, flags | __PAF_ZERO);
 }
 extern void beehive_free(struct beehive_allotter *, void *);
+extern int beehive_alloc_bulk(struct beehive_allotter *, paf_t, size_t, void **);
+extern void beehive_free_bulk(struct beehive_allotter *, size_t, void **);
+extern int beehive_shrink(struct beehive_allotter *);
+extern int beehive_shrink_all(void);
 
 void *kmalloc(size_t size, paf_t flags);
 static inline void *kzalloc(size_t size, paf_t flags)
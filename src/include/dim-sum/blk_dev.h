@@ -2,16 +2,19 @@
 #define __DIM_SUM_BLOCK_DEVICE_H
 
 #include <dim-sum/blk_infrast.h>
+#include <dim-sum/cpu.h>
 #include <dim-sum/iosched.h>
 #include <dim-sum/major.h>
 #include <dim-sum/semaphore.h>
 #include <dim-sum/wait.h>
 #include <dim-sum/disk.h>
+#include <dim-sum/hash_list.h>
 #include <dim-sum/mutex.h>
 #include <dim-sum/object.h>
 #include <dim-sum/timer.h>
 #include <dim-sum/workqueue.h>
 #include <dim-sum/pagemap.h>
+#include <dim-sum/rbtree.h>
 
 struct scatterlist;
 struct block_device;
@@ -24,6 +27,10 @@ struct block_io_desc;
 struct block_io_item;
 struct ioscheduler;
 struct work_struct;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
+struct task_desc;
 
 extern struct super_block *blkfs_superblock;
 
@@ -173,6 +180,10 @@ enum {
 	 * 不重要的请求，底层遇到错误时不用重试
 	 */
 	__BLKREQ_NORETRY,	
+	/**
+	 * 多队列路径上的请求，描述符来自硬件队列的标签
+	 */
+	__BLKREQ_MQ,
 };
 
 #define BLKREQ_NOCACHE		(1 << __BLKREQ_NOCACHE)
@@ -183,6 +194,7 @@ enum {
 #define BLKREQ_VERBOSE			(1 << __BLKREQ_VERBOSE)
 #define BLKREQ_NORETRY	(1 << __BLKREQ_NORETRY)
 #define BLKREQ_NOMERGE	(1 << __BLKREQ_NOMERGE)
+#define BLKREQ_MQ	(1 << __BLKREQ_MQ)
 
 enum {
 	/**
@@ -211,6 +223,16 @@ enum {
 	 * 写请求
 	 */
 	__BLKQUEUE_WRITE,
+	/**
+	 * 使用多队列路径
+	 * 请求先进入每CPU软件队列，再由硬件派发队列交给驱动
+	 */
+	__BLKQUEUE_MQ,
+	/**
+	 * 多队列路径上的请求经过IO调度器排序后再派发
+	 * 队列使用noop以外的调度器时设置
+	 */
+	__BLKQUEUE_MQ_SCHED,
 };
 
 #define BLKQUEUE_STOPPED	(1UL << __BLKQUEUE_STOPPED)
@@ -219,6 +241,8 @@ enum {
 #define BLKQUEUE_DRAINING	(1UL << __BLKQUEUE_DRAINING)
 #define BLKQUEUE_ATTACHED	(1UL << __BLKQUEUE_ATTACHED)
 #define BLKQUEUE_WRITE		(1UL << __BLKQUEUE_WRITE)
+#define BLKQUEUE_MQ		(1UL << __BLKQUEUE_MQ)
+#define BLKQUEUE_MQ_SCHED	(1UL << __BLKQUEUE_MQ_SCHED)
 
 #define BLK_MAX_CDB 16
 
@@ -234,6 +258,16 @@ struct blk_request {
 	 * 用于把请求链接到请求队列中。
 	 */
 	struct double_list list;
+	/**
+	 * 以结束扇区为键值，链接到队列的合并哈希表中
+	 * 用于查找可以向后合并的请求
+	 */
+	struct hash_list_node hash;
+	/**
+	 * 以起始扇区为键值，链接到队列的排序树中
+	 * 用于查找可以向前合并的请求，调度器也用它排序
+	 */
+	struct rb_node rb_node;
 	/**
 	 * 请求标志
 	 */
@@ -338,6 +372,83 @@ struct blk_request {
 	 * sense命令的缓冲区指针。
 	 */
 	void *sense;
+	/**
+	 * 多队列路径上请求的标签，以及提交请求的软件队列
+	 */
+	int tag;
+	struct blk_mq_ctx *mq_ctx;
+	/**
+	 * 请求生成时的时钟周期数，用于统计完成延迟
+	 */
+	u64 start_cycles;
+};
+
+/**
+ * 任务的块设备请求插头
+ * 在blk_start_plug和blk_finish_plug之间，任务提交的BIO
+ * 在本地合并、暂存，不获取队列锁
+ * 拔出插头或者任务睡眠时，按扇区排序后一次性推送给驱动
+ */
+struct blk_plug {
+	/**
+	 * 暂存的请求
+	 */
+	struct double_list list;
+	/**
+	 * list中的请求数量
+	 */
+	unsigned int count;
+};
+
+/**
+ * 插头中暂存的请求超过此数时，立即推送
+ */
+#define BLK_MAX_PLUG_REQUESTS	16
+
+/**
+ * 传统队列的请求统计，由queue_lock保护
+ */
+struct blk_queue_stat {
+	/**
+	 * BIO被合并到已有请求的末尾、前面的次数
+	 */
+	unsigned long back_merges;
+	unsigned long front_merges;
+	/**
+	 * 相邻请求合并的次数
+	 */
+	unsigned long request_merges;
+	/**
+	 * 交给驱动、以及完成的请求数
+	 */
+	unsigned long dispatched;
+	unsigned long completed;
+	/**
+	 * 调度器中尚未派发的请求数，及其峰值
+	 */
+	unsigned int queued;
+	unsigned int max_queued;
+	/**
+	 * 已经交给驱动，尚未完成的请求数
+	 */
+	unsigned int in_flight;
+};
+
+/**
+ * 请求完成延迟直方图的桶数
+ * 第i个桶统计延迟在[2^i, 2^(i+1))微秒之间的请求
+ * 最后一个桶包含所有更慢的请求
+ */
+#define BLK_LATENCY_BUCKETS	20
+
+/**
+ * 队列的请求完成延迟统计，读写分开
+ */
+struct blk_latency_stat {
+	unsigned long buckets[2][BLK_LATENCY_BUCKETS];
+	unsigned long nr_requests[2];
+	unsigned long total_us[2];
+	unsigned long max_us[2];
 };
 
 #if BITS_PER_LONG == 32
@@ -392,6 +503,18 @@ struct blk_request_queue
 	 * 所有请求的链表头
 	 */
 	struct double_list	requests;
+	/**
+	 * 尚未派发的请求，按结束扇区组织的哈希表
+	 */
+	struct hash_list_bucket	merge_hash[IOSCHED_HASH_SIZE];
+	/**
+	 * 尚未派发的请求，按起始扇区排序，读写分开
+	 */
+	struct rb_root		merge_tree[2];
+	/**
+	 * 请求统计
+	 */
+	struct blk_queue_stat	stat;
 	/**
 	 * 调度器对象，IO调度算法使用
 	 */
@@ -500,6 +623,27 @@ struct blk_request_queue
 	 * 抽象给文件系统层的描述符
 	 */
 	struct blkdev_infrast	blkdev_infrast;
+	/**
+	 * 多队列驱动的回调
+	 */
+	struct blk_mq_ops	*mq_ops;
+	/**
+	 * 每CPU软件提交队列
+	 */
+	struct blk_mq_ctx __percpu *queue_ctx;
+	/**
+	 * 硬件派发队列及其数量
+	 */
+	struct blk_mq_hw_ctx	**hw_ctxs;
+	unsigned int		nr_hw_queues;
+	/**
+	 * CPU到硬件派发队列的映射
+	 */
+	unsigned int		mq_map[MAX_CPUS];
+	/**
+	 * 每CPU的请求完成延迟统计
+	 */
+	struct blk_latency_stat __percpu *latency;
 	/**
 	 * 块设备驱动程序的私有数据。
 	 */
@@ -609,6 +753,14 @@ extern int blkio_hw_segments(struct blk_request_queue *, struct block_io_desc *)
 	if ((rq->bio_head))			\
 		for (_bio = (rq)->bio_head; _bio; _bio = _bio->bi_next)
 
+/**
+ * 请求是否在队列的排序树中，即尚未派发
+ */
+static inline bool blk_request_sorted(struct blk_request *req)
+{
+	return !RB_EMPTY_NODE(&req->rb_node);
+}
+
 static inline void blkdev_dequeue_request(struct blk_request *req)
 {
 	iosched_remove_request(req->queue, req);
@@ -616,6 +768,21 @@ static inline void blkdev_dequeue_request(struct blk_request *req)
 extern int blk_update_request(struct blk_request *, int, int);
 extern void blk_finish_request(struct blk_request *);
 extern void blk_end_request(struct blk_request *req, int uptodate);
+extern void blk_init_request_from_bio(struct blk_request_queue *,
+	struct blk_request *, struct block_io_desc *);
+extern bool blk_attempt_list_merge(struct blk_request_queue *,
+	struct double_list *, struct block_io_desc *, int);
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *);
+extern void blk_plug_add_request(struct blk_plug *, struct blk_request *);
+extern void blk_schedule_flush_plug(struct task_desc *);
+
+extern void blk_get_latency(struct blk_request_queue *,
+	struct blk_latency_stat *);
+extern void blk_reset_latency(struct blk_request_queue *);
+extern void blk_dump_latency(struct blk_request_queue *);
 
 extern void blk_sync_queue(struct blk_request_queue *queue);
 extern void blk_attach_device(struct blk_request_queue *);
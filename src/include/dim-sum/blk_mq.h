@@ -0,0 +1,213 @@
+#ifndef __DIM_SUM_BLK_MQ_H
+#define __DIM_SUM_BLK_MQ_H
+
+#include <dim-sum/blk_dev.h>
+#include <dim-sum/percpu.h>
+#include <dim-sum/smp_lock.h>
+#include <dim-sum/wait.h>
+#include <dim-sum/workqueue.h>
+
+struct blk_mq_hw_ctx;
+
+/**
+ * 每个软件队列中，向前查找可合并请求的最大数量
+ */
+#define BLK_MQ_MERGE_DEPTH	8
+/**
+ * 软件队列中积压的请求超过此数时，立即向硬件派发
+ */
+#define BLK_MQ_BATCH		16
+/**
+ * 每个硬件队列默认的标签数量
+ */
+#define BLK_MQ_DEFAULT_DEPTH	BLKDEV_MAX_RQ
+
+/**
+ * queue_rq回调的返回值
+ */
+enum {
+	/**
+	 * 请求已经交给硬件
+	 */
+	BLK_MQ_RQ_OK,
+	/**
+	 * 硬件队列已满，稍后重试
+	 */
+	BLK_MQ_RQ_BUSY,
+	/**
+	 * 请求出错，已由驱动结束
+	 */
+	BLK_MQ_RQ_ERROR,
+};
+
+/**
+ * 硬件派发队列的状态
+ */
+enum {
+	/**
+	 * 驱动暂停了硬件队列
+	 */
+	__BLK_MQ_STOPPED,
+	/**
+	 * 正在向驱动派发请求，避免重入
+	 */
+	__BLK_MQ_RUNNING,
+	/**
+	 * 软件队列中有等待派发的请求
+	 */
+	__BLK_MQ_PENDING,
+};
+
+/**
+ * 块设备驱动提供的多队列回调
+ */
+struct blk_mq_ops {
+	/**
+	 * 将请求交给硬件队列
+	 * last为真表示这是本轮派发的最后一个请求，驱动可以通知设备了
+	 */
+	int (*queue_rq)(struct blk_mq_hw_ctx *, struct blk_request *, bool last);
+	/**
+	 * 本轮派发因忙而中止时，通知设备处理已经交给它的请求
+	 */
+	void (*commit_rqs)(struct blk_mq_hw_ctx *);
+	/**
+	 * 初始化预分配的请求，驱动可以在此设置其私有数据
+	 */
+	int (*init_request)(void *driver_data, struct blk_request *,
+			unsigned int hctx_idx, unsigned int tag);
+};
+
+/**
+ * 预先分配的请求描述符，以标签为下标
+ */
+struct blk_mq_tags {
+	/**
+	 * 标签数量
+	 */
+	unsigned int nr_tags;
+	/**
+	 * 已经分配的标签位图
+	 */
+	unsigned long *bitmap;
+	/**
+	 * 标签对应的请求描述符
+	 */
+	struct blk_request **rqs;
+	/**
+	 * 等待标签的任务
+	 */
+	struct wait_queue wait;
+};
+
+/**
+ * 每CPU软件提交队列
+ * 任务在本地CPU上合并、暂存请求，不与其他CPU竞争
+ */
+struct blk_mq_ctx {
+	/**
+	 * 保护rq_list，只有派发线程会在其他CPU上获取此锁
+	 */
+	struct smp_lock lock;
+	/**
+	 * 暂存的请求
+	 */
+	struct double_list rq_list;
+	/**
+	 * rq_list中的请求数量
+	 */
+	unsigned int nr_pending;
+	/**
+	 * 所属CPU
+	 */
+	unsigned int cpu;
+	/**
+	 * 映射到的硬件派发队列
+	 */
+	struct blk_mq_hw_ctx *hctx;
+	/**
+	 * 下一次从此处开始查找空闲标签
+	 * 各CPU从位图的不同位置开始，减少缓存行争用
+	 */
+	unsigned int last_tag;
+	/**
+	 * 统计信息
+	 */
+	unsigned long nr_merged;
+	unsigned long nr_queued;
+};
+
+/**
+ * 硬件派发队列，与驱动的一个硬件队列对应
+ */
+struct blk_mq_hw_ctx {
+	/**
+	 * 保护dispatch链表
+	 */
+	struct smp_lock lock;
+	/**
+	 * 硬件忙时未能派发的请求，下一轮优先派发
+	 */
+	struct double_list dispatch;
+	/**
+	 * __BLK_MQ_STOPPED等状态位
+	 */
+	unsigned long state;
+	/**
+	 * 硬件队列编号
+	 */
+	unsigned int queue_num;
+	/**
+	 * 本硬件队列的请求标签
+	 */
+	struct blk_mq_tags *tags;
+	/**
+	 * 所属请求队列
+	 */
+	struct blk_request_queue *queue;
+	/**
+	 * 驱动私有数据，一般指向驱动的硬件队列
+	 */
+	void *driver_data;
+	/**
+	 * 在kblockd中异步派发
+	 */
+	struct work_struct run_work;
+	/**
+	 * 统计信息
+	 */
+	unsigned long nr_dispatched;
+	unsigned long nr_busy;
+};
+
+/**
+ * 请求描述符之后是驱动的私有数据
+ */
+static inline void *blk_mq_rq_to_pdu(struct blk_request *req)
+{
+	return req + 1;
+}
+
+static inline struct blk_request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return (struct blk_request *)pdu - 1;
+}
+
+static inline bool blk_queue_mq(struct blk_request_queue *queue)
+{
+	return test_bit(__BLKQUEUE_MQ, &queue->state);
+}
+
+extern struct blk_request_queue *
+blk_mq_create_queue(struct blk_mq_ops *ops, unsigned int nr_hw_queues,
+	unsigned int queue_depth, unsigned int cmd_size, void *driver_data);
+extern void blk_mq_free_queue(struct blk_request_queue *queue);
+extern void blk_mq_free_request(struct blk_request *req);
+extern void blk_mq_insert_requests(struct blk_request_queue *queue,
+	struct double_list *list);
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+extern void blk_mq_run_hw_queues(struct blk_request_queue *queue, bool async);
+extern void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+extern void blk_mq_start_stopped_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+
+#endif /* __DIM_SUM_BLK_MQ_H */
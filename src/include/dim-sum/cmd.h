@@ -7,6 +7,8 @@
 
 int sh_showmem_cmd(int argc, char **args);
 extern void dump_all_zones_info(int detail);
+extern int blk_stat_cmd(int argc, char **args);
+extern int blk_iosched_cmd(int argc, char **args);
 
 extern int net_ping_cmd(int argc, char *argv[]);
 extern int net_tftp_cmd(int argc, char *argv[]);
@@ -28,6 +28,11 @@ struct slave_cpu_data {
  */
 extern int nr_existent_cpus;
 
+/**
+ * CPU热插拨事件，回调函数的data参数为CPU编号
+ */
+#define CPU_ONLINE		0x0002
+
 /**
  * 注册及取消注册
  * CPU热插拨回调函数
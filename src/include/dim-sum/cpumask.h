@@ -63,6 +63,11 @@ static inline void cpumask_clear_cpu(int cpu, struct cpumask *dstp)
 	atomic_clear_bit(cpumask_check(cpu), cpumask_bits(dstp));
 }
 
+static inline void cpumask_clear(struct cpumask *dstp)
+{
+	bitmap_zero(cpumask_bits(dstp), MAX_CPUS);
+}
+
 #define cpumask_test_cpu(cpu, cpumask) \
 	test_bit(cpumask_check(cpu), cpumask_bits((cpumask)))
 
@@ -71,6 +76,11 @@ static inline unsigned int cpumask_weight(const struct cpumask *srcp)
 	return bitmap_weight(cpumask_bits(srcp), MAX_CPUS);
 }
 
+static inline int cpumask_empty(const struct cpumask *srcp)
+{
+	return bitmap_empty(cpumask_bits(srcp), MAX_CPUS);
+}
+
 static inline void cpumask_copy(struct cpumask *dstp,
 				const struct cpumask *srcp)
 {
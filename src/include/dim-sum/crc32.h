@@ -0,0 +1,8 @@
+#ifndef _DIM_SUM_CRC32_H
+#define _DIM_SUM_CRC32_H
+
+#include <dim-sum/types.h>
+
+extern u32 crc32_be(u32 crc, const unsigned char *p, size_t len);
+
+#endif /* _DIM_SUM_CRC32_H */
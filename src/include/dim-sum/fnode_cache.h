@@ -3,7 +3,9 @@
 
 #include <dim-sum/accurate_counter.h>
 #include <dim-sum/hash_list.h>
+#include <dim-sum/rcupdate.h>
 #include <dim-sum/smp_lock.h>
+#include <dim-sum/smp_seq_lock.h>
 
 struct filenode_lookup_s;
 struct super_block;
@@ -33,12 +35,23 @@ enum {
 	 * 动态分配的文件名
 	 */
 	__FNODECACHE_DYNAME,
+	/**
+	 * 文件节点是目录，可以在其中继续查找
+	 * 供无锁路径查找使用，避免访问文件节点
+	 */
+	__FNODECACHE_LOOKUP,
+	/**
+	 * 文件节点是符号链接
+	 */
+	__FNODECACHE_SYMLINK,
 };
 /**
  * 缓存节点标志
  */
 #define FNODECACHE_INHASH (1UL << __FNODECACHE_INHASH)
 #define FNODECACHE_DYNAME	(1UL << __FNODECACHE_DYNAME)
+#define FNODECACHE_LOOKUP	(1UL << __FNODECACHE_LOOKUP)
+#define FNODECACHE_SYMLINK	(1UL << __FNODECACHE_SYMLINK)
 
 #define FNAME_INCACHE_LEN 35
 /**
@@ -57,6 +70,12 @@ struct filenode_cache {
 	 * 标志，如FNODECACHE_INHASH
 	 */
 	unsigned int flags;
+	/**
+	 * 节点的名称、父目录、文件节点发生变化，或者被移出哈希表时递增
+	 * 无锁路径查找用它验证读取到的数据
+	 * 写者持有filenode_cache_lock
+	 */
+	struct smp_seq_count seq;
 	/**
 	 * 文件系统操作缓存节点的方法
 	 */
@@ -89,6 +108,10 @@ struct filenode_cache {
 	 * 对目录而言，用于记录mount在该目录中的文件系统数量。
 	 */
 	int mount_count;
+	/**
+	 * 在宽限期结束后释放描述符
+	 */
+	struct rcu_head rcu;
 	/**
 	 * 存放短文件名
 	 */
@@ -1113,6 +1113,11 @@ struct file_ra_state {
 	 * 进程请求的最后一页的索引。
 	 */
 	unsigned long prev_page;	/* Cache last read() position */
+	/**
+	 * 当前窗口末尾的异步预读部分的页数
+	 * 读到这部分的第一页(标记页)时提交下一个窗口
+	 */
+	unsigned long async_size;
 	/**
 	 * 预读窗内的第一页的索引
 	 */
@@ -1760,6 +1765,8 @@ int writeback_wait_data(struct file_cache_space *space);
 unsigned long invalidate_mapping_pages(struct file_cache_space *space,
 					pgoff_t start, pgoff_t end);
 unsigned long invalidate_page_cache(struct file_cache_space *space);
+int invalidate_complete_page(struct file_cache_space *space,
+					struct page_frame *page);
 void deactivate_super(struct super_block *sb);
 int init_isolate_superblock(struct super_block *s, void *data);
 extern int remount_filesystem(struct super_block *sb, int flags,
@@ -1823,7 +1830,8 @@ void loosen_super(struct super_block *super);
 
 /* cache_space.c */
 int generic_readpages(struct file_cache_space *space, struct double_list *pages,
-				unsigned nr_pages, map_block_f map_block);
+				unsigned nr_pages, map_block_f map_block,
+				get_blocks_f get_blocks);
 int generic_readpage(struct page_frame *page, map_block_f map_block);
 
 typedef int (*writepage_journal_f)(struct file_cache_space *,
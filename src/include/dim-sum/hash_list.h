@@ -1,8 +1,11 @@
 #ifndef __DIM_SUM_HASH_LIST_H
 #define __DIM_SUM_HASH_LIST_H
 
+#include <linux/compiler.h>
 #include <dim-sum/double_list.h>
 
+#include <asm/barrier.h>
+
 static inline void hash_list_init_bucket(struct hash_list_bucket *ptr)
 {
 	list_init(&ptr->head);
@@ -48,6 +51,33 @@ static inline void hlist_add_head(struct hash_list_node *n, struct hash_list_buc
 	list_insert_behind(&n->node, &h->head);
 }
 
+/**
+ * 从哈希链表中摘除节点，供RCU读者并发遍历的链表使用
+ * 保留节点的next指针，正在访问该节点的读者仍然可以继续遍历
+ * 节点必须在宽限期之后才能释放
+ */
+static inline void hlist_del_rcu(struct hash_list_node *n)
+{
+	__list_del_entry(&n->node);
+	n->node.prev = LIST_UNLINK2;
+}
+
+/**
+ * 将节点加入哈希链表，供RCU读者并发遍历的链表使用
+ * 初始化节点后，才将其发布给读者
+ */
+static inline void
+hlist_add_head_rcu(struct hash_list_node *n, struct hash_list_bucket *h)
+{
+	struct double_list *prev = h->head.prev;
+
+	n->node.next = &h->head;
+	n->node.prev = prev;
+	smp_wmb();
+	WRITE_ONCE(prev->next, &n->node);
+	h->head.prev = &n->node;
+}
+
 /* next must be != NULL */
 static inline void hlist_add_before(struct hash_list_node *n,
 					struct hash_list_node *next)
@@ -68,6 +98,16 @@ static inline void hlist_add_behind(struct hash_list_node *n,
 			&pos->node != &(h)->head;	\
 			pos = container_of(pos->node.next, struct hash_list_node, node))
 
+/**
+ * 在RCU读端临界区中遍历哈希链表
+ */
+#define hlist_for_each_rcu(pos, h) \
+		for (pos = container_of(rcu_dereference((h)->head.next),	\
+				struct hash_list_node, node);	\
+			&pos->node != &(h)->head;	\
+			pos = container_of(rcu_dereference(pos->node.next),	\
+				struct hash_list_node, node))
+
 #define hlist_container(ptr, type, member) \
 	container_of(ptr, type, member.node)
 
@@ -46,6 +46,7 @@ extern void __init init_chrdev_early(void);
 extern void init_lext3(void);
 extern int __init init_block_layer(void);
 extern int __init init_iosched_noop(void);
+extern int __init init_iosched_deadline(void);
 int init_journal(void);
 extern int __init amba_init(void);
 int __init init_disk_early(void);
@@ -5,6 +5,12 @@ struct ioscheduler;
 struct blk_request_queue;
 struct blk_request;
 struct block_io_desc;
+
+/**
+ * 队列合并哈希表的大小
+ */
+#define IOSCHED_HASH_BITS	6
+#define IOSCHED_HASH_SIZE	(1 << IOSCHED_HASH_BITS)
 	
 /**
  * get_merge_pos函数的返回值
@@ -178,13 +184,18 @@ extern void iosched_remove_request(struct blk_request_queue *queue,
 extern int iosched_try_last_merge(struct blk_request_queue *, struct block_io_desc *);
 extern int iosched_can_merge(struct blk_request *, struct block_io_desc *);
 extern int iosched_try_merge(struct blk_request *, struct block_io_desc *);
+extern void iosched_add_sorted(struct blk_request_queue *, struct blk_request *);
+extern void iosched_del_sorted(struct blk_request_queue *, struct blk_request *);
+extern void iosched_merged_bio(struct blk_request_queue *, struct blk_request *, int);
 
 extern int register_ioscheduler(struct ioscheduler_type *);
 extern void unregister_ioscheduler(struct ioscheduler_type *);
 int register_iosched_queue(struct blk_request_queue *q);
 void unregister_iosched_queue(struct blk_request_queue *q);
 extern int iosched_init(struct blk_request_queue *, char *);
+extern int iosched_switch(struct blk_request_queue *, char *);
 
 __maybe_unused void iosched_noop_exit(void);
+__maybe_unused void iosched_deadline_exit(void);
 void init_iosched(void);
 #endif /* __DIM_SUM_IOSCHED_H */
@@ -326,6 +326,8 @@ extern void unregister_isr_handle(unsigned int, void *);
 extern void enable_percpu_irq(unsigned int irq, unsigned int type);
 extern void disable_percpu_irq(unsigned int irq);
 
+extern int set_irq_affinity(unsigned int irq, int cpu);
+
 void irq_enable(struct irq_desc *desc);
 void irq_disable(struct irq_desc *desc);
 
@@ -33,6 +33,10 @@ struct irq_controller {
 	 * 设置某个中断的类型
 	 */
 	int		(*set_trigger_type)(struct irq_desc *data, unsigned int type);
+	/**
+	 * 将某个中断路由到指定CPU
+	 */
+	int		(*set_affinity)(struct irq_desc *data, int cpu);
 	/**
 	 * 屏蔽某个中断
 	 */
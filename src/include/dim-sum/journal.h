@@ -162,10 +162,20 @@ enum journal_block_type {
 };
 
 #define JFS_MAGIC_NUMBER 0xc03b3998U
+/**
+ * 提交块中带有事务日志块的校验和
+ */
+#define JFS_FEATURE_COMPAT_CHECKSUM	0x00000001
 #define JFS_FEATURE_INCOMPAT_REVOKE	0x00000001
-#define JFS_KNOWN_COMPAT_FEATURES	0
+/**
+ * 提交块与日志块同时写入，不等待日志块完成
+ * 回放时依靠校验和判断事务是否完整
+ */
+#define JFS_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+#define JFS_KNOWN_COMPAT_FEATURES	JFS_FEATURE_COMPAT_CHECKSUM
 #define JFS_KNOWN_ROCOMPAT_FEATURES	0
-#define JFS_KNOWN_INCOMPAT_FEATURES	JFS_FEATURE_INCOMPAT_REVOKE
+#define JFS_KNOWN_INCOMPAT_FEATURES	(JFS_FEATURE_INCOMPAT_REVOKE | \
+					JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)
 
 enum journal_tag_flag {
 	/**
@@ -430,6 +440,11 @@ struct transaction
 	 * 从此磁盘块开始记录日志数据
 	 */
 	unsigned long start_block_num;
+	/**
+	 * 描述符块及元数据日志块的校验和
+	 * 写入提交块，供回放时验证
+	 */
+	u32 log_crc;
 	/**
 	 * 保留给日志操作使用的空间额度
 	 * 即日志要顺利完成，所需要的块数量
@@ -900,6 +915,28 @@ struct journal_revoke_header
 	__be32 size;
 };
 
+#define JFS_CRC32_CHKSUM	1
+#define JFS_CHECKSUM_BYTES	(32 / sizeof(u32))
+
+/**
+ * 提交块的描述符头
+ */
+struct journal_commit_header
+{
+	/**
+	 * 通用描述符头
+	 */
+	struct journal_header header;
+	/**
+	 * 校验和类型，如JFS_CRC32_CHKSUM
+	 * 为0表示没有校验和
+	 */
+	unsigned char chksum_type;
+	unsigned char chksum_size;
+	unsigned char padding[2];
+	__be32 chksum[JFS_CHECKSUM_BYTES];
+};
+
 
 #define journal_oom_retry 1
 
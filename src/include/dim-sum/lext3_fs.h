@@ -120,6 +120,10 @@
  */
 #define LEXT3_MOUNT_RESERVATION		0x10000
 #define LEXT3_MOUNT_BARRIER			0x20000
+/**
+ * 日志提交块与日志块同时写入，提交块中带有校验和
+ */
+#define LEXT3_MOUNT_JOURNAL_ASYNC_COMMIT	0x40000
 
 #define LEXT3_SUPER_MAGIC				0xEF53
 
@@ -195,6 +199,34 @@ enum {
 
 #define LEXT3_LINK_MAX		32000
 
+/**
+ * 目录索引使用的哈希算法
+ */
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+
+/**
+ * 文件名的哈希值
+ */
+struct lext3_dx_hash_info {
+	/**
+	 * 主哈希值，决定目录项位于哪个叶子块
+	 */
+	u32 hash;
+	/**
+	 * 次哈希值，仅用于readdir时区分主哈希值相同的目录项
+	 */
+	u32 minor_hash;
+	int hash_version;
+	u32 *seed;
+};
+
+/**
+ * 索引目录readdir结束时的文件位置
+ */
+#define LEXT3_HTREE_EOF		0x7fffffff
+
 /**
  * 文件节点状态
  */
@@ -539,6 +571,19 @@ struct lext3_superblock {
 	 * 孤儿链表头。
 	 */
 	struct double_list orphans;
+	/**
+	 * 目录索引的哈希种子及默认哈希算法
+	 */
+	u32 hash_seed[4];
+	int def_hash_version;
+	/**
+	 * 所有文件的预留窗口，按起始块号排序
+	 */
+	struct rb_root rsv_root;
+	/**
+	 * 保护rsv_root
+	 */
+	struct smp_lock rsv_lock;
 };
 
 /**
@@ -757,6 +802,39 @@ struct lext3_fnode_disk {
 #define uid_high	os2.linux_os.uid_high
 #define gid_high	os2.linux_os.gid_high
 
+/**
+ * 预留窗口的默认大小和最大大小，以块为单位
+ */
+#define LEXT3_DEFAULT_RESERVE_BLOCKS	8
+#define LEXT3_MAX_RESERVE_BLOCKS	1024
+
+/**
+ * 文件的块预留窗口
+ * 窗口中的空闲块优先分配给本文件，其他文件的窗口会避开这个区域
+ * 这样并发写的文件各自得到连续的磁盘块
+ */
+struct lext3_reserve_window {
+	/**
+	 * 通过此字段链接到超级块的rsv_root
+	 */
+	struct rb_node rb_node;
+	/**
+	 * 窗口的起止块号，包含end
+	 * start为0表示还没有窗口
+	 */
+	unsigned long start;
+	unsigned long end;
+	/**
+	 * 下一次分配窗口时的大小
+	 */
+	unsigned int goal_size;
+	/**
+	 * 在当前窗口中分配的块数
+	 * 命中率高时增大窗口
+	 */
+	unsigned int alloc_hit;
+};
+
 /**
  * LEXT3文件节点在内存中的映像
  */
@@ -824,6 +902,20 @@ struct lext3_file_node {
 	 * 用于防止并发的执行文件截断操作
 	 */
 	struct semaphore truncate_sem;
+	/**
+	 * 逻辑块到物理块的区段缓存，避免每次都遍历间接块
+	 */
+	struct rb_root extent_tree;
+	unsigned int extent_count;
+	/**
+	 * 每次截断时递增，截断之前查到的映射不能再加入缓存
+	 */
+	unsigned long extent_gen;
+	struct smp_lock extent_lock;
+	/**
+	 * 数据块预留窗口，仅用于普通文件
+	 */
+	struct lext3_reserve_window rsv_window;
 	/**
 	 * VFS层需要使用的文件节点对象
 	 */
@@ -1095,6 +1187,9 @@ int lext3_mark_fnode_dirty(struct journal_handle *handle,
 	struct file_node *file_node);
 extern int lext3_alloc_block (struct journal_handle *,
 	struct file_node *, unsigned long, int *);
+extern unsigned long lext3_alloc_blocks(struct journal_handle *,
+	struct file_node *, unsigned long, unsigned long *, int *);
+extern void lext3_init_reservation(struct file_node *);
 extern void
 lext3_free_blocks (struct journal_handle *, struct file_node *,
 	unsigned long, unsigned long);
@@ -1133,10 +1228,26 @@ lext3_get_fnode_disk(struct lext3_fnode_loc *fnode_loc)
 
 extern int lext3_add_orphan(struct journal_handle *, struct file_node *);
 extern int lext3_orphan_del(struct journal_handle *, struct file_node *);
+
+extern unsigned long lext3_extent_gen(struct file_node *fnode);
+extern unsigned long lext3_extent_lookup(struct file_node *fnode,
+	unsigned long block, unsigned long *phy);
+extern void lext3_extent_add(struct file_node *fnode, unsigned long gen,
+	unsigned long logic, unsigned long phy, unsigned long count);
+extern void lext3_extent_truncate(struct file_node *fnode, unsigned long from);
+extern void lext3_extent_destroy(struct file_node *fnode);
+extern void lext3_extent_init(struct file_node *fnode);
+extern void init_lext3_extent(void);
 extern void lext3_read_fnode(struct file_node *);
 
 /* dir.c */
 extern struct file_ops lext3_dir_fileops;
+extern int lext3_htree_store_dirent(struct file *dir_file, __u32 hash,
+	__u32 minor_hash, struct lext3_dir_item *dir_item);
+
+/* hash.c */
+extern int lext3_dirhash(const char *name, int len,
+	struct lext3_dx_hash_info *hinfo);
 
 /* file.c */
 extern struct file_node_ops lext3_file_fnode_ops;
@@ -1145,6 +1256,8 @@ extern struct file_ops lext3_file_ops;
 /* namei.c */
 extern struct file_node_ops lext3_dir_fnode_ops;
 extern struct file_node_ops lext3_special_fnode_ops;
+extern int lext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
+	__u32 start_minor_hash, __u32 *next_hash);
 
 /* symlink.c */
 extern struct file_node_ops lext3_symlink_fnode_ops;
@@ -1199,6 +1312,8 @@ unsigned long lext3_blkcount_groupdesc(struct super_block *super, int group);
 #define __printf_2_3 __attribute__((format (printf, 2, 3)))
 extern __printf_2_3 void lext3_enconter_error(struct super_block *, const char *, ...);
 extern __printf_2_3 void lext3_abort_filesystem (struct super_block *, const char *, ...);
+extern __printf_3_4 void lext3_warning(struct super_block *, const char *,
+	const char *, ...);
 extern int fs_overflowuid;
 extern int fs_overflowgid;
 #define DEFAULT_FS_OVERFLOWUID	65534
@@ -18,6 +18,7 @@
 #define STACK_MAGIC	0xdeadbeef
 
 #define MSGQ_MAGIC 0x37210709
+#define MSG_RING_MAGIC 0x37210710
 #define TIMER_MAGIC	0x4b87ad6e
 #define TTY_MAGIC		0x5401
 #define TTY_LDISC_MAGIC	0x5403
@@ -49,6 +49,42 @@ struct page_statistics_cpu {
 	 */
 	long bio_read;
 	long bio_write;
+
+	/**
+	 * 页面回收扫描过的页面数量
+	 */
+	long reclaim_scan;
+	/**
+	 * 页面回收释放的页面数量
+	 */
+	long reclaim_free;
+	/**
+	 * 在分配路径上直接回收的次数
+	 */
+	long reclaim_direct;
+	/**
+	 * 唤醒后台回收线程的次数
+	 */
+	long reclaim_wakeup;
+
+	/**
+	 * 获得内存区锁的次数
+	 */
+	long area_lock_count;
+	/**
+	 * 持有、等待内存区锁的时间，以cycle为单位
+	 */
+	long area_lock_hold;
+	long area_lock_wait;
+
+	/**
+	 * 从其他可移动性类型的空闲链表中分配的次数
+	 */
+	long mobility_fallback;
+	/**
+	 * 整个页块被改为请求类型的次数
+	 */
+	long mobility_steal;
 };
 
 extern unsigned long __approximate_page_statistics(int offset);
@@ -2,6 +2,8 @@
 #define _DIM_SUM_MOUNT_H
 
 #include <dim-sum/object.h>
+#include <dim-sum/rcupdate.h>
+#include <dim-sum/smp_seq_lock.h>
 
 /**
  * 文件系统安装点
@@ -45,6 +47,10 @@ struct mount_desc
 	 * 该文件系统的超级块对象。
 	 */
 	struct super_block *super_block;
+	/**
+	 * 在宽限期结束后释放描述符
+	 */
+	struct rcu_head rcu;
 };
 
 static inline struct mount_desc *hold_mount(struct mount_desc *desc)
@@ -61,12 +67,27 @@ static inline void loosen_mount(struct mount_desc *desc)
 		loosen_object(&desc->object);
 }
 
+/**
+ * 在RCU读端临界区中获取引用
+ * 描述符正在被释放时失败
+ */
+static inline int try_hold_mount(struct mount_desc *desc)
+{
+	return ref_count_try_hold(&desc->object.ref);
+}
+
 extern struct mount_desc *lookup_mount(struct mount_desc *, struct filenode_cache *);
+extern struct mount_desc *
+lookup_mount_rcu(struct mount_desc *, struct filenode_cache *);
 
 /**
  * 保护已经安装文件系统的链表。
  */
 extern struct smp_lock mount_lock;
+/**
+ * 安装树发生变化时递增，写者持有mount_lock
+ */
+extern struct smp_seq_count mount_seq;
 /*
  * Block device ioctls
  */
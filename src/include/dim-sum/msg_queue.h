@@ -1,8 +1,11 @@
 #ifndef __DIM_SUM_MSG_QUEUE_H
 #define __DIM_SUM_MSG_QUEUE_H
 
+#include <dim-sum/accurate_counter.h>
+#include <dim-sum/cache.h>
 #include <dim-sum/magic.h>
 #include <dim-sum/smp_lock.h>
+#include <dim-sum/wait.h>
 
 #define MSGQ_TRY_AGAIN 1
 #define MSGQ_WAIT 2
@@ -64,4 +67,56 @@ int  msg_queue_send( struct msg_queue * queue, char *msg, unsigned int msglen,
                            int wait, int pri );
 int msg_queue_count(struct msg_queue * queue);
 
+/**
+ * 环形队列中的一个槽位
+ * seq等于位置号时，槽位空闲，可以写入
+ * seq等于位置号+1时，槽位中有消息，可以读取
+ */
+struct msg_ring_cell {
+	unsigned long seq;
+	unsigned long msg;
+};
+
+/**
+ * 无锁的指针消息队列
+ * 多生产者、多消费者，每个消息是一个字长
+ * 收发两端不持有任何锁，只在队列空、满时才睡眠
+ */
+struct msg_ring {
+	u32 magic;
+	/**
+	 * 槽位数量减1，槽位数量总是2的幂
+	 */
+	unsigned long mask;
+	struct msg_ring_cell *cells;
+	/**
+	 * 睡眠前自旋的次数，根据最近的自旋效果调整
+	 */
+	int spin_limit;
+	/**
+	 * 下一个写入位置，生产者之间竞争
+	 */
+	unsigned long send_pos aligned_cacheline_in_smp;
+	/**
+	 * 下一个读取位置，消费者之间竞争
+	 */
+	unsigned long recv_pos aligned_cacheline_in_smp;
+	/**
+	 * 正在睡眠的收发者数量
+	 * 没有睡眠者时，对端不必调用wake_up
+	 */
+	struct accurate_counter recv_waiters aligned_cacheline_in_smp;
+	struct accurate_counter send_waiters;
+	struct wait_queue recv_wait;
+	struct wait_queue send_wait;
+};
+
+int msg_ring_init(struct msg_ring *ring, int max_msgs);
+void msg_ring_destroy(struct msg_ring *ring);
+int msg_ring_send(struct msg_ring *ring, unsigned long msg, int wait);
+int msg_ring_receive(struct msg_ring *ring, unsigned long *msg, int wait);
+int msg_ring_receive_batch(struct msg_ring *ring, unsigned long *msgs,
+	int nr, int wait);
+int msg_ring_count(struct msg_ring *ring);
+
 #endif /* __DIM_SUM_MSG_QUEUE_H */
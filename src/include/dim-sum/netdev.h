@@ -11,6 +11,15 @@ struct dim_sum_netdev {
 
 	int  (*initialize) (struct dim_sum_netdev *netdev);
 	int  (*send_pkt) (struct dim_sum_netdev *netdev, void *packet, int length);
+	/**
+	 * 以分散聚集方式直接发送pbuf链，优先于send_pkt
+	 * 驱动自行增加pbuf引用计数，发送完成后释放
+	 */
+	int  (*send_pbuf) (struct dim_sum_netdev *netdev, struct pbuf *p);
+	/**
+	 * 轮询方式收包，中断驱动的设备不需要设置
+	 * 而是调用dim_sum_netdev_input将报文送给协议栈
+	 */
 	int  (*recv_pkt) (struct dim_sum_netdev *netdev, void *packet, int *length);
 	void (*halt_netdev) (struct dim_sum_netdev *netdev);
 
@@ -23,5 +32,6 @@ struct dim_sum_netdev {
 };
 
 int dim_sum_netdev_register(struct dim_sum_netdev *netdev);
+void dim_sum_netdev_input(struct dim_sum_netdev *netdev, struct pbuf *p);
 
 #endif /* __DIM_SUM_NETDEV_H */
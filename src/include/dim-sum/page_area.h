@@ -10,6 +10,33 @@
 #include <asm/page.h>
 
 #define PG_AREA_MAX_ORDER 11
+/**
+ * 不大于此order的块，都经过每CPU缓存分配
+ * 任务堆栈、beehive等常用的小块分配不必获得内存区锁
+ */
+#define PAGE_CACHE_MAX_ORDER 3
+
+/**
+ * 页面的可移动性
+ * 空闲块按此分组，避免长期占用的内核页面散布在整个内存区中
+ */
+enum page_mobility {
+	/* 内核数据结构，既不能移动，也不能回收 */
+	MOBILITY_UNMOVABLE,
+	/* 可回收的内核缓存，如beehive中可回收的对象 */
+	MOBILITY_RECLAIMABLE,
+	/* 用户页面及文件页面缓存 */
+	MOBILITY_MOVABLE,
+	/* 类型数量 */
+	MOBILITY_COUNT
+};
+
+/**
+ * 页块是记录可移动性的单位
+ * 不同类型的分配尽量不共用一个页块
+ */
+#define PAGEBLOCK_ORDER		(PG_AREA_MAX_ORDER - 1)
+#define PAGEBLOCK_PAGES		(1UL << PAGEBLOCK_ORDER)
 
 /**
  * 内存区类型
@@ -52,8 +79,9 @@ struct per_cpu_pages {
 	int batch;		/* chunk size for buddy add/remove */
 	/**
 	 * 高速缓存中包含的页框描述符链表。
+	 * 每种可移动性一个链表，分配时不必遍历查找
 	 */
-	struct double_list list;
+	struct double_list lists[MOBILITY_COUNT];
 };
 
 /**
@@ -97,6 +125,11 @@ struct page_area {
 		 * 热高速缓存和冷高速缓存。
 		 */
 		struct per_cpu_pages cpu_cache[CPU_CACHE_COUNT];	/* 0: hot.  1: cold */
+		/**
+		 * 多页块的缓存，下标为order - 1
+		 * 链表中的每一项是一个2^order大小的块
+		 */
+		struct per_cpu_pages order_cache[PAGE_CACHE_MAX_ORDER];
 	} aligned_cacheline_in_smp page_caches[MAX_CPUS];
 
 	/**
@@ -107,14 +140,20 @@ struct page_area {
 	struct page_free_brick {
 		/**
 		 * 在内存区域中的空闲页面块链表
+		 * 按所在页块的可移动性分开链接
 		 */
-		struct double_list	free_list;
+		struct double_list	free_list[MOBILITY_COUNT];
 		/**
-		 * 页面块数量
+		 * 页面块数量，包含所有类型
 		 */
 		unsigned long		brick_count;
 	} buddies[PG_AREA_MAX_ORDER];
 
+	/**
+	 * 每个页块的可移动性，参见enum page_mobility
+	 */
+	unsigned char		*block_mobility;
+
 	struct {
 		char unused[0];
 	} aligned_cacheline_in_smp _pad1;
@@ -157,6 +196,27 @@ struct page_area {
 	} attrs; 
 };
 
+/**
+ * 节点的页面LRU链表
+ * 页面缓存中的页面按访问冷热排列，回收从非活动链表尾部开始
+ */
+struct page_lru {
+	/**
+	 * 保护两个链表及计数
+	 */
+	struct smp_lock lock;
+	/**
+	 * 最近被重复访问过的页面
+	 */
+	struct double_list active_list;
+	/**
+	 * 回收候选页面
+	 */
+	struct double_list inactive_list;
+	unsigned long nr_active;
+	unsigned long nr_inactive;
+};
+
 /**
  * 内存区域，在非连续内存模型中，代表一块内存bank
  * 在NUMA系统中，一般表示一个NUMA节点。
@@ -166,6 +226,16 @@ struct memory_node {
 	 * 节点管理区描述符数组
 	 */
 	struct page_area pg_areas[PG_AREA_COUNT];
+	/**
+	 * 节点的页面LRU链表
+	 */
+	struct page_lru aligned_cacheline_in_smp lru;
+	/**
+	 * 后台回收线程在此等待
+	 * 空闲页面低于pages_low时被唤醒
+	 */
+	struct wait_queue reclaim_wait;
+	int reclaim_pending;
 	/**
 	 * 用于页面分配的内存区域
 	 * 按此顺序依次在内存区域中查找合适的页面
@@ -207,4 +277,14 @@ struct memory_node {
  */
 #define NODE_PG_AREA(node, pg_area)	((node << PG_AREA_SHIFT) | pg_area)
 
+/**
+ * 内存区在某个order上的碎片指数，放大了1000倍
+ */
+int page_area_frag_index(struct page_area *pg_area, int order);
+
+/**
+ * 将所有CPU的多页块缓存归还给伙伴系统
+ */
+void drain_order_caches(struct page_area_pool *pool);
+
 #endif /* _DIM_SUM_PAGE_AREA_H */
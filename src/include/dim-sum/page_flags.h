@@ -60,6 +60,18 @@ enum {
 	PG_compound,
 	PG_reclaim,
 	PG_arch_1,
+	/**
+	 * 预读标记页，读到该页时触发异步预读
+	 */
+	PG_readahead,
+	/**
+	 * 页面在内存节点的LRU链表中
+	 */
+	PG_lru,
+	/**
+	 * 页面最近被访问过，回收时据此判断冷热
+	 */
+	PG_referenced,
 	PGFLAG_COUNT
 };
 
@@ -68,7 +80,8 @@ enum {
 			| (1UL << PG_writeback) || (1UL << PG_dirty))
 
 #define ALLOC_PAGE_FLAG ((1UL << PG_private) | (1UL << PG_locked) \
-			| (1UL << PG_dirty) | (1UL << PG_reclaim) | (1UL << PG_writeback))
+			| (1UL << PG_dirty) | (1UL << PG_reclaim) | (1UL << PG_writeback) \
+			| (1UL << PG_lru))
 
 #define ALL_PAGE_FLAG GENMASK(PGFLAG_COUNT - 1, 0)
 
@@ -95,6 +108,24 @@ enum {
 #define ClearPageError(page)	atomic_clear_bit(PG_error, &(page)->flags)
 
 
+#define pgflag_readahead(page)	test_bit(PG_readahead, &(page)->flags)
+#define set_page_readahead(page)	atomic_set_bit(PG_readahead, &(page)->flags)
+#define clear_page_readahead(page)	atomic_clear_bit(PG_readahead, &(page)->flags)
+
+#define pgflag_lru(page)	test_bit(PG_lru, &(page)->flags)
+#define set_page_lru(page)	atomic_set_bit(PG_lru, &(page)->flags)
+#define pgflag_test_clear_lru(page)	atomic_test_and_clear_bit(PG_lru, &(page)->flags)
+
+#define pgflag_active(page)	test_bit(PG_active, &(page)->flags)
+#define set_page_active(page)	atomic_set_bit(PG_active, &(page)->flags)
+#define clear_page_active(page)	atomic_clear_bit(PG_active, &(page)->flags)
+
+#define pgflag_referenced(page)	test_bit(PG_referenced, &(page)->flags)
+#define set_page_referenced(page)	atomic_set_bit(PG_referenced, &(page)->flags)
+#define clear_page_referenced(page)	atomic_clear_bit(PG_referenced, &(page)->flags)
+#define pgflag_test_clear_referenced(page)	\
+		atomic_test_and_clear_bit(PG_referenced, &(page)->flags)
+
 #define pgflag_uptodate(page)	test_bit(PG_uptodate, &(page)->flags)
 #define set_page_uptodate(page)	atomic_set_bit(PG_uptodate, &(page)->flags)
 #define clear_page_uptodate(page)	atomic_clear_bit(PG_uptodate, &(page)->flags)
@@ -110,6 +110,14 @@ int cache_space_tagged(struct file_cache_space *space, int tag);
 typedef int filler_t(struct file *, struct page_frame *);
 extern struct page_frame * read_cache_page(struct file_cache_space *space,
 				unsigned long index, void *data);
+
+struct file_ra_state;
+void page_cache_sync_readahead(struct file_cache_space *space,
+	struct file_ra_state *ra, struct file *filp,
+	pgoff_t offset, unsigned long req_size);
+void page_cache_async_readahead(struct file_cache_space *space,
+	struct file_ra_state *ra, struct file *filp,
+	struct page_frame *page, pgoff_t offset, unsigned long req_size);
 unsigned pgcache_find_pages_tag(struct file_cache_space *space, pgoff_t *index,
 			int tag, unsigned int nr_pages, struct page_frame **pages);
 
@@ -38,8 +38,15 @@ static inline unsigned pagevec_add(struct pagevec *pvec, struct page_frame *page
 	return pagevec_space(pvec);
 }
 
+void __pagevec_release(struct pagevec *pvec);
+
+/**
+ * 释放pagevec中页面的引用
+ */
 static inline void pagevec_release(struct pagevec *pvec)
 {
+	if (pagevec_count(pvec))
+		__pagevec_release(pvec);
 }
 
 unsigned pgcache_collect_pages(struct pagevec *pvec, struct file_cache_space *space,
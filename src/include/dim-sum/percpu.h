@@ -7,6 +7,7 @@
 #include <dim-sum/mm.h>
 #include <dim-sum/smp.h>
 #include <dim-sum/init.h>
+#include <dim-sum/irqflags.h>
 
 #define __PCPU_ATTRS(sec)						\
 	__percpu __attribute__((section(PER_CPU_BASE_SECTION sec)))	\
@@ -47,24 +48,30 @@
 	preempt_enable();				\
 } while (0)
 
-struct dynamic_percpu {
-	void *ptrs[MAX_CPUS];
-	void *data;
-};
+/**
+ * 每个CPU单元中，紧跟静态每CPU变量，为动态分配保留的空间
+ * 用完后再按单元大小分配新的块
+ */
+#define PERCPU_DYNAMIC_RESERVE	(32 << 10)
+/**
+ * 动态分配的最小单位
+ */
+#define PERCPU_MIN_ALLOC_SIZE	sizeof(unsigned long)
 
 /**
  * 返回每CPU数组中，与参数cpu对应的cpu元素地址，参数pointer给出数组的地址。
+ * 动态分配的每CPU变量与静态变量一样，在各CPU上的偏移都是per_cpu_offset(cpu)
+ */
+#define __percpu_ptr(ptr, cpu)	SHIFT_PERCPU_PTR((ptr), per_cpu_offset(cpu))
+
+/**
+ * 本CPU上的元素地址，调用者需要关闭抢占
  */
-#define __percpu_ptr(ptr, cpu)                \
-({                                              \
-        struct dynamic_percpu *__p = 		\
-        		(struct dynamic_percpu *)~(unsigned long)(ptr); \
-        (__typeof__(ptr))__p->ptrs[(cpu)];	\
-})
+#define this_cpu_ptr(ptr)	this_cpu_var(ptr)
 
 #define hold_percpu_ptr(var) ({				\
-	int cpu = get_cpu();				\
-	__percpu_ptr(var, cpu); })
+	preempt_disable();				\
+	this_cpu_ptr(var); })
 
 #define loosen_percpu_ptr(var) do {				\
 	(void)(var);					\
@@ -72,8 +79,48 @@ struct dynamic_percpu {
 } while (0)
 
 
+/**
+ * 直接通过本CPU的偏移寻址每CPU变量，静态定义和动态分配的都适用
+ * pcp是变量本身，对动态分配的变量，使用*ptr
+ * 带__前缀的版本，要求调用者已经关闭抢占，并且不会在中断中并发修改
+ */
+#define __this_cpu_read(pcp)		(*this_cpu_var(&(pcp)))
+#define __this_cpu_write(pcp, val)	do { *this_cpu_var(&(pcp)) = (val); } while (0)
+#define __this_cpu_add(pcp, val)	do { *this_cpu_var(&(pcp)) += (val); } while (0)
+#define __this_cpu_inc(pcp)		__this_cpu_add(pcp, 1)
+#define __this_cpu_dec(pcp)		__this_cpu_add(pcp, -1)
+
+/**
+ * 可在任意上下文中调用的版本
+ * ARM64没有基于段寄存器的内存操作指令，这里用关中断保证读-改-写的原子性
+ */
+#define this_cpu_read(pcp) ({				\
+	__typeof__(pcp) __ret;				\
+	preempt_disable();				\
+	__ret = READ_ONCE(__this_cpu_read(pcp));	\
+	preempt_enable();				\
+	__ret; })
+
+#define __this_cpu_irqsafe(op, pcp, val) do {		\
+	unsigned long __flags;				\
+	local_irq_save(__flags);			\
+	op(pcp, val);					\
+	local_irq_restore(__flags);			\
+} while (0)
+
+#define this_cpu_write(pcp, val)	__this_cpu_irqsafe(__this_cpu_write, pcp, val)
+#define this_cpu_add(pcp, val)	__this_cpu_irqsafe(__this_cpu_add, pcp, val)
+#define this_cpu_sub(pcp, val)	this_cpu_add(pcp, -(val))
+#define this_cpu_inc(pcp)	this_cpu_add(pcp, 1)
+#define this_cpu_dec(pcp)	this_cpu_add(pcp, -1)
+
 extern void *__alloc_percpu(size_t size, size_t align);
 extern void free_percpu(const void *);
+/**
+ * 将每个CPU单元中静态变量之后的保留空间，作为第一个动态分配块
+ */
+extern void __init init_percpu_first_chunk(unsigned long static_size,
+	unsigned long unit_size);
 
 #define alloc_percpu(type)	\
 	(typeof(type) __percpu *)__alloc_percpu(sizeof(type), __alignof__(type))
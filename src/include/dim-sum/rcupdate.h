@@ -0,0 +1,67 @@
+#ifndef __DIM_SUM_RCUPDATE_H
+#define __DIM_SUM_RCUPDATE_H
+
+#include <linux/compiler.h>
+#include <dim-sum/preempt.h>
+
+#include <asm/barrier.h>
+
+/**
+ * RCU回调描述符
+ * 嵌入到需要延迟释放的对象中
+ */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+/**
+ * 读端临界区
+ * 基于静止状态的RCU，读者只需要禁止抢占
+ * 临界区内不能睡眠
+ */
+#define rcu_read_lock()		preempt_disable()
+#define rcu_read_unlock()	preempt_enable()
+
+/**
+ * 读取受RCU保护的指针
+ */
+#define rcu_dereference(p) ({				\
+	typeof(p) __p = READ_ONCE(p);			\
+	smp_read_barrier_depends();			\
+	__p;						\
+})
+
+/**
+ * 发布受RCU保护的指针
+ * 保证读者看到指针时，对象已经初始化完毕
+ */
+#define rcu_assign_pointer(p, v) do {			\
+	smp_wmb();					\
+	WRITE_ONCE(p, v);				\
+} while (0)
+
+/**
+ * 在宽限期结束后，调用func释放对象
+ */
+extern void call_rcu(struct rcu_head *head,
+	void (*func)(struct rcu_head *head));
+/**
+ * 等待已经开始的读端临界区全部结束
+ */
+extern void synchronize_rcu(void);
+
+/**
+ * 本CPU经过了一个静止状态
+ * 在任务切换及空闲循环中调用
+ */
+extern void rcu_note_qs(void);
+/**
+ * 在时钟中断中调用，推进宽限期
+ */
+extern void rcu_check_callbacks(void);
+
+void init_rcu_early(void);
+void init_rcu(void);
+
+#endif /* __DIM_SUM_RCUPDATE_H */
@@ -12,6 +12,15 @@ static inline unsigned long get_ref_count(struct ref_count *ref)
 	return accurate_read(&ref->count);
 }
 
+/**
+ * 引用计数不为0时才获取引用
+ * 用于在RCU读端临界区中获取可能正在释放的对象
+ */
+static inline int ref_count_try_hold(struct ref_count *ref)
+{
+	return accurate_inc_not_zero(&ref->count);
+}
+
 void ref_count_init(struct ref_count *ref);
 void ref_count_hold(struct ref_count *ref);
 void ref_count_loosen(struct ref_count *ref,
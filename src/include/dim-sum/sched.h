@@ -18,6 +18,7 @@ struct wait_queue;
 struct task_fs_context;
 struct task_file_handles;
 struct blkdev_infrast;
+struct blk_plug;
 
 /**
  * 任务标志
@@ -90,6 +91,14 @@ struct task_desc {
 	 * 是否在运行队列中
 	 */
 	bool			in_run_queue;
+	/**
+	 * 任务所在运行队列的CPU
+	 */
+	int			cpu;
+	/**
+	 * 任务绑定的CPU，负数表示可以在任意CPU上运行
+	 */
+	int			affinity;
 	/**
 	 * 通过此字段将任务放进运行队列 
 	 */
@@ -186,6 +195,10 @@ struct task_desc {
 	 * 正在使用的原子操作对象。
 	 */
 	void *journal_info;
+	/**
+	 * 正在使用的块设备请求插头
+	 */
+	struct blk_plug *plug;
 	/**
 	 * 在系统调用wait4中睡眠的进程的等待队列。
 	 */
@@ -348,6 +361,34 @@ int wake_up_process(struct task_desc *tsk);
 extern struct task_desc * __switch_cpu_context(struct task_desc *prev,
 	struct task_desc *next);
 
+/**
+ * 每个CPU上的调度统计信息
+ */
+struct sched_statistics {
+	/**
+	 * 运行队列中的任务数量
+	 */
+	int nr_running;
+	/**
+	 * 任务切换次数
+	 */
+	unsigned long nr_switches;
+	/**
+	 * 通过负载均衡从其他CPU窃取的任务数量
+	 */
+	unsigned long nr_pulled;
+};
+
+extern int set_task_affinity(struct task_desc *tsk, int cpu);
+extern void get_sched_statistics(int cpu, struct sched_statistics *stat);
+/**
+ * 负载均衡
+ *	idle_balance:CPU空闲时调用
+ *	sched_tick:时钟中断中周期性调用
+ */
+extern int idle_balance(void);
+extern void sched_tick(void);
+
 extern int process_signal(struct exception_spot *regs);
 extern int post_signal(unsigned long sig,struct task_desc * p,int priv);
 extern int post_signal_to_proc(int pid, int sig, int priv);
@@ -365,10 +406,7 @@ static inline int kthread_should_stop(void)
 	return 0;
 }
 
-static inline void kthread_bind(struct task_desc *k, unsigned int cpu)
-{
-	/* TO-DO */
-}
+extern void kthread_bind(struct task_desc *k, unsigned int cpu);
 
 struct task_desc *kthread_create(int (*threadfn)(void *data),
 			void *data, int prio, const char namefmt[], ...);
@@ -28,15 +28,37 @@ enum ipi_cmd_type {
 	IPI_CALL_FUNC,
 };
 
+/**
+ * 跨核函数调用标志
+ *	SMP_CALL_PENDING:请求还没有被处理
+ *	SMP_CALL_WAIT:请求者在等待，描述符位于其堆栈中
+ *	SMP_CALL_ALLOC:描述符是动态分配的，由目标核释放
+ */
+#define SMP_CALL_PENDING	0x1
+#define SMP_CALL_WAIT		0x2
+#define SMP_CALL_ALLOC		0x4
+
+/**
+ * 跨核函数调用请求
+ */
 struct smp_call_data {
-	struct smp_lock lock;
+	/**
+	 * 通过此字段链接到目标核的调用队列
+	 */
+	struct double_list list;
 	void (*func) (void *info);
 	void *priv;
 	u16 flags;
 };
 
+int smp_call_for_cpu(int cpu, void (*func) (void *info), void *info, int wait);
+int smp_call_for_many(const struct cpumask *mask,
+	void (*func) (void *info), void *info, int wait);
 int smp_call_function(void(*func)(void *info), void *info, int wait);
 int smp_call_for_all(void (*func) (void *info), void *info, int wait);
+void smp_send_reschedule(int cpu);
+void smp_call_interrupt(void);
+extern void __init init_smp_call(void);
 
 #define get_cpu()		({ preempt_disable(); smp_processor_id(); })
 #define put_cpu()		preempt_enable()
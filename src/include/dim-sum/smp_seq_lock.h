@@ -1,6 +1,7 @@
 #ifndef __DIM_SUM_SMP_SEQ_LOCK_H
 #define __DIM_SUM_SMP_SEQ_LOCK_H
 
+#include <linux/compiler.h>
 #include <dim-sum/smp_lock.h>
 #include <dim-sum/preempt.h>
 
@@ -70,4 +71,48 @@ static inline int smp_seq_read_retry(const struct smp_seq_lock *lock, unsigned i
 	return (iv & 1) | (lock->sequence ^ iv);
 }
 
+/**
+ * 顺序计数器
+ * 与顺序锁相同，但是不带自旋锁
+ * 写者之间的互斥由调用者使用其他锁保证
+ */
+struct smp_seq_count {
+	unsigned sequence;
+};
+
+static inline void smp_seq_count_init(struct smp_seq_count *count)
+{
+	count->sequence = 0;
+}
+
+static inline unsigned smp_seq_count_begin(const struct smp_seq_count *count)
+{
+	unsigned ret;
+
+	ret = READ_ONCE(count->sequence);
+	smp_rmb();
+
+	return ret;
+}
+
+static inline int
+smp_seq_count_retry(const struct smp_seq_count *count, unsigned iv)
+{
+	smp_rmb();
+
+	return (iv & 1) | (READ_ONCE(count->sequence) ^ iv);
+}
+
+static inline void smp_seq_count_write_begin(struct smp_seq_count *count)
+{
+	count->sequence++;
+	smp_wmb();
+}
+
+static inline void smp_seq_count_write_end(struct smp_seq_count *count)
+{
+	smp_wmb();
+	count->sequence++;
+}
+
 #endif /* __DIM_SUM_SMP_SEQ_LOCK_H */
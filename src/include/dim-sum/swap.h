@@ -2,8 +2,21 @@
 #define __DIM_SUM_SWAP_H
 
 struct page_frame;
+struct memory_node;
 
 extern void mark_page_accessed(struct page_frame *);
 extern void lru_cache_add(struct page_frame *);
 
+/**
+ * 一次回收操作处理的页面数量
+ */
+#define RECLAIM_BATCH	32
+
+extern unsigned long shrink_memory_node(struct memory_node *node,
+			unsigned long nr_to_reclaim, unsigned int paf_mask);
+extern unsigned long try_to_free_pages(struct memory_node *node,
+			unsigned int order, unsigned int paf_mask);
+extern void wakeup_page_reclaim(struct memory_node *node);
+extern void init_page_reclaim(void);
+
 #endif /* __DIM_SUM_SWAP_H */
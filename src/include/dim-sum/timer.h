@@ -34,7 +34,11 @@ enum {
 	 * 周期性定时器
 	 */
 	__TIMER_PERIODIC,
-	
+	/**
+	 * 高精度定时器，按到期时间排序在红黑树中
+	 * 其他定时器放在时间轮中
+	 */
+	__TIMER_HRES,
 };
 
 /**
@@ -46,6 +50,51 @@ enum {
 #define TIMER_PERIODIC		(1UL << __TIMER_PERIODIC)
 #define TIMER_INQUEUE		(1UL << __TIMER_INQUEUE)
 #define TIMER_OPEN_IRQ		(1UL << __TIMER_OPEN_IRQ)
+#define TIMER_HRES			(1UL << __TIMER_HRES)
+
+/**
+ * 时间轮
+ * 第一级256个桶，每个桶对应一个jiffy
+ * 后面四级各64个桶，每个桶的跨度是前一级的64倍
+ */
+#define TVN_BITS	6
+#define TVR_BITS	8
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_LEVELS	4
+
+/**
+ * 每个CPU上的定时器统计
+ */
+struct timer_statistics {
+	/**
+	 * 加入队列的次数
+	 */
+	unsigned long nr_add;
+	/**
+	 * 到期前被删除的次数
+	 */
+	unsigned long nr_remove;
+	/**
+	 * 修改到期时间的次数
+	 */
+	unsigned long nr_rejoin;
+	/**
+	 * 不需要移动桶，无锁完成的次数
+	 * 按执行修改的CPU统计，不计入nr_rejoin
+	 */
+	unsigned long nr_rejoin_fast;
+	/**
+	 * 到期运行的次数
+	 */
+	unsigned long nr_expire;
+	/**
+	 * 在时间轮各级之间迁移的次数
+	 */
+	unsigned long nr_cascade;
+};
 
 /**
  * 每个CPU上的定时器队列描述符
@@ -64,6 +113,13 @@ struct cpu_timer_queue
 	 * 定时器根节点
 	 */
 	struct rb_root rbroot;
+	/**
+	 * 时间轮下一个要处理的jiffy
+	 */
+	u64 wheel_jiffies;
+	struct double_list tv1[TVR_SIZE];
+	struct double_list tvn[TVN_LEVELS][TVN_SIZE];
+	struct timer_statistics stat;
 };
 
 /**
@@ -88,9 +144,13 @@ struct timer
 	 */
 	struct rb_node rbnode;
 	/**
-	 * 通过此节点，将定时器加入到队列链表中
+	 * 通过此节点，将定时器加入到队列链表或者时间轮的桶中
 	 */
 	struct double_list list;
+	/**
+	 * 时间轮定时器所在的桶
+	 */
+	struct double_list *bucket;
 	/**
 	 * 定时器到期时间
 	 */
@@ -130,6 +190,8 @@ int timer_remove(struct timer *timer);
  */
 extern int synchronize_timer_del(struct timer *timer);
 
+extern void get_timer_statistics(int cpu, struct timer_statistics *stat);
+
 void hrtimer_interrupt(struct timer_device *dev);
 
 extern void init_timer(void);
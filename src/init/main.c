@@ -8,8 +8,10 @@
 #include <dim-sum/mem.h>
 #include <dim-sum/mmu.h>
 #include <dim-sum/radix-tree.h>
+#include <dim-sum/rcupdate.h>
 #include <dim-sum/sched.h>
 #include <dim-sum/smp.h>
+#include <dim-sum/swap.h>
 #include <dim-sum/syscall.h>
 #include <dim-sum/timer.h>
 #include <dim-sum/tty.h>
@@ -84,7 +86,9 @@ asmlinkage void __init start_master(void)
 	init_IRQ();
 	init_time();
 	init_timer();
+	init_rcu_early();
 	init_sched();
+	init_smp_call();
 	init_console();
 
 	enable_irq();
@@ -112,6 +116,14 @@ static __maybe_unused int init_in_process(void *unused)
 	 * 可睡眠的延迟任务
 	 */
 	init_sleep_works();
+	/**
+	 * 后台页面回收线程
+	 */
+	init_page_reclaim();
+	/**
+	 * 执行RCU回调的后台线程
+	 */
+	init_rcu();
 
 	init_vfs();
 	init_file_systems();
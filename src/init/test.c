@@ -1,10 +1,19 @@
 #include <dim-sum/accurate_counter.h>
 #include <dim-sum/beehive.h>
+#include <dim-sum/blkio.h>
+#include <dim-sum/blk_dev.h>
 #include <dim-sum/delay.h>
+#include <dim-sum/err.h>
+#include <dim-sum/fs.h>
+#include <dim-sum/mem.h>
+#include <dim-sum/msg_queue.h>
+#include <dim-sum/page_area.h>
 #include <dim-sum/percpu.h>
 #include <dim-sum/printk.h>
 #include <dim-sum/sched.h>
 #include <dim-sum/syscall.h>
+#include <dim-sum/time.h>
+#include <dim-sum/timer.h>
 #include <dim-sum/timex.h>
 #include <dim-sum/wait.h>
 
@@ -13,6 +22,15 @@
 #include <dim-sum/smp_bit_lock.h>
 #include <dim-sum/smp.h>
 
+#include <lwip/icmp.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/ip.h>
+#include <lwip/netif.h>
+#include <lwip/pbuf.h>
+#include <lwip/stats.h>
+#include <lwip/udp.h>
+#include <netif/etharp.h>
+
 void dim_sum_test(void);
 
 struct foo_struct {
@@ -85,6 +103,1161 @@ static  __attribute__((__noinline__)) int new_xby_test_jump(int a)
 	return a + 1;
 }
 
+/**
+ * 调度器乒乓测试
+ * 在每个CPU上绑定两个同优先级任务，互相让出CPU
+ * 依次测试1到全部CPU，观察任务切换速率能否线性增长
+ */
+#define PINGPONG_LOOPS	100000
+static struct accurate_counter pingpong_done = ACCURATE_COUNTER_INIT(0);
+
+static int sched_pingpong_task(void *data)
+{
+	int cpu = (int)(unsigned long)data;
+	int i;
+
+	set_task_affinity(current, cpu);
+	sys_sched_yield();
+
+	for (i = 0; i < PINGPONG_LOOPS; i++)
+		sys_sched_yield();
+
+	accurate_inc(&pingpong_done);
+
+	return 0;
+}
+
+static void sched_pingpong_bench(void)
+{
+	struct sched_statistics stat;
+	unsigned long switches;
+	u64 start, ticks;
+	int nr, cpu, i;
+
+	for (nr = 1; nr <= num_online_cpus(); nr++) {
+		accurate_set(&pingpong_done, 0);
+		switches = 0;
+		for (cpu = 0; cpu < nr; cpu++) {
+			get_sched_statistics(cpu, &stat);
+			switches -= stat.nr_switches;
+		}
+
+		start = get_jiffies_64();
+		for (cpu = 0; cpu < nr; cpu++)
+			for (i = 0; i < 2; i++)
+				create_process(sched_pingpong_task,
+					(void *)(unsigned long)cpu, "pingpong", 25);
+
+		while (accurate_read(&pingpong_done) < 2 * nr)
+			msleep(10);
+		ticks = get_jiffies_64() - start;
+
+		for (cpu = 0; cpu < nr; cpu++) {
+			get_sched_statistics(cpu, &stat);
+			switches += stat.nr_switches;
+		}
+
+		printk("sched pingpong: %d cpus, %lu switches in %llu ticks, %llu switches/tick\n",
+			nr, switches, ticks, ticks ? switches / ticks : 0);
+	}
+}
+
+/**
+ * 字符串函数性能测试
+ * 从8字节到1M，每种长度处理约64M字节
+ * 以通用定时器计数为单位，输出每个计数处理的字节数(x100)
+ */
+#define STRING_BENCH_MAX	(1UL << 20)
+#define STRING_BENCH_BYTES	(64UL << 20)
+
+static void string_bench_one(const char *name, int op,
+	char *dst, char *src, unsigned long size)
+{
+	unsigned long loops = STRING_BENCH_BYTES / size;
+	cycles_t start, ticks;
+	unsigned long i;
+
+	start = get_cycles();
+	for (i = 0; i < loops; i++) {
+		switch (op) {
+		case 0:
+			memcpy(dst, src, size);
+			break;
+		case 1:
+			memmove(dst + 8, dst, size - 8);
+			break;
+		case 2:
+			memset(dst, 0, size);
+			break;
+		case 3:
+			if (memcmp(dst, src, size))
+				return;
+			break;
+		default:
+			if (strlen(src) != size - 1)
+				return;
+		}
+		barrier();
+	}
+	ticks = get_cycles() - start;
+
+	printk("%-8s %8lu bytes: %lu ticks, %lu bytes/tick x100\n", name, size,
+		(unsigned long)ticks,
+		ticks ? loops * size * 100 / ticks : 0);
+}
+
+static void string_bench(void)
+{
+	static const char *names[] = {"memcpy", "memmove", "memset", "memcmp", "strlen"};
+	int order = get_order(STRING_BENCH_MAX + 64);
+	char *src, *dst;
+	unsigned long size;
+	int op;
+
+	src = (char *)alloc_pages_memory(PAF_KERNEL, order);
+	dst = (char *)alloc_pages_memory(PAF_KERNEL, order);
+	if (!src || !dst)
+		goto out;
+
+	for (op = 0; op < ARRAY_SIZE(names); op++)
+		for (size = 8; size <= STRING_BENCH_MAX; size <<= 1) {
+			/**
+			 * memcmp比较两块相同的内存，strlen的字符串长度为size - 1
+			 */
+			memset(src, 'a', size);
+			src[size - 1] = op == 4 ? 0 : 'a';
+			memcpy(dst, src, size);
+			string_bench_one(names[op], op, dst, src, size);
+		}
+
+out:
+	if (src)
+		free_pages_memory((unsigned long)src, order);
+	if (dst)
+		free_pages_memory((unsigned long)dst, order);
+}
+
+/**
+ * 定时器性能测试
+ * 10万个定时器反复加入、推后、删除，分别测试时间轮和红黑树
+ */
+#define TIMER_BENCH_COUNT	100000
+#define TIMER_BENCH_CHUNK	1000
+
+static int timer_bench_handle(void *data)
+{
+	return 0;
+}
+
+static void timer_bench_one(struct timer **chunks, unsigned int flag)
+{
+	struct timer_statistics stat;
+	cycles_t start, add, rejoin, remove;
+	u64 now = get_jiffies_64();
+	int i;
+
+	start = get_cycles();
+	for (i = 0; i < TIMER_BENCH_COUNT; i++) {
+		struct timer *timer = &chunks[i / TIMER_BENCH_CHUNK][i % TIMER_BENCH_CHUNK];
+
+		timer_init(timer);
+		timer->flag |= flag;
+		timer->handle = timer_bench_handle;
+		timer->expire = now + 1000 + (i % 50000);
+		timer_add(timer);
+	}
+	add = get_cycles();
+
+	for (i = 0; i < TIMER_BENCH_COUNT; i++) {
+		struct timer *timer = &chunks[i / TIMER_BENCH_CHUNK][i % TIMER_BENCH_CHUNK];
+
+		timer_rejoin(timer, timer->expire + 1);
+	}
+	rejoin = get_cycles();
+
+	for (i = 0; i < TIMER_BENCH_COUNT; i++)
+		timer_remove(&chunks[i / TIMER_BENCH_CHUNK][i % TIMER_BENCH_CHUNK]);
+	remove = get_cycles();
+
+	get_timer_statistics(smp_processor_id(), &stat);
+	printk("timer bench(%s): add %lu, rejoin %lu, remove %lu ticks\n",
+		flag & TIMER_HRES ? "rbtree" : "wheel",
+		(unsigned long)(add - start), (unsigned long)(rejoin - add),
+		(unsigned long)(remove - rejoin));
+	printk("  add %lu remove %lu rejoin %lu fast %lu expire %lu cascade %lu\n",
+		stat.nr_add, stat.nr_remove, stat.nr_rejoin,
+		stat.nr_rejoin_fast, stat.nr_expire, stat.nr_cascade);
+}
+
+static void timer_bench(void)
+{
+	static struct timer *chunks[TIMER_BENCH_COUNT / TIMER_BENCH_CHUNK];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(chunks); i++) {
+		chunks[i] = kmalloc(TIMER_BENCH_CHUNK * sizeof(struct timer), PAF_KERNEL);
+		if (!chunks[i])
+			goto out;
+	}
+
+	/**
+	 * 绑定到当前CPU，所有定时器都在同一个队列中
+	 */
+	set_task_affinity(current, smp_processor_id());
+	timer_bench_one(chunks, 0);
+	timer_bench_one(chunks, TIMER_HRES);
+
+out:
+	for (i = 0; i < ARRAY_SIZE(chunks); i++)
+		kfree(chunks[i]);
+}
+
+/**
+ * 块设备IOPS测试，类似fio的randread/read
+ * 每个CPU一个任务，保持BLK_BENCH_DEPTH个4K读请求在途
+ * 只读不写，不会破坏磁盘上的文件系统
+ */
+#define BLK_BENCH_DEV		"/dev/vda"
+#define BLK_BENCH_DEPTH		32
+#define BLK_BENCH_IOS		20000
+#define BLK_BENCH_SIZE		PAGE_SIZE
+
+struct blk_bench_worker {
+	struct block_device *bdev;
+	struct page_frame *page;
+	struct accurate_counter inflight;
+	struct wait_queue wait;
+	sector_t nr_sectors;
+	unsigned long seed;
+	int cpu;
+	bool random;
+};
+
+static struct accurate_counter blk_bench_done;
+
+static int blk_bench_finish(struct block_io_desc *bio, unsigned int bytes_done, int err)
+{
+	struct blk_bench_worker *worker = bio->bi_private;
+
+	if (bio->remain_size)
+		return 1;
+
+	loosen_blkio(bio);
+	accurate_dec(&worker->inflight);
+	wake_up(&worker->wait);
+
+	return 0;
+}
+
+static int blk_bench_task(void *data)
+{
+	struct blk_bench_worker *worker = data;
+	unsigned long blocks = worker->nr_sectors / (BLK_BENCH_SIZE >> 9);
+	unsigned long block = worker->cpu * (blocks / MAX_CPUS);
+	struct block_io_desc *bio;
+	int i;
+
+	set_task_affinity(current, worker->cpu);
+
+	for (i = 0; i < BLK_BENCH_IOS; i++) {
+		cond_wait(worker->wait,
+			accurate_read(&worker->inflight) < BLK_BENCH_DEPTH);
+
+		if (worker->random) {
+			worker->seed = worker->seed * 6364136223846793005UL
+					+ 1442695040888963407UL;
+			block = (worker->seed >> 17) % blocks;
+		} else
+			block = (block + 1) % blocks;
+
+		bio = blkio_alloc(PAF_KERNEL, 1);
+		bio->start_sector = block * (BLK_BENCH_SIZE >> 9);
+		bio->bi_bdev = worker->bdev;
+		bio->items[0].bv_page = worker->page;
+		bio->items[0].length = BLK_BENCH_SIZE;
+		bio->items[0].bv_offset = 0;
+		bio->item_count = 1;
+		bio->bi_idx = 0;
+		bio->remain_size = BLK_BENCH_SIZE;
+		bio->finish = blk_bench_finish;
+		bio->bi_private = worker;
+
+		accurate_inc(&worker->inflight);
+		blk_submit_request(READ, bio);
+	}
+
+	cond_wait(worker->wait, accurate_read(&worker->inflight) == 0);
+	accurate_inc(&blk_bench_done);
+
+	return 0;
+}
+
+static void blk_bench_one(struct block_device *bdev, int nr, bool random)
+{
+	static struct blk_bench_worker workers[MAX_CPUS];
+	u64 start, ticks;
+	unsigned long ios;
+	int cpu;
+
+	accurate_set(&blk_bench_done, 0);
+	blk_reset_latency(blkdev_get_queue(bdev));
+	start = get_jiffies_64();
+	for (cpu = 0; cpu < nr; cpu++) {
+		struct blk_bench_worker *worker = &workers[cpu];
+
+		worker->bdev = bdev;
+		worker->page = alloc_page_frame(PAF_KERNEL);
+		if (!worker->page) {
+			nr = cpu;
+			break;
+		}
+		accurate_set(&worker->inflight, 0);
+		init_waitqueue(&worker->wait);
+		worker->nr_sectors = bd_get_sectors(bdev);
+		worker->seed = cpu + 1;
+		worker->cpu = cpu;
+		worker->random = random;
+		create_process(blk_bench_task, worker, "blk_bench", 25);
+	}
+
+	while (accurate_read(&blk_bench_done) < nr)
+		msleep(10);
+	ticks = get_jiffies_64() - start;
+
+	for (cpu = 0; cpu < nr; cpu++)
+		free_page_frame(workers[cpu].page);
+
+	ios = (unsigned long)nr * BLK_BENCH_IOS;
+	printk("blk bench(%s): %d cpus, %lu ios in %llu ticks, %llu iops\n",
+		random ? "randread" : "read", nr, ios, ticks,
+		ticks ? (u64)ios * HZ / ticks : 0);
+	blk_dump_latency(blkdev_get_queue(bdev));
+}
+
+static void blk_bench(void)
+{
+	struct block_device *bdev;
+	int nr;
+
+	bdev = blkdev_load_desc(BLK_BENCH_DEV);
+	if (IS_ERR(bdev)) {
+		printk("blk bench: can not find %s\n", BLK_BENCH_DEV);
+		return;
+	}
+
+	if (open_block_device(bdev, FMODE_READ, 0)) {
+		loosen_block_device(bdev);
+		return;
+	}
+
+	for (nr = 1; nr <= num_online_cpus(); nr <<= 1) {
+		blk_bench_one(bdev, nr, false);
+		blk_bench_one(bdev, nr, true);
+	}
+
+	/**
+	 * 同样的随机读经过deadline调度器
+	 */
+	if (!iosched_switch(blkdev_get_queue(bdev), "deadline")) {
+		printk("blk bench: deadline\n");
+		blk_bench_one(bdev, num_online_cpus(), true);
+		iosched_switch(blkdev_get_queue(bdev), "noop");
+	}
+
+	close_block_device(bdev);
+}
+
+/**
+ * lext3并发写碎片测试
+ * 多个任务同时向各自的文件交错追加写，然后统计每个文件的物理区段数
+ * 最后用O_DIRECT顺序读回所有文件，测量吞吐量
+ */
+#define FRAG_BENCH_FILES	4
+#define FRAG_BENCH_SIZE		(4 << 20)
+#define FRAG_BENCH_ORDER	2
+#define FRAG_BENCH_CHUNK	(PAGE_SIZE << FRAG_BENCH_ORDER)
+
+static struct accurate_counter frag_bench_done;
+
+static void frag_bench_name(char *name, int size, long idx)
+{
+	snprintf(name, size, "/frag_bench.%ld", idx);
+}
+
+static int frag_bench_task(void *data)
+{
+	long idx = (long)data;
+	char name[32];
+	char *buf;
+	int fd, i;
+
+	buf = (char *)alloc_pages_memory(PAF_KERNEL, FRAG_BENCH_ORDER);
+	if (!buf)
+		goto out;
+
+	memset(buf, 'a' + idx, FRAG_BENCH_CHUNK);
+	frag_bench_name(name, sizeof(name), idx);
+	fd = sys_open(name, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd >= 0) {
+		for (i = 0; i < FRAG_BENCH_SIZE / FRAG_BENCH_CHUNK; i++)
+			if (sys_write(fd, buf, FRAG_BENCH_CHUNK) != FRAG_BENCH_CHUNK)
+				break;
+		sys_close(fd);
+	}
+
+	free_pages_memory((unsigned long)buf, FRAG_BENCH_ORDER);
+out:
+	accurate_inc(&frag_bench_done);
+
+	return 0;
+}
+
+/**
+ * 统计文件占用的物理区段数量，物理上连续的块算作一个区段
+ */
+static unsigned long frag_bench_extents(int fd, unsigned long *pblocks)
+{
+	struct file_cache_space *space;
+	unsigned long blocks, extents = 0;
+	sector_t block, phy, prev = 0;
+	struct file_node *fnode;
+	struct file *file;
+
+	*pblocks = 0;
+	file = file_find(fd);
+	if (!file)
+		return 0;
+
+	space = file->cache_space;
+	fnode = space->fnode;
+	blocks = (fnode->file_size + (1 << fnode->block_size_order) - 1)
+			>> fnode->block_size_order;
+	for (block = 0; block < blocks; block++) {
+		phy = space->ops->map_block(space, block);
+		if (!phy || phy != prev + 1)
+			extents++;
+		prev = phy;
+	}
+	loosen_file(file);
+	*pblocks = blocks;
+
+	return extents;
+}
+
+static void frag_bench(void)
+{
+	unsigned long blocks, extents, total = 0;
+	u64 start, ticks, bytes = 0;
+	char name[32];
+	char *buf;
+	long idx;
+	ssize_t ret;
+	int fd;
+
+	accurate_set(&frag_bench_done, 0);
+	start = get_jiffies_64();
+	for (idx = 0; idx < FRAG_BENCH_FILES; idx++)
+		create_process(frag_bench_task, (void *)idx, "frag_bench", 25);
+
+	while (accurate_read(&frag_bench_done) < FRAG_BENCH_FILES)
+		msleep(10);
+	sys_sync();
+	ticks = get_jiffies_64() - start;
+	printk("frag bench: %d files, %d bytes each, written in %llu ticks\n",
+		FRAG_BENCH_FILES, FRAG_BENCH_SIZE, ticks);
+
+	for (idx = 0; idx < FRAG_BENCH_FILES; idx++) {
+		frag_bench_name(name, sizeof(name), idx);
+		fd = sys_open(name, O_RDONLY, 0);
+		if (fd < 0)
+			continue;
+
+		extents = frag_bench_extents(fd, &blocks);
+		total += extents;
+		printk("  %s: %lu blocks, %lu extents\n", name, blocks, extents);
+		sys_close(fd);
+	}
+	printk("frag bench: %lu extents in total\n", total);
+
+	buf = (char *)alloc_pages_memory(PAF_KERNEL, FRAG_BENCH_ORDER);
+	if (!buf)
+		goto out;
+
+	start = get_jiffies_64();
+	for (idx = 0; idx < FRAG_BENCH_FILES; idx++) {
+		frag_bench_name(name, sizeof(name), idx);
+		fd = sys_open(name, O_RDONLY | O_DIRECT, 0);
+		if (fd < 0)
+			continue;
+
+		while ((ret = sys_read(fd, buf, FRAG_BENCH_CHUNK)) > 0)
+			bytes += ret;
+		sys_close(fd);
+	}
+	ticks = get_jiffies_64() - start;
+	free_pages_memory((unsigned long)buf, FRAG_BENCH_ORDER);
+
+	printk("frag bench: read %llu bytes in %llu ticks, %llu KB/s\n",
+		bytes, ticks, ticks ? bytes * HZ / ticks / 1024 : 0);
+
+out:
+	for (idx = 0; idx < FRAG_BENCH_FILES; idx++) {
+		frag_bench_name(name, sizeof(name), idx);
+		sys_unlink(name);
+	}
+}
+
+/**
+ * lext3大目录测试
+ * 在一个目录中创建大量文件，然后测量查找、读目录、删除的速度
+ */
+#define HTREE_BENCH_DIR		"/htree_bench"
+#define HTREE_BENCH_FILES	100000
+
+static void htree_bench_name(char *name, int size, const char *prefix, int idx)
+{
+	snprintf(name, size, HTREE_BENCH_DIR "/%s%06d", prefix, idx);
+}
+
+static void htree_bench_report(const char *what, int count, u64 ticks)
+{
+	printk("htree bench: %s %d entries in %llu ticks, %llu ops/s\n",
+		what, count, ticks, ticks ? (u64)count * HZ / ticks : 0);
+}
+
+static void htree_bench(void)
+{
+	struct dirent64 *dirent;
+	int i, fd, count;
+	char name[64];
+	long ret;
+	u64 start;
+
+	if (sys_mkdir(HTREE_BENCH_DIR, 0755) < 0) {
+		printk("htree bench: failed to create %s\n", HTREE_BENCH_DIR);
+		return;
+	}
+
+	start = get_jiffies_64();
+	for (count = 0; count < HTREE_BENCH_FILES; count++) {
+		htree_bench_name(name, sizeof(name), "f", count);
+		fd = sys_open(name, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0)
+			break;
+		sys_close(fd);
+	}
+	htree_bench_report("created", count, get_jiffies_64() - start);
+
+	start = get_jiffies_64();
+	for (i = 0; i < count; i++) {
+		htree_bench_name(name, sizeof(name), "f",
+			(i * 7919) % count);
+		fd = sys_open(name, O_RDONLY, 0);
+		if (fd >= 0)
+			sys_close(fd);
+	}
+	htree_bench_report("looked up", count, get_jiffies_64() - start);
+
+	start = get_jiffies_64();
+	for (i = 0; i < count; i++) {
+		htree_bench_name(name, sizeof(name), "x", i);
+		fd = sys_open(name, O_RDONLY, 0);
+		if (fd >= 0)
+			sys_close(fd);
+	}
+	htree_bench_report("missed", count, get_jiffies_64() - start);
+
+	dirent = (struct dirent64 *)alloc_page_memory(PAF_KERNEL);
+	fd = sys_open(HTREE_BENCH_DIR, O_RDONLY, 0);
+	if (dirent && fd >= 0) {
+		i = 0;
+		start = get_jiffies_64();
+		while ((ret = sys_getdents64(fd, dirent, PAGE_SIZE)) > 0) {
+			char *p = (char *)dirent;
+
+			while (p < (char *)dirent + ret) {
+				i++;
+				p += ((struct dirent64 *)p)->d_reclen;
+			}
+		}
+		htree_bench_report("read", i, get_jiffies_64() - start);
+	}
+	if (fd >= 0)
+		sys_close(fd);
+	if (dirent)
+		free_page_memory((unsigned long)dirent);
+
+	start = get_jiffies_64();
+	for (i = 0; i < count; i++) {
+		htree_bench_name(name, sizeof(name), "f", i);
+		sys_unlink(name);
+	}
+	htree_bench_report("unlinked", count, get_jiffies_64() - start);
+
+	sys_rmdir(HTREE_BENCH_DIR);
+}
+
+/**
+ * 路径查找性能测试
+ * 在1到全部CPU上并发stat同一个深层路径
+ * 观察查找速率能否随CPU数量线性增长
+ */
+#define WALK_BENCH_DIR		"/walk_bench"
+#define WALK_BENCH_FILE		WALK_BENCH_DIR "/a/b/c/d/file"
+#define WALK_BENCH_LOOPS	100000
+static struct accurate_counter walk_bench_done;
+
+static int walk_bench_task(void *data)
+{
+	int cpu = (int)(unsigned long)data;
+	struct stat st;
+	int i;
+
+	set_task_affinity(current, cpu);
+	sys_sched_yield();
+
+	for (i = 0; i < WALK_BENCH_LOOPS; i++)
+		sys_stat(WALK_BENCH_FILE, &st);
+
+	accurate_inc(&walk_bench_done);
+
+	return 0;
+}
+
+static void walk_bench(void)
+{
+	static const char *dirs[] = {
+		WALK_BENCH_DIR,
+		WALK_BENCH_DIR "/a",
+		WALK_BENCH_DIR "/a/b",
+		WALK_BENCH_DIR "/a/b/c",
+		WALK_BENCH_DIR "/a/b/c/d",
+	};
+	u64 start, ticks;
+	int nr, cpu, fd, i;
+
+	for (i = 0; i < ARRAY_SIZE(dirs); i++)
+		sys_mkdir(dirs[i], 0755);
+	fd = sys_open(WALK_BENCH_FILE, O_CREAT | O_WRONLY, 0644);
+	if (fd < 0) {
+		printk("walk bench: failed to create %s\n", WALK_BENCH_FILE);
+		return;
+	}
+	sys_close(fd);
+
+	for (nr = 1; nr <= num_online_cpus(); nr++) {
+		accurate_set(&walk_bench_done, 0);
+		start = get_jiffies_64();
+		for (cpu = 0; cpu < nr; cpu++)
+			create_process(walk_bench_task,
+				(void *)(unsigned long)cpu, "walk_bench", 25);
+
+		while (accurate_read(&walk_bench_done) < nr)
+			msleep(10);
+		ticks = get_jiffies_64() - start;
+
+		printk("walk bench: %d cpus, %d lookups in %llu ticks, %llu lookups/s\n",
+			nr, nr * WALK_BENCH_LOOPS, ticks,
+			ticks ? (u64)nr * WALK_BENCH_LOOPS * HZ / ticks : 0);
+	}
+
+	sys_unlink(WALK_BENCH_FILE);
+	for (i = ARRAY_SIZE(dirs) - 1; i >= 0; i--)
+		sys_rmdir(dirs[i]);
+}
+
+/**
+ * 消息队列乒乓延迟测试
+ * 两个任务分别运行在不同CPU上，来回传递一个指针
+ * 比较加锁的msg_queue与无锁的msg_ring的往返时间
+ */
+#define PINGPONG_LOOPS		100000
+static struct msg_queue pingpong_queue[2];
+static struct msg_ring pingpong_ring[2];
+static struct accurate_counter pingpong_done;
+
+static int pingpong_queue_task(void *data)
+{
+	int cpu = (int)(unsigned long)data;
+	unsigned long msg;
+	int i;
+
+	set_task_affinity(current, cpu);
+	sys_sched_yield();
+
+	for (i = 0; i < PINGPONG_LOOPS; i++) {
+		msg_queue_receive(&pingpong_queue[0], (char *)&msg, sizeof(msg), -1);
+		msg_queue_send(&pingpong_queue[1], (char *)&msg, sizeof(msg), -1, 0);
+	}
+	accurate_inc(&pingpong_done);
+
+	return 0;
+}
+
+static int pingpong_ring_task(void *data)
+{
+	int cpu = (int)(unsigned long)data;
+	unsigned long msg;
+	int i;
+
+	set_task_affinity(current, cpu);
+	sys_sched_yield();
+
+	for (i = 0; i < PINGPONG_LOOPS; i++) {
+		msg_ring_receive(&pingpong_ring[0], &msg, -1);
+		msg_ring_send(&pingpong_ring[1], msg, -1);
+	}
+	accurate_inc(&pingpong_done);
+
+	return 0;
+}
+
+static void pingpong_report(const char *name, u64 ns)
+{
+	do_div(ns, PINGPONG_LOOPS);
+	printk("pingpong bench: %s, %d round trips, %llu ns per round trip\n",
+		name, PINGPONG_LOOPS, ns);
+}
+
+static void pingpong_bench(void)
+{
+	int peer = num_online_cpus() > 1 ? 1 : 0;
+	unsigned long msg;
+	u64 start;
+	int i;
+
+	set_task_affinity(current, 0);
+	sys_sched_yield();
+
+	for (i = 0; i < 2; i++) {
+		msg_queue_init(&pingpong_queue[i], 16, sizeof(unsigned long), 0);
+		msg_ring_init(&pingpong_ring[i], 16);
+	}
+
+	accurate_set(&pingpong_done, 0);
+	create_process(pingpong_queue_task, (void *)(unsigned long)peer,
+		"pingpong", 25);
+	start = uptime();
+	for (i = 0; i < PINGPONG_LOOPS; i++) {
+		msg = i;
+		msg_queue_send(&pingpong_queue[0], (char *)&msg, sizeof(msg), -1, 0);
+		msg_queue_receive(&pingpong_queue[1], (char *)&msg, sizeof(msg), -1);
+	}
+	pingpong_report("msg_queue", uptime() - start);
+	while (accurate_read(&pingpong_done) < 1)
+		msleep(10);
+
+	accurate_set(&pingpong_done, 0);
+	create_process(pingpong_ring_task, (void *)(unsigned long)peer,
+		"pingpong", 25);
+	start = uptime();
+	for (i = 0; i < PINGPONG_LOOPS; i++) {
+		msg_ring_send(&pingpong_ring[0], i, -1);
+		msg_ring_receive(&pingpong_ring[1], &msg, -1);
+	}
+	pingpong_report("msg_ring", uptime() - start);
+	while (accurate_read(&pingpong_done) < 1)
+		msleep(10);
+
+	for (i = 0; i < 2; i++) {
+		msg_queue_destroy(&pingpong_queue[i]);
+		msg_ring_destroy(&pingpong_ring[i]);
+	}
+}
+
+/**
+ * 页面分配并发性能测试
+ * 在1到全部CPU上并发分配、释放单页及小的多页块
+ * 同时输出内存区锁的获得次数及持有时间
+ */
+#define PAGE_BENCH_LOOPS	20000
+#define PAGE_BENCH_DEPTH	16
+static struct accurate_counter page_bench_done;
+
+static int page_bench_task(void *data)
+{
+	int cpu = (int)(unsigned long)data;
+	unsigned long addr[PAGE_BENCH_DEPTH];
+	int i, j, order;
+
+	set_task_affinity(current, cpu);
+	sys_sched_yield();
+
+	for (i = 0; i < PAGE_BENCH_LOOPS; i++) {
+		order = i % (PAGE_CACHE_MAX_ORDER + 1);
+		for (j = 0; j < PAGE_BENCH_DEPTH; j++)
+			addr[j] = alloc_pages_memory(PAF_KERNEL, order);
+		for (j = 0; j < PAGE_BENCH_DEPTH; j++)
+			free_pages_memory(addr[j], order);
+	}
+
+	accurate_inc(&page_bench_done);
+
+	return 0;
+}
+
+static void page_bench(void)
+{
+	unsigned long lock_count, lock_hold, lock_wait;
+	u64 start, ticks, ops;
+	int nr, cpu;
+
+	for (nr = 1; nr <= num_online_cpus(); nr++) {
+		lock_count = approximate_page_statistics(area_lock_count);
+		lock_hold = approximate_page_statistics(area_lock_hold);
+		lock_wait = approximate_page_statistics(area_lock_wait);
+
+		accurate_set(&page_bench_done, 0);
+		start = get_jiffies_64();
+		for (cpu = 0; cpu < nr; cpu++)
+			create_process(page_bench_task,
+				(void *)(unsigned long)cpu, "page_bench", 25);
+
+		while (accurate_read(&page_bench_done) < nr)
+			msleep(10);
+		ticks = get_jiffies_64() - start;
+		ops = (u64)nr * PAGE_BENCH_LOOPS * PAGE_BENCH_DEPTH;
+
+		lock_count = approximate_page_statistics(area_lock_count) - lock_count;
+		lock_hold = approximate_page_statistics(area_lock_hold) - lock_hold;
+		lock_wait = approximate_page_statistics(area_lock_wait) - lock_wait;
+
+		printk("page bench: %d cpus, %llu allocs in %llu ticks, %llu allocs/s\n",
+			nr, ops, ticks, ticks ? ops * HZ / ticks : 0);
+		printk("page bench: area lock taken %lu times, hold %lu, wait %lu cycles\n",
+			lock_count, lock_hold, lock_wait);
+	}
+}
+
+/**
+ * 页面碎片测试
+ * 交错分配长期占用的内核页面和可回收的用户页面，然后释放用户页面
+ * 观察内核页面是否集中在少数页块中，大块分配能否成功
+ */
+#define MOBILITY_BENCH_PAGES	8192
+#define MOBILITY_BENCH_BLOCKS	256
+#define MOBILITY_BENCH_ORDER	3
+
+static void mobility_bench(void)
+{
+	static struct page_frame *pages[MOBILITY_BENCH_PAGES];
+	static struct page_frame *blocks[MOBILITY_BENCH_BLOCKS];
+	struct memory_node *node = MEMORY_NODE(numa_node_id());
+	int i, order, got = 0;
+
+	for (i = 0; i < MOBILITY_BENCH_PAGES; i++)
+		pages[i] = alloc_page_frame((i % 8) ? PAF_USER : PAF_KERNEL);
+
+	for (i = 0; i < MOBILITY_BENCH_PAGES; i++)
+		if ((i % 8) && pages[i]) {
+			free_page_frame(pages[i]);
+			pages[i] = NULL;
+		}
+
+	for (i = 0; i < MOBILITY_BENCH_BLOCKS; i++) {
+		blocks[i] = alloc_page_frames(PAF_KERNEL | PAF_NOWAIT,
+					MOBILITY_BENCH_ORDER);
+		if (blocks[i])
+			got++;
+	}
+
+	printk("mobility bench: %d/%d order-%d allocations succeeded\n",
+		got, MOBILITY_BENCH_BLOCKS, MOBILITY_BENCH_ORDER);
+	for (i = 0; i < PG_AREA_COUNT; i++) {
+		struct page_area *pg_area = node->pg_areas + i;
+
+		if (!pg_area->attrs.pages_solid)
+			continue;
+
+		printk("mobility bench: %s frag index", pg_area->attrs.name);
+		for (order = 0; order < PG_AREA_MAX_ORDER; order++)
+			printk(" %d", page_area_frag_index(pg_area, order));
+		printk("\n");
+	}
+	printk("mobility bench: fallback %ld, steal %ld\n",
+		approximate_page_statistics(mobility_fallback),
+		approximate_page_statistics(mobility_steal));
+
+	for (i = 0; i < MOBILITY_BENCH_BLOCKS; i++)
+		if (blocks[i])
+			free_page_frames(blocks[i], MOBILITY_BENCH_ORDER);
+	for (i = 0; i < MOBILITY_BENCH_PAGES; i++)
+		if (pages[i])
+			free_page_frame(pages[i]);
+}
+
+/**
+ * 各CPU多页块缓存中的块数
+ */
+static int order_cached_blocks(struct page_area_pool *pool)
+{
+	struct page_area *pg_area;
+	int i, cpu, order, count = 0;
+
+	for (i = 0; (pg_area = pool->pg_areas[i]) != NULL; i++)
+		for_each_online_cpu(cpu)
+			for (order = 1; order <= PAGE_CACHE_MAX_ORDER; order++)
+				count += READ_ONCE(pg_area->page_caches[cpu]
+						.order_cache[order - 1].count);
+
+	return count;
+}
+
+/**
+ * 释放的多页块先进入每CPU缓存
+ * 清空之后，所有CPU的多页块缓存都应当为空
+ */
+#define DRAIN_TEST_BLOCKS	64
+#define DRAIN_TEST_ORDER	2
+
+static void order_cache_drain_test(void)
+{
+	static struct page_frame *blocks[DRAIN_TEST_BLOCKS];
+	struct memory_node *node = MEMORY_NODE(numa_node_id());
+	struct page_area_pool *pool = node->pools + (PAF_KERNEL & PAF_AREAMASK);
+	int i, cached, left;
+
+	for (i = 0; i < DRAIN_TEST_BLOCKS; i++)
+		blocks[i] = alloc_page_frames(PAF_KERNEL, DRAIN_TEST_ORDER);
+	for (i = 0; i < DRAIN_TEST_BLOCKS; i++)
+		if (blocks[i])
+			free_page_frames(blocks[i], DRAIN_TEST_ORDER);
+
+	cached = order_cached_blocks(pool);
+	if (!cached)
+		printk("drain test: no blocks cached before drain\n");
+
+	drain_order_caches(pool);
+	left = order_cached_blocks(pool);
+	if (left)
+		printk("drain test: %d blocks cached, %d left after drain\n",
+			cached, left);
+	else
+		printk("drain test: %d blocks drained ok\n", cached);
+}
+
+/**
+ * 与virtio_net的接收缓冲区布局相同
+ * 自定义PBUF_RAM报文，负载前面留有链路层及IP头部的空间
+ */
+struct icmp_rx_buf {
+	struct pbuf_custom pc;
+	char headroom[PBUF_LINK_HLEN + PBUF_IP_HLEN];
+	char buf[256];
+	int freed;
+};
+
+#define ICMP_RX_DATA_LEN	32
+
+static void icmp_rx_free(struct pbuf *p)
+{
+	struct icmp_rx_buf *rxbuf = (struct icmp_rx_buf *)p;
+
+	WRITE_ONCE(rxbuf->freed, 1);
+}
+
+/**
+ * 构造一个发往本机的IP报文，返回帧长度
+ */
+static int icmp_rx_build(struct icmp_rx_buf *rxbuf, struct netif *netif,
+	u8_t proto)
+{
+	struct eth_hdr *eth = (struct eth_hdr *)rxbuf->buf;
+	struct ip_hdr *iph = (struct ip_hdr *)(eth + 1);
+	char *l4 = (char *)(iph + 1);
+	int l4_len;
+
+	memset(rxbuf->buf, 0, sizeof(rxbuf->buf));
+	memcpy(&eth->dest, netif->hwaddr, ETHARP_HWADDR_LEN);
+	eth->src.addr[0] = 0x52;
+	eth->src.addr[1] = 0x54;
+	eth->src.addr[5] = 0x99;
+	eth->type = PP_HTONS(ETHTYPE_IP);
+
+	if (proto == IP_PROTO_ICMP) {
+		struct icmp_echo_hdr *echo = (struct icmp_echo_hdr *)l4;
+
+		l4_len = sizeof(*echo) + ICMP_RX_DATA_LEN;
+		echo->type = ICMP_ECHO;
+		echo->id = PP_HTONS(0x1234);
+		echo->seqno = PP_HTONS(1);
+		echo->chksum = inet_chksum(echo, l4_len);
+	} else {
+		struct udp_hdr *udph = (struct udp_hdr *)l4;
+
+		/**
+		 * 发往没有监听的端口，校验和为0表示不校验
+		 */
+		l4_len = sizeof(*udph) + ICMP_RX_DATA_LEN;
+		udph->src = PP_HTONS(40000);
+		udph->dest = PP_HTONS(9);
+		udph->len = htons(l4_len);
+	}
+
+	IPH_VHL_SET(iph, 4, IP_HLEN / 4);
+	IPH_LEN_SET(iph, htons(IP_HLEN + l4_len));
+	IPH_TTL_SET(iph, 64);
+	IPH_PROTO_SET(iph, proto);
+	IP4_ADDR(&iph->src, 10, 0, 2, 99);
+	ip_addr_copy(iph->dest, netif->ip_addr);
+	IPH_CHKSUM_SET(iph, inet_chksum(iph, IP_HLEN));
+
+	return sizeof(*eth) + IP_HLEN + l4_len;
+}
+
+/**
+ * 以网卡驱动的方式送入一个报文，检查协议栈是否发出了ICMP应答
+ */
+static int icmp_rx_one(struct netif *netif, u8_t proto, const char *name)
+{
+	static struct icmp_rx_buf rxbuf;
+	struct pbuf *p;
+	u16_t xmit;
+	int len, i;
+
+	len = icmp_rx_build(&rxbuf, netif, proto);
+	rxbuf.freed = 0;
+	rxbuf.pc.custom_free_function = icmp_rx_free;
+	p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_RAM, &rxbuf.pc,
+				rxbuf.buf, sizeof(rxbuf.buf));
+	if (!p) {
+		printk("icmp test: %s, failed to build pbuf\n", name);
+		return -1;
+	}
+
+	xmit = lwip_stats.icmp.xmit;
+	if (netif->input(p, netif) != ERR_OK) {
+		pbuf_free(p);
+		printk("icmp test: %s, input failed\n", name);
+		return -1;
+	}
+
+	/**
+	 * 协议栈线程处理完报文后会释放它
+	 */
+	for (i = 0; i < 100 && !READ_ONCE(rxbuf.freed); i++)
+		msleep(10);
+
+	if (!READ_ONCE(rxbuf.freed)) {
+		printk("icmp test: %s, frame never released\n", name);
+		return -1;
+	}
+
+	if (lwip_stats.icmp.xmit == xmit) {
+		printk("icmp test: %s, no ICMP sent\n", name);
+		return -1;
+	}
+
+	printk("icmp test: %s ok\n", name);
+	return 0;
+}
+
+static void icmp_rx_test(void)
+{
+	struct netif *netif = netif_default;
+
+	if (!netif || ip_addr_isany(&netif->ip_addr)) {
+		printk("icmp test: no network interface\n");
+		return;
+	}
+
+	icmp_rx_one(netif, IP_PROTO_ICMP, "echo reply");
+	icmp_rx_one(netif, IP_PROTO_UDP, "port unreachable");
+}
+
+/**
+ * 分配器中还有多少页面
+ */
+static long beehive_pages(struct beehive_allotter *beehive)
+{
+	long count = 0;
+	int i;
+
+	for (i = 0; i < MAX_NUMNODES; i++)
+		count += accurate_read(&beehive->nodes[i]->beehive_count);
+
+	return count;
+}
+
+/**
+ * 批量分配中途失败时，已经分配的对象必须全部归还
+ * 用大对象请求超过空闲内存的数量，不等待回收，分配必然中途失败
+ * 回滚之后收缩分配器，不应当有页面残留
+ */
+#define BULK_TEST_OBJ_SIZE	(8 * PAGE_SIZE)
+
+static void beehive_bulk_test(void)
+{
+	struct memory_node *node = MEMORY_NODE(numa_node_id());
+	struct page_area_pool *pool = node->pools + (PAF_KERNEL & PAF_AREAMASK);
+	struct beehive_allotter *beehive;
+	struct page_area *pg_area;
+	unsigned long free = 0;
+	size_t nr, i;
+	void **objs;
+	int order, ret;
+
+	for (i = 0; (pg_area = pool->pg_areas[i]) != NULL; i++)
+		free += pg_area->free_pages;
+
+	nr = free * PAGE_SIZE / BULK_TEST_OBJ_SIZE + 64;
+	order = get_order(nr * sizeof(void *));
+	if (order >= PG_AREA_MAX_ORDER) {
+		printk("beehive bulk test: too much memory, skipped\n");
+		return;
+	}
+
+	objs = (void **)alloc_pages_memory(PAF_KERNEL, order);
+	beehive = beehive_create("bulk_test", BULK_TEST_OBJ_SIZE, 0,
+		BEEHIVE_UNMERGEABLE, NULL);
+	if (!objs || !beehive) {
+		printk("beehive bulk test: no memory\n");
+		goto out;
+	}
+
+	ret = beehive_alloc_bulk(beehive, PAF_NOWAIT, nr, objs);
+	if (ret) {
+		printk("beehive bulk test: %lu objects, returned %d\n",
+			(unsigned long)nr, ret);
+		beehive_free_bulk(beehive, nr, objs);
+		goto out;
+	}
+
+	beehive_shrink(beehive);
+	if (beehive_pages(beehive)) {
+		printk("beehive bulk test: %ld pages leaked after rollback\n",
+			beehive_pages(beehive));
+		goto out;
+	}
+
+	nr = 64;
+	ret = beehive_alloc_bulk(beehive, PAF_KERNEL | __PAF_ZERO, nr, objs);
+	if (ret != nr) {
+		printk("beehive bulk test: full allocation returned %d\n", ret);
+		goto out;
+	}
+	for (i = 0; i < nr; i++)
+		if (((char *)objs[i])[BULK_TEST_OBJ_SIZE - 1]) {
+			printk("beehive bulk test: object %lu not zeroed\n",
+				(unsigned long)i);
+			break;
+		}
+	beehive_free_bulk(beehive, nr, objs);
+
+	beehive_shrink(beehive);
+	if (beehive_pages(beehive))
+		printk("beehive bulk test: %ld pages leaked after free\n",
+			beehive_pages(beehive));
+	else
+		printk("beehive bulk test: ok\n");
+
+out:
+	if (beehive)
+		beehive_destroy(beehive);
+	if (objs)
+		free_pages_memory((unsigned long)objs, order);
+}
+
 void xby_test(int fun)
 {
 	if (fun == 7)
@@ -183,6 +1356,58 @@ msleep(1);
              : "memory");
 #endif
 	}
+	else if (fun == 13)
+	{
+		sched_pingpong_bench();
+	}
+	else if (fun == 14)
+	{
+		string_bench();
+	}
+	else if (fun == 15)
+	{
+		timer_bench();
+	}
+	else if (fun == 16)
+	{
+		blk_bench();
+	}
+	else if (fun == 17)
+	{
+		frag_bench();
+	}
+	else if (fun == 18)
+	{
+		htree_bench();
+	}
+	else if (fun == 19)
+	{
+		walk_bench();
+	}
+	else if (fun == 20)
+	{
+		pingpong_bench();
+	}
+	else if (fun == 21)
+	{
+		page_bench();
+	}
+	else if (fun == 22)
+	{
+		mobility_bench();
+	}
+	else if (fun == 23)
+	{
+		icmp_rx_test();
+	}
+	else if (fun == 24)
+	{
+		beehive_bulk_test();
+	}
+	else if (fun == 25)
+	{
+		order_cache_drain_test();
+	}
 }
 void dim_sum_test(void)
 {
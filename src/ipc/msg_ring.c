@@ -0,0 +1,331 @@
+#include <linux/compiler.h>
+#include <dim-sum/cpumask.h>
+#include <dim-sum/errno.h>
+#include <dim-sum/irq.h>
+#include <dim-sum/mem.h>
+#include <dim-sum/msg_queue.h>
+#include <dim-sum/printk.h>
+#include <dim-sum/sched.h>
+#include <dim-sum/wait.h>
+#include <asm/cmpxchg.h>
+#include <asm/processor.h>
+#include <asm/string.h>
+
+/**
+ * 睡眠前自旋次数的上下限
+ */
+#define MSG_RING_SPIN_MIN	16
+#define MSG_RING_SPIN_MAX	4096
+
+int msg_ring_init(struct msg_ring *ring, int max_msgs)
+{
+	unsigned long size = 1, i;
+
+	if (max_msgs <= 0)
+		return -EINVAL;
+
+	if (in_interrupt()) {
+		printk("can't create msg ring in_interrupt!\n");
+		return -EINVAL;
+	}
+
+	while (size < max_msgs)
+		size <<= 1;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->cells = kmalloc(sizeof(struct msg_ring_cell) * size, PAF_KERNEL);
+	if (ring->cells == NULL) {
+		printk("Can't get mem for msg ring");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < size; i++)
+		ring->cells[i].seq = i;
+	ring->mask = size - 1;
+	ring->spin_limit = MSG_RING_SPIN_MIN;
+	accurate_set(&ring->recv_waiters, 0);
+	accurate_set(&ring->send_waiters, 0);
+	init_waitqueue(&ring->recv_wait);
+	init_waitqueue(&ring->send_wait);
+
+	smp_wmb();
+	ring->magic = MSG_RING_MAGIC;
+
+	return 0;
+}
+
+/**
+ * 调用者保证已经没有收发者在使用队列
+ */
+void msg_ring_destroy(struct msg_ring *ring)
+{
+	if (ring->magic != MSG_RING_MAGIC)
+		return;
+
+	ring->magic = 0;
+	kfree(ring->cells);
+	ring->cells = NULL;
+}
+
+/**
+ * 尝试写入一个消息，队列满时返回0
+ */
+static int __msg_ring_send(struct msg_ring *ring, unsigned long msg)
+{
+	struct msg_ring_cell *cell;
+	unsigned long pos, seq;
+	long dif;
+
+	pos = READ_ONCE(ring->send_pos);
+	while (1) {
+		cell = &ring->cells[pos & ring->mask];
+		seq = READ_ONCE(cell->seq);
+		dif = (long)(seq - pos);
+		if (dif == 0) {
+			/**
+			 * 槽位空闲，与其他生产者竞争这个位置
+			 */
+			if (cmpxchg(&ring->send_pos, pos, pos + 1) == pos)
+				break;
+		} else if (dif < 0)
+			/**
+			 * 消费者还没有取走上一轮的消息，队列已满
+			 */
+			return 0;
+
+		pos = READ_ONCE(ring->send_pos);
+	}
+
+	cell->msg = msg;
+	/**
+	 * 先写消息，再发布槽位
+	 */
+	smp_wmb();
+	WRITE_ONCE(cell->seq, pos + 1);
+
+	return 1;
+}
+
+/**
+ * 尝试取出最多nr个连续的消息，队列空时返回0
+ * 一次cmpxchg就可以占有多个槽位
+ */
+static int __msg_ring_receive(struct msg_ring *ring, unsigned long *msgs, int nr)
+{
+	struct msg_ring_cell *cell;
+	unsigned long pos;
+	long dif;
+	int cnt, i;
+
+	pos = READ_ONCE(ring->recv_pos);
+	while (1) {
+		for (cnt = 0; cnt < nr; cnt++) {
+			cell = &ring->cells[(pos + cnt) & ring->mask];
+			if (READ_ONCE(cell->seq) != pos + cnt + 1)
+				break;
+		}
+
+		if (cnt == 0) {
+			cell = &ring->cells[pos & ring->mask];
+			dif = (long)(READ_ONCE(cell->seq) - (pos + 1));
+			/**
+			 * 生产者还没有写入，队列为空
+			 */
+			if (dif < 0)
+				return 0;
+		} else if (cmpxchg(&ring->recv_pos, pos, pos + cnt) == pos)
+			break;
+
+		pos = READ_ONCE(ring->recv_pos);
+	}
+
+	/**
+	 * 看到seq之后才能读消息
+	 */
+	smp_rmb();
+	for (i = 0; i < cnt; i++)
+		msgs[i] = ring->cells[(pos + i) & ring->mask].msg;
+
+	/**
+	 * 读完消息后才能将槽位还给生产者
+	 */
+	smp_mb();
+	for (i = 0; i < cnt; i++)
+		WRITE_ONCE(ring->cells[(pos + i) & ring->mask].seq,
+			pos + i + ring->mask + 1);
+
+	return cnt;
+}
+
+static bool msg_ring_can_send(struct msg_ring *ring)
+{
+	unsigned long pos = READ_ONCE(ring->send_pos);
+
+	return READ_ONCE(ring->cells[pos & ring->mask].seq) == pos;
+}
+
+static bool msg_ring_can_receive(struct msg_ring *ring)
+{
+	unsigned long pos = READ_ONCE(ring->recv_pos);
+
+	return READ_ONCE(ring->cells[pos & ring->mask].seq) == pos + 1;
+}
+
+/**
+ * 对端正在其他CPU上运行时，通常很快就能等到结果
+ * 此时自旋比睡眠、唤醒的代价小得多
+ * 自旋成功则加倍下次的自旋次数，失败则减半
+ */
+static bool msg_ring_spin(struct msg_ring *ring,
+	bool (*ready)(struct msg_ring *ring))
+{
+	int limit = READ_ONCE(ring->spin_limit);
+	int i;
+
+	if (num_online_cpus() == 1)
+		return false;
+
+	for (i = 0; i < limit; i++) {
+		if (ready(ring)) {
+			if (limit < MSG_RING_SPIN_MAX)
+				WRITE_ONCE(ring->spin_limit, limit * 2);
+			return true;
+		}
+		cpu_relax();
+	}
+
+	if (limit > MSG_RING_SPIN_MIN)
+		WRITE_ONCE(ring->spin_limit, limit / 2);
+
+	return false;
+}
+
+/**
+ * 睡眠等待，直到条件满足或者超时
+ * 返回剩余的等待时间
+ */
+static long msg_ring_sleep(struct msg_ring *ring, struct wait_queue *wq,
+	struct accurate_counter *waiters,
+	bool (*ready)(struct msg_ring *ring), long timeout)
+{
+	DEFINE_WAIT(wait);
+
+	prepare_to_wait(wq, &wait, TASK_INTERRUPTIBLE);
+	accurate_inc(waiters);
+	/**
+	 * 对端先修改队列，再检查等待者数量
+	 * 这里先增加等待者数量，再检查队列，二者不会同时错过
+	 */
+	smp_mb();
+	if (!ready(ring))
+		timeout = schedule_timeout(timeout);
+	accurate_dec(waiters);
+	finish_wait(wq, &wait);
+
+	return timeout;
+}
+
+static void msg_ring_wake(struct wait_queue *wq,
+	struct accurate_counter *waiters)
+{
+	smp_mb();
+	if (accurate_read(waiters))
+		wake_up(wq);
+}
+
+/**
+ * 发送一个字长的消息
+ * wait为0表示不等待，小于0表示一直等待，否则为等待的节拍数
+ */
+int msg_ring_send(struct msg_ring *ring, unsigned long msg, int wait)
+{
+	long timeout = wait < 0 ? MAX_SCHEDULE_TIMEOUT : wait;
+
+	if (ring->magic != MSG_RING_MAGIC)
+		return ERROR_MSGQID_INVALID;
+
+	if (in_interrupt() && wait)
+		return ERROR_MSGQ_IN_INTR;
+
+	while (!__msg_ring_send(ring, msg)) {
+		if (!wait)
+			return ERROR_MSGQ_FULL;
+
+		if (msg_ring_spin(ring, msg_ring_can_send))
+			continue;
+
+		if (!timeout)
+			return ERROR_MSGQ_TIMED_OUT;
+
+		timeout = msg_ring_sleep(ring, &ring->send_wait,
+			&ring->send_waiters, msg_ring_can_send, timeout);
+	}
+
+	msg_ring_wake(&ring->recv_wait, &ring->recv_waiters);
+
+	return 0;
+}
+
+/**
+ * 一次取出最多nr个消息，返回取出的数量
+ * 只有在队列为空时才会等待
+ */
+int msg_ring_receive_batch(struct msg_ring *ring, unsigned long *msgs,
+	int nr, int wait)
+{
+	long timeout = wait < 0 ? MAX_SCHEDULE_TIMEOUT : wait;
+	int cnt;
+
+	if (ring->magic != MSG_RING_MAGIC)
+		return ERROR_MSGQID_INVALID;
+
+	if (nr <= 0)
+		return ERROR_BUF_LENS_UNDER;
+
+	if (in_interrupt() && wait)
+		return ERROR_MSGQ_IN_INTR;
+
+	while (!(cnt = __msg_ring_receive(ring, msgs, nr))) {
+		if (!wait)
+			return ERROR_MSGQ_EMPTY;
+
+		if (msg_ring_spin(ring, msg_ring_can_receive))
+			continue;
+
+		if (!timeout)
+			return ERROR_MSGQ_TIMED_OUT;
+
+		timeout = msg_ring_sleep(ring, &ring->recv_wait,
+			&ring->recv_waiters, msg_ring_can_receive, timeout);
+	}
+
+	msg_ring_wake(&ring->send_wait, &ring->send_waiters);
+
+	return cnt;
+}
+
+int msg_ring_receive(struct msg_ring *ring, unsigned long *msg, int wait)
+{
+	int ret = msg_ring_receive_batch(ring, msg, 1, wait);
+
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * 近似的消息数量，收发并发时仅供参考
+ */
+int msg_ring_count(struct msg_ring *ring)
+{
+	long count;
+
+	if (ring->magic != MSG_RING_MAGIC)
+		return ERROR_MSGQID_INVALID;
+
+	count = (long)(READ_ONCE(ring->send_pos) - READ_ONCE(ring->recv_pos));
+	if (count < 0)
+		count = 0;
+	if (count > ring->mask + 1)
+		count = ring->mask + 1;
+
+	return count;
+}
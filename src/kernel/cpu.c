@@ -23,6 +23,11 @@
  */
 struct mutex mutex_cpu_hotplug = MUTEX_INITIALIZER(mutex_cpu_hotplug);
 
+/**
+ * CPU热插拨回调链表，由mutex_cpu_hotplug保护
+ */
+static struct double_list cpu_notifiers = LIST_HEAD_INITIALIZER(cpu_notifiers);
+
 const DECLARE_BITMAP(cpu_all_bits, MAX_CPUS) = CPU_BITS_ALL;
 
 static DECLARE_BITMAP(cpu_possible_bits, CONFIG_MAX_CPUS) ;
@@ -211,6 +216,17 @@ static int __cpu_launch(unsigned int cpu, struct task_desc *idle)
 	return ret;
 }
 
+/**
+ * 调用者持有mutex_cpu_hotplug
+ */
+static void notify_cpu_event(unsigned long id, unsigned int cpu)
+{
+	struct notifier_data *notifier;
+
+	list_for_each_entry(notifier, &cpu_notifiers, list)
+		notifier->callback(notifier, id, (void *)(unsigned long)cpu);
+}
+
 int cpu_launch(unsigned int cpu)
 {
 	int ret = 0;
@@ -224,7 +240,9 @@ int cpu_launch(unsigned int cpu)
 	}
 
 	ret = __cpu_launch(cpu, idle);
-	
+	if (ret == 0)
+		notify_cpu_event(CPU_ONLINE, cpu);
+
 unlock:
 	unlock_cpu_hotplug();
 
@@ -239,11 +257,24 @@ int cpu_offline(unsigned int cpu)
 
 int register_cpu_notifier(struct notifier_data *data)
 {
-	/* TO-DO */
+	struct notifier_data *notifier;
+
+	lock_cpu_hotplug();
+	/**
+	 * 按优先级从高到低排列，同优先级按注册顺序
+	 */
+	list_for_each_entry(notifier, &cpu_notifiers, list)
+		if (data->priority > notifier->priority)
+			break;
+	list_insert_behind(&data->list, &notifier->list);
+	unlock_cpu_hotplug();
+
 	return 0;
 }
 
 void unregister_cpu_notifier(struct notifier_data *data)
 {
-	/* TO-DO */
+	lock_cpu_hotplug();
+	list_del_init(&data->list);
+	unlock_cpu_hotplug();
 }
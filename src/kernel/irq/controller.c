@@ -49,6 +49,34 @@ int set_irq_trigger_type(unsigned int irq, unsigned int type)
 	return ret;
 }
 
+/**
+ * 设置中断的目标CPU
+ */
+int set_irq_affinity(unsigned int irq, int cpu)
+{
+	struct irq_desc *desc = get_irq_desc(irq);
+	struct irq_controller *controller;
+	unsigned long flags;
+	int ret;
+
+	if (!desc)
+		return -EINVAL;
+
+	controller = desc->controller;
+	if (!controller || !controller->set_affinity)
+		return -ENOSYS;
+
+	irq_controller_lock(desc);
+	smp_lock_irqsave(&desc->lock, flags);
+
+	ret = controller->set_affinity(desc, cpu);
+
+	smp_unlock_irqrestore(&desc->lock, flags);
+	irq_controller_unlock(desc);
+
+	return ret;
+}
+
 void irq_enable(struct irq_desc *desc)
 {
 	irq_state_clear(desc, IRQSTATE_IRQ_DISABLED);
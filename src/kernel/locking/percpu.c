@@ -1,52 +1,268 @@
 #include <dim-sum/beehive.h>
+#include <dim-sum/bitops.h>
+#include <dim-sum/boot_allotter.h>
+#include <dim-sum/double_list.h>
+#include <dim-sum/init.h>
+#include <dim-sum/kernel.h>
+#include <dim-sum/mutex.h>
 #include <dim-sum/percpu.h>
 
+#include <asm/sections.h>
+
 /**
  * per-cpu变量在所有CPU上面的偏移值
  */
 unsigned long per_cpu_var_offsets[MAX_CPUS];
 
+/**
+ * 动态每CPU内存块
+ * 每个块在每个CPU上都有一段大小相同的内存
+ * 块在各CPU上的地址，与静态每CPU变量一样，相差per_cpu_offset(cpu)
+ */
+struct percpu_chunk {
+	/**
+	 * 通过此字段链接到percpu_chunks
+	 */
+	struct double_list list;
+	/**
+	 * 块的基地址，位于静态每CPU变量的地址空间中
+	 * 不能直接访问，加上per_cpu_offset(cpu)才是在CPU上的地址
+	 */
+	char *base;
+	/**
+	 * 块中以PERCPU_MIN_ALLOC_SIZE为单位的总数及空闲数
+	 */
+	unsigned long units;
+	unsigned long free_units;
+	/**
+	 * 已经分配出去的单位
+	 */
+	unsigned long *alloc_map;
+	/**
+	 * 每次分配的第一个单位，释放时据此确定分配的长度
+	 */
+	unsigned long *bound_map;
+	/**
+	 * 块的内存页面，第一个块来自boot内存，为0
+	 */
+	unsigned long pages;
+	int order;
+};
+
+/**
+ * 每个CPU单元的大小，也是新分配块的大小
+ */
+static unsigned long percpu_unit_size;
+static struct percpu_chunk percpu_first_chunk;
+static struct double_list percpu_chunks = LIST_HEAD_INITIALIZER(percpu_chunks);
+/**
+ * 分配新块时可能睡眠，因此用互斥锁保护
+ */
+static struct mutex percpu_mutex = MUTEX_INITIALIZER(percpu_mutex);
+
+static void chunk_set_bits(unsigned long *map, unsigned long start,
+	unsigned long end)
+{
+	for (; start < end; start++)
+		__set_bit(start, map);
+}
+
+static void chunk_clear_bits(unsigned long *map, unsigned long start,
+	unsigned long end)
+{
+	for (; start < end; start++)
+		__clear_bit(start, map);
+}
+
+/**
+ * 在块中查找nr个连续空闲单位，起始位置按align对齐
+ * 返回起始单位，失败时返回-1
+ */
+static long chunk_alloc_area(struct percpu_chunk *chunk, unsigned long nr,
+	unsigned long align)
+{
+	unsigned long start = 0, busy;
+
+	if (chunk->free_units < nr)
+		return -1;
+
+	while (1) {
+		start = find_next_zero_bit(chunk->alloc_map, chunk->units, start);
+		start = ALIGN(start, align);
+		if (start + nr > chunk->units)
+			return -1;
+
+		busy = find_next_bit(chunk->alloc_map, start + nr, start);
+		if (busy >= start + nr)
+			break;
+		start = busy + 1;
+	}
+
+	chunk_set_bits(chunk->alloc_map, start, start + nr);
+	__set_bit(start, chunk->bound_map);
+	chunk->free_units -= nr;
+
+	return start;
+}
+
+static void chunk_free_area(struct percpu_chunk *chunk, unsigned long start)
+{
+	unsigned long end, zero;
+
+	/**
+	 * 分配的长度截止到下一次分配的起点，或者第一个空闲单位
+	 */
+	end = find_next_bit(chunk->bound_map, chunk->units, start + 1);
+	zero = find_next_zero_bit(chunk->alloc_map, chunk->units, start + 1);
+	end = min(end, zero);
+
+	__clear_bit(start, chunk->bound_map);
+	chunk_clear_bits(chunk->alloc_map, start, end);
+	chunk->free_units += end - start;
+}
+
+static void init_chunk(struct percpu_chunk *chunk, char *base,
+	unsigned long size, unsigned long *maps)
+{
+	unsigned long longs;
+
+	chunk->base = base;
+	chunk->units = size / PERCPU_MIN_ALLOC_SIZE;
+	chunk->free_units = chunk->units;
+	longs = BITS_TO_LONGS(chunk->units);
+	chunk->alloc_map = maps;
+	chunk->bound_map = maps + longs;
+	memset(maps, 0, 2 * longs * sizeof(unsigned long));
+	list_init(&chunk->list);
+}
+
+void __init init_percpu_first_chunk(unsigned long static_size,
+	unsigned long unit_size)
+{
+	unsigned long size = unit_size - static_size;
+	unsigned long *maps;
+
+	percpu_unit_size = unit_size;
+	maps = alloc_boot_mem_permanent(2 * BITS_TO_LONGS(size
+				/ PERCPU_MIN_ALLOC_SIZE) * sizeof(unsigned long),
+				sizeof(unsigned long));
+	init_chunk(&percpu_first_chunk, per_cpu_var_start + static_size,
+		size, maps);
+	list_insert_behind(&percpu_first_chunk.list, &percpu_chunks);
+}
+
+/**
+ * 分配一个新块，每个CPU一个完整的单元
+ * 各CPU的单元连续存放，间隔与启动时分配的单元相同
+ */
+static struct percpu_chunk *create_chunk(void)
+{
+	unsigned long longs = BITS_TO_LONGS(percpu_unit_size / PERCPU_MIN_ALLOC_SIZE);
+	struct percpu_chunk *chunk;
+
+	chunk = kmalloc(sizeof(*chunk) + 2 * longs * sizeof(unsigned long),
+			PAF_KERNEL);
+	if (!chunk)
+		return NULL;
+
+	chunk->order = get_order(percpu_unit_size * MAX_CPUS);
+	chunk->pages = alloc_pages_memory(PAF_KERNEL, chunk->order);
+	if (!chunk->pages) {
+		kfree(chunk);
+		return NULL;
+	}
+
+	/**
+	 * CPU 0的单元位于pages处，由此倒推出基地址
+	 */
+	init_chunk(chunk, (char *)chunk->pages - per_cpu_offset(0),
+		percpu_unit_size, (unsigned long *)(chunk + 1));
+
+	return chunk;
+}
+
+static void destroy_chunk(struct percpu_chunk *chunk)
+{
+	free_pages_memory(chunk->pages, chunk->order);
+	kfree(chunk);
+}
+
 void *__alloc_percpu(size_t size, size_t align)
 {
-	struct dynamic_percpu *pdata;
-	int i;
+	struct percpu_chunk *chunk;
+	unsigned long nr;
+	long start;
+	void *ptr;
+	int cpu;
 
-	pdata = kmalloc(sizeof (*pdata), PAF_KERNEL | __PAF_ZERO);
-	if (!pdata)
+	if (!size || size > percpu_unit_size)
 		return NULL;
 
-	for (i = 0; i < MAX_CPUS; i++) {
-		if (!cpu_possible(i))
-			continue;
-		pdata->ptrs[i] = kmalloc(size, PAF_KERNEL | __PAF_ZERO);
+	/**
+	 * 分配新块时持有互斥锁，不能在原子上下文中调用
+	 * 启动早期只有一个CPU，互斥锁不会被争用
+	 */
+	might_sleep_if(boot_state >= KERN_RUNNING);
 
-		if (!pdata->ptrs[i])
-			goto oom;
-	}
+	nr = DIV_ROUND_UP(size, PERCPU_MIN_ALLOC_SIZE);
+	align = max_t(size_t, align, PERCPU_MIN_ALLOC_SIZE) / PERCPU_MIN_ALLOC_SIZE;
 
-	return (void *)(~(unsigned long)pdata);
+	mutex_lock(&percpu_mutex);
+	list_for_each_entry(chunk, &percpu_chunks, list) {
+		start = chunk_alloc_area(chunk, nr, align);
+		if (start >= 0)
+			goto found;
+	}
 
-oom:
-	while (--i >= 0) {
-		if (!cpu_possible(i))
-			continue;
-		kfree(pdata->ptrs[i]);
+	chunk = create_chunk();
+	if (!chunk) {
+		mutex_unlock(&percpu_mutex);
+		return NULL;
 	}
-	kfree(pdata);
+	list_insert_behind(&chunk->list, &percpu_chunks);
+	start = chunk_alloc_area(chunk, nr, align);
+	BUG_ON(start < 0);
+
+found:
+	ptr = chunk->base + start * PERCPU_MIN_ALLOC_SIZE;
+	mutex_unlock(&percpu_mutex);
 
-	return NULL;
+	for_each_possible_cpu(cpu)
+		memset(__percpu_ptr(ptr, cpu), 0, size);
+
+	return ptr;
 }
 
 void free_percpu(const void *ptr)
 {
-	struct dynamic_percpu *pdata;
-	int i;
+	struct percpu_chunk *chunk;
+	unsigned long offset;
+
+	if (!ptr)
+		return;
 
-	pdata = (struct dynamic_percpu *)(~(unsigned long)ptr);
-	for (i = 0; i < MAX_CPUS; i++) {
-		if (!cpu_possible(i))
+	mutex_lock(&percpu_mutex);
+	list_for_each_entry(chunk, &percpu_chunks, list) {
+		if ((char *)ptr < chunk->base)
 			continue;
-		kfree(pdata->ptrs[i]);
+
+		offset = (char *)ptr - chunk->base;
+		if (offset >= chunk->units * PERCPU_MIN_ALLOC_SIZE)
+			continue;
+
+		chunk_free_area(chunk, offset / PERCPU_MIN_ALLOC_SIZE);
+		/**
+		 * 释放完全空闲的块，第一个块除外
+		 */
+		if (chunk != &percpu_first_chunk
+		    && chunk->free_units == chunk->units) {
+			list_del(&chunk->list);
+			destroy_chunk(chunk);
+		}
+		mutex_unlock(&percpu_mutex);
+		return;
 	}
-	kfree(pdata);
+	mutex_unlock(&percpu_mutex);
+
+	WARN(1, "free_percpu: bad pointer %p\n", ptr);
 }
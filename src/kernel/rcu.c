@@ -0,0 +1,308 @@
+#include <dim-sum/cache.h>
+#include <dim-sum/cpumask.h>
+#include <dim-sum/init.h>
+#include <dim-sum/irqflags.h>
+#include <dim-sum/rcupdate.h>
+#include <dim-sum/sched.h>
+#include <dim-sum/smp.h>
+#include <dim-sum/smp_lock.h>
+#include <dim-sum/wait.h>
+#include <kapi/dim-sum/task.h>
+
+/**
+ * 全局宽限期控制块
+ * 每个批次对应一个宽限期
+ * 所有在线CPU都经过静止状态后，批次完成
+ */
+static struct rcu_ctrlblk {
+	struct smp_lock lock;
+	/**
+	 * 当前正在进行的批次号
+	 */
+	long cur;
+	/**
+	 * 最近完成的批次号
+	 * 与cur相等时，表示没有正在进行的宽限期
+	 */
+	long completed;
+	/**
+	 * 有回调在等待下一个批次
+	 */
+	int next_pending;
+	/**
+	 * 尚未报告静止状态的CPU
+	 */
+	struct cpumask cpumask;
+} aligned_cacheline_in_smp rcu_ctrl = {
+	.lock = SMP_LOCK_UNLOCKED(rcu_ctrl.lock),
+	.cur = -300,
+	.completed = -300,
+};
+
+/**
+ * 每CPU的RCU状态
+ */
+struct rcu_data {
+	/**
+	 * 本CPU正在为哪个批次记录静止状态
+	 */
+	long quiescbatch;
+	/**
+	 * 自quiescbatch开始以来，经过了静止状态
+	 */
+	int passed_quiesc;
+	/**
+	 * 还需要向控制块报告静止状态
+	 */
+	int qs_pending;
+	/**
+	 * curlist中的回调所等待的批次
+	 */
+	long batch;
+	/**
+	 * 新加入的回调，还没有分配批次
+	 */
+	struct rcu_head *nxtlist;
+	struct rcu_head **nxttail;
+	/**
+	 * 正在等待batch完成的回调
+	 */
+	struct rcu_head *curlist;
+	struct rcu_head **curtail;
+} aligned_cacheline_in_smp;
+
+static struct rcu_data rcu_data[MAX_CPUS];
+
+/**
+ * 宽限期已经结束，等待执行的回调
+ * 由后台线程在进程上下文中执行
+ */
+static struct smp_lock done_lock = SMP_LOCK_UNLOCKED(done_lock);
+static struct rcu_head *done_list;
+static struct rcu_head **done_tail = &done_list;
+static struct wait_queue rcu_reclaim_wait =
+	__WAIT_QUEUE_INITIALIZER(rcu_reclaim_wait);
+
+static inline int rcu_batch_before(long a, long b)
+{
+	return (a - b) < 0;
+}
+
+/**
+ * 如果有回调在等待，并且上一个批次已经完成，开始新的批次
+ * 调用者持有rcu_ctrl.lock
+ */
+static void rcu_start_batch(void)
+{
+	if (rcu_ctrl.next_pending && rcu_ctrl.completed == rcu_ctrl.cur) {
+		rcu_ctrl.next_pending = 0;
+		cpumask_copy(&rcu_ctrl.cpumask, cpu_online_mask);
+		/**
+		 * 先设置掩码，再发布批次号
+		 */
+		smp_wmb();
+		rcu_ctrl.cur++;
+	}
+}
+
+/**
+ * 本CPU已经经过静止状态，从掩码中清除
+ * 最后一个CPU负责结束当前批次
+ */
+static void rcu_cpu_quiet(int cpu, struct rcu_data *rdp)
+{
+	smp_lock(&rcu_ctrl.lock);
+	if (rdp->quiescbatch == rcu_ctrl.cur
+	    && cpumask_test_cpu(cpu, &rcu_ctrl.cpumask)) {
+		cpumask_clear_cpu(cpu, &rcu_ctrl.cpumask);
+		if (cpumask_empty(&rcu_ctrl.cpumask)) {
+			rcu_ctrl.completed = rcu_ctrl.cur;
+			rcu_start_batch();
+		}
+	}
+	smp_unlock(&rcu_ctrl.lock);
+}
+
+static void rcu_check_quiescent_state(int cpu, struct rcu_data *rdp)
+{
+	long cur = READ_ONCE(rcu_ctrl.cur);
+
+	/**
+	 * 开始了新的批次
+	 * 之前经过的静止状态不算数，必须重新等待
+	 */
+	if (rdp->quiescbatch != cur) {
+		smp_rmb();
+		rdp->qs_pending = 1;
+		rdp->passed_quiesc = 0;
+		rdp->quiescbatch = cur;
+		return;
+	}
+
+	if (!rdp->qs_pending || !rdp->passed_quiesc)
+		return;
+
+	rdp->qs_pending = 0;
+	rcu_cpu_quiet(cpu, rdp);
+}
+
+void rcu_note_qs(void)
+{
+	rcu_data[smp_processor_id()].passed_quiesc = 1;
+}
+
+/**
+ * 时钟中断中调用
+ * 将完成宽限期的回调交给后台线程，为新回调申请批次，并报告静止状态
+ */
+void rcu_check_callbacks(void)
+{
+	int cpu = smp_processor_id();
+	struct rcu_data *rdp = &rcu_data[cpu];
+	int wakeup = 0;
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	/**
+	 * 被中断的上下文允许抢占，不可能处于读端临界区中
+	 * 这相当于经过了一次静止状态
+	 * 避免长时间运行而不调度的任务阻塞宽限期
+	 */
+	if (!(preempt_count() & ~(PREEMPT_ACTIVE | HARDIRQ_OFFSET)))
+		rdp->passed_quiesc = 1;
+
+	if (rdp->curlist
+	    && !rcu_batch_before(READ_ONCE(rcu_ctrl.completed), rdp->batch)) {
+		smp_lock(&done_lock);
+		*done_tail = rdp->curlist;
+		done_tail = rdp->curtail;
+		smp_unlock(&done_lock);
+		rdp->curlist = NULL;
+		rdp->curtail = &rdp->curlist;
+		wakeup = 1;
+	}
+
+	if (rdp->nxtlist && !rdp->curlist) {
+		rdp->curlist = rdp->nxtlist;
+		rdp->curtail = rdp->nxttail;
+		rdp->nxtlist = NULL;
+		rdp->nxttail = &rdp->nxtlist;
+
+		smp_lock(&rcu_ctrl.lock);
+		/**
+		 * 当前批次可能已经开始，其间的读者可能仍然持有引用
+		 * 因此要等待下一个批次
+		 */
+		rdp->batch = rcu_ctrl.cur + 1;
+		if (!rcu_ctrl.next_pending) {
+			rcu_ctrl.next_pending = 1;
+			rcu_start_batch();
+		}
+		smp_unlock(&rcu_ctrl.lock);
+	}
+
+	rcu_check_quiescent_state(cpu, rdp);
+
+	local_irq_restore(flags);
+
+	if (wakeup)
+		wake_up(&rcu_reclaim_wait);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	struct rcu_data *rdp;
+	unsigned long flags;
+
+	head->func = func;
+	head->next = NULL;
+
+	local_irq_save(flags);
+	rdp = &rcu_data[smp_processor_id()];
+	*rdp->nxttail = head;
+	rdp->nxttail = &head->next;
+	local_irq_restore(flags);
+}
+
+struct rcu_synchronize {
+	struct rcu_head head;
+	struct task_desc *task;
+	int done;
+};
+
+static void wakeme_after_rcu(struct rcu_head *head)
+{
+	struct rcu_synchronize *rcu =
+		container_of(head, struct rcu_synchronize, head);
+	struct task_desc *task = rcu->task;
+
+	/**
+	 * 设置标志后，等待者可能立即返回并释放rcu
+	 */
+	smp_mb();
+	WRITE_ONCE(rcu->done, 1);
+	wake_up_process(task);
+}
+
+void synchronize_rcu(void)
+{
+	struct rcu_synchronize rcu;
+
+	might_sleep();
+
+	rcu.task = current;
+	rcu.done = 0;
+	call_rcu(&rcu.head, wakeme_after_rcu);
+
+	while (1) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (READ_ONCE(rcu.done))
+			break;
+		schedule();
+	}
+	set_current_state(TASK_RUNNING);
+}
+
+/**
+ * 在进程上下文中执行宽限期已经结束的回调
+ */
+static int rcu_reclaim_task(void *unused)
+{
+	struct rcu_head *list, *next;
+
+	while (1) {
+		cond_wait(rcu_reclaim_wait, READ_ONCE(done_list) != NULL);
+
+		smp_lock_irq(&done_lock);
+		list = done_list;
+		done_list = NULL;
+		done_tail = &done_list;
+		smp_unlock_irq(&done_lock);
+
+		for (; list; list = next) {
+			next = list->next;
+			list->func(list);
+		}
+	}
+
+	return 0;
+}
+
+void __init init_rcu_early(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		struct rcu_data *rdp = &rcu_data[i];
+
+		rdp->quiescbatch = rcu_ctrl.completed;
+		rdp->nxttail = &rdp->nxtlist;
+		rdp->curtail = &rdp->curlist;
+	}
+}
+
+void __init init_rcu(void)
+{
+	create_process(rcu_reclaim_task, NULL, "rcu_reclaim", 5);
+}
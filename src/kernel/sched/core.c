@@ -1,10 +1,13 @@
 #include <dim-sum/beehive.h>
+#include <dim-sum/blk_dev.h>
 #include <dim-sum/boot_allotter.h>
+#include <dim-sum/cache.h>
 #include <dim-sum/cpu.h>
 #include <dim-sum/fs.h>
 #include <dim-sum/idle.h>
 #include <dim-sum/irq.h>
 #include <dim-sum/mem.h>
+#include <dim-sum/rcupdate.h>
 #include <dim-sum/sched.h>
 #include <dim-sum/smp.h>
 #include <dim-sum/string.h>
@@ -32,13 +35,68 @@ union process_union master_idle_stack;
  * 这样最后总有一位是0
  */
 #define SCHED_MASK_SIZE ((MAX_RT_PRIO + BITS_PER_LONG) / BITS_PER_LONG)
-unsigned long sched_runqueue_mask[SCHED_MASK_SIZE] = { 0 };
-struct double_list sched_runqueue_list[MAX_RT_PRIO+1];
+
+/**
+ * 周期性负载均衡的间隔，以tick为单位
+ */
+#define SCHED_BALANCE_INTERVAL	4
+
+/**
+ * 每个CPU上的运行队列
+ */
+struct sched_runqueue {
+	/**
+	 * 保护本队列的锁
+	 * 在任务切换期间一直持有，由新任务释放
+	 */
+	struct smp_lock lock;
+	/**
+	 * 队列所属的CPU
+	 */
+	int cpu;
+	/**
+	 * 队列中的任务数量，包含正在运行的任务
+	 * 但是不包含idle任务
+	 */
+	int nr_running;
+	/**
+	 * 当前正在本CPU上运行的任务
+	 * 负载均衡不能迁移该任务
+	 */
+	struct task_desc *curr;
+	/**
+	 * 切换完成后，需要推送到其他CPU的任务
+	 */
+	struct task_desc *push_task;
+	/**
+	 * 下一次周期性负载均衡的时间
+	 */
+	u64 next_balance;
+	/**
+	 * 统计值，任务切换次数、窃取的任务数
+	 */
+	unsigned long nr_switches;
+	unsigned long nr_pulled;
+	/**
+	 * 优先级位图，与链表一一对应
+	 */
+	unsigned long mask[SCHED_MASK_SIZE];
+	struct double_list list[MAX_RT_PRIO+1];
+} aligned_cacheline;
+
+static struct sched_runqueue cpu_runqueues[MAX_CPUS];
+
+#define cpu_rq(cpu)	(&cpu_runqueues[(cpu)])
+#define this_rq()	cpu_rq(smp_processor_id())
 
 union process_union *idle_proc_stacks[MAX_CPUS];
 struct task_desc *idle_task_desc[MAX_CPUS];
 #define INIT_SP(tsk)		((unsigned long)tsk + THREAD_START_SP)
 
+/**
+ * 仅仅保护全局任务链表
+ * 运行队列由每CPU的队列锁保护
+ */
 struct smp_lock lock_all_task_list = SMP_LOCK_UNLOCKED(lock_all_task_list);
 struct double_list sched_all_task_list = LIST_HEAD_INITIALIZER(sched_all_task_list);
 
@@ -69,22 +127,95 @@ void __release_task_desc(struct ref_count *ref)
 	free_proc_stack(tsk->stack);
 }
 
-static inline void add_to_runqueue(struct task_desc * p)
+/**
+ * 锁住任务所在的运行队列
+ * 任务可能在此期间被迁移，因此需要重试
+ */
+static struct sched_runqueue *
+lock_task_rq(struct task_desc *tsk, unsigned long *flags)
+{
+	struct sched_runqueue *rq;
+
+	for (;;) {
+		rq = cpu_rq(tsk->cpu);
+		smp_lock_irqsave(&rq->lock, *flags);
+		if (likely(rq == cpu_rq(tsk->cpu)))
+			return rq;
+
+		smp_unlock_irqrestore(&rq->lock, *flags);
+		cpu_relax();
+	}
+}
+
+static inline void
+unlock_task_rq(struct sched_runqueue *rq, unsigned long flags)
+{
+	smp_unlock_irqrestore(&rq->lock, flags);
+}
+
+/**
+ * 同时锁住两个运行队列
+ * 按地址顺序获取，避免死锁。调用者已经关闭中断
+ */
+static void double_rq_lock(struct sched_runqueue *rq1,
+	struct sched_runqueue *rq2)
+{
+	if (rq1 == rq2)
+		smp_lock(&rq1->lock);
+	else if (rq1 < rq2) {
+		smp_lock(&rq1->lock);
+		smp_lock(&rq2->lock);
+	} else {
+		smp_lock(&rq2->lock);
+		smp_lock(&rq1->lock);
+	}
+}
+
+static void double_rq_unlock(struct sched_runqueue *rq1,
+	struct sched_runqueue *rq2)
+{
+	smp_unlock(&rq1->lock);
+	if (rq1 != rq2)
+		smp_unlock(&rq2->lock);
+}
+
+/**
+ * 要求队列上正在运行的任务重新调度
+ * 远端CPU上的任务，通过IPI通知其立即调度
+ * 否则要等到其下一次时钟中断
+ */
+static inline void resched_curr(struct sched_runqueue *rq)
+{
+	struct task_desc *curr = rq->curr;
+
+	if (__test_and_set_process_flag(task_process_info(curr),
+	    PROCFLAG_NEED_RESCHED))
+		return;
+
+	if (rq->cpu != smp_processor_id())
+		smp_send_reschedule(rq->cpu);
+}
+
+static inline void add_to_runqueue(struct sched_runqueue *rq,
+	struct task_desc * p)
 {
  	int pri = p->sched_prio;
 
 	if (p->in_run_queue)
 		return;
 
-	list_insert_behind(&p->run_list,&(sched_runqueue_list[pri])); 
+	list_insert_behind(&p->run_list, &rq->list[pri]); 
 	p->in_run_queue = 1;
-	if (p->sched_prio < current->sched_prio)
-		set_task_need_resched(current);
+	p->cpu = rq->cpu;
+	rq->nr_running++;
+	if (p->sched_prio < rq->curr->sched_prio)
+		resched_curr(rq);
 
-	atomic_set_bit(pri, ( long unsigned int *)sched_runqueue_mask);  
+	atomic_set_bit(pri, rq->mask);  
 }
 
-static inline void del_from_runqueue(struct task_desc * p)
+static inline void del_from_runqueue(struct sched_runqueue *rq,
+	struct task_desc * p)
 {
 	int pri = p->sched_prio;
 
@@ -94,12 +225,189 @@ static inline void del_from_runqueue(struct task_desc * p)
 	list_del(&p->run_list);
 	list_init(&p->run_list);
 
-	if(list_is_empty(&(sched_runqueue_list[pri])))
-	    atomic_clear_bit(pri, ( long unsigned int *)sched_runqueue_mask);
+	if(list_is_empty(&rq->list[pri]))
+	    atomic_clear_bit(pri, rq->mask);
 
+	rq->nr_running--;
 	p->in_run_queue = 0;
 }
 
+/**
+ * 任务能否在指定CPU上运行
+ */
+static inline bool task_allowed_on(struct task_desc *p, int cpu)
+{
+	return p->affinity < 0 || p->affinity == cpu;
+}
+
+/**
+ * 为刚唤醒或者新创建的任务选择运行队列
+ * 优先留在原CPU上，以利用缓存
+ * 原CPU繁忙时，选择一个空闲的CPU
+ * 这里无锁读取其他队列，只是一个近似值
+ */
+static int select_task_cpu(struct task_desc *p)
+{
+	struct sched_runqueue *rq;
+	int cpu;
+
+	if (p->affinity >= 0)
+		return p->affinity;
+
+	rq = cpu_rq(p->cpu);
+	if (cpu_online(p->cpu) && !rq->nr_running)
+		return p->cpu;
+
+	for_each_online_cpu(cpu) {
+		rq = cpu_rq(cpu);
+		if (!rq->nr_running)
+			return cpu;
+	}
+
+	return cpu_online(p->cpu) ? p->cpu : smp_processor_id();
+}
+
+/**
+ * 将不在运行队列中的任务加入到合适的运行队列
+ * 调用者持有任务当前所在队列的锁
+ * 返回时，仍然只持有rq的锁，但是rq可能已经变化
+ */
+static struct sched_runqueue *
+enqueue_task_select(struct sched_runqueue *rq, struct task_desc *p)
+{
+	struct sched_runqueue *target;
+
+	/**
+	 * 任务仍然在原CPU上运行，不能迁移
+	 */
+	if (rq->curr == p)
+		goto local;
+
+	target = cpu_rq(select_task_cpu(p));
+	if (target == rq)
+		goto local;
+
+	/**
+	 * 按顺序重新获取两个队列的锁
+	 * 由于任务状态已经是TASK_RUNNING，其他唤醒者不会再操作它
+	 */
+	smp_unlock(&rq->lock);
+	double_rq_lock(rq, target);
+	if (p->in_run_queue || rq->curr == p || p->cpu != rq->cpu) {
+		smp_unlock(&target->lock);
+		if (!p->in_run_queue && p->cpu == rq->cpu)
+			add_to_runqueue(rq, p);
+		return rq;
+	}
+	p->cpu = target->cpu;
+	smp_unlock(&rq->lock);
+	add_to_runqueue(target, p);
+
+	return target;
+local:
+	add_to_runqueue(rq, p);
+	return rq;
+}
+
+/**
+ * 从繁忙队列中拉取任务到本队列
+ * 调用者已经按顺序获得两个队列的锁
+ */
+static int pull_tasks(struct sched_runqueue *this_rq,
+	struct sched_runqueue *busiest, int max_pull)
+{
+	struct task_desc *p, *tmp;
+	int pulled = 0;
+	int idx;
+
+	for (idx = find_first_bit(busiest->mask, MAX_RT_PRIO + 1);
+	     idx <= MAX_RT_PRIO && pulled < max_pull;
+	     idx = find_next_bit(busiest->mask, MAX_RT_PRIO + 1, idx + 1)) {
+		list_for_each_entry_safe(p, tmp, &busiest->list[idx], run_list) {
+			if (p == busiest->curr)
+				continue;
+			if (!task_allowed_on(p, this_rq->cpu))
+				continue;
+
+			del_from_runqueue(busiest, p);
+			add_to_runqueue(this_rq, p);
+			pulled++;
+			if (pulled >= max_pull)
+				break;
+		}
+	}
+
+	this_rq->nr_pulled += pulled;
+
+	return pulled;
+}
+
+/**
+ * 工作窃取负载均衡
+ * 找到最繁忙的CPU，从其队列中拉取等待运行的任务
+ * 返回拉取的任务数量
+ */
+static int load_balance(int this_cpu)
+{
+	struct sched_runqueue *this_rq = cpu_rq(this_cpu);
+	struct sched_runqueue *busiest = NULL;
+	int max_load = 0, imbalance;
+	unsigned long flags;
+	int cpu, pulled = 0;
+
+	for_each_online_cpu(cpu) {
+		struct sched_runqueue *rq = cpu_rq(cpu);
+
+		if (cpu == this_cpu)
+			continue;
+		if (rq->nr_running > max_load) {
+			max_load = rq->nr_running;
+			busiest = rq;
+		}
+	}
+
+	/**
+	 * 繁忙CPU上至少有一个任务在等待
+	 * 并且负载差距至少为2，才值得迁移
+	 */
+	if (!busiest || max_load < 2 || max_load - this_rq->nr_running < 2)
+		return 0;
+
+	local_irq_save(flags);
+	double_rq_lock(this_rq, busiest);
+	imbalance = (busiest->nr_running - this_rq->nr_running) / 2;
+	if (imbalance > 0)
+		pulled = pull_tasks(this_rq, busiest, imbalance);
+	double_rq_unlock(this_rq, busiest);
+	local_irq_restore(flags);
+
+	return pulled;
+}
+
+/**
+ * CPU空闲时调用，尝试从其他CPU窃取任务
+ */
+int idle_balance(void)
+{
+	return load_balance(smp_processor_id());
+}
+
+/**
+ * 时钟中断中调用，周期性的进行负载均衡
+ */
+void sched_tick(void)
+{
+	int cpu = smp_processor_id();
+	struct sched_runqueue *rq = cpu_rq(cpu);
+	u64 now = get_jiffies_64();
+
+	if (now < rq->next_balance)
+		return;
+
+	rq->next_balance = now + SCHED_BALANCE_INTERVAL;
+	load_balance(cpu);
+}
+
 asmlinkage void __sched preempt_schedule(void)
 {
 	if (likely(preempt_count() || irqs_disabled()))
@@ -152,9 +460,41 @@ static struct task_desc *__switch_to(struct process_desc *prev,
 	return last;
 }
 
+/**
+ * 任务切换完成后，在新任务的上下文中调用
+ * 释放运行队列锁，并将需要迁移的任务推送到目标CPU
+ */
+static void finish_task_switch(struct sched_runqueue *rq)
+{
+	struct task_desc *push = rq->push_task;
+	struct sched_runqueue *target;
+	unsigned long flags;
+	int cpu;
+
+	rq->push_task = NULL;
+	smp_unlock(&rq->lock);
+	enable_irq();
+
+	if (likely(!push))
+		return;
+
+	/**
+	 * 在此期间，绑定关系可能已经被修改
+	 */
+	cpu = push->affinity;
+	if (cpu < 0)
+		cpu = rq->cpu;
+	target = cpu_rq(cpu);
+	smp_lock_irqsave(&target->lock, flags);
+	push->cpu = target->cpu;
+	add_to_runqueue(target, push);
+	smp_unlock_irqrestore(&target->lock, flags);
+}
+
 asmlinkage void schedule(void)
 {
 	struct task_desc *prev, *next;
+	struct sched_runqueue *rq;
 	unsigned long flags;
 	int idx;
 
@@ -164,22 +504,45 @@ asmlinkage void schedule(void)
 		BUG();
 	}
 
+	/**
+	 * 任务即将主动睡眠，先推送它积攒的块设备请求
+	 * 否则它可能永远等待这些请求完成
+	 * 被抢占的任务仍然在运行队列中，很快会回来继续积攒
+	 */
+	if (!(preempt_count() & PREEMPT_ACTIVE)
+	    && !(current->state & TASK_RUNNING) && current->plug)
+		blk_schedule_flush_plug(current);
+
 need_resched:
 	/**
 	 * 这里必须手动增加抢占计数
 	 * 以避免在打开锁的时候执行调度，那样就乱套了
 	 */
 	preempt_disable();
-	smp_lock_irqsave(&lock_all_task_list, flags);
+	/**
+	 * 调度点不可能处于RCU读端临界区中
+	 */
+	rcu_note_qs();
+	rq = this_rq();
+	smp_lock_irqsave(&rq->lock, flags);
 
 	prev = current;
 	/**
 	 * 很微妙的两个标志，请特别小心
 	 */
 	if (!(preempt_count() & PREEMPT_ACTIVE) && !(prev->state & TASK_RUNNING))
-		del_from_runqueue(prev);
+		del_from_runqueue(rq, prev);
+	else if (unlikely((prev->state & TASK_RUNNING) && prev->in_run_queue
+			&& !task_allowed_on(prev, rq->cpu))) {
+		/**
+		 * 任务被绑定到其他CPU
+		 * 切换出去以后，再将其推送到目标CPU
+		 */
+		del_from_runqueue(rq, prev);
+		rq->push_task = prev;
+	}
 
-	idx = find_first_bit(sched_runqueue_mask, MAX_RT_PRIO + 1);
+	idx = find_first_bit(rq->mask, MAX_RT_PRIO + 1);
 	/**
 	 * 没有任务可运行
 	 */
@@ -187,9 +550,9 @@ need_resched:
 		/**
 		 * 选择本CPU上的IDLE任务来运行
 		 */
-		next = idle_task_desc[smp_processor_id()];
+		next = idle_task_desc[rq->cpu];
 	else
-		next = list_first_container(&sched_runqueue_list[idx],
+		next = list_first_container(&rq->list[idx],
 							struct task_desc, run_list);
 
 	/**
@@ -197,13 +560,15 @@ need_resched:
 	 */
 	if (unlikely(prev == next)) {
 		clear_task_need_resched(prev);
-		smp_unlock_irq(&lock_all_task_list);
+		smp_unlock_irq(&rq->lock);
 		preempt_enable_no_resched();
 		goto same_process;
 	}
 	clear_task_need_resched(prev);
 
 	next->prev_sched = prev;
+	rq->curr = next;
+	rq->nr_switches++;
 	task_process_info(next)->cpu = task_process_info(prev)->cpu;
 	prev = __switch_to(task_process_info(prev), task_process_info(next)); 
 	barrier();
@@ -216,7 +581,11 @@ need_resched:
 		current->prev_sched = NULL;
 	}
 
-	smp_unlock_irq(&lock_all_task_list);
+	/**
+	 * 当前任务可能是在其他CPU上被切换出去的
+	 * 因此需要重新获取运行队列
+	 */
+	finish_task_switch(this_rq());
 	preempt_enable_no_resched();
 
 same_process:
@@ -226,19 +595,42 @@ same_process:
 	return;
 }
 
+/**
+ * 主动让出CPU
+ * 将当前任务移动到同优先级任务的末尾
+ */
+asmlinkage int sys_sched_yield(void)
+{
+	struct task_desc *tsk = current;
+	struct sched_runqueue *rq;
+	unsigned long flags;
+
+	rq = lock_task_rq(tsk, &flags);
+	if (tsk->in_run_queue) {
+		list_del(&tsk->run_list);
+		list_insert_behind(&tsk->run_list, &rq->list[tsk->sched_prio]);
+	}
+	unlock_task_rq(rq, flags);
+
+	schedule();
+
+	return 0;
+}
+
 int __sched wake_up_process_special(struct task_desc *tsk, unsigned int state, int sync)
 {
+	struct sched_runqueue *rq;
 	unsigned long flags;
 	int ret;
 
-	smp_lock_irqsave(&lock_all_task_list, flags);
+	rq = lock_task_rq(tsk, &flags);
 	if (tsk->state & state) {
-		add_to_runqueue(tsk);
 		tsk->state = TASK_RUNNING;
+		rq = enqueue_task_select(rq, tsk);
 		ret = 0;
 	} else
 		ret = -1;
-	smp_unlock_irqrestore(&lock_all_task_list, flags);
+	unlock_task_rq(rq, flags);
 
 	return ret;
 }
@@ -251,24 +643,77 @@ int __sched wake_up_process(struct task_desc *tsk)
 
 void change_task_prio(struct task_desc *tsk, int prio)
 {
+	struct sched_runqueue *rq;
 	unsigned long flags;
 	
 	if (prio == tsk->sched_prio)
 		return;
 
-	smp_lock_irqsave(&lock_all_task_list, flags);
+	rq = lock_task_rq(tsk, &flags);
 
 	/**
 	 * 此处需要用in_list进行判断，而不能判断进程状态是否为TASK_RUNNING
 	 */
 	if (tsk->in_run_queue) {
-		del_from_runqueue(tsk);
+		del_from_runqueue(rq, tsk);
 		tsk->sched_prio = prio;
-		add_to_runqueue(tsk);
+		add_to_runqueue(rq, tsk);
 	} else
 		tsk->sched_prio = prio;
 
-	smp_unlock_irqrestore(&lock_all_task_list, flags);
+	unlock_task_rq(rq, flags);
+}
+
+/**
+ * 将任务绑定到指定CPU上运行
+ * cpu为负数表示允许在任意CPU上运行
+ */
+int set_task_affinity(struct task_desc *tsk, int cpu)
+{
+	struct sched_runqueue *rq, *target;
+	unsigned long flags;
+
+	if (cpu >= MAX_CPUS || (cpu >= 0 && !cpu_online(cpu)))
+		return -EINVAL;
+
+	rq = lock_task_rq(tsk, &flags);
+	tsk->affinity = cpu;
+	if (cpu < 0 || tsk->cpu == cpu)
+		goto out;
+
+	/**
+	 * 正在运行的任务，在下一次调度时迁移
+	 */
+	if (rq->curr == tsk) {
+		resched_curr(rq);
+		goto out;
+	}
+
+	/**
+	 * 不在队列中的任务，在唤醒时选择目标CPU
+	 */
+	if (!tsk->in_run_queue)
+		goto out;
+
+	target = cpu_rq(cpu);
+	smp_unlock(&rq->lock);
+	double_rq_lock(rq, target);
+	if (tsk->in_run_queue && tsk->cpu == rq->cpu && rq->curr != tsk) {
+		del_from_runqueue(rq, tsk);
+		add_to_runqueue(target, tsk);
+	}
+	double_rq_unlock(rq, target);
+	local_irq_restore(flags);
+
+	return 0;
+out:
+	unlock_task_rq(rq, flags);
+	return 0;
+}
+
+void kthread_bind(struct task_desc *k, unsigned int cpu)
+{
+	set_task_affinity(k, cpu);
 }
 
 static void __noreturn do_exit_task(int code)
@@ -301,8 +746,7 @@ static void task_entry(void)
 	 * 稍微有点费解
 	 * 这里是与schedule函数前半部分对应
 	 */
-	smp_unlock(&lock_all_task_list);
-	enable_irq();
+	finish_task_switch(this_rq());
 	preempt_enable();
 
 	/**
@@ -325,6 +769,7 @@ struct task_desc *create_task(struct task_create_param *param)
 {
 	struct task_desc *ret = NULL;
 	union process_union *stack = NULL;
+	struct sched_runqueue *rq;
 	unsigned long flags;
 	struct task_desc *tsk;
 
@@ -353,6 +798,8 @@ struct task_desc *create_task(struct task_create_param *param)
 	tsk->task_main = param->func;
 	tsk->main_data = param->data;
 	tsk->in_run_queue = 0;
+	tsk->cpu = smp_processor_id();
+	tsk->affinity = -1;
 	tsk->pid = (pid_t)tsk;
 	
 	stack->process_desc.preempt_count = 2;
@@ -373,12 +820,16 @@ struct task_desc *create_task(struct task_create_param *param)
 	list_init(&tsk->run_list);
 	list_init(&tsk->all_list);
 	init_waitqueue(&tsk->wait_child_exit);
+
 	smp_lock_irqsave(&lock_all_task_list, flags);
-	tsk->state = TASK_RUNNING;
-	add_to_runqueue(tsk);
 	list_insert_behind(&tsk->all_list, &sched_all_task_list);
 	smp_unlock_irqrestore(&lock_all_task_list, flags);
 
+	rq = lock_task_rq(tsk, &flags);
+	tsk->state = TASK_RUNNING;
+	rq = enqueue_task_select(rq, tsk);
+	unlock_task_rq(rq, flags);
+
 	return tsk;
 out:
 	if (tsk)
@@ -392,10 +843,10 @@ out:
 
 /**
  * 暂停任务运行
- * 在SMP下面应当重新实现本函数
  */
 int suspend_task(struct task_desc *tsk)
 {
+	struct sched_runqueue *rq;
 	int ret = -1;
 	unsigned long flags;
 
@@ -403,9 +854,9 @@ int suspend_task(struct task_desc *tsk)
 		return -EINVAL;
 
 	tsk->state |= TASK_STOPPED;
-	smp_lock_irqsave(&lock_all_task_list, flags);
-	del_from_runqueue(tsk);
-	smp_unlock_irqrestore(&lock_all_task_list, flags);
+	rq = lock_task_rq(tsk, &flags);
+	del_from_runqueue(rq, tsk);
+	unlock_task_rq(rq, flags);
 
 	if (tsk == current)
 		schedule();
@@ -419,24 +870,37 @@ int suspend_task(struct task_desc *tsk)
  */
 int resume_task(struct task_desc *tsk)
 {
+	struct sched_runqueue *rq;
 	int ret = -1;
 	unsigned long flags;
 
 	if (!tsk)
 		return -EINVAL;
 
-	smp_lock_irqsave(&lock_all_task_list, flags);
+	rq = lock_task_rq(tsk, &flags);
 	tsk->state &= ~TASK_STOPPED;
 	if (!tsk->state) {
-		add_to_runqueue(tsk);
 		tsk->state = TASK_RUNNING;
+		rq = enqueue_task_select(rq, tsk);
 	}
-	smp_unlock_irqrestore(&lock_all_task_list, flags);
+	unlock_task_rq(rq, flags);
 
 	ret = 0;
 	return ret;
 }
 
+/**
+ * 获取某个CPU上的调度统计信息
+ */
+void get_sched_statistics(int cpu, struct sched_statistics *stat)
+{
+	struct sched_runqueue *rq = cpu_rq(cpu);
+
+	stat->nr_running = rq->nr_running;
+	stat->nr_switches = rq->nr_switches;
+	stat->nr_pulled = rq->nr_pulled;
+}
+
 static void init_idle_process(union process_union *stack,
 		struct task_desc *proc, int cpu)
 {
@@ -458,6 +922,8 @@ static void init_idle_process(union process_union *stack,
 	proc->task_main = &cpu_idle;
 	proc->main_data = NULL;
 	proc->in_run_queue = 0;
+	proc->cpu = cpu;
+	proc->affinity = cpu;
 	proc->prev_sched = NULL;
 
 	init_task_fs(NULL, proc);
@@ -505,7 +971,8 @@ void init_sched_early(void)
  */
 void init_sched(void)
 {
-	int i;
+	struct sched_runqueue *rq;
+	int i, j;
 
 	list_init(&sched_all_task_list);
 	
@@ -514,8 +981,18 @@ void init_sched(void)
 		disable_irq();
 	}
 	
-	for(i = 0; i < ARRAY_SIZE(sched_runqueue_list); i++)
-		list_init(&(sched_runqueue_list[i]));
-
-	memset(sched_runqueue_mask, 0, sizeof(sched_runqueue_mask));
+	for (i = 0; i < MAX_CPUS; i++) {
+		rq = cpu_rq(i);
+		smp_lock_init(&rq->lock);
+		rq->cpu = i;
+		rq->nr_running = 0;
+		rq->curr = i < nr_existent_cpus ? idle_task_desc[i] : NULL;
+		rq->push_task = NULL;
+		rq->next_balance = 0;
+		rq->nr_switches = 0;
+		rq->nr_pulled = 0;
+		for (j = 0; j < ARRAY_SIZE(rq->list); j++)
+			list_init(&rq->list[j]);
+		memset(rq->mask, 0, sizeof(rq->mask));
+	}
 }
@@ -4,6 +4,7 @@
 
 //#include <dim-sum/adapter.h>
 #include <dim-sum/idle.h>
+#include <dim-sum/rcupdate.h>
 
 #include <dim-sum/sched.h>
 
@@ -45,7 +46,15 @@ void cpu_idle (void)
 		preempt_disable();
 		while (!need_resched())
 		{
-			idle();
+			/**
+			 * 空闲循环也是RCU的静止状态
+			 */
+			rcu_note_qs();
+			/**
+			 * 先尝试从其他CPU窃取任务
+			 */
+			if (!idle_balance())
+				idle();
 		}
 		preempt_enable();
 		schedule();
@@ -1,10 +1,210 @@
+#include <dim-sum/beehive.h>
 #include <dim-sum/cpu.h>
 #include <dim-sum/cpumask.h>
+#include <dim-sum/irqflags.h>
+#include <dim-sum/sched.h>
 #include <dim-sum/smp.h>
+#include <dim-sum/smp_lock.h>
 
+/**
+ * 每个CPU上的跨核函数调用队列
+ */
+struct smp_call_queue {
+	struct smp_lock lock;
+	struct double_list list;
+} aligned_cacheline;
+
+static struct smp_call_queue cpu_call_queues[MAX_CPUS];
+
+/**
+ * 运行调用请求，并通知请求者
+ */
+static void run_call_data(struct smp_call_data *data)
+{
+	void (*func) (void *info) = data->func;
+	void *priv = data->priv;
+	u16 flags = data->flags;
+
+	/**
+	 * 请求者在栈上分配的描述符
+	 * 清除PENDING标志以后，就不能再访问它了
+	 */
+	if (flags & SMP_CALL_WAIT) {
+		func(priv);
+		smp_mb();
+		data->flags &= ~SMP_CALL_PENDING;
+	} else {
+		func(priv);
+		if (flags & SMP_CALL_ALLOC)
+			kfree(data);
+	}
+}
+
+/**
+ * IPI_CALL_FUNC中断处理函数
+ * 在中断上下文中运行，此时已经关中断
+ */
+void smp_call_interrupt(void)
+{
+	struct smp_call_queue *queue = &cpu_call_queues[smp_processor_id()];
+	struct double_list list;
+	struct smp_call_data *data, *tmp;
+
+	list_init(&list);
+	smp_lock(&queue->lock);
+	list_combine_behind_init(&queue->list, &list);
+	smp_unlock(&queue->lock);
+
+	list_for_each_entry_safe(data, tmp, &list, list) {
+		list_del(&data->list);
+		run_call_data(data);
+	}
+}
+
+/**
+ * 将请求放到目标CPU的队列中
+ * 返回true表示队列原来为空，需要发送IPI
+ */
+static bool queue_call_data(int cpu, struct smp_call_data *data)
+{
+	struct smp_call_queue *queue = &cpu_call_queues[cpu];
+	unsigned long flags;
+	bool first;
+
+	smp_lock_irqsave(&queue->lock, flags);
+	first = list_is_empty(&queue->list);
+	list_insert_behind(&data->list, &queue->list);
+	smp_unlock_irqrestore(&queue->lock, flags);
+
+	return first;
+}
+
+static int __smp_call_for_many(const struct cpumask *mask,
+	void (*func) (void *info), void *info, int wait, bool self)
+{
+	struct smp_call_data datas[MAX_CPUS];
+	struct smp_call_data *data;
+	struct cpumask queued, kick;
+	unsigned long flags;
+	int cpu, this_cpu;
+	int ret = 0;
+
+	/**
+	 * 关中断等待其他核，可能与对方互相等待而死锁
+	 */
+	WARN_ON(wait && irqs_disabled(), "smp call with irq disabled.\n");
+
+	this_cpu = get_cpu();
+	cpumask_clear(&queued);
+	cpumask_clear(&kick);
+
+	for_each_cpu(cpu, mask) {
+		if (cpu == this_cpu || !cpu_online(cpu))
+			continue;
+
+		if (wait)
+			data = &datas[cpu];
+		else {
+			data = kmalloc(sizeof(*data), PAF_ATOMIC);
+			if (!data) {
+				ret = -ENOMEM;
+				continue;
+			}
+		}
+
+		data->func = func;
+		data->priv = info;
+		data->flags = SMP_CALL_PENDING;
+		data->flags |= wait ? SMP_CALL_WAIT : SMP_CALL_ALLOC;
+
+		cpumask_set_cpu(cpu, &queued);
+		/**
+		 * 队列中已经有请求，IPI已经在路上了
+		 */
+		if (queue_call_data(cpu, data))
+			cpumask_set_cpu(cpu, &kick);
+	}
+
+	if (cpumask_weight(&kick))
+		arch_raise_ipi(&kick, IPI_CALL_FUNC);
+
+	if (self && cpumask_test_cpu(this_cpu, mask)) {
+		local_irq_save(flags);
+		func(info);
+		local_irq_restore(flags);
+	}
+
+	if (wait)
+		for_each_cpu(cpu, &queued)
+			while (((volatile u16)datas[cpu].flags) & SMP_CALL_PENDING)
+				cpu_relax();
+
+	put_cpu();
+
+	return ret;
+}
+
+/**
+ * 在mask指定的所有CPU上运行函数，包含当前CPU
+ */
+int smp_call_for_many(const struct cpumask *mask,
+	void (*func) (void *info), void *info, int wait)
+{
+	return __smp_call_for_many(mask, func, info, wait, true);
+}
+
+/**
+ * 在指定CPU上运行函数
+ */
+int smp_call_for_cpu(int cpu, void (*func) (void *info), void *info, int wait)
+{
+	struct cpumask mask;
+
+	if (cpu < 0 || cpu >= MAX_CPUS || !cpu_online(cpu))
+		return -ENXIO;
+
+	cpumask_clear(&mask);
+	cpumask_set_cpu(cpu, &mask);
+
+	return __smp_call_for_many(&mask, func, info, wait, true);
+}
+
+/**
+ * 在除当前CPU以外的其他所有CPU上运行函数
+ */
+int smp_call_function(void (*func) (void *info), void *info, int wait)
+{
+	return __smp_call_for_many(cpu_online_mask, func, info, wait, false);
+}
+
+/**
+ * 在所有CPU上运行函数，包含当前CPU
+ */
 int smp_call_for_all(void (*func) (void *info), void *info, int wait)
 {
-	return 0;
+	return __smp_call_for_many(cpu_online_mask, func, info, wait, true);
+}
+
+/**
+ * 要求其他CPU重新调度
+ */
+void smp_send_reschedule(int cpu)
+{
+	struct cpumask mask;
+
+	cpumask_clear(&mask);
+	cpumask_set_cpu(cpu, &mask);
+	arch_raise_ipi(&mask, IPI_RESCHEDULE);
+}
+
+void __init init_smp_call(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		smp_lock_init(&cpu_call_queues[i].lock);
+		list_init(&cpu_call_queues[i].list);
+	}
 }
 
 void __init launch_slave(void)
@@ -1,4 +1,6 @@
 #include <dim-sum/delay.h>
+#include <dim-sum/percpu.h>
+#include <dim-sum/rcupdate.h>
 #include <dim-sum/smp.h>
 #include <dim-sum/sched.h>
 #include <dim-sum/timer.h>
@@ -9,6 +11,11 @@
  */
 static struct cpu_timer_queue cpu_timers[MAX_CPUS];
 struct cpu_timer_queue dummy_timer_queue;
+/**
+ * 无锁修改到期时间的次数
+ * 不持有队列锁，因此按执行修改的CPU计数
+ */
+static DEFINE_PER_CPU(unsigned long, rejoin_fast_count);
 
 static struct cpu_timer_queue *
 lock_timer_queue(struct timer *timer, unsigned long *flags)
@@ -33,12 +40,60 @@ static void unlock_timer_queue(struct timer *timer, unsigned long flags)
 	smp_unlock_irqrestore(&timer->queue->lock, flags);
 }
 
+/**
+ * 根据到期时间计算时间轮中的桶
+ */
+static struct double_list *
+wheel_bucket(struct cpu_timer_queue *queue, u64 expire)
+{
+	u64 base = READ_ONCE(queue->wheel_jiffies);
+	u64 idx = expire - base;
+	int level;
+
+	/**
+	 * 已经过期，在下一个jiffy运行
+	 */
+	if ((s64)idx < 0)
+		return queue->tv1 + (base & TVR_MASK);
+
+	if (idx < TVR_SIZE)
+		return queue->tv1 + (expire & TVR_MASK);
+
+	/**
+	 * 超出时间轮的范围，放在最后一级最远的桶中
+	 * 迁移时会按照实际的到期时间重新计算
+	 */
+	if (idx >= (1ULL << (TVR_BITS + TVN_LEVELS * TVN_BITS)))
+		expire = base + (1ULL << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1;
+
+	for (level = 0; level < TVN_LEVELS - 1; level++)
+		if (idx < (1ULL << (TVR_BITS + (level + 1) * TVN_BITS)))
+			break;
+
+	return queue->tvn[level] +
+		((expire >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK);
+}
+
+static void __wheel_insert(struct cpu_timer_queue *queue, struct timer *timer)
+{
+	struct double_list *bucket = wheel_bucket(queue, timer->expire);
+
+	list_insert_behind(&timer->list, bucket);
+	timer->bucket = bucket;
+	timer->flag |= TIMER_INQUEUE;
+}
+
 static void __timer_insert(struct cpu_timer_queue *queue, struct timer *timer)
 {
 	struct rb_node **link = &queue->rbroot.rb_node;
 	struct rb_node *parent = NULL, *rbprev = NULL;
 	struct timer *entry;
 
+	if (!(timer->flag & TIMER_HRES)) {
+		__wheel_insert(queue, timer);
+		return;
+	}
+
 	while (*link) {
 		parent = *link;
 		entry = rb_entry(parent, struct timer, rbnode);
@@ -64,9 +119,15 @@ static void __timer_insert(struct cpu_timer_queue *queue, struct timer *timer)
 
 static void __timer_dequeue(struct timer *timer)
 {
-	rb_erase(&timer->rbnode, &timer->queue->rbroot);
+	if (timer->flag & TIMER_HRES)
+		rb_erase(&timer->rbnode, &timer->queue->rbroot);
 	list_del(&timer->list);
+	timer->bucket = NULL;
 	timer->flag &= ~TIMER_INQUEUE;
+	/**
+	 * 与timer_rejoin的无锁流程配对
+	 */
+	smp_mb();
 }
 
 int timer_init(struct timer *timer)
@@ -88,17 +149,53 @@ void timer_add(struct timer * timer)
 	timer->queue = queue;
 	__timer_insert(queue, timer);
 	timer->flag &= ~TIMER_FREE;
+	queue->stat.nr_add++;
 	smp_unlock_irqrestore(&queue->lock, flag);
 }
 
+/**
+ * 不获取队列锁，修改时间轮定时器的到期时间
+ * 只处理到期时间推后并且不需要移动桶的情况
+ * 时间轮处理桶时会重新检查到期时间，推后的定时器被重新插入
+ */
+static bool timer_rejoin_fast(struct timer *timer, u64 expire)
+{
+	struct cpu_timer_queue *queue = READ_ONCE(timer->queue);
+	struct double_list *bucket = READ_ONCE(timer->bucket);
+
+	if ((timer->flag & (TIMER_HRES | TIMER_INQUEUE)) != TIMER_INQUEUE)
+		return false;
+
+	if (!bucket || expire < timer->expire ||
+	    wheel_bucket(queue, expire) != bucket)
+		return false;
+
+	WRITE_ONCE(timer->expire, expire);
+	/**
+	 * 与__timer_dequeue配对
+	 * 要么时间轮看到新的到期时间，要么我们看到定时器已经出队
+	 */
+	smp_mb();
+	if (!(READ_ONCE(timer->flag) & TIMER_INQUEUE))
+		return false;
+
+	this_cpu_inc(rejoin_fast_count);
+	return true;
+}
+
 int timer_rejoin(struct timer *timer, u64 expire)
 {
+	struct cpu_timer_queue *queue;
 	unsigned long flag;
 
+	if (timer_rejoin_fast(timer, expire))
+		return 0;
+
+	queue = lock_timer_queue(timer, &flag);
 	timer->expire = expire;
-	lock_timer_queue(timer, &flag);
 	if (timer->flag & TIMER_INQUEUE)
 		__timer_dequeue(timer);
+	queue->stat.nr_rejoin++;
 	unlock_timer_queue(timer, flag);
 
 	timer_add(timer);
@@ -108,13 +205,16 @@ int timer_rejoin(struct timer *timer, u64 expire)
 
 int timer_remove(struct timer *timer)
 {
+	struct cpu_timer_queue *queue;
 	unsigned long flag;
 
-	lock_timer_queue(timer, &flag);
+	queue = lock_timer_queue(timer, &flag);
 	if (unlikely(timer->flag & TIMER_FREE))
 		goto out;
-	if (timer->flag & TIMER_INQUEUE)
+	if (timer->flag & TIMER_INQUEUE) {
 		__timer_dequeue(timer);
+		queue->stat.nr_remove++;
+	}
 	timer->flag |= TIMER_FREE;
 
 out:
@@ -134,6 +234,105 @@ int synchronize_timer_del(struct timer *timer)
 	return 0;
 }
 
+/**
+ * 运行到期的定时器，调用者持有队列锁
+ * 运行期间会暂时释放锁
+ */
+static void run_one_timer(struct cpu_timer_queue *queue,
+	struct timer *timer, unsigned long *flag)
+{
+	timer->flag |= TIMER_RUNING;
+	queue->stat.nr_expire++;
+
+	smp_unlock_irqrestore(&queue->lock, *flag);
+	if (timer->flag & TIMER_OPEN_IRQ) {
+		enable_irq();
+		timer->handle(timer->data);
+		disable_irq();
+	} else
+		timer->handle(timer->data);
+	smp_lock_irqsave(&queue->lock, *flag);
+
+	if (!(timer->flag & TIMER_INQUEUE)) {
+		if (!(timer->flag & TIMER_FREE)) {
+			if (timer->flag & TIMER_PERIODIC) {
+				timer->expire += timer->period;
+				__timer_insert(queue, timer);
+			} else
+				timer->flag |= TIMER_FREE;
+		}
+	}
+	timer->flag &= ~TIMER_RUNING;
+}
+
+/**
+ * 将上一级时间轮中的一个桶重新分散到下面的级别
+ */
+static int cascade(struct cpu_timer_queue *queue, int level, int index)
+{
+	struct double_list *bucket = queue->tvn[level] + index;
+	struct timer *timer, *next;
+	struct double_list list;
+
+	list_init(&list);
+	list_combine_behind_init(bucket, &list);
+
+	list_for_each_entry_safe(timer, next, &list, list) {
+		list_del(&timer->list);
+		__wheel_insert(queue, timer);
+		queue->stat.nr_cascade++;
+	}
+
+	return index;
+}
+
+#define WHEEL_INDEX(queue, level)	\
+	(((queue)->wheel_jiffies >> (TVR_BITS + (level) * TVN_BITS)) & TVN_MASK)
+
+/**
+ * 处理时间轮中到now为止的所有桶
+ */
+static void run_wheel_timers(struct cpu_timer_queue *queue,
+	u64 now, unsigned long *flag)
+{
+	struct double_list work_list;
+	struct timer *timer;
+
+	list_init(&work_list);
+
+	while (queue->wheel_jiffies <= now) {
+		int index = queue->wheel_jiffies & TVR_MASK;
+		int level;
+		u64 cur;
+
+		/**
+		 * 第一级转完一圈，从上一级迁移一个桶下来
+		 */
+		for (level = 0; !index && level < TVN_LEVELS; level++)
+			if (cascade(queue, level, WHEEL_INDEX(queue, level)))
+				break;
+
+		cur = queue->wheel_jiffies;
+		WRITE_ONCE(queue->wheel_jiffies, cur + 1);
+		list_combine_behind_init(queue->tv1 + index, &work_list);
+
+		while (!list_is_empty(&work_list)) {
+			timer = list_first_container(&work_list, struct timer, list);
+			__timer_dequeue(timer);
+
+			/**
+			 * 到期时间被无锁推后了，重新插入
+			 */
+			if (READ_ONCE(timer->expire) > cur) {
+				__wheel_insert(queue, timer);
+				continue;
+			}
+
+			run_one_timer(queue, timer, flag);
+		}
+	}
+}
+
 /**
  * 在时钟中断中调用，运行当前CPU上的定时器
  */
@@ -147,6 +346,8 @@ static void run_local_timer(void)
 
 again:
 	smp_lock_irqsave(&queue->lock, flag);
+	run_wheel_timers(queue, now, &flag);
+
 	while (likely(!list_is_empty(&queue->timers))) {
 		timer = list_container(queue->timers.next, struct timer, list);
 
@@ -154,27 +355,7 @@ again:
 			break;
 	
 		__timer_dequeue(timer);
-		timer->flag |= TIMER_RUNING;
-
-		smp_unlock_irqrestore(&queue->lock, flag);
-		if (timer->flag & TIMER_OPEN_IRQ) {
-			enable_irq();
-			timer->handle(timer->data);
-			disable_irq();
-		} else
-			timer->handle(timer->data);
-		smp_lock_irqsave(&queue->lock, flag);
-
-		if (!(timer->flag & TIMER_INQUEUE)) {
-			if (!(timer->flag & TIMER_FREE)) {
-				if (timer->flag & TIMER_PERIODIC) {
-					timer->expire += timer->period;
-					__timer_insert(queue, timer);
-				} else
-					timer->flag |= TIMER_FREE;
-			}
-		}
-		timer->flag &= ~TIMER_RUNING;
+		run_one_timer(queue, timer, &flag);
 	}
 
 	/**
@@ -206,18 +387,37 @@ void hrtimer_interrupt(struct timer_device *dev)
 	}
 
 	run_local_timer();
+	sched_tick();
+	rcu_check_callbacks();
 
 	counter = ns_to_timer_counter(dev, NSEC_PER_SEC / HZ);
 	dev->trigger_timer(counter, dev);
 }
 
+/**
+ * 获取某个CPU上的定时器统计信息
+ */
+void get_timer_statistics(int cpu, struct timer_statistics *stat)
+{
+	*stat = cpu_timers[cpu].stat;
+	stat->nr_rejoin_fast = per_cpu_var(rejoin_fast_count, cpu);
+}
+
 void init_timer(void)
 {
-	int i;
+	int i, j, level;
 
 	for (i = 0; i < MAX_CPUS; i++) {
-		smp_lock_init(&cpu_timers[i].lock);
-		list_init(&cpu_timers[i].timers);
+		struct cpu_timer_queue *queue = &cpu_timers[i];
+
+		smp_lock_init(&queue->lock);
+		list_init(&queue->timers);
+		queue->wheel_jiffies = get_jiffies_64();
+		for (j = 0; j < TVR_SIZE; j++)
+			list_init(queue->tv1 + j);
+		for (level = 0; level < TVN_LEVELS; level++)
+			for (j = 0; j < TVN_SIZE; j++)
+				list_init(queue->tvn[level] + j);
 	}
 
 	smp_lock_init(&dummy_timer_queue.lock);
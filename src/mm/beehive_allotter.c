@@ -242,12 +242,14 @@ static void delete_from_partial(struct beehive_allotter *beehive,
 
 /**
  * 获得半满的页并锁住
+ * 顺便取出一批页面放到CPU暂存链表，减少对节点链表锁的争用
  */
 static struct page_frame *
 pick_and_lock_partial_page(struct beehive_allotter *beehive,
-						paf_t flags, int node_id)
+		struct beehive_cpu_cache *cache, paf_t flags, int node_id)
 {
-	struct page_frame *page;
+	struct page_frame *page, *next;
+	struct page_frame *first = NULL;
 	struct beehive_node *node;
 
 	if (node_id < 0)
@@ -259,27 +261,126 @@ pick_and_lock_partial_page(struct beehive_allotter *beehive,
 
 	smp_lock(&node->list_lock);
 
-	list_for_each_entry(page, &node->partial_list, beehive_list) {
+	list_for_each_entry_safe(page, next, &node->partial_list, beehive_list) {
 		/**
 		 * 避免死锁，用trylock
 		 */
-		if (beehive_page_trylock(page)) {
-			/**
-			 * 从半满链表中摘除
-			 */
-			list_del(&page->beehive_list);
-			node->partial_count--;
-			pgflag_set_beehive_incache(page);
+		if (!beehive_page_trylock(page))
+			continue;
 
-			smp_unlock(&node->list_lock);
-			return page;
+		/**
+		 * 从半满链表中摘除
+		 */
+		list_del(&page->beehive_list);
+		node->partial_count--;
+		pgflag_set_beehive_incache(page);
+
+		/**
+		 * 第一个页面作为活动页面，保持锁定返回给调用者
+		 */
+		if (!first) {
+			first = page;
+			continue;
 		}
+
+		list_insert_behind(&page->beehive_list, &cache->partial);
+		cache->partial_count++;
+		beehive_page_unlock(page);
+
+		if (cache->partial_count >= beehive->attrs.cpu_partial / 2)
+			break;
 	}
 
 	smp_unlock(&node->list_lock);
+	return first;
+}
+
+/**
+ * 从CPU暂存链表中取一个页面并锁住
+ * 暂存页面只被本CPU访问，不需要节点锁
+ */
+static struct page_frame *
+pick_and_lock_cpu_partial(struct beehive_cpu_cache *cache, int node_id)
+{
+	struct page_frame *page;
+
+	list_for_each_entry(page, &cache->partial, beehive_list) {
+		if (node_id >= 0 && node_id_of_page(page) != node_id)
+			continue;
+
+		list_del(&page->beehive_list);
+		cache->partial_count--;
+		beehive_page_lock(page);
+
+		return page;
+	}
+
 	return NULL;
 }
 
+/**
+ * 将CPU暂存的半满页面归还到节点半满链表
+ * 全空的页面，在节点半满页面足够时释放给伙伴系统
+ * 调用者已经关闭中断
+ */
+static void unfreeze_partials(struct beehive_allotter *beehive,
+				struct beehive_cpu_cache *cache)
+{
+	struct beehive_node *node = NULL;
+	struct page_frame *page, *next;
+	struct double_list discard;
+
+	list_init(&discard);
+
+	list_for_each_entry_safe(page, next, &cache->partial, beehive_list) {
+		struct beehive_node *n = beehive->nodes[node_id_of_page(page)];
+
+		list_del(&page->beehive_list);
+
+		/**
+		 * 同一节点的页面，只获取一次链表锁
+		 */
+		if (n != node) {
+			if (node)
+				smp_unlock(&node->list_lock);
+			node = n;
+			smp_lock(&node->list_lock);
+		}
+
+		/**
+		 * 释放流程先获取页面锁，再获取链表锁
+		 * 这里持有链表锁，只能trylock，失败则按正常顺序重新加锁
+		 */
+		if (!beehive_page_trylock(page)) {
+			smp_unlock(&node->list_lock);
+			beehive_page_lock(page);
+			smp_lock(&node->list_lock);
+		}
+
+		pgflag_clear_beehive_incache(page);
+		if (!page->inuse_count && node->partial_count >= MIN_PARTIAL)
+			list_insert_front(&page->beehive_list, &discard);
+		else if (page->freelist) {
+			node->partial_count++;
+			if (page->inuse_count)
+				list_insert_front(&page->beehive_list, &node->partial_list);
+			else
+				list_insert_behind(&page->beehive_list, &node->partial_list);
+		}
+
+		beehive_page_unlock(page);
+	}
+
+	if (node)
+		smp_unlock(&node->list_lock);
+	cache->partial_count = 0;
+
+	list_for_each_entry_safe(page, next, &discard, beehive_list) {
+		list_del(&page->beehive_list);
+		discard_one_beehive(beehive, page);
+	}
+}
+
 /**
  * 把beehive从CPU缓存中移除
  */
@@ -357,10 +458,16 @@ static void drain_cpu_cache(void *param)
 	struct beehive_allotter *beehive = param;
 	struct beehive_cpu_cache *cache = beehive->cpu_caches[smp_processor_id()];
 
-	if (likely(cache && cache->beehive_page)) {
+	if (!cache)
+		return;
+
+	if (likely(cache->beehive_page)) {
 		beehive_page_lock(cache->beehive_page);
 		remove_cpu_cache(beehive, cache);
 	}
+
+	if (cache->partial_count)
+		unfreeze_partials(beehive, cache);
 }
 
 static void drain_cpu_caches(struct beehive_allotter *beehive)
@@ -390,6 +497,8 @@ static void init_cpu_cache(struct beehive_allotter *beehive,
 	cache->node = 0;
 	cache->next_obj = beehive->attrs.free_offset / sizeof(void *);
 	cache->size_solid = beehive->attrs.size_solid;
+	list_init(&cache->partial);
+	cache->partial_count = 0;
 }
 
 /**
@@ -462,9 +571,18 @@ load_freelist:
 
 got_cache:
 	/**
-	 * 优先从特定NUMA节点中获得一个Partial Beehive
+	 * 优先使用本CPU暂存的半满页面
 	 */
-	page = pick_and_lock_partial_page(beehive, pafflags, node);
+	page = pick_and_lock_cpu_partial(cache, node);
+	if (page) {
+		cache->beehive_page = page;
+		goto load_freelist;
+	}
+
+	/**
+	 * 再从特定NUMA节点中获得一个Partial Beehive
+	 */
+	page = pick_and_lock_partial_page(beehive, cache, pafflags, node);
 	if (page) {
 		cache->beehive_page = page;
 		goto load_freelist;
@@ -556,12 +674,13 @@ void *beehive_alloc(struct beehive_allotter *beehive, paf_t pafflags)
 
 /*
  * beehive慢速释放流程
+ * head到tail是同一页面中的count个对象组成的链表
  */
 static void beehive_free_nocache(struct beehive_allotter *beehive,
-		struct page_frame *page, void *addr, unsigned int next_obj)
+		struct beehive_cpu_cache *cache, struct page_frame *page,
+		void **head, void **tail, int count)
 {
 	bool full;
-	void **object = (void *)addr;
 
 	beehive_page_lock(page);
 
@@ -572,10 +691,10 @@ static void beehive_free_nocache(struct beehive_allotter *beehive,
 	/**
 	 * 将对象插入到beehive的空闲链表中
 	 */
-	object[next_obj] = page->freelist;
-	page->freelist = object;
+	tail[cache->next_obj] = page->freelist;
+	page->freelist = head;
 	/* 递减对象计数 */
-	page->inuse_count--;
+	page->inuse_count -= count;
 
 	/**
 	 * 处于每CPU缓存中的页面
@@ -608,13 +727,21 @@ static void beehive_free_nocache(struct beehive_allotter *beehive,
 
 	/**
 	 * 全满变半满
+	 * 放到本CPU的暂存链表，不必获取节点链表锁
 	 */
-	if (unlikely(full))
+	if (unlikely(full)) {
+		pgflag_set_beehive_incache(page);
+		list_insert_front(&page->beehive_list, &cache->partial);
+		cache->partial_count++;
+		beehive_page_unlock(page);
+
 		/**
-		 * 将其添加到半满队列 
-		 * 注意，是放到后面，为什么?
+		 * 暂存的页面太多，批量归还给节点
 		 */
-		insert_to_partial_behind(beehive->nodes[node_id_of_page(page)], page);
+		if (unlikely(cache->partial_count > beehive->attrs.cpu_partial))
+			unfreeze_partials(beehive, cache);
+		return;
+	}
 
 out_unlock:
 	beehive_page_unlock(page);
@@ -651,11 +778,99 @@ void beehive_free(struct beehive_allotter *beehive, void *addr)
 		/**
 		 * 没办法，只能走慢速释放流程了。
 		 */
-		beehive_free_nocache(beehive, page, addr, cache->next_obj);
+		beehive_free_nocache(beehive, cache, page, object, object, 1);
 
 	local_irq_restore(flags);
 }
 
+/**
+ * 批量释放对象
+ * 属于同一页面的连续对象，只获取一次页面锁
+ */
+void beehive_free_bulk(struct beehive_allotter *beehive, size_t nr, void **p)
+{
+	struct beehive_cpu_cache *cache;
+	unsigned long flags;
+	size_t i = 0;
+
+	local_irq_save(flags);
+
+	cache = beehive->cpu_caches[smp_processor_id()];
+	while (i < nr) {
+		struct page_frame *page = linear_virt_beehive(p[i]);
+		void **head = p[i], **tail = p[i];
+		int count = 1;
+
+		BUG_ON(page->beehive != beehive);
+
+		/**
+		 * 将同一页面的连续对象串成链表
+		 */
+		for (i++; i < nr && linear_virt_beehive(p[i]) == page; i++) {
+			void **object = p[i];
+
+			object[cache->next_obj] = head;
+			head = object;
+			count++;
+		}
+
+		if (page == cache->beehive_page) {
+			tail[cache->next_obj] = cache->freelist;
+			cache->freelist = head;
+		} else
+			beehive_free_nocache(beehive, cache, page, head, tail, count);
+	}
+
+	local_irq_restore(flags);
+}
+
+/**
+ * 批量分配nr个对象，保存到p中
+ * 整个过程只关闭一次中断
+ * 成功返回nr，失败时已经分配的对象被释放，返回0
+ */
+int beehive_alloc_bulk(struct beehive_allotter *beehive, paf_t pafflags,
+	size_t nr, void **p)
+{
+	struct beehive_cpu_cache *cache;
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+
+	cache = beehive->cpu_caches[smp_processor_id()];
+	for (i = 0; i < nr; i++) {
+		void **object = cache->freelist;
+
+		if (unlikely(!object)) {
+			object = beehive_alloc_nocache(beehive, pafflags, -1, cache);
+			if (unlikely(!object))
+				goto fail;
+			/**
+			 * 慢速流程中可能打开过中断
+			 */
+			cache = beehive->cpu_caches[smp_processor_id()];
+		} else
+			cache->freelist = object[cache->next_obj];
+
+		p[i] = object;
+	}
+
+	local_irq_restore(flags);
+
+	if (unlikely(pafflags & __PAF_ZERO))
+		for (i = 0; i < nr; i++)
+			memset(p[i], 0, cache->size_solid);
+
+	return nr;
+
+fail:
+	local_irq_restore(flags);
+	beehive_free_bulk(beehive, i, p);
+
+	return 0;
+}
+
 /**
  * 查找一个满足要求的order值
  * 它能容纳指定数量的对象
@@ -793,6 +1008,24 @@ static int find_out_layout(struct beehive_allotter *beehive)
 
 }
 
+/**
+ * 确定每CPU暂存的半满页面数量
+ * 对象越大，每个页面中的对象越少，需要暂存的页面越少
+ */
+static void set_cpu_partial(struct beehive_allotter *beehive)
+{
+	int size = beehive->attrs.size_swell;
+
+	if (size >= PAGE_SIZE)
+		beehive->attrs.cpu_partial = 2;
+	else if (size >= 1024)
+		beehive->attrs.cpu_partial = 6;
+	else if (size >= 256)
+		beehive->attrs.cpu_partial = 13;
+	else
+		beehive->attrs.cpu_partial = 30;
+}
+
 static struct beehive_allotter *find_similar(size_t size,
 		size_t align, unsigned long flags, const char *name,
 		void (*ctor)(struct beehive_allotter *, void *))
@@ -955,6 +1188,8 @@ static int init_beehive(struct beehive_allotter *beehive, paf_t pafflags,
 	if (!find_out_layout(beehive))
 		goto error;
 
+	set_cpu_partial(beehive);
+
 	beehive->ref_count = 1;
 
 	if (!init_beehive_nodes(beehive, pafflags & ~PAF_DMA))
@@ -1050,6 +1285,66 @@ free_partial_list(struct beehive_allotter *beehive, struct beehive_node *node)
 	return inuse;
 }
 
+/**
+ * 收缩分配器
+ * 清空所有CPU缓存，并将全空的页面归还给伙伴系统
+ * 返回释放的页面数量
+ */
+int beehive_shrink(struct beehive_allotter *beehive)
+{
+	struct page_frame *page, *next;
+	struct double_list discard;
+	unsigned long flags;
+	int freed = 0;
+	int i;
+
+	drain_cpu_caches(beehive);
+
+	for (i = 0; i < MAX_NUMNODES; i++) {
+		struct beehive_node *node = beehive->nodes[i];
+
+		list_init(&discard);
+
+		smp_lock_irqsave(&node->list_lock, flags);
+		list_for_each_entry_safe(page, next, &node->partial_list, beehive_list) {
+			if (page->inuse_count || !beehive_page_trylock(page))
+				continue;
+
+			if (!page->inuse_count) {
+				list_del(&page->beehive_list);
+				node->partial_count--;
+				list_insert_front(&page->beehive_list, &discard);
+			}
+			beehive_page_unlock(page);
+		}
+		smp_unlock_irqrestore(&node->list_lock, flags);
+
+		list_for_each_entry_safe(page, next, &discard, beehive_list) {
+			list_del(&page->beehive_list);
+			discard_one_beehive(beehive, page);
+			freed += 1 << beehive->attrs.order;
+		}
+	}
+
+	return freed;
+}
+
+/**
+ * 收缩所有分配器，内存紧张时由页面回收调用
+ */
+int beehive_shrink_all(void)
+{
+	struct beehive_allotter *beehive;
+	int freed = 0;
+
+	mutex_lock(&beehive_lock);
+	list_for_each_entry(beehive, &all_beehives, list)
+		freed += beehive_shrink(beehive);
+	mutex_unlock(&beehive_lock);
+
+	return freed;
+}
+
 /**
  * 释放分配器描述符
  */
@@ -1,14 +1,89 @@
 #include <dim-sum/string.h>
 #include <dim-sum/mem.h>
 #include <dim-sum/cmd.h>
+#include <dim-sum/numa.h>
+#include <dim-sum/page_area.h>
+
+static char *mobility_names[MOBILITY_COUNT] = {
+	"unmovable",
+	"reclaimable",
+	"movable" };
+
+/**
+ * 显示内存区中各类页块的数量，以及每个order的碎片指数
+ */
+static void show_fragmentation(struct page_area *pg_area)
+{
+	unsigned long blocks[MOBILITY_COUNT] = {0};
+	unsigned long count, i;
+	int order, idx;
+
+	count = (pg_area->attrs.pages_swell + PAGEBLOCK_PAGES - 1)
+			>> PAGEBLOCK_ORDER;
+	for (i = 0; i < count; i++)
+		blocks[pg_area->block_mobility[i]]++;
+
+	printk("    blocks");
+	for (i = 0; i < MOBILITY_COUNT; i++)
+		printk(" %s:%lu", mobility_names[i], blocks[i]);
+	printk("\n");
+
+	printk("    frag index");
+	for (order = 0; order < PG_AREA_MAX_ORDER; order++) {
+		idx = page_area_frag_index(pg_area, order);
+		if (idx < 0)
+			printk(" -%d.%03d", -idx / 1000, -idx % 1000);
+		else
+			printk(" %d.%03d", idx / 1000, idx % 1000);
+	}
+	printk("\n");
+}
 
 int sh_showmem_cmd(int argc, char **args)
 {
+	int node_id, i;
+
 	if (argc > 2) {
 		printk("Usage: showmem/showmem\n");
 		return -1;
 	}
 
+	printk("free:%ld cache:%ld dirty:%ld writeback:%ld\n",
+		approximate_page_statistics(free),
+		approximate_page_statistics(cache),
+		approximate_page_statistics(fs_dirty),
+		approximate_page_statistics(fs_wb));
+	printk("reclaim scan:%ld free:%ld direct:%ld wakeup:%ld\n",
+		approximate_page_statistics(reclaim_scan),
+		approximate_page_statistics(reclaim_free),
+		approximate_page_statistics(reclaim_direct),
+		approximate_page_statistics(reclaim_wakeup));
+	printk("area lock count:%ld hold:%ld wait:%ld cycles\n",
+		approximate_page_statistics(area_lock_count),
+		approximate_page_statistics(area_lock_hold),
+		approximate_page_statistics(area_lock_wait));
+	printk("mobility fallback:%ld steal:%ld\n",
+		approximate_page_statistics(mobility_fallback),
+		approximate_page_statistics(mobility_steal));
+
+	for (node_id = 0; node_id < num_possible_nodes(); node_id++) {
+		struct memory_node *node = MEMORY_NODE(node_id);
+
+		printk("node %d active:%lu inactive:%lu\n", node_id,
+			node->lru.nr_active, node->lru.nr_inactive);
+		for (i = 0; i < PG_AREA_COUNT; i++) {
+			struct page_area *pg_area = node->pg_areas + i;
+
+			if (!pg_area->attrs.pages_solid)
+				continue;
+
+			printk("  %s free:%lu min:%lu low:%lu high:%lu\n",
+				pg_area->attrs.name, pg_area->free_pages,
+				pg_area->pages_min, pg_area->pages_low,
+				pg_area->pages_high);
+			show_fragmentation(pg_area);
+		}
+	}
+
 	return 0;
 }
-
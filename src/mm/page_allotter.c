@@ -14,6 +14,8 @@
 #include <dim-sum/sched.h>
 #include <dim-sum/smp_lock.h>
 #include <dim-sum/stacktrace.h>
+#include <dim-sum/swap.h>
+#include <dim-sum/timex.h>
 
 #include <asm-generic/current.h>
 #include <asm/asm-offsets.h>
@@ -89,6 +91,31 @@ void __update_page_statistics(unsigned offset, int count)
 	local_irq_restore(flags);
 }
 
+/**
+ * 获得、释放内存区锁，并统计等待、持有锁的时间
+ * 调用者已经关闭中断
+ */
+static inline cycles_t page_area_lock(struct page_area *pg_area)
+{
+	struct page_statistics_cpu *stat = &__get_cpu_var(statistics);
+	cycles_t start = get_cycles(), now;
+
+	smp_lock(&pg_area->lock);
+	now = get_cycles();
+	stat->area_lock_count++;
+	stat->area_lock_wait += now - start;
+
+	return now;
+}
+
+static inline void page_area_unlock(struct page_area *pg_area, cycles_t start)
+{
+	cycles_t hold = get_cycles() - start;
+
+	smp_unlock(&pg_area->lock);
+	__get_cpu_var(statistics).area_lock_hold += hold;
+}
+
 /*
  * 检查页面是否在某个内存区中
  */
@@ -114,6 +141,45 @@ static int page_in_pgarea(struct page_area *pg_area, struct page_frame *page)
 	return 1;
 }
 
+/**
+ * 根据分配标志，确定页面的可移动性
+ * 页面缓存使用PAF_USER分配，可以被回收线程释放，视为可移动
+ */
+static inline int paf_to_mobility(paf_t paf_mask)
+{
+	if (paf_mask & __PAF_USER)
+		return MOBILITY_MOVABLE;
+	if (paf_mask & __PAF_RECLAIMABLE)
+		return MOBILITY_RECLAIMABLE;
+
+	return MOBILITY_UNMOVABLE;
+}
+
+/**
+ * 页块按绝对页号对齐，与move_free_pages_block保持一致
+ * 内存区起始位置不在页块边界时，第一项对应的页块跨越了内存区边界
+ */
+static inline unsigned char *
+pageblock_mobility_ptr(struct page_area *pg_area, struct page_frame *page)
+{
+	unsigned long idx = (number_of_page(page) >> PAGEBLOCK_ORDER)
+		- (pg_area->attrs.pgnum_start >> PAGEBLOCK_ORDER);
+
+	return pg_area->block_mobility + idx;
+}
+
+static inline int
+get_pageblock_mobility(struct page_area *pg_area, struct page_frame *page)
+{
+	return *pageblock_mobility_ptr(pg_area, page);
+}
+
+static inline void set_pageblock_mobility(struct page_area *pg_area,
+	struct page_frame *page, int mobility)
+{
+	*pageblock_mobility_ptr(pg_area, page) = mobility;
+}
+
 static void encounter_confused_page(struct page_frame *page)
 {
 	printk(KERN_EMERG "Bad page state (in process '%s', page %p)\n",
@@ -135,7 +201,8 @@ static void encounter_confused_page(struct page_frame *page)
  * 从大的块中，切分出一小块页面
  */
 static inline void split_bricks(struct page_area *pg_area,
-	struct page_frame *page, int low, int high, struct page_free_brick *bricks)
+	struct page_frame *page, int low, int high,
+	struct page_free_brick *bricks, int mobility)
 {
 	unsigned long size = 1 << high;
 	/**
@@ -151,7 +218,7 @@ static inline void split_bricks(struct page_area *pg_area,
 		high--;
 		size >>= 1;
 		ASSERT(page_in_pgarea(pg_area, &page[size]));
-		list_insert_front(&page[size].brick_list, &bricks->free_list);
+		list_insert_front(&page[size].brick_list, &bricks->free_list[mobility]);
 		bricks->brick_count++;
 		page[size].order = high;
 		pgflag_set_buddy(&page[size]);
@@ -159,25 +226,15 @@ static inline void split_bricks(struct page_area *pg_area,
 }
 
 /**
- * 返回第一个被分配的页框的页描述符。如果内存管理区没有所请求大小的一组连续页框，则返回NULL。
- * 在指定的内存管理区中分配页框。它使用每CPU页框高速缓存来处理单一页框请求。
- * pg_area:内存管理区描述符的地址。
- * order：请求分配的内存大小的对数,0表示分配一个页框。
- * paf_flags:分配标志，如果paf_flags中的__paf_COLD标志被置位，那么页框应当从冷高速缓存中获取，否则应当从热高速缓存中获取（只对单一页框请求有意义。）
+ * 在指定可移动性的空闲链表中，取出一个2^order大小的块
+ * 调用者持有内存区锁
  */
 static struct page_frame *
-alloc_page_nocache(struct page_area *pg_area, int order, paf_t paf_flags)
+__rmqueue_smallest(struct page_area *pg_area, int order, int mobility)
 {
-	struct page_frame *page = NULL;
 	struct page_free_brick * bricks;
+	struct page_frame *page;
 	unsigned int current_order;
-	unsigned long flags;
-
-	/**
-	 * 内存请求没有得到满足，或者是因为请求跨越了几个连续页框，或者是因为被选中的页框高速缓存为空。
-	 * 调用__rmqueue函数(因为已经保护了，直接调用__rmqueue即可)从伙伴系统中分配所请求的页框。
-	 */
-	smp_lock_irqsave(&pg_area->lock, flags);
 
 	/**
 	 * 从所请求的order开始，扫描每个可用块链表进行循环搜索。
@@ -187,32 +244,187 @@ alloc_page_nocache(struct page_area *pg_area, int order, paf_t paf_flags)
 		/**
 		 * 对应的空闲块链表为空，在更大的空闲块链表中进行循环搜索。
 		 */
-		if (list_is_empty(&bricks->free_list))
+		if (list_is_empty(&bricks->free_list[mobility]))
 			continue;
 
 		/**
 		 * 运行到此，说明有合适的空闲块。
 		 */
-		page = list_container(bricks->free_list.next, struct page_frame, brick_list);
+		page = list_container(bricks->free_list[mobility].next,
+					struct page_frame, brick_list);
 		/**
 		 * 如果2^order空闲块链表中没有合适的空闲块，那么就是从更大的空闲链表中分配的。
 		 * 将剩余的空闲块分散到合适的链表中去。
 		 */
-		split_bricks(pg_area, page, order, current_order, bricks);
+		split_bricks(pg_area, page, order, current_order, bricks, mobility);
 
 		/**
 		 * 减少空闲管理区的空闲页数量。
 		 */
 		pg_area->free_pages -= 1UL << order;
 
-		break;
+		return page;
 	}
 
-	smp_unlock_irqrestore(&pg_area->lock, flags);
+	return NULL;
+}
+
+/**
+ * 请求类型的空闲块用完后，依次从这些类型中借用
+ */
+static const int mobility_fallbacks[MOBILITY_COUNT][MOBILITY_COUNT - 1] = {
+	[MOBILITY_UNMOVABLE]	= { MOBILITY_RECLAIMABLE, MOBILITY_MOVABLE },
+	[MOBILITY_RECLAIMABLE]	= { MOBILITY_UNMOVABLE, MOBILITY_MOVABLE },
+	[MOBILITY_MOVABLE]	= { MOBILITY_RECLAIMABLE, MOBILITY_UNMOVABLE },
+};
+
+/**
+ * 将页块中所有的空闲块移到指定类型的链表中
+ * 返回移动的页面数量
+ */
+static unsigned long move_free_pages_block(struct page_area *pg_area,
+	struct page_frame *page, int mobility)
+{
+	unsigned long pg_num, end_num, moved = 0;
+	struct page_frame *cur;
+
+	pg_num = number_of_page(page) & ~(PAGEBLOCK_PAGES - 1);
+	end_num = pg_num + PAGEBLOCK_PAGES;
+	pg_num = max(pg_num, pg_area->attrs.pgnum_start);
+	end_num = min(end_num,
+		pg_area->attrs.pgnum_start + pg_area->attrs.pages_swell);
+
+	while (pg_num < end_num) {
+		cur = number_to_page(pg_num);
+		if (!pgflag_buddy(cur) || pgflag_ghost(cur)
+		    || !page_in_pgarea(pg_area, cur)) {
+			pg_num++;
+			continue;
+		}
+
+		list_move_to_front(&cur->brick_list,
+			&pg_area->buddies[cur->order].free_list[mobility]);
+		pg_num += 1UL << cur->order;
+		moved += 1UL << cur->order;
+	}
+
+	return moved;
+}
+
+/**
+ * 请求类型没有空闲块了，从其他类型中借用
+ * 从最大的块开始借，尽量整块地改变页块的类型，而不是在多个页块中混杂
+ * 调用者持有内存区锁
+ */
+static struct page_frame *
+__rmqueue_fallback(struct page_area *pg_area, int order, int start_mobility)
+{
+	struct page_statistics_cpu *stat = &__get_cpu_var(statistics);
+	struct page_free_brick *bricks;
+	struct page_frame *page;
+	int current_order, mobility, i;
+
+	for (current_order = PG_AREA_MAX_ORDER - 1; current_order >= order;
+	    current_order--) {
+		bricks = pg_area->buddies + current_order;
+		for (i = 0; i < MOBILITY_COUNT - 1; i++) {
+			mobility = mobility_fallbacks[start_mobility][i];
+			if (list_is_empty(&bricks->free_list[mobility]))
+				continue;
+
+			page = list_container(bricks->free_list[mobility].next,
+						struct page_frame, brick_list);
+			stat->mobility_fallback++;
+
+			/**
+			 * 借用的块较大，或者是不可移动的分配
+			 * 将页块中其他空闲块一并搬过来，以后同类分配集中在这个页块中
+			 * 页块中大半是空闲的，就将页块改为请求的类型
+			 */
+			if (current_order >= PAGEBLOCK_ORDER / 2
+			    || start_mobility != MOBILITY_MOVABLE) {
+				if (move_free_pages_block(pg_area, page, start_mobility)
+				    >= PAGEBLOCK_PAGES / 2) {
+					set_pageblock_mobility(pg_area, page, start_mobility);
+					stat->mobility_steal++;
+				}
+				mobility = start_mobility;
+			}
+
+			split_bricks(pg_area, page, order, current_order,
+				bricks, mobility);
+			pg_area->free_pages -= 1UL << order;
+
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * 从伙伴系统中取出一个2^order大小的块
+ * 如果内存管理区没有所请求大小的一组连续页框，则返回NULL。
+ * 调用者持有内存区锁
+ */
+static struct page_frame *
+__rmqueue(struct page_area *pg_area, int order, int mobility)
+{
+	struct page_frame *page;
+
+	page = __rmqueue_smallest(pg_area, order, mobility);
+	if (page == NULL)
+		page = __rmqueue_fallback(pg_area, order, mobility);
 
 	return page;
 }
 
+/**
+ * 返回第一个被分配的页框的页描述符。如果内存管理区没有所请求大小的一组连续页框，则返回NULL。
+ * 绕过每CPU页框高速缓存，直接在伙伴系统中分配。
+ * pg_area:内存管理区描述符的地址。
+ * order：请求分配的内存大小的对数,0表示分配一个页框。
+ */
+static struct page_frame *
+alloc_page_nocache(struct page_area *pg_area, int order, paf_t paf_flags)
+{
+	struct page_frame *page;
+	unsigned long flags;
+	cycles_t start;
+
+	local_irq_save(flags);
+	start = page_area_lock(pg_area);
+	page = __rmqueue(pg_area, order, paf_to_mobility(paf_flags));
+	page_area_unlock(pg_area, start);
+	local_irq_restore(flags);
+
+	return page;
+}
+
+/**
+ * 只获得一次内存区锁，从伙伴系统中取出count个2^order大小的块
+ * 放入每CPU缓存中对应可移动性的链表，返回实际取得的块数
+ * 调用者已经关闭中断
+ */
+static int rmqueue_bulk(struct page_area *pg_area, int order, int mobility,
+	int count, struct double_list *list)
+{
+	struct page_frame *page;
+	cycles_t start;
+	int i;
+
+	start = page_area_lock(pg_area);
+	for (i = 0; i < count; i++) {
+		page = __rmqueue(pg_area, order, mobility);
+		if (page == NULL)
+			break;
+		list_insert_behind(&page->cache_list, list);
+	}
+	page_area_unlock(pg_area, start);
+
+	return i;
+}
+
 /**
  * 判断内存区中的空闲页是否满足分配要求
  */
@@ -262,47 +474,50 @@ static int pages_enough(struct page_area *pg_area,
 	return 1;
 }
 
+/**
+ * 获得内存区在某个CPU上的页面缓存
+ * 单页分为冷、热两个缓存，多页块每个order一个缓存
+ */
+static inline struct per_cpu_pages *
+cpu_page_cache(struct page_area *pg_area, int cpu, int order, int cold)
+{
+	struct per_cpu_page_cache *caches = &pg_area->page_caches[cpu];
+
+	if (order)
+		return &caches->order_cache[order - 1];
+
+	return &caches->cpu_cache[cold ? PAGE_COLD_CACHE : PAGE_HOT_CACHE];
+}
+
 static struct page_frame *
-alloc_page_cache(struct page_area *pg_area, paf_t paf_flags)
+alloc_page_cache(struct page_area *pg_area, int order, paf_t paf_flags)
 {
+	int mobility = paf_to_mobility(paf_flags);
 	struct page_frame *page = NULL;
-		struct per_cpu_pages *cache;
-		unsigned long flags;
-	int cache_type;
-
-	if (paf_flags & __PAF_COLD)
-		cache_type = PAGE_COLD_CACHE;
-	else
-		cache_type = PAGE_HOT_CACHE;
+	struct per_cpu_pages *cache;
+	struct double_list *list;
+	unsigned long flags;
 
 	/**
 	 * 检查由__paf_COLD标志所标识的内存管理区本地CPU高速缓存是否需要被补充。
 	 * 其count字段小于或者等于low
 	 */
-	cache = &pg_area->page_caches[get_cpu()].cpu_cache[cache_type];
+	cache = cpu_page_cache(pg_area, get_cpu(), order, paf_flags & __PAF_COLD);
+	list = &cache->lists[mobility];
 	local_irq_save(flags);
 	/**
-	 * 当前缓存中的页框数低于low，需要从伙伴系统中补充页框。
-	 * 调用rmqueue_bulk函数从伙伴系统中分配batch个单一页框
-	 * rmqueue_bulk反复调用__rmqueue，直到缓存的页框达到low。
+	 * 当前缓存中的页框数低于low，或者没有同类的块，需要从伙伴系统中补充页框。
+	 * 调用rmqueue_bulk函数从伙伴系统中分配batch个块
+	 * 整批页面只获得一次内存区锁
 	 */
-	if (cache->count <= cache->low) {
-		int i;
-
-		for (i = 0; i < cache->batch; ++i) {
-			page = alloc_page_nocache(pg_area, 0, paf_flags);
-			if (page == NULL)
-				break;
-			cache->count++;
-			list_insert_behind(&page->cache_list, &cache->list);
-		}
-	}
+	if (cache->count <= cache->low || list_is_empty(list))
+		cache->count += rmqueue_bulk(pg_area, order, mobility,
+						cache->batch, list);
 	/**
-	 * 如果count为正，函数从高速缓存链表中获得一个页框。
-	 * count减1
+	 * 找到了，从高速缓存链表中取下，count减1
 	 */
-	if (cache->count) {
-		page = list_container(cache->list.next, struct page_frame, cache_list);
+	if (!list_is_empty(list)) {
+		page = list_first_container(list, struct page_frame, cache_list);
 		list_del(&page->cache_list);
 		cache->count--;
 	}
@@ -332,6 +547,8 @@ __alloc_page_frames(int node_id, unsigned int paf_mask, unsigned int order)
 	struct page_area **pg_areas, *area;
 	struct task_desc *p = current;
 	struct page_frame *page;
+	int drained = 0;
+	int i;
 
 	ASSERT(order < PG_AREA_MAX_ORDER);
 	ASSERT(boot_state >= KERN_MALLOC_READY);
@@ -348,83 +565,76 @@ __alloc_page_frames(int node_id, unsigned int paf_mask, unsigned int order)
 	ASSERT(area != NULL);
 
 try_again:
-	if (order == 0) {
-		area = pg_areas[0];
-		while (area) {
-			if (!pages_enough(area, paf_mask, 0, 0)) {
-				area++;
+	if (order <= PAGE_CACHE_MAX_ORDER) {
+		for (i = 0; (area = pg_areas[i]) != NULL; i++) {
+			if (!pages_enough(area, paf_mask, order, 0)) {
 				continue;
 			}
 
-			page = alloc_page_cache(area, paf_mask);
+			page = alloc_page_cache(area, order, paf_mask);
 			if (page)
 				goto got_pg;
-
-			area++;
 		}
 
-		area = pg_areas[0];
-		while (area) {
-			if (!pages_enough(area, paf_mask, 0, 1)) {
-				area++;
+		for (i = 0; (area = pg_areas[i]) != NULL; i++) {
+			if (!pages_enough(area, paf_mask, order, 1)) {
 				continue;
 			}
 
-			page = alloc_page_cache(area, paf_mask);
+			page = alloc_page_cache(area, order, paf_mask);
 			if (page)
 				goto got_pg;
-
-			area++;
 		}
 	}else {
-		area = pg_areas[0];
 	 	/**
 	 	 * 扫描包含在后备缓冲池中的每一个内存区
 		 */
-		while (area) {
+		for (i = 0; (area = pg_areas[i]) != NULL; i++) {
 			/**
 			 * zone_watermark_ok辅助函数接收几个参数，它们决定内存管理区中空闲页框个数的阀值min。
 			 * 这是对内存管理区的第一次扫描，在第一次扫描中，阀值设置为z->pages_lo
 			 */
 			if (!pages_enough(area, paf_mask, order, 0)) {
-				area++;
 				continue;
 			}
 
 			page = alloc_page_nocache(area, order, paf_mask);
 			if (page)
 				goto got_pg;
-
-			area++;
 		}
 
-		area = pg_areas[0];
 		/**
 		 * 第一次分配失败
 		 * 看来得降低水线再试了。
 		 * 执行对内存管理区的第二次扫描
 		 */
-		while (area) {
+		for (i = 0; (area = pg_areas[i]) != NULL; i++) {
 			if (!pages_enough(area, paf_mask, order, 1)) {
-				area++;
 				continue;
 			}
 
 			page = alloc_page_nocache(area, order, paf_mask);
 			if (page)
 				goto got_pg;
-
-			area++;
 		}
 	}
 
+	/**
+	 * 空闲的块可能还留在各CPU的多页块缓存中
+	 * 回收或者失败之前，先将它们归还给伙伴系统，再试一次
+	 */
+	if (order && !drained) {
+		drain_order_caches(pool);
+		drained = 1;
+		goto try_again;
+	}
+
 	/**
 	 * 如果产生内存分配的内核控制路径不是一个中断处理程序或者可延迟函数，
 	 * 并且它试图回收页框（PF_MEMALLOC，TIF_MEMDIE标志被置位）,那么才对内存管理区进行第三次扫描。
 	 */
 	if (((p->flags & TASKFLAG_RECLAIM) || unlikely(test_process_flag(PROCFLAG_OOM_KILLED))) && !in_interrupt()) {
-		area = pg_areas[0];
-		while (area) {
+		for (i = 0; (area = pg_areas[i]) != NULL; i++) {
 			/**
 			 * 本次扫描就不调用zone_watermark_ok，它忽略阀值，这样才能从预留的页中分配页。
 			 * 允许这样做，因为是这个进程想要归还页框，那就暂借一点给它吧（呵呵，舍不得孩子套不到狼）。
@@ -432,8 +642,6 @@ try_again:
 			page = alloc_page_nocache(area, order, paf_mask);
 			if (page)
 				goto got_pg;
-
-			area++;
 		}
 
 		/**
@@ -451,10 +659,11 @@ try_again:
 		goto nopage;
 
 	/**
-	 * 被动等待内存释放
-	 * 以后这里会添加内存回收代码
+	 * 直接回收页面缓存
+	 * 什么都没有回收到，说明剩下的是脏页，等待回写线程
 	 */
-	msleep(1);
+	if (!try_to_free_pages(MEMORY_NODE(node_id), order, paf_mask))
+		msleep(1);
 	goto try_again;
 	
 	/**
@@ -470,6 +679,12 @@ nopage:
 	return NULL;
 
 got_pg:
+	/**
+	 * 空闲页面低于pages_low，唤醒后台回收线程
+	 */
+	if (area->free_pages < area->pages_low)
+		wakeup_page_reclaim(area->mem_node);
+
 	/**
 	 * 将第一个页清除一些标志，将private字段置0，并将页框引用计数器置1。
 	 */
@@ -664,7 +879,11 @@ static noinline void __free_pages_nocache (struct page_frame *page,
 	coalesced = min_buddy + page_idx;
 	coalesced->order = order;
 	pgflag_set_buddy(coalesced);
-	list_insert_front(&coalesced->brick_list, &pg_area->buddies[order].free_list);
+	/**
+	 * 回到所在页块类型的链表中
+	 */
+	list_insert_front(&coalesced->brick_list,
+		&pg_area->buddies[order].free_list[get_pageblock_mobility(pg_area, coalesced)]);
 	pg_area->buddies[order].brick_count++;
 	/**
 	 * 增加管理区的空闲页数
@@ -673,11 +892,86 @@ static noinline void __free_pages_nocache (struct page_frame *page,
 }
 
 /**
- * 释放单个页框到每CPU页面缓存。
+ * 只获得一次内存区锁，将count个块从缓存链表尾部归还给伙伴系统
+ * 各可移动性的链表轮流归还，返回实际归还的块数
+ * 调用者已经关闭中断
+ */
+static int free_pages_bulk(struct page_area *pg_area, int order, int count,
+	struct per_cpu_pages *cache)
+{
+	struct page_frame *page;
+	struct double_list *list;
+	int real_count = 0, empty = 0;
+	int mobility = 0;
+	cycles_t start;
+
+	start = page_area_lock(pg_area);
+	while (count && empty < MOBILITY_COUNT) {
+		list = &cache->lists[mobility];
+		mobility = (mobility + 1) % MOBILITY_COUNT;
+		if (list_is_empty(list)) {
+			empty++;
+			continue;
+		}
+
+		empty = 0;
+		page = list_container(list->prev, struct page_frame, cache_list);
+		list_del(&page->cache_list);
+		__free_pages_nocache(page, pg_area, order);
+		real_count++;
+		count--;
+	}
+	page_area_unlock(pg_area, start);
+
+	return real_count;
+}
+
+/**
+ * 将当前CPU上所有多页块缓存归还给伙伴系统
+ * 在IPI中运行时中断已经关闭
+ */
+static void drain_local_order_caches(void *data)
+{
+	struct page_area_pool *pool = data;
+	struct page_area *pg_area;
+	struct per_cpu_pages *cache;
+	unsigned long flags;
+	int i, order, real_count;
+
+	local_irq_save(flags);
+	for (i = 0; (pg_area = pool->pg_areas[i]) != NULL; i++)
+		for (order = 1; order <= PAGE_CACHE_MAX_ORDER; order++) {
+			cache = cpu_page_cache(pg_area, smp_processor_id(), order, 0);
+			if (!cache->count)
+				continue;
+
+			real_count = free_pages_bulk(pg_area, order,
+						cache->count, cache);
+			cache->count -= real_count;
+			sub_page_statistics(cache, real_count << order);
+		}
+	local_irq_restore(flags);
+}
+
+/**
+ * 其他CPU缓存的块无法与伙伴合并
+ * 多页分配失败之前，将所有CPU的多页块缓存归还给伙伴系统
+ * 不能发送IPI时，只归还当前CPU的缓存
+ */
+void drain_order_caches(struct page_area_pool *pool)
+{
+	if (in_interrupt() || irqs_disabled())
+		drain_local_order_caches(pool);
+	else
+		smp_call_for_all(drain_local_order_caches, pool, 1);
+}
+
+/**
+ * 释放一个2^order大小的块到每CPU页面缓存。
  * page-要释放的页面描述符地址。
- * cold-释放到热高速缓存还是冷高速缓存中
+ * cold-释放到热高速缓存还是冷高速缓存中，只对单页有意义
  */
-static void fastcall free_page_to_cache(struct page_frame *page, int cache_idx)
+static void fastcall free_page_to_cache(struct page_frame *page, int order, int cold)
 {
 	/**
 	 * 获得page所在的内存区描述符。
@@ -685,45 +979,43 @@ static void fastcall free_page_to_cache(struct page_frame *page, int cache_idx)
 	struct page_area *pg_area = page_to_pgarea(page);
 	struct per_cpu_pages *cache;
 	unsigned long flags;
-
-	ASSERT(cache_idx < CPU_CACHE_COUNT);
+	int mobility, i;
 
 	if (page_mapped_anon(page))
 		page->cache_space = NULL;
 
+	/**
+	 * 多页块在缓存中可能被再次分配，而不经过伙伴系统
+	 * 因此在这里就检查每一个页面
+	 */
+	for (i = 1; i < (1 << order); i++)
+		free_pages_check(page + i);
+
+	/**
+	 * 按块所在页块的可移动性，放入对应的链表
+	 */
+	mobility = get_pageblock_mobility(pg_area, page);
+
 	/* 缓存页面计数 */
-	inc_page_statistics(cache);
+	add_page_statistics(cache, 1 << order);
 
 	/**
 	 * 冷高速缓存还是热高速缓存??
 	 */
-	cache = &pg_area->page_caches[get_cpu()].cpu_cache[cache_idx];
+	cache = cpu_page_cache(pg_area, get_cpu(), order, cold);
 	local_irq_save(flags);
 	/**
 	 * 如果缓存的页框太多，就清除一些。
-	 * 调用free_pages_nocache将这些页面释放给伙伴系统。
+	 * 调用free_pages_bulk将这些页面释放给伙伴系统。
 	 */
 	if (cache->count >= cache->high) {
-		struct page_frame *tmp;
 		/**
-		 * 实际归还给伙伴系统的页面
-		 * 以及预期想要归还的页面
+		 * 实际归还给伙伴系统的块
 		 */
-		int real_count = 0;
-		int count = cache->batch;
-
-		/**
-		 * 获得内存区的锁
-		 */
-		smp_lock(&pg_area->lock);
-		while (!list_is_empty(&cache->list) && count--) {
-			tmp = list_container(cache->list.prev, struct page_frame, cache_list);
-			list_del(&tmp->cache_list);
-			__free_pages_nocache(tmp, pg_area, 0);
-			real_count++;
-		}
-		smp_unlock(&pg_area->lock);
+		int real_count;
 
+		real_count = free_pages_bulk(pg_area, order,
+						cache->batch, cache);
 		/*
 		 * 当然，需要更新一下count计数。
 		 */
@@ -731,13 +1023,13 @@ static void fastcall free_page_to_cache(struct page_frame *page, int cache_idx)
 		/**
 		 * 更新页面统计计数
 		 */
-		sub_page_statistics(cache, real_count);
+		sub_page_statistics(cache, real_count << order);
 	}
 	/**
 	 * 将释放的页框加到高速缓存链表上。
 	 * 并增加缓存的count字段。
 	 */
-	list_insert_front(&page->cache_list, &cache->list);
+	list_insert_front(&page->cache_list, &cache->lists[mobility]);
 	cache->count++;
 	local_irq_restore(flags);
 	put_cpu();
@@ -745,12 +1037,12 @@ static void fastcall free_page_to_cache(struct page_frame *page, int cache_idx)
 
 void fastcall free_cold_page_frame(struct page_frame *page)
 {
-	free_page_to_cache(page, PAGE_COLD_CACHE);
+	free_page_to_cache(page, 0, 1);
 }
 
 void fastcall free_hot_page_frame(struct page_frame *page)
 {
-	free_page_to_cache(page, PAGE_HOT_CACHE);
+	free_page_to_cache(page, 0, 0);
 }
 
 /**
@@ -767,13 +1059,18 @@ void free_page_frames(struct page_frame *page, unsigned int order)
 		if (order == 0)
 			/* 释放到CPU本地缓存页 */
 			free_hot_page_frame(page);
+		else if (order <= PAGE_CACHE_MAX_ORDER)
+			free_page_to_cache(page, order, 0);
 		else {
 			struct page_area *pg_area = page_to_pgarea(page);
 			unsigned long flags;
+			cycles_t start;
 
-			smp_lock_irqsave(&pg_area->lock, flags);
+			local_irq_save(flags);
+			start = page_area_lock(pg_area);
 			__free_pages_nocache(page, pg_area, order);
-			smp_unlock_irqrestore(&pg_area->lock, flags);
+			page_area_unlock(pg_area, start);
+			local_irq_restore(flags);
 		}
 	}
 }
@@ -792,6 +1089,37 @@ void free_pages_memory(unsigned long addr, unsigned int order)
 	}
 }
 
+/**
+ * 内存区在某个order上的碎片指数，放大了1000倍
+ * 有满足要求的空闲块时，分配一定能成功，返回-1000
+ * 否则接近0表示空闲内存不足，接近1000表示空闲内存充足，但是过于零碎
+ */
+int page_area_frag_index(struct page_area *pg_area, int order)
+{
+	unsigned long free_pages = 0, free_blocks = 0, suitable = 0;
+	unsigned long flags;
+	int i;
+
+	smp_lock_irqsave(&pg_area->lock, flags);
+	for (i = 0; i < PG_AREA_MAX_ORDER; i++) {
+		unsigned long count = pg_area->buddies[i].brick_count;
+
+		free_blocks += count;
+		free_pages += count << i;
+		if (i >= order)
+			suitable += count;
+	}
+	smp_unlock_irqrestore(&pg_area->lock, flags);
+
+	if (suitable)
+		return -1000;
+
+	if (!free_blocks)
+		return 0;
+
+	return 1000 - (1000 + (free_pages * 1000 >> order)) / free_blocks;
+}
+
 /**
  * 计算所有区的大小及其空洞
  */
@@ -917,6 +1245,14 @@ static void __init setup_pages(unsigned long pgnum_start, unsigned long count,
 	}
 }
 
+static void __init init_cache_lists(struct per_cpu_pages *cache)
+{
+	int i;
+
+	for (i = 0; i < MOBILITY_COUNT; i++)
+		list_init(&cache->lists[i]);
+}
+
 static void __init init_one_node(struct memory_node *node)
 {
 	unsigned long page_ref_count = 0;
@@ -942,6 +1278,17 @@ static void __init init_one_node(struct memory_node *node)
 	printk(KERN_DEBUG "On node %d totalpages: %lu/%lu\n",
 			node->attrs.node_id, node->attrs.pages_swell, node->attrs.pages_solid);
 
+	/**
+	 * 初始化页面回收使用的LRU链表
+	 */
+	smp_lock_init(&node->lru.lock);
+	list_init(&node->lru.active_list);
+	list_init(&node->lru.inactive_list);
+	node->lru.nr_active = 0;
+	node->lru.nr_inactive = 0;
+	init_waitqueue(&node->reclaim_wait);
+	node->reclaim_pending = 0;
+
 	/**
 	 * 构建NUMA节点中每个内存区描述符
 	 */
@@ -975,6 +1322,13 @@ static void __init init_one_node(struct memory_node *node)
 		pg_area->pages_reserve[PG_AREA_DMA] = 0;
 		pg_area->pages_reserve[PG_AREA_KERNEL] = size_solid / 256;
 		pg_area->pages_reserve[PG_AREA_USER] = size_solid / 32;
+		/**
+		 * 回收水线
+		 * 低于pages_low时唤醒后台回收，回收到pages_high为止
+		 */
+		pg_area->pages_min = size_solid / 256;
+		pg_area->pages_low = pg_area->pages_min * 2;
+		pg_area->pages_high = pg_area->pages_min * 3;
 
 		/**
 		 * 计算每个CPU上面缓存的页面数量
@@ -998,14 +1352,27 @@ static void __init init_one_node(struct memory_node *node)
 			cache->low = 2 * batch;
 			cache->high = 6 * batch;
 			cache->batch = 1 * batch;
-			list_init(&cache->list);
+			init_cache_lists(cache);
 
 			cache = &pg_area->page_caches[cpu].cpu_cache[PAGE_COLD_CACHE];	/* cold */
 			cache->count = 0;
 			cache->low = 0;
 			cache->high = 2 * batch;
 			cache->batch = 1 * batch;
-			list_init(&cache->list);
+			init_cache_lists(cache);
+
+			/**
+			 * 多页块缓存的页面数量与单页缓存相当
+			 * 空了才补充
+			 */
+			for (j = 1; j <= PAGE_CACHE_MAX_ORDER; j++) {
+				cache = &pg_area->page_caches[cpu].order_cache[j - 1];
+				cache->count = 0;
+				cache->low = 0;
+				cache->batch = max(batch >> j, 1UL);
+				cache->high = 4 * cache->batch;
+				init_cache_lists(cache);
+			}
 		}
 		printk(KERN_DEBUG "  %s pg_area: %lu pages, batch:%lu\n",
 				pg_area_names[i], size_solid, batch);
@@ -1039,10 +1406,23 @@ static void __init init_one_node(struct memory_node *node)
 		 * 初始化空闲块链表
 		 */
 		for (j = 0; j < PG_AREA_MAX_ORDER; j++) {
-			list_init(&pg_area->buddies[j].free_list);
+			int k;
+
+			for (k = 0; k < MOBILITY_COUNT; k++)
+				list_init(&pg_area->buddies[j].free_list[k]);
 			pg_area->buddies[j].brick_count = 0;
 		}
 
+		/**
+		 * 开始时全部页块都是可移动的
+		 * 内核分配会按需将整个页块借走
+		 */
+		table_count = ((pgnum_start + size_swell + PAGEBLOCK_PAGES - 1)
+			>> PAGEBLOCK_ORDER) - (pgnum_start >> PAGEBLOCK_ORDER);
+		pg_area->block_mobility = (unsigned char *)
+			alloc_boot_mem_permanent(table_count, 0);
+		memset(pg_area->block_mobility, MOBILITY_MOVABLE, table_count);
+
 		pgnum_start += size_swell;
 	}
 }
@@ -217,6 +217,11 @@ int add_to_page_cache(struct page_frame *page, struct file_cache_space *space,
 		}
 		smp_unlock_irq(&space->tree_lock);
 		radix_tree_preload_end();
+		/**
+		 * 加入LRU，以便内存紧张时回收
+		 */
+		if (!error)
+			lru_cache_add(page);
 	}
 
 	return error;
@@ -334,6 +339,14 @@ __read_cache_page(struct file_cache_space *space,
 	if (IS_ERR(page))
 		return ERR_PTR(-ENOMEM);
 
+	/**
+	 * 页面已经在缓存中并且是最新的，不用再读磁盘
+	 */
+	if (pgflag_uptodate(page)) {
+		unlock_page(page);
+		return page;
+	}
+
 	err = space->ops->readpage(data, page);
 	if (err < 0) {
 		loosen_page_cache(page);
@@ -456,6 +469,7 @@ do_read(struct file_cache_space *space, struct file_ra_state *_ra,
 	struct file_node *fnode = space->fnode;
 	struct file_ra_state ra = *_ra;
 	unsigned long end_index;
+	unsigned long last_index;
 	unsigned long index;
 	unsigned long offset;
 	loff_t file_size;
@@ -466,6 +480,11 @@ do_read(struct file_cache_space *space, struct file_ra_state *_ra,
 	 */
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	offset = *ppos & ~PAGE_CACHE_MASK;
+	/**
+	 * 本次请求的结束页面，用于确定预读大小
+	 */
+	last_index = (*ppos + desc->remain_count + PAGE_CACHE_SIZE - 1)
+			>> PAGE_CACHE_SHIFT;
 
 	file_size = fnode_size(fnode);
 	if (!file_size)
@@ -496,12 +515,49 @@ do_read(struct file_cache_space *space, struct file_ra_state *_ra,
 		}
 		bytes = bytes - offset;
 
+		page = pgcache_find_page(space, index);
+		if (!page) {
+			/**
+			 * 缓存缺失，同步预读包含该页在内的一批页面
+			 */
+			page_cache_sync_readahead(space, &ra, file,
+						index, last_index - index);
+			page = pgcache_find_page(space, index);
+			if (unlikely(!page))
+				goto no_cached_page;
+		}
+
+		/**
+		 * 读到了标记页，在当前窗口读完之前提交下一个窗口
+		 */
+		if (pgflag_readahead(page))
+			page_cache_async_readahead(space, &ra, file,
+						page, index, last_index - index);
+
+		if (!pgflag_uptodate(page)) {
+			wait_on_page_locked(page);
+			/**
+			 * 预读失败，或者页面被截断了
+			 * 回到逐页同步读取
+			 */
+			if (!pgflag_uptodate(page)) {
+				loosen_page_cache(page);
+				goto no_cached_page;
+			}
+		}
+		mark_page_accessed(page);
+		goto page_ok;
+
+no_cached_page:
 		page = read_cache_page(space, index, file);
 		if (IS_ERR(page)) {
 			desc->error = PTR_ERR(page);
 			goto out;
 		}
 
+page_ok:
+		ra.prev_page = index;
+
 		/**
 		 * 将数据复制给用户，返回值是成功复制的数量
 		 */
@@ -540,6 +596,11 @@ out:
  * seg_count:	缓冲区数组长度。
  * ppos:		文件当前指针变量。
  */
+static ssize_t
+generic_file_direct_IO(int rw, struct async_io_desc *aio,
+	const struct io_segment *io_seg, unsigned long seg_count,
+	loff_t offset, size_t count);
+
 static ssize_t __generic_file_aio_read(struct async_io_desc *aio,
 	const struct io_segment *io_seg, unsigned long seg_count, loff_t *ppos)
 {
@@ -567,6 +628,23 @@ static ssize_t __generic_file_aio_read(struct async_io_desc *aio,
 	if (count == 0)
 		return 0;
 
+	/**
+	 * 直接IO，绕过页面缓存
+	 */
+	if (file->flags & O_DIRECT) {
+		loff_t pos = *ppos;
+
+		if (pos >= fnode_size(file->cache_space->fnode))
+			return 0;
+
+		ret = generic_file_direct_IO(READ, aio, io_seg, seg_count,
+					pos, count);
+		if (ret > 0)
+			*ppos = pos + ret;
+
+		return ret;
+	}
+
 	/**
 	 * 遍历处理每一个段
 	 */
@@ -914,6 +992,32 @@ static int writeback_submit_wait_data(struct file_cache_space *space)
 	return ret;
 }
 
+/**
+ * 在用户缓冲区与磁盘之间直接传输数据
+ * 先回写缓存中的脏页，保证读到最新的数据，也不会被随后的回写覆盖
+ * 写入之后，缓存中对应的页面已经过时，将其丢弃
+ */
+static ssize_t
+generic_file_direct_IO(int rw, struct async_io_desc *aio,
+	const struct io_segment *io_seg, unsigned long seg_count,
+	loff_t offset, size_t count)
+{
+	struct file_cache_space *space = aio->file->cache_space;
+	ssize_t ret;
+
+	ret = writeback_submit_wait_data(space);
+	if (ret)
+		return ret;
+
+	ret = space->ops->direct_IO(rw, aio, io_seg, offset, seg_count);
+
+	if (rw == WRITE && space->page_count)
+		invalidate_mapping_pages(space, offset >> PAGE_CACHE_SHIFT,
+			(offset + count - 1) >> PAGE_CACHE_SHIFT);
+
+	return ret;
+}
+
 /**
  * 将特定文件节点的脏数据同步到磁盘
  * 文件写操作可以调用此函数刷新数据到磁盘
@@ -1183,6 +1287,21 @@ __aio_write(struct async_io_desc *aio, const struct io_segment *io_seg,
 	 */
 	fnode_update_time(fnode, 1);
 
+	if (unlikely(file->flags & O_DIRECT)) {
+		written = generic_file_direct_IO(WRITE, aio, io_seg, seg_count,
+						pos, count);
+		if (written > 0)
+			*ppos = pos + written;
+		if (written < 0 || written == count)
+			goto out;
+
+		/**
+		 * 没有全部写入，剩余部分通过页面缓存写入
+		 */
+		pos += written;
+		count -= written;
+	}
+
 	/**
 	 * 循环处理，以更新写操作中的所有文件页。
 	 */
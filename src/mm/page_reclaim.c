@@ -0,0 +1,390 @@
+#include <dim-sum/beehive.h>
+#include <dim-sum/block_buf.h>
+#include <dim-sum/delay.h>
+#include <dim-sum/fs.h>
+#include <dim-sum/mem.h>
+#include <dim-sum/mm.h>
+#include <dim-sum/page_area.h>
+#include <dim-sum/pagemap.h>
+#include <dim-sum/sched.h>
+#include <dim-sum/swap.h>
+#include <dim-sum/wait.h>
+#include <dim-sum/writeback.h>
+#include <kapi/dim-sum/task.h>
+
+/**
+ * 回收优先级，每一轮扫描LRU的1/(2^priority)
+ * 优先级降到0时扫描整个LRU
+ */
+#define DEF_PRIORITY	12
+
+/**
+ * 本次回收的控制参数
+ */
+struct reclaim_control {
+	/**
+	 * 需要回收的页面数量
+	 */
+	unsigned long nr_to_reclaim;
+	/**
+	 * 已经回收的页面数量
+	 */
+	unsigned long nr_reclaimed;
+	/**
+	 * 扫描过程中遇到的脏页
+	 * 回收结束后据此启动回写
+	 */
+	unsigned long nr_dirty;
+	/**
+	 * 分配标志，决定能否进入文件系统
+	 */
+	unsigned int paf_mask;
+};
+
+/**
+ * 页面仍有用户时增加引用
+ * 引用计数为0的页面正在被释放，由释放者将其从LRU中摘除
+ */
+static inline int hold_page_unless_zero(struct page_frame *page)
+{
+	return accurate_add_ifneq(&page->ref_count, 1, -1);
+}
+
+/**
+ * 从src链表尾部摘取最多nr_to_scan个页面到dst
+ * 摘下的页面持有一个引用，并清除了PG_lru标志
+ * 调用者持有lru->lock
+ */
+static int isolate_lru_pages(int nr_to_scan, struct double_list *src,
+	struct double_list *dst, int *scanned)
+{
+	int nr_taken = 0;
+	int scan;
+
+	for (scan = 0; scan < nr_to_scan && !list_is_empty(src); scan++) {
+		struct page_frame *page;
+
+		page = list_last_container(src, struct page_frame, lru);
+		if (!hold_page_unless_zero(page)) {
+			list_move_to_front(&page->lru, src);
+			continue;
+		}
+
+		pgflag_test_clear_lru(page);
+		list_move_to_front(&page->lru, dst);
+		nr_taken++;
+	}
+
+	*scanned = scan;
+	return nr_taken;
+}
+
+/**
+ * 将隔离的页面放回LRU，并释放隔离时持有的引用
+ */
+static void putback_lru_page(struct page_lru *lru, struct page_frame *page)
+{
+	unsigned long flags;
+
+	smp_lock_irqsave(&lru->lock, flags);
+	set_page_lru(page);
+	if (pgflag_active(page)) {
+		list_insert_front(&page->lru, &lru->active_list);
+		lru->nr_active++;
+	} else {
+		list_insert_front(&page->lru, &lru->inactive_list);
+		lru->nr_inactive++;
+	}
+	smp_unlock_irqrestore(&lru->lock, flags);
+
+	/**
+	 * 如果这是最后一个引用，loosen_page会将其从LRU中摘除并释放
+	 */
+	loosen_page(page);
+}
+
+/**
+ * 尝试回收一个非活动页面
+ * 返回1表示页面已被释放
+ */
+static int reclaim_one_page(struct page_frame *page, struct reclaim_control *rc)
+{
+	struct file_cache_space *space;
+
+	if (pgflag_test_and_set_locked(page))
+		return 0;
+
+	space = page->cache_space;
+	/**
+	 * 页面已经被截断，随着最后一个引用释放
+	 */
+	if (!space)
+		goto keep_locked;
+
+	/**
+	 * 映射到用户态的页面，以及最近被访问过的页面
+	 * 都移回活动链表
+	 */
+	if (page_mapped_user(page) || pgflag_test_clear_referenced(page)) {
+		set_page_active(page);
+		goto keep_locked;
+	}
+
+	if (pgflag_writeback(page))
+		goto keep_locked;
+
+	/**
+	 * 脏页交给回写线程，写回后下一轮再回收
+	 */
+	if (pgflag_dirty(page) || pgflag_pending_dirty(page)) {
+		rc->nr_dirty++;
+		goto keep_locked;
+	}
+
+	/**
+	 * 释放块缓冲区可能进入文件系统
+	 */
+	if (pgflag_private(page) && !(rc->paf_mask & __PAF_FS))
+		goto keep_locked;
+
+	/**
+	 * 除了页面缓存和我们，还有其他用户
+	 */
+	if (page_ref_count(page) > 2)
+		goto keep_locked;
+
+	if (!invalidate_complete_page(space, page))
+		goto keep_locked;
+
+	unlock_page(page);
+	return 1;
+
+keep_locked:
+	unlock_page(page);
+	return 0;
+}
+
+/**
+ * 扫描非活动链表尾部的nr_to_scan个页面，回收其中的干净页面
+ */
+static void shrink_inactive_list(struct page_lru *lru,
+	int nr_to_scan, struct reclaim_control *rc)
+{
+	struct page_frame *page, *next;
+	struct double_list page_list;
+	int nr_taken, scanned;
+
+	list_init(&page_list);
+
+	smp_lock_irq(&lru->lock);
+	nr_taken = isolate_lru_pages(nr_to_scan, &lru->inactive_list,
+					&page_list, &scanned);
+	lru->nr_inactive -= nr_taken;
+	smp_unlock_irq(&lru->lock);
+
+	add_page_statistics(reclaim_scan, scanned);
+
+	list_for_each_entry_safe(page, next, &page_list, lru) {
+		list_del(&page->lru);
+		if (reclaim_one_page(page, rc)) {
+			/**
+			 * 页面已经从页面缓存中删除
+			 * 释放隔离时持有的最后一个引用
+			 */
+			loosen_page(page);
+			rc->nr_reclaimed++;
+			inc_page_statistics(reclaim_free);
+			continue;
+		}
+
+		putback_lru_page(lru, page);
+	}
+}
+
+/**
+ * 将活动链表尾部最近没有被访问的页面移到非活动链表
+ */
+static void refill_inactive_list(struct page_lru *lru, int nr_to_scan)
+{
+	struct page_frame *page, *next;
+	struct double_list page_list;
+	int nr_taken, scanned;
+
+	list_init(&page_list);
+
+	smp_lock_irq(&lru->lock);
+	nr_taken = isolate_lru_pages(nr_to_scan, &lru->active_list,
+					&page_list, &scanned);
+	lru->nr_active -= nr_taken;
+	smp_unlock_irq(&lru->lock);
+
+	list_for_each_entry_safe(page, next, &page_list, lru) {
+		list_del(&page->lru);
+		if (!page_mapped_user(page) &&
+		    !pgflag_test_clear_referenced(page))
+			clear_page_active(page);
+
+		putback_lru_page(lru, page);
+	}
+}
+
+/**
+ * 在节点上回收nr_to_reclaim个页面
+ * 从低到高逐步提高扫描比例，直到回收足够的页面
+ * 返回实际回收的页面数
+ */
+unsigned long shrink_memory_node(struct memory_node *node,
+	unsigned long nr_to_reclaim, unsigned int paf_mask)
+{
+	struct page_lru *lru = &node->lru;
+	struct reclaim_control rc = {
+		.nr_to_reclaim = nr_to_reclaim,
+		.nr_reclaimed = 0,
+		.nr_dirty = 0,
+		.paf_mask = paf_mask,
+	};
+	int priority;
+
+	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
+		unsigned long nr_scan;
+
+		nr_scan = (lru->nr_active + lru->nr_inactive) >> priority;
+		if (nr_scan < RECLAIM_BATCH)
+			nr_scan = RECLAIM_BATCH;
+
+		while (nr_scan) {
+			int batch = min(nr_scan, (unsigned long)RECLAIM_BATCH);
+
+			/**
+			 * 保持非活动链表不少于活动链表
+			 */
+			if (lru->nr_inactive < lru->nr_active)
+				refill_inactive_list(lru, batch);
+
+			if (!lru->nr_inactive)
+				break;
+
+			shrink_inactive_list(lru, batch, &rc);
+			nr_scan -= batch;
+
+			if (rc.nr_reclaimed >= rc.nr_to_reclaim)
+				goto out;
+		}
+
+		if (!lru->nr_inactive && !lru->nr_active)
+			break;
+	}
+
+out:
+	/**
+	 * 遇到了脏页，让回写线程写回它们
+	 * 下一次回收就可以释放了
+	 */
+	if (rc.nr_dirty && (paf_mask & __PAF_IO))
+		kick_writeback_task(rc.nr_dirty);
+
+	return rc.nr_reclaimed;
+}
+
+/**
+ * 分配路径上的直接回收
+ * 在当前任务的上下文中回收页面，以满足order阶的分配
+ */
+unsigned long try_to_free_pages(struct memory_node *node,
+	unsigned int order, unsigned int paf_mask)
+{
+	struct task_desc *tsk = current;
+	unsigned long reclaimed;
+
+	/**
+	 * 回收过程中的内存分配可以动用保留页面
+	 * 并且不会递归进入回收
+	 */
+	tsk->flags |= TASKFLAG_RECLAIM;
+	inc_page_statistics(reclaim_direct);
+	reclaimed = shrink_memory_node(node,
+			max(RECLAIM_BATCH, 1 << order), paf_mask);
+	tsk->flags &= ~TASKFLAG_RECLAIM;
+
+	return reclaimed;
+}
+
+/**
+ * 节点中是否有内存区的空闲页面低于水线
+ */
+static bool node_below_watermark(struct memory_node *node, bool high)
+{
+	int i;
+
+	for (i = 0; i < PG_AREA_COUNT; i++) {
+		struct page_area *pg_area = node->pg_areas + i;
+		unsigned long mark;
+
+		if (!pg_area->attrs.pages_solid)
+			continue;
+
+		mark = high ? pg_area->pages_high : pg_area->pages_low;
+		if (pg_area->free_pages < mark)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * 空闲页面低于pages_low时唤醒后台回收线程
+ */
+void wakeup_page_reclaim(struct memory_node *node)
+{
+	if (node->reclaim_pending || !node_below_watermark(node, false))
+		return;
+
+	node->reclaim_pending = 1;
+	smp_mb();
+	inc_page_statistics(reclaim_wakeup);
+	wake_up(&node->reclaim_wait);
+}
+
+/**
+ * 后台回收线程
+ * 被唤醒后一直回收，直到所有内存区的空闲页面高于pages_high
+ */
+static int page_reclaim_task(void *data)
+{
+	struct memory_node *node = data;
+
+	current->flags |= TASKFLAG_RECLAIM;
+
+	while (1) {
+		cond_wait(node->reclaim_wait, node->reclaim_pending);
+
+		while (node_below_watermark(node, true)) {
+			if (shrink_memory_node(node, RECLAIM_BATCH * 4, PAF_KERNEL))
+				continue;
+
+			/**
+			 * 页面缓存中没有可以回收的页面了
+			 * 将beehive中的全空页面归还给伙伴系统
+			 * 仍然不够就等待回写线程清理脏页
+			 */
+			beehive_shrink_all();
+			msleep(100);
+			if (!node_below_watermark(node, false))
+				break;
+		}
+
+		node->reclaim_pending = 0;
+		smp_mb();
+	}
+
+	return 0;
+}
+
+void init_page_reclaim(void)
+{
+	int node_id;
+
+	for (node_id = 0; node_id < num_possible_nodes(); node_id++)
+		create_process(page_reclaim_task, MEMORY_NODE(node_id),
+				"page_reclaim", 5);
+}
@@ -21,4 +21,275 @@ file_ra_state_init(struct file_ra_state *ra, struct file_cache_space *space)
 {
 	ra->max_ra_pages = space->blkdev_infrast->max_ra_pages;
 	ra->prev_page = -1;
+	ra->start = 0;
+	ra->size = 0;
+	ra->async_size = 0;
+}
+
+/**
+ * 第一次顺序读时的窗口大小
+ * 请求较小时放大4倍，较大时放大2倍
+ */
+static unsigned long get_init_ra_size(unsigned long size, unsigned long max)
+{
+	unsigned long newsize = size > 1 ? 1UL << fls_long(size - 1) : 1;
+
+	if (newsize <= max / 32)
+		newsize = newsize * 4;
+	else if (newsize <= max / 4)
+		newsize = newsize * 2;
+	else
+		newsize = max;
+
+	return newsize;
+}
+
+/**
+ * 顺序流命中后，窗口逐步增长到max_ra_pages
+ */
+static unsigned long get_next_ra_size(struct file_ra_state *ra,
+	unsigned long max)
+{
+	unsigned long cur = ra->size;
+	unsigned long newsize;
+
+	if (cur < max / 16)
+		newsize = 4 * cur;
+	else
+		newsize = 2 * cur;
+
+	return min(newsize, max);
+}
+
+/**
+ * 查找index之后第一个不在缓存中的页面
+ * 最多查找max个页面，都在缓存中则返回index + max
+ */
+static pgoff_t pgcache_next_hole(struct file_cache_space *space,
+	pgoff_t index, unsigned long max)
+{
+	unsigned long i;
+
+	smp_lock_irq(&space->tree_lock);
+	for (i = 0; i < max; i++) {
+		if (!radix_tree_lookup(&space->page_tree, index))
+			break;
+		index++;
+	}
+	smp_unlock_irq(&space->tree_lock);
+
+	return index;
+}
+
+/**
+ * 一次性提交链表中的所有页面
+ * 文件系统没有readpages方法时，逐页调用readpage
+ */
+static void read_pages(struct file_cache_space *space, struct file *filp,
+	struct double_list *pages, unsigned nr_pages)
+{
+	struct page_frame *page;
+	unsigned i;
+
+	if (space->ops->readpages) {
+		space->ops->readpages(filp, space, pages, nr_pages);
+		goto out;
+	}
+
+	for (i = 0; i < nr_pages; i++) {
+		page = list_last_container(pages, struct page_frame, pgcache_list);
+		list_del(&page->pgcache_list);
+		if (!add_to_page_cache(page, space, page->index, PAF_KERNEL))
+			space->ops->readpage(filp, page);
+		loosen_page_cache(page);
+	}
+
+out:
+	/**
+	 * 请求都已进入块设备队列，推动设备开始处理
+	 */
+	if (space->blkdev_infrast->push_io)
+		space->blkdev_infrast->push_io(space->blkdev_infrast, NULL);
+}
+
+/**
+ * 为[offset, offset + nr_to_read)中不在缓存里的页面分配页
+ * 并批量提交读请求，不等待IO完成
+ * 第nr_to_read - lookahead_size个页面被设置为预读标记页
+ * 返回提交的页面数
+ */
+static int
+__do_page_cache_readahead(struct file_cache_space *space, struct file *filp,
+	pgoff_t offset, unsigned long nr_to_read, unsigned long lookahead_size)
+{
+	struct file_node *fnode = space->fnode;
+	struct page_frame *page;
+	unsigned long end_index;
+	struct double_list page_pool;
+	loff_t file_size;
+	int page_idx;
+	int ret = 0;
+
+	file_size = fnode_size(fnode);
+	if (file_size == 0)
+		goto out;
+
+	list_init(&page_pool);
+	end_index = ((file_size - 1) >> PAGE_CACHE_SHIFT);
+
+	for (page_idx = 0; page_idx < nr_to_read; page_idx++) {
+		pgoff_t page_offset = offset + page_idx;
+
+		if (page_offset > end_index)
+			break;
+
+		page = pgcache_find_page(space, page_offset);
+		if (page) {
+			loosen_page_cache(page);
+			continue;
+		}
+
+		page = page_cache_alloc_cold(space);
+		if (!page)
+			break;
+		page->index = page_offset;
+		list_insert_front(&page->pgcache_list, &page_pool);
+		if (page_idx == nr_to_read - lookahead_size)
+			set_page_readahead(page);
+		ret++;
+	}
+
+	if (ret)
+		read_pages(space, filp, &page_pool, ret);
+	BUG_ON(!list_is_empty(&page_pool));
+out:
+	return ret;
+}
+
+static unsigned long ra_submit(struct file_ra_state *ra,
+	struct file_cache_space *space, struct file *filp)
+{
+	return __do_page_cache_readahead(space, filp,
+				ra->start, ra->size, ra->async_size);
+}
+
+/**
+ * 按需预读
+ * 识别顺序流并维护预读窗口，随机读只读取请求的页面
+ */
+static unsigned long
+ondemand_readahead(struct file_cache_space *space, struct file_ra_state *ra,
+	struct file *filp, bool hit_readahead_marker, pgoff_t offset,
+	unsigned long req_size)
+{
+	unsigned long max = ra->max_ra_pages;
+
+	/**
+	 * 从文件头开始读
+	 */
+	if (!offset)
+		goto initial_readahead;
+
+	/**
+	 * 正好读到了上一个窗口的标记页或者窗口末尾
+	 * 将窗口向前推进并放大
+	 */
+	if (offset == (ra->start + ra->size - ra->async_size) ||
+	    offset == (ra->start + ra->size)) {
+		ra->start += ra->size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		goto readit;
+	}
+
+	/**
+	 * 命中了标记页，但预读状态不匹配
+	 * 可能是多个任务交错读同一文件
+	 * 从缓存中第一个空洞处重新建立窗口
+	 */
+	if (hit_readahead_marker) {
+		pgoff_t start;
+
+		start = pgcache_next_hole(space, offset + 1, max);
+		if (start - offset > max)
+			return 0;
+
+		ra->start = start;
+		ra->size = start - offset;
+		ra->size += req_size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		goto readit;
+	}
+
+	/**
+	 * 大的请求，直接按请求大小读取
+	 */
+	if (req_size > max)
+		goto initial_readahead;
+
+	/**
+	 * 紧接上一次读的位置，是一个新的顺序流
+	 */
+	if (offset - ra->prev_page <= 1UL)
+		goto initial_readahead;
+
+	/**
+	 * 随机读，不预读
+	 */
+	return __do_page_cache_readahead(space, filp, offset, req_size, 0);
+
+initial_readahead:
+	ra->start = offset;
+	ra->size = get_init_ra_size(req_size, max);
+	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
+
+readit:
+	return ra_submit(ra, space, filp);
+}
+
+/**
+ * 同步预读，页面不在缓存中时调用
+ * offset:	缺失页面的索引
+ * req_size:	本次读请求还需要的页面数
+ */
+void page_cache_sync_readahead(struct file_cache_space *space,
+	struct file_ra_state *ra, struct file *filp,
+	pgoff_t offset, unsigned long req_size)
+{
+	/**
+	 * 禁止了预读
+	 */
+	if (!ra->max_ra_pages)
+		return;
+
+	ondemand_readahead(space, ra, filp, false, offset, req_size);
+}
+
+/**
+ * 异步预读，读到预读标记页时调用
+ * 在当前窗口被读完之前，提前提交下一个窗口
+ */
+void page_cache_async_readahead(struct file_cache_space *space,
+	struct file_ra_state *ra, struct file *filp,
+	struct page_frame *page, pgoff_t offset, unsigned long req_size)
+{
+	if (!ra->max_ra_pages)
+		return;
+
+	/**
+	 * 标记页正在回写，说明它已不是刚读入的页面
+	 */
+	if (pgflag_writeback(page))
+		return;
+
+	clear_page_readahead(page);
+
+	/**
+	 * 设备读拥塞时推迟预读
+	 */
+	if (blkdev_read_congested(space->blkdev_infrast))
+		return;
+
+	ondemand_readahead(space, ra, filp, true, offset, req_size);
 }
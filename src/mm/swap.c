@@ -1,17 +1,47 @@
 #include <dim-sum/mm.h>
+#include <dim-sum/page_area.h>
 #include <dim-sum/pagemap.h>
 #include <dim-sum/pagevec.h>
 #include <dim-sum/percpu.h>
 #include <dim-sum/swap.h>
 
-/* TO-DO */
 void hold_page(struct page_frame *page)
 {
 	accurate_inc(&page->ref_count);
 }
 
+static inline struct page_lru *page_lru(struct page_frame *page)
+{
+	return &page_to_pgarea(page)->mem_node->lru;
+}
+
+static inline void
+del_page_from_lru(struct page_lru *lru, struct page_frame *page)
+{
+	list_del(&page->lru);
+	if (pgflag_active(page)) {
+		clear_page_active(page);
+		lru->nr_active--;
+	} else
+		lru->nr_inactive--;
+}
+
 static void __page_cache_release(struct page_frame *page)
 {
+	/**
+	 * 最后一个引用已经释放
+	 * 回收线程不会再从LRU中摘取该页，由我们将其摘除
+	 */
+	if (pgflag_lru(page)) {
+		struct page_lru *lru = page_lru(page);
+		unsigned long flags;
+
+		smp_lock_irqsave(&lru->lock, flags);
+		if (pgflag_test_clear_lru(page))
+			del_page_from_lru(lru, page);
+		smp_unlock_irqrestore(&lru->lock, flags);
+	}
+
 	if (page_ref_count(page) == 0)
 		free_hot_page_frame(page);
 }
@@ -22,7 +52,70 @@ void loosen_page(struct page_frame *page)
 		__page_cache_release(page);
 }
 
+/**
+ * 批量释放页面引用
+ */
+void release_pages(struct page_frame **pages, int nr, int cold)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		loosen_page(pages[i]);
+}
+
+void __pagevec_release(struct pagevec *pvec)
+{
+	release_pages(pvec->pages, pagevec_count(pvec), pvec->cold);
+	pagevec_init(pvec, pvec->cold);
+}
+
+/**
+ * 将新加入页面缓存的页面放到非活动链表头
+ */
+void lru_cache_add(struct page_frame *page)
+{
+	struct page_lru *lru = page_lru(page);
+	unsigned long flags;
+
+	smp_lock_irqsave(&lru->lock, flags);
+	if (!pgflag_lru(page)) {
+		set_page_lru(page);
+		list_insert_front(&page->lru, &lru->inactive_list);
+		lru->nr_inactive++;
+	}
+	smp_unlock_irqrestore(&lru->lock, flags);
+}
+
+/**
+ * 将非活动页面移到活动链表
+ */
+static void activate_page(struct page_frame *page)
+{
+	struct page_lru *lru = page_lru(page);
+	unsigned long flags;
+
+	smp_lock_irqsave(&lru->lock, flags);
+	if (pgflag_lru(page) && !pgflag_active(page)) {
+		list_del(&page->lru);
+		lru->nr_inactive--;
+		set_page_active(page);
+		list_insert_front(&page->lru, &lru->active_list);
+		lru->nr_active++;
+	}
+	smp_unlock_irqrestore(&lru->lock, flags);
+}
+
+/**
+ * 页面被访问
+ * 第一次访问只设置PG_referenced
+ * 再次访问时将页面移到活动链表
+ */
 void fastcall mark_page_accessed(struct page_frame *page)
 {
-	/* TO-DO */
+	if (!pgflag_active(page) && pgflag_referenced(page) &&
+	    pgflag_lru(page)) {
+		activate_page(page);
+		clear_page_referenced(page);
+	} else if (!pgflag_referenced(page))
+		set_page_referenced(page);
 }
@@ -6,8 +6,9 @@
 
 /**
  * 使页面缓存失效
+ * 调用者持有页面锁
  */
-static int
+int
 invalidate_complete_page(struct file_cache_space *mapping, struct page_frame *page)
 {
 	if (page->cache_space!= mapping)
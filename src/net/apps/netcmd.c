@@ -10,6 +10,8 @@
 #include <dim-sum/cmd.h>
 #include <dim-sum/delay.h>
 #include <dim-sum/sched.h>
+#include <dim-sum/timex.h>
+#include <clocksource/arm_arch_timer.h>
 
 #include "../netdev.h"
 
@@ -221,6 +223,129 @@ int net_tcptest_cmd(int argc, char **args)
 	return 0;
 }
 
+#define ECHO_PORT		7
+#define BENCH_DEF_COUNT	1000
+#define BENCH_DEF_SIZE	64
+
+static char bench_buf[PKT_LEN_2];
+
+static unsigned long cycles_to_us(cycles_t cycles)
+{
+	return (unsigned long)(cycles * 1000000ULL / arch_timer_get_rate());
+}
+
+/**
+ * 网络收发性能测试
+ * 对端需要运行UDP echo服务，例如在tap0上运行：
+ *	socat UDP-LISTEN:7,fork EXEC:cat
+ * 第一阶段逐个收发，测量往返时延
+ * 第二阶段连续发送，测量吞吐量
+ */
+static int udp_bench_client(char *svrip, int count, int size)
+{
+	struct sockaddr_in sockaddr;
+	struct in_addr ipaddr;
+	cycles_t start, rtt, min = ~0ULL, max = 0, sum = 0;
+	int fd, i, ret, timeout = 1000;
+	int received = 0, lost = 0;
+
+	if (inet_aton((const char *)svrip, &ipaddr) == 0) {
+		printk("Invalid svrip %s\n", svrip);
+		return -1;
+	}
+
+	memset(&sockaddr, 0, sizeof(struct sockaddr_in));
+	sockaddr.sin_family = AF_INET;
+	sockaddr.sin_port = htons(ECHO_PORT);
+	sockaddr.sin_addr.s_addr = ipaddr.s_addr;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		printk("Create socket failed!\n");
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	if (connect(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0) {
+		printk("connect socket failed\n");
+		goto end;
+	}
+
+	memset(bench_buf, 0x5a, size);
+
+	for (i = 0; i < count; i++) {
+		start = get_cycles();
+		if (send(fd, bench_buf, size, 0) != size)
+			break;
+		ret = recv(fd, bench_buf, size, 0);
+		if (ret <= 0) {
+			lost++;
+			continue;
+		}
+
+		rtt = get_cycles() - start;
+		sum += rtt;
+		if (rtt < min)
+			min = rtt;
+		if (rtt > max)
+			max = rtt;
+		received++;
+	}
+
+	if (received)
+		printk("latency: %d/%d replies, rtt min/avg/max = %lu/%lu/%lu us\n",
+			received, count, cycles_to_us(min),
+			cycles_to_us(sum / received), cycles_to_us(max));
+	else
+		printk("latency: no replies from %s\n", svrip);
+
+	timeout = 100;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	received = 0;
+	start = get_cycles();
+	for (i = 0; i < count; i++) {
+		if (send(fd, bench_buf, size, 0) != size)
+			break;
+		/* 收取已经返回的报文，避免对端和本地队列溢出 */
+		while (recv(fd, bench_buf, size, MSG_DONTWAIT) > 0)
+			received++;
+	}
+	while (received < count && recv(fd, bench_buf, size, 0) > 0)
+		received++;
+	rtt = cycles_to_us(get_cycles() - start);
+
+	if (rtt)
+		printk("throughput: %d/%d echoed in %lu us, %lu pps, %lu KB/s\n",
+			received, count, (unsigned long)rtt,
+			(unsigned long)(received * 1000000ULL / rtt),
+			(unsigned long)(received * 1000ULL * size / rtt));
+
+end:
+	close(fd);
+	return 0;
+}
+
+int net_netbench_cmd(int argc, char **args)
+{
+	int count = BENCH_DEF_COUNT, size = BENCH_DEF_SIZE;
+
+	if (argc < 2 || argc > 4) {
+		printk("Usage: netbench svraddr [count] [size]\n");
+		return -1;
+	}
+
+	if (argc >= 3)
+		count = atoi(args[2]);
+	if (argc == 4)
+		size = atoi(args[3]);
+	if (count <= 0 || size <= 0 || size > PKT_LEN_2) {
+		printk("Invalid count or size\n");
+		return -1;
+	}
+
+	return udp_bench_client(args[1], count, size);
+}
+
 extern int cpsw_net_debug;
 extern struct dim_sum_netdev *netdev_list;
 
@@ -50,15 +50,20 @@ err_t sys_mbox_new(sys_mbox_t *mbox, int size)
 {
 	if (!size)
 		size = 10;
-	
-	msg_queue_init(&mbox->sys_mbox, LWIP_MAX_MSGS, size, 0);// = ker_msgQCreate(LWIP_MAX_MSGS, size, 0);
+
+	if (msg_ring_init(&mbox->sys_mbox, LWIP_MAX_MSGS))
+		return ERR_MEM;
+	smp_lock_init(&mbox->fetch_lock);
+	mbox->fetch_head = 0;
+	mbox->fetch_count = 0;
+	mbox->refilling = 0;
 	mbox->valid = 1;
 	return ERR_OK;
 }
 
 void sys_mbox_free(sys_mbox_t *mbox)
 {
-	msg_queue_destroy(&mbox->sys_mbox);
+	msg_ring_destroy(&mbox->sys_mbox);
 }
 
 void sys_mbox_post(sys_mbox_t *mbox, void *msg)
@@ -66,14 +71,56 @@ void sys_mbox_post(sys_mbox_t *mbox, void *msg)
 	if(!msg)
 		msg = (void*)&pvNullPointer;
 
-	if (msg_queue_send(&mbox->sys_mbox, (char*)&msg, sizeof(void*), WAIT_FOREVER, 0))
+	if (msg_ring_send(&mbox->sys_mbox, (unsigned long)msg, WAIT_FOREVER))
 		printk("%s %d failed\n", __FUNCTION__,__LINE__);
 	
 }
 
 err_t sys_mbox_trypost(sys_mbox_t *mbox, void *msg)
 {
-	return msg_queue_send(&mbox->sys_mbox, (char*)&msg, sizeof(void*), 0, 0) ? ERR_MEM : ERR_OK;
+	return msg_ring_send(&mbox->sys_mbox, (unsigned long)msg, 0) ? ERR_MEM : ERR_OK;
+}
+
+/**
+ * 取一个消息，优先从批量缓存中取
+ * 缓存为空时，一次从队列中取出多个消息
+ * 这样tcpip_thread每次唤醒可以处理多个消息
+ */
+static int sys_mbox_fetch_one(sys_mbox_t *mbox, void **msg, int wait)
+{
+	unsigned long msgs[LWIP_MBOX_BATCH];
+	int batch, ret, i;
+
+	smp_lock(&mbox->fetch_lock);
+	if (mbox->fetch_count) {
+		*msg = (void *)mbox->fetched[mbox->fetch_head];
+		mbox->fetch_head = (mbox->fetch_head + 1) % LWIP_MBOX_BATCH;
+		mbox->fetch_count--;
+		smp_unlock(&mbox->fetch_lock);
+		return 0;
+	}
+	batch = !mbox->refilling;
+	if (batch)
+		mbox->refilling = 1;
+	smp_unlock(&mbox->fetch_lock);
+
+	ret = msg_ring_receive_batch(&mbox->sys_mbox, msgs,
+		batch ? LWIP_MBOX_BATCH : 1, wait);
+	if (ret > 0)
+		*msg = (void *)msgs[0];
+
+	if (batch) {
+		smp_lock(&mbox->fetch_lock);
+		for (i = 1; i < ret; i++) {
+			mbox->fetched[(mbox->fetch_head + mbox->fetch_count)
+				% LWIP_MBOX_BATCH] = msgs[i];
+			mbox->fetch_count++;
+		}
+		mbox->refilling = 0;
+		smp_unlock(&mbox->fetch_lock);
+	}
+
+	return ret > 0 ? 0 : ret;
 }
 
 u32_t sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
@@ -87,7 +134,7 @@ u32_t sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
 		wait = WAIT_FOREVER;
 
 	start = uptime();
-	if (msg_queue_receive(&mbox->sys_mbox, (char*)msg, sizeof(void*), wait) <= 0) {
+	if (sys_mbox_fetch_one(mbox, msg, wait)) {
 		return SYS_ARCH_TIMEOUT;
 	}
 
@@ -98,7 +145,7 @@ u32_t sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
 
 u32_t sys_arch_mbox_tryfetch(sys_mbox_t *mbox, void **msg)
 {
-	return msg_queue_receive(&mbox->sys_mbox, (char*)msg, sizeof(void*), 0) ? SYS_MBOX_EMPTY : 0;
+	return sys_mbox_fetch_one(mbox, msg, 0) ? SYS_MBOX_EMPTY : 0;
 }
 
 int sys_mbox_valid(sys_mbox_t *mbox)
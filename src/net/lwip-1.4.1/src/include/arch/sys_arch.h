@@ -24,6 +24,7 @@
 #define LWIP_MAX_MSGS		100
 #define LWIP_Q_SIZE 		10              /* LwIP queue size */
 #define LWIP_MAX_QS 		20              /* Max. LwIP queues */
+#define LWIP_MBOX_BATCH		16              /* msgs drained per wakeup */
 
 #define TaskId unsigned long
 typedef TaskId sys_thread_t;
@@ -33,7 +34,19 @@ typedef TaskId sys_thread_t;
 
 typedef struct
 {
-	struct msg_queue sys_mbox;
+	struct msg_ring sys_mbox;
+	/**
+	 * 一次唤醒批量取出、还没有交给lwIP的消息
+	 */
+	struct smp_lock fetch_lock;
+	unsigned long fetched[LWIP_MBOX_BATCH];
+	int fetch_head;
+	int fetch_count;
+	/**
+	 * 有接收者正在批量取消息
+	 * 其他接收者只能逐个取，避免缓存溢出
+	 */
+	int refilling;
 	unsigned char valid;
 }
 sys_mbox_t;
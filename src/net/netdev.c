@@ -42,6 +42,12 @@ static err_t dim_sum_send_pkt(struct netif *netif, struct pbuf *p)
 
 	ndev = list_container(netif, struct dim_sum_netdev, lwip_netif);
 
+	/**
+	 * 驱动支持分散聚集，不用拷贝
+	 */
+	if (ndev->send_pbuf)
+		return ndev->send_pbuf(ndev, p) ? ERR_IF : ERR_OK;
+
 	if (p->next) {
 		pos = buff = (unsigned char *)ndev->send_buff;
 		for (q = p; q != NULL; q = q->next) {
@@ -74,10 +80,12 @@ static err_t dim_sum_netif_init(struct netif *netif)
 	netif->hwaddr_len = 6;
 	memcpy(netif->hwaddr, ndev->enetaddr, 6);
 
-	ndev->send_buff = kmalloc_app((netif->mtu + 4095) & ~4095);
-	if (!ndev->send_buff) {
-		printk("%s %d, kmalloc_app fail\n", __FUNCTION__, __LINE__);
-		return ERR_MEM;
+	if (!ndev->send_pbuf) {
+		ndev->send_buff = kmalloc_app((netif->mtu + 4095) & ~4095);
+		if (!ndev->send_buff) {
+			printk("%s %d, kmalloc_app fail\n", __FUNCTION__, __LINE__);
+			return ERR_MEM;
+		}
 	}
 
 	ndev->halt_netdev(ndev);
@@ -86,6 +94,40 @@ static err_t dim_sum_netif_init(struct netif *netif)
 	return ERR_OK;
 }
 
+/**
+ * 将收到的以太网报文送给协议栈
+ * 由驱动的收包线程或者轮询线程调用
+ */
+void dim_sum_netdev_input(struct dim_sum_netdev *ndev, struct pbuf *p)
+{
+	struct eth_hdr *ethhdr;
+
+	/**
+	 * 设备还没有加入到协议栈中
+	 */
+	if (unlikely(!ndev || !ndev->lwip_netif.input)) {
+		pbuf_free(p);
+		return;
+	}
+
+	ethhdr = (struct eth_hdr *)p->payload;
+
+	switch (htons(ethhdr->type)) {
+		case ETHTYPE_IP:
+		case ETHTYPE_ARP:
+			if (ndev->lwip_netif.input(p, &ndev->lwip_netif)!= ERR_OK) { 
+				pbuf_free(p);
+			}
+			break;
+		default:
+			pbuf_free(p);
+			break;
+	}
+}
+
+/**
+ * 为不支持中断收包的设备轮询收包
+ */
 static int dim_sum_net_poll_task(void *argv)
 {
 	while (1) {
@@ -95,11 +137,13 @@ static int dim_sum_net_poll_task(void *argv)
 			int ret, len;
 			void *inpkt = &rcv_pkt[0];
 			struct pbuf *p, *q;
-			struct eth_hdr *ethhdr;
+
+			if (!ndev->recv_pkt)
+				goto next_dev;
 
 			ret = ndev->recv_pkt(ndev, &rcv_pkt[0], &len);
 			if (ret <= 0)   { /* no packet */
-				goto next_try;
+				goto next_dev;
 			}
 
 			if (!(p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL))) {
@@ -110,41 +154,12 @@ static int dim_sum_net_poll_task(void *argv)
 				memcpy(q->payload, (void*)inpkt, q->len);
 				inpkt += q->len;
 			}
-			ethhdr = (struct eth_hdr *)p->payload;
-
-#if 0
-printk("xby_debug in dim_sum_net_poll_task, %x[%x.%x.%x.%x.%x.%x][%x.%x.%x.%x.%x.%x]\n", 
-	htons(ethhdr->type),
-	ethhdr->dest.addr[0],
-	ethhdr->dest.addr[1],
-	ethhdr->dest.addr[2],
-	ethhdr->dest.addr[3],
-	ethhdr->dest.addr[4],
-	ethhdr->dest.addr[5],
-	ethhdr->src.addr[0],
-	ethhdr->src.addr[1],
-	ethhdr->src.addr[2],
-	ethhdr->src.addr[3],
-	ethhdr->src.addr[4],
-	ethhdr->src.addr[5]);
-#endif
-
-			switch (htons(ethhdr->type)) {
-				case ETHTYPE_IP:
-				case ETHTYPE_ARP:
-					if (ndev->lwip_netif.input(p, &ndev->lwip_netif)!= ERR_OK) { 
-						pbuf_free(p);
-					}
-					break;
-				default:
-					pbuf_free(p);
-					break;
-			}
 
+			dim_sum_netdev_input(ndev, p);
+next_dev:
 			ndev = ndev->next;
 		}
 
-next_try:
 		msleep(2);
 	}
 }
@@ -164,8 +179,14 @@ void dim_sum_netdev_startup(void)
 		netif_set_up(&dev->lwip_netif);
 		dev = dev->next;
 	}
-	if (netdev_list)
-		create_process(dim_sum_net_poll_task, NULL, "lwip_net_poll", 10);
+	/**
+	 * 只有轮询设备才需要收包线程
+	 */
+	for (dev = netdev_list; dev; dev = dev->next)
+		if (dev->recv_pkt) {
+			create_process(dim_sum_net_poll_task, NULL, "lwip_net_poll", 10);
+			break;
+		}
 }
 
 
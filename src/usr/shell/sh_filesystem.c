@@ -118,6 +118,20 @@ void _initialize_filesystem_cmds(void)
 		"This command creates a new file.",
 		sh_noop_completer);
 
+	register_shell_command("blkstat", blk_stat_cmd,
+		"show block queue statistics",
+		"blkstat device [reset]",
+		"This command shows merge, dispatch and latency statistics\n\t"
+		"of the request queue of a block device.",
+		sh_filename_completer);
+
+	register_shell_command("iosched", blk_iosched_cmd,
+		"show or change the io scheduler",
+		"iosched device [noop|deadline]",
+		"This command shows the io scheduler of a block device,\n\t"
+		"or switches it once the scheduler holds no request.",
+		sh_filename_completer);
+
 	register_shell_command("xby_test", xby_test_cmd,
 			"xby_test command", 
 			"xby_test command", 
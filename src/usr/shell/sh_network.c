@@ -46,6 +46,11 @@ static int sh_tcptest_cmd(int argc, char *argv[])
 	return net_tcptest_cmd(argc, argv);
 }
 
+static int sh_netbench_cmd(int argc, char *argv[])
+{
+	return net_netbench_cmd(argc, argv);
+}
+
 void _initialize_network_cmds(void)
 {
 	register_shell_command("ip", sh_ip_cmd, 
@@ -73,6 +78,13 @@ void _initialize_network_cmds(void)
 		"tcptest -- start a tcp server, tcptest svraddr -- start a tcp client",
 		sh_noop_completer);
 
+	register_shell_command("netbench", sh_netbench_cmd,
+		"Network latency and throughput test", 
+		"netbench svraddr [count] [size]", 
+		"netbench -- send udp packets to the echo port of svraddr, \n\t"
+		"and report round trip latency and echo throughput.",
+		sh_noop_completer);
+
 	return;
 }
 